@@ -119,21 +119,24 @@ os_err_t mqtt_disconnect(void) {
 
 mqtt_state_t mqtt_get_state(void) { return adapter.state; }
 
-os_err_t mqtt_publish_state(os_eui64_t node_addr, cap_id_t cap_id,
-                            const cap_value_t *value) {
+os_err_t mqtt_publish_state(const cap_event_t *state) {
   if (!adapter.initialized || adapter.state != MQTT_STATE_CONNECTED) {
     return OS_ERR_NOT_INITIALIZED;
   }
 
-  const cap_info_t *info = cap_get_info(cap_id);
+  const cap_info_t *info = cap_get_info(state->cap_id);
   if (!info) {
     return OS_ERR_INVALID_ARG;
   }
+  const cap_value_t *value = &state->value;
 
-  /* Build topic: bridge/<node_id>/<capability>/state */
+  /* Build topic: bridge/<node_id>/<instance>/state */
+  char instance[CAP_INSTANCE_NAME_LEN];
+  cap_instance_name(instance, sizeof(instance), state->cap_id,
+                    state->endpoint_id, state->instances);
   char topic[MAX_TOPIC_LEN];
   snprintf(topic, sizeof(topic), TOPIC_BASE "/" OS_EUI64_FMT "/%s/state",
-           OS_EUI64_ARG(node_addr), info->name);
+           OS_EUI64_ARG(state->node_addr), instance);
 
   /* Build payload */
   char payload[MAX_PAYLOAD_LEN];
@@ -196,6 +199,20 @@ os_err_t mqtt_publish_status(bool online) {
   return mqtt_publish(topic, payload, strlen(payload));
 }
 
+os_err_t mqtt_publish_availability(os_eui64_t node_addr, bool online) {
+  if (!adapter.initialized) {
+    return OS_ERR_NOT_INITIALIZED;
+  }
+
+  /* Build topic: bridge/<node_id>/availability */
+  char topic[MAX_TOPIC_LEN];
+  snprintf(topic, sizeof(topic), TOPIC_BASE "/" OS_EUI64_FMT "/availability",
+           OS_EUI64_ARG(node_addr));
+
+  const char *payload = online ? "online" : "offline";
+  return mqtt_publish(topic, payload, strlen(payload));
+}
+
 os_err_t mqtt_publish(const char *topic, const void *payload, size_t len) {
   if (!adapter.initialized) {
     return OS_ERR_NOT_INITIALIZED;
@@ -284,13 +301,13 @@ static void handle_cap_state_changed(const os_event_t *event, void *ctx) {
     return;
   }
 
-  /* Extract payload */
-  struct {
-    os_eui64_t node_addr;
-    cap_id_t cap_id;
-    cap_value_t value;
-  } *payload = (void *)event->payload;
+  /* Extract payload; string values beyond the event payload are cut */
+  cap_event_t state;
+  memset(&state, 0, sizeof(state));
+  memcpy(&state, event->payload,
+         event->payload_len < sizeof(state) ? event->payload_len
+                                            : sizeof(state));
 
   /* Publish to MQTT */
-  mqtt_publish_state(payload->node_addr, payload->cap_id, &payload->value);
+  mqtt_publish_state(&state);
 }
@@ -73,12 +73,14 @@ mqtt_state_t mqtt_get_state(void);
 
 /**
  * @brief Publish capability state
- * @param node_addr Node IEEE address
- * @param cap_id Capability ID
- * @param value Capability value
+ *
+ * Topic bridge/<node_id>/<instance>/state, the instance named by
+ * cap_instance_name().
+ *
+ * @param state Capability instance and value
  * @return OS_OK on success
  */
-os_err_t mqtt_publish_state(os_eui64_t node_addr, cap_id_t cap_id, const cap_value_t *value);
+os_err_t mqtt_publish_state(const cap_event_t *state);
 
 /**
  * @brief Publish device metadata
@@ -96,6 +98,18 @@ os_err_t mqtt_publish_meta(os_eui64_t node_addr, const char *manufacturer, const
  */
 os_err_t mqtt_publish_status(bool online);
 
+/**
+ * @brief Publish node availability
+ *
+ * Plain "online"/"offline" payload on bridge/<node_id>/availability, as
+ * referenced by the node's HA discovery configs.
+ *
+ * @param node_addr Node IEEE address
+ * @param online true if the node is reachable
+ * @return OS_OK on success
+ */
+os_err_t mqtt_publish_availability(os_eui64_t node_addr, bool online);
+
 /**
  * @brief Publish arbitrary message
  * @param topic Topic string
@@ -12,6 +12,8 @@
 // #include "app_blink.h" // Disabled - blink task not used
 #include "capability.h"
 #include "ha_disc.h"
+#include "history.h"
+#include "liveness.h"
 #include "interview.h"
 #include "local_node.h"
 #include "mqtt_adapter.h"
@@ -87,6 +89,12 @@ static int bridge_main(void) {
     LOG_E(MAIN_MODULE, "Registry init failed: %d", err);
   }
 
+  /* Reload paired devices so they are known before they re-announce */
+  err = reg_restore();
+  if (err != OS_OK) {
+    LOG_E(MAIN_MODULE, "Registry restore failed: %d", err);
+  }
+
   /* Initialize interview service */
   err = interview_init();
   if (err != OS_OK) {
@@ -99,6 +107,21 @@ static int bridge_main(void) {
     LOG_E(MAIN_MODULE, "Capability init failed: %d", err);
   }
 
+  /* Restored nodes start from their last known capability values */
+  cap_restore();
+
+  /* Initialize capability history store */
+  err = history_init();
+  if (err != OS_OK) {
+    LOG_E(MAIN_MODULE, "History init failed: %d", err);
+  }
+
+  /* Initialize node liveness tracking */
+  err = liveness_init();
+  if (err != OS_OK) {
+    LOG_E(MAIN_MODULE, "Liveness init failed: %d", err);
+  }
+
   /* Initialize MQTT adapter */
   err = mqtt_init(NULL);
   if (err != OS_OK) {
@@ -162,11 +185,34 @@ static int bridge_main(void) {
     LOG_E(MAIN_MODULE, "Failed to create interview task: %d", err);
   }
 
+  err = os_fibre_create(os_persist_task, NULL, "persist", 2048, NULL);
+  if (err != OS_OK) {
+    LOG_E(MAIN_MODULE, "Failed to create persist task: %d", err);
+  }
+
   err = os_fibre_create(mqtt_task, NULL, "mqtt", 2048, NULL);
   if (err != OS_OK) {
     LOG_E(MAIN_MODULE, "Failed to create mqtt task: %d", err);
   }
 
+  err = os_fibre_create(liveness_task, NULL, "liveness", 2048, NULL);
+  if (err != OS_OK) {
+    LOG_E(MAIN_MODULE, "Failed to create liveness task: %d", err);
+  }
+
+  err = os_fibre_create(cap_task, NULL, "cap", 2048, NULL);
+  if (err != OS_OK) {
+    LOG_E(MAIN_MODULE, "Failed to create capability task: %d", err);
+  }
+
+#if OS_PERSIST_TELEMETRY_MS > 0
+  err = os_fibre_create(os_persist_telemetry_task, NULL, "persist_tm", 2048,
+                        NULL);
+  if (err != OS_OK) {
+    LOG_E(MAIN_MODULE, "Failed to create persist telemetry task: %d", err);
+  }
+#endif
+
 #if OS_FEATURE_HA_DISC
   err = os_fibre_create(ha_disc_task, NULL, "ha_disc", 2048, NULL);
   if (err != OS_OK) {
@@ -13,9 +13,11 @@
 #include "os_fibre.h"
 #include "os_event.h"
 #include "os_log.h"
+#include "os_mem.h"
 #include "os_console.h"
 #include "os_shell.h"
 #include "os_persist.h"
+#include "os_persist_telemetry.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -28,7 +28,20 @@
 
 /* Persistence configuration */
 #define OS_PERSIST_NAMESPACE    "bridge"
-#define OS_PERSIST_FLUSH_MS     5000
+#define OS_PERSIST_FLUSH_MS     5000    /* Max age of a buffered write */
+#define OS_PERSIST_DEBOUNCE_MS  2000    /* Quiet time before an idle flush */
+#define OS_PERSIST_FLUSH_BYTES  (OS_PERSIST_CACHE_ARENA / 2) /* Volume trigger */
+#define OS_PERSIST_CACHE_ENTRIES 32     /* Dirty keys held (power of two) */
+#define OS_PERSIST_CACHE_ARENA  4096    /* Bytes of buffered value storage */
+#define OS_PERSIST_MAX_MIGRATIONS 8     /* Registered migration steps */
+#define OS_PERSIST_TIER_FLUSH_MS 60000  /* Max age of a cache-tier write */
+#define OS_PERSIST_SCAN_MS      200     /* Budget for the boot integrity scan */
+#define OS_PERSIST_HOST_NVS_ENTRIES 756 /* Host model of the 24 KB nvs partition */
+#define OS_PERSIST_FLASH_ENDURANCE 100000 /* Erase cycles per flash sector */
+#define OS_PERSIST_TELEMETRY_MS 300000  /* MQTT telemetry period, 0 = off */
+
+/* Memory accounting configuration */
+#define OS_MEM_MAX_REGIONS      32      /* Regions shown by `mem` */
 
 /* Timer configuration */
 #define OS_TIMER_TICK_MS        1
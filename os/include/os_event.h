@@ -44,6 +44,7 @@ typedef enum {
     /* Capability events */
     OS_EVENT_CAP_STATE_CHANGED,
     OS_EVENT_CAP_COMMAND,
+    OS_EVENT_CAP_REMOVED,
     
     /* Persistence events */
     OS_EVENT_PERSIST_FLUSH,
@@ -156,7 +157,7 @@ os_corr_id_t os_event_new_corr_id(void);
 /* Helper macros for common event types */
 #define OS_EVENT_FILTER_ALL     {0, OS_EVENT_TYPE_MAX}
 #define OS_EVENT_FILTER_ZB      {OS_EVENT_ZB_STACK_UP, OS_EVENT_ZB_CMD_ERROR}
-#define OS_EVENT_FILTER_CAP     {OS_EVENT_CAP_STATE_CHANGED, OS_EVENT_CAP_COMMAND}
+#define OS_EVENT_FILTER_CAP     {OS_EVENT_CAP_STATE_CHANGED, OS_EVENT_CAP_REMOVED}
 
 #ifdef __cplusplus
 }
@@ -100,6 +100,16 @@ os_tick_t os_now_ticks(void);
  */
 os_time_ms_t os_uptime_ms(void);
 
+/**
+ * @brief Get uptime in whole seconds
+ *
+ * Counted alongside the ticks rather than derived from them, so it keeps
+ * increasing after the 32-bit millisecond tick wraps (about 49.7 days).
+ *
+ * @return Uptime in seconds
+ */
+uint32_t os_uptime_s(void);
+
 /**
  * @brief Get number of active fibres
  * @return Fibre count
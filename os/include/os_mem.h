@@ -0,0 +1,75 @@
+/**
+ * @file os_mem.h
+ * @brief Memory accounting
+ *
+ * ESP32-C6 Zigbee Bridge OS - Per-subsystem RAM footprint
+ *
+ * Subsystems register their regions once at init: a fixed static size plus
+ * a callback that reports heap held and slots in use when metrics are
+ * read. Nothing is sampled in between, so accounting costs nothing until
+ * `mem` or os_mem_get_metrics() asks.
+ */
+
+#ifndef OS_MEM_H
+#define OS_MEM_H
+
+#include "os_config.h"
+#include "os_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* One accounted region */
+typedef struct {
+    const char *name;       /* "<subsystem>.<region>" */
+    uint32_t static_bytes;  /* Reserved at build time */
+    uint32_t dynamic_bytes; /* Heap currently held */
+    uint32_t used;          /* Slots (or bytes, per region) in use */
+    uint32_t capacity;      /* Slots reserved; 0 if not slot based */
+} os_mem_region_t;
+
+/**
+ * @brief Region reporter
+ *
+ * Fills dynamic_bytes, used and capacity; name and static_bytes are
+ * already set.
+ */
+typedef void (*os_mem_report_fn)(os_mem_region_t *region, void *ctx);
+
+/* All regions, as of one os_mem_get_metrics() call */
+typedef struct {
+    uint32_t region_count;
+    uint32_t static_total;
+    uint32_t dynamic_total;
+    os_mem_region_t regions[OS_MEM_MAX_REGIONS];
+} os_mem_metrics_t;
+
+/**
+ * @brief Register a region
+ *
+ * Registering a name again replaces the earlier entry, so a subsystem can
+ * register from an init function that runs more than once.
+ *
+ * @param name Region name (static string)
+ * @param static_bytes Build-time footprint
+ * @param report Usage reporter, or NULL for static-only regions
+ * @param ctx Passed to report
+ * @return OS_OK, OS_ERR_INVALID_ARG, or OS_ERR_FULL if OS_MEM_MAX_REGIONS
+ *         regions are registered
+ */
+os_err_t os_mem_register(const char *name, uint32_t static_bytes,
+                         os_mem_report_fn report, void *ctx);
+
+/**
+ * @brief Read every region, in registration order
+ * @param metrics Output metrics
+ * @return OS_OK on success
+ */
+os_err_t os_mem_get_metrics(os_mem_metrics_t *metrics);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OS_MEM_H */
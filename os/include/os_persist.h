@@ -8,6 +8,12 @@
  * - Key-value blob storage
  * - Schema versioning
  * - Buffered writes with periodic flush
+ * - Double-buffered write-back cache drained by a background flusher
+ * - Essential and cache tiers with separate write policies
+ * - Prefix-filtered key enumeration
+ * - Lazy per-record schema migration, registered by key prefix
+ * - Crash-atomic flushes and multi-key transactions
+ * - CRC32-framed records with quarantine of damaged ones
  */
 
 #ifndef OS_PERSIST_H
@@ -19,7 +25,8 @@
 extern "C" {
 #endif
 
-/* Maximum key length */
+/* Maximum key length, including the terminator. On ESP32, keys longer than
+ * the 15 characters NVS allows are stored under a hashed name. */
 #define OS_PERSIST_KEY_MAX  32
 
 /* Maximum value size */
@@ -40,6 +47,29 @@ os_err_t os_persist_init(void);
  */
 os_err_t os_persist_put(const char *key, const void *data, size_t len);
 
+/* Durability class of a key */
+typedef enum {
+    OS_PERSIST_TIER_ESSENTIAL = 0, /* Must survive: identity, state, config */
+    OS_PERSIST_TIER_CACHE,         /* Nice to have: last known values */
+} os_persist_tier_t;
+
+/**
+ * @brief Store a blob value in a durability tier
+ *
+ * Essential values behave as os_persist_put. Cache-tier values are held in
+ * their own buffer and written every OS_PERSIST_TIER_FLUSH_MS at most; when
+ * that buffer is full its pending values are dropped rather than stalling
+ * the caller or displacing essential writes. Reads see both tiers.
+ *
+ * @param key Key string (a key belongs to one tier)
+ * @param data Data buffer
+ * @param len Data length
+ * @param tier Durability tier
+ * @return OS_OK on success
+ */
+os_err_t os_persist_put_tier(const char *key, const void *data, size_t len,
+                             os_persist_tier_t tier);
+
 /**
  * @brief Retrieve a blob value
  * @param key Key string
@@ -66,10 +96,65 @@ bool os_persist_exists(const char *key);
 
 /**
  * @brief Flush buffered writes to storage
+ *
+ * All flushed keys become durable together. Writes of an open transaction
+ * are left for its commit.
+ *
  * @return OS_OK on success
  */
 os_err_t os_persist_flush(void);
 
+/**
+ * @brief Start a transaction
+ *
+ * Puts until commit or abort are held in memory (reads see them at once)
+ * and reach storage together; after a crash either all or none of them are
+ * present. Deletes are not part of the transaction and apply immediately.
+ * Staged puts move to the new write buffer when one is sealed; if they do
+ * not fit, the transaction is aborted and the call that sealed the buffer
+ * (a put or flush) returns OS_ERR_FULL.
+ *
+ * @return OS_OK on success, OS_ERR_BUSY if a transaction is already open
+ */
+os_err_t os_persist_txn_begin(void);
+
+/**
+ * @brief Write all puts of the open transaction atomically
+ * @return OS_OK on success; on failure the transaction stays open
+ */
+os_err_t os_persist_txn_commit(void);
+
+/**
+ * @brief Discard all puts of the open transaction
+ * @return OS_OK on success
+ */
+os_err_t os_persist_txn_abort(void);
+
+/**
+ * @brief Finish or discard a group write interrupted by a reset
+ *
+ * Run by os_persist_init(); a committed group is replayed, an incomplete
+ * one is dropped.
+ *
+ * @return OS_OK on success
+ */
+os_err_t os_persist_recover(void);
+
+/**
+ * @brief Verify every stored record
+ *
+ * Run by os_persist_init() after recovery. Checks each record's frame and
+ * CRC and quarantines damaged ones, which then read as absent. Stops after
+ * OS_PERSIST_SCAN_MS; records not reached are verified when read.
+ *
+ * The first complete scan of a store written before framing reframes its
+ * unframed records and marks the store converted. After that an unframed
+ * record is treated as damaged.
+ *
+ * @return OS_OK on success
+ */
+os_err_t os_persist_scan(void);
+
 /**
  * @brief Get current schema version
  * @return Schema version number
@@ -83,6 +168,38 @@ uint32_t os_persist_schema_version(void);
  */
 os_err_t os_persist_set_schema_version(uint32_t version);
 
+/**
+ * @brief Migration step for one record format version
+ *
+ * Versioned records start with a format version byte. A step rewrites a
+ * record of version N into version N + 1, including the new version byte.
+ *
+ * @param in Record at the step's source version
+ * @param in_len Record length
+ * @param out Output buffer (OS_PERSIST_VALUE_MAX bytes)
+ * @param out_len Output buffer size
+ * @param new_len Output: migrated record length
+ * @return OS_OK on success
+ */
+typedef os_err_t (*os_persist_migrate_fn)(const uint8_t *in, size_t in_len,
+                                          uint8_t *out, size_t out_len,
+                                          size_t *new_len);
+
+/**
+ * @brief Register a migration step for records under a key prefix
+ *
+ * Records are migrated lazily: the first os_persist_get() of a record whose
+ * version byte has a registered step runs the chain up to the newest
+ * version, stores the result in place of the old record and returns it.
+ *
+ * @param prefix Key prefix the step applies to (string must stay valid)
+ * @param from_version Record version the step migrates from
+ * @param fn Step function
+ * @return OS_OK on success, OS_ERR_FULL if no slots remain
+ */
+os_err_t os_persist_register_migration(const char *prefix, uint8_t from_version,
+                                       os_persist_migrate_fn fn);
+
 /**
  * @brief Erase all persisted data
  * @return OS_OK on success
@@ -101,6 +218,38 @@ typedef struct {
     uint32_t writes_buffered;
     uint32_t total_writes;
     uint32_t total_reads;
+    uint32_t buffer_swaps;      /* Active buffer sealed because it was full */
+    uint32_t cache_bytes_used;  /* Live value bytes in both buffers */
+    uint32_t migrations;        /* Records upgraded to a newer version */
+    uint32_t txn_commits;
+    uint32_t txn_replayed;      /* Committed records replayed at init */
+    uint32_t stalls;            /* Puts that waited for a flush (both full) */
+    uint32_t stall_ms_total;
+    uint32_t stall_ms_max;
+    uint32_t flushes;           /* Buffer drains completed */
+    uint32_t flush_p50_ms;      /* Seal-to-durable latency percentiles */
+    uint32_t flush_p90_ms;      /* over recent flushes */
+    uint32_t flush_p99_ms;
+    uint32_t puts;              /* os_persist_put calls accepted */
+    uint32_t puts_absorbed;     /* Puts that overwrote a buffered value */
+    uint32_t max_absorbed;      /* Most puts absorbed by one key before a flush */
+    uint32_t flush_deadline;    /* Background flushes by trigger */
+    uint32_t flush_volume;
+    uint32_t flush_idle;
+    uint32_t tier_buffered;     /* Cache-tier values pending */
+    uint32_t tier_writes;       /* Cache-tier values written */
+    uint32_t tier_dropped;      /* Cache-tier values dropped under pressure */
+    uint32_t scan_records;      /* Records verified by the last scan */
+    uint32_t scan_ms;
+    bool scan_complete;         /* False if the scan ran out of budget */
+    uint32_t corrupt;           /* Records failing length or CRC checks */
+    uint32_t quarantined;       /* Corrupt records moved aside */
+    uint32_t legacy;            /* Unframed records converted by last scan */
+    uint32_t put_bytes;         /* Value bytes accepted by puts */
+    uint32_t bytes_written;     /* Framed bytes sent to storage (journal too) */
+    uint32_t records_written;
+    uint32_t entries_written;   /* 32-byte NVS entries those writes consumed */
+    os_tick_t init_tick;        /* Counters run from here */
     os_tick_t last_flush_tick;
     os_err_t last_error;
 } os_persist_stats_t;
@@ -111,7 +260,75 @@ typedef struct {
  */
 void os_persist_get_stats_ex(os_persist_stats_t *stats);
 
-/* Persistence task for periodic flush (run as fibre) */
+/* Key iterator (contents are private to os_persist.c) */
+typedef struct {
+    void *handle;                    /* Backend cursor (DIR * / nvs_iterator_t) */
+    char prefix[OS_PERSIST_KEY_MAX];
+    uint32_t cache_pos;              /* Next write cache entry to visit */
+    bool backend_done;
+} os_persist_iter_t;
+
+/**
+ * @brief Start enumerating keys that begin with a prefix
+ *
+ * Visits keys in storage and keys still pending in the write cache, each
+ * once. Keys put or deleted while iterating may or may not be visited.
+ *
+ * @param it Iterator to initialize
+ * @param prefix Key prefix to match ("" or NULL for all keys)
+ * @return OS_OK on success
+ */
+os_err_t os_persist_iter_begin(os_persist_iter_t *it, const char *prefix);
+
+/**
+ * @brief Get the next matching key
+ * @param it Iterator
+ * @param key Output key buffer (OS_PERSIST_KEY_MAX bytes is always enough)
+ * @param key_len Key buffer size
+ * @return OS_OK with key filled, OS_ERR_NOT_FOUND when no keys remain
+ */
+os_err_t os_persist_iter_next(os_persist_iter_t *it, char *key, size_t key_len);
+
+/**
+ * @brief Release iterator resources
+ * @param it Iterator
+ */
+void os_persist_iter_end(os_persist_iter_t *it);
+
+/**
+ * @brief Get storage partition usage
+ *
+ * In 32-byte NVS entries (nvs_get_stats). The host backend models the
+ * bridge's 24 KB nvs partition (OS_PERSIST_HOST_NVS_ENTRIES).
+ *
+ * @param used_entries Output: entries holding data (may be NULL)
+ * @param free_entries Output: entries available (may be NULL)
+ * @param total_entries Output: partition size (may be NULL)
+ */
+void os_persist_get_usage(uint32_t *used_entries, uint32_t *free_entries,
+                          uint32_t *total_entries);
+
+/* Why the background flusher would write buffered values now */
+typedef enum {
+    OS_PERSIST_FLUSH_NONE = 0,
+    OS_PERSIST_FLUSH_DEADLINE,  /* Oldest value older than OS_PERSIST_FLUSH_MS */
+    OS_PERSIST_FLUSH_VOLUME,    /* OS_PERSIST_FLUSH_BYTES or more buffered */
+    OS_PERSIST_FLUSH_IDLE,      /* No puts for OS_PERSIST_DEBOUNCE_MS, bus empty */
+} os_persist_flush_reason_t;
+
+/**
+ * @brief Evaluate the flush policy
+ *
+ * Writes are debounced: a burst of puts is held until it goes quiet and the
+ * event bus has drained, so repeated updates of the same key cost one flash
+ * write. Dirty volume and a max-latency deadline bound memory use and the
+ * data lost on power failure.
+ *
+ * @return Trigger that is due, or OS_PERSIST_FLUSH_NONE
+ */
+os_persist_flush_reason_t os_persist_flush_due(void);
+
+/* Persistence task for debounced background flush (run as fibre) */
 void os_persist_task(void *arg);
 
 #ifdef __cplusplus
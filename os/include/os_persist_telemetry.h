@@ -0,0 +1,60 @@
+/**
+ * @file os_persist_telemetry.h
+ * @brief Flash wear and write-amplification telemetry
+ *
+ * ESP32-C6 Zigbee Bridge OS - Derived from os_persist counters
+ *
+ * Rates are averaged since os_persist_init(). Ratios are fixed point x100
+ * (the C6 has no FPU).
+ */
+
+#ifndef OS_PERSIST_TELEMETRY_H
+#define OS_PERSIST_TELEMETRY_H
+
+#include "os_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint32_t elapsed_s;           /* Since os_persist_init */
+    uint32_t bytes_per_hour;      /* Framed bytes written to storage */
+    uint32_t entries_per_hour;    /* 32-byte NVS entries written */
+    uint32_t avg_value_size;      /* Bytes per accepted put */
+    uint32_t puts_per_flush_x100; /* Puts absorbed by each buffer flush */
+    uint32_t write_amp_x100;      /* Storage bytes per value byte put */
+    uint32_t nvs_used_entries;
+    uint32_t nvs_free_entries;
+    uint32_t nvs_total_entries;
+    uint32_t lifetime_days;       /* Projected; UINT32_MAX if nothing written */
+} os_persist_telemetry_t;
+
+/**
+ * @brief Compute current telemetry
+ *
+ * Lifetime assumes NVS wear levelling spreads writes over the whole
+ * partition and each sector survives OS_PERSIST_FLASH_ENDURANCE erases.
+ *
+ * @param out Output telemetry
+ * @return OS_OK on success
+ */
+os_err_t os_persist_telemetry_get(os_persist_telemetry_t *out);
+
+/**
+ * @brief Publish telemetry as JSON to bridge/telemetry/persist
+ * @return OS_OK on success, MQTT error otherwise
+ */
+os_err_t os_persist_telemetry_publish(void);
+
+/**
+ * @brief Periodic publisher (run as fibre); OS_PERSIST_TELEMETRY_MS period
+ * @param arg Unused
+ */
+void os_persist_telemetry_task(void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OS_PERSIST_TELEMETRY_H */
@@ -9,6 +9,7 @@
 
 #include "os_event.h"
 #include "os_fibre.h"
+#include "os_mem.h"
 #include <string.h>
 
 /* Subscriber entry */
@@ -40,6 +41,18 @@ static struct {
     os_corr_id_t next_corr_id;
 } bus = {0};
 
+static void mem_report_queue(os_mem_region_t *region, void *ctx) {
+    (void)ctx;
+    region->used = bus.count;
+    region->capacity = OS_EVENT_QUEUE_SIZE;
+}
+
+static void mem_report_subscribers(os_mem_region_t *region, void *ctx) {
+    (void)ctx;
+    region->used = bus.sub_count;
+    region->capacity = OS_MAX_SUBSCRIBERS;
+}
+
 os_err_t os_event_init(void) {
     if (bus.initialized) {
         return OS_ERR_ALREADY_EXISTS;
@@ -49,6 +62,10 @@ os_err_t os_event_init(void) {
     bus.next_corr_id = 1;
     bus.initialized = true;
     
+    os_mem_register("event.queue", sizeof(bus.queue), mem_report_queue, NULL);
+    os_mem_register("event.subscribers", sizeof(bus.subscribers),
+                    mem_report_subscribers, NULL);
+    
     return OS_OK;
 }
 
@@ -10,9 +10,12 @@
  */
 
 #include "os_fibre.h"
+#include "os_mem.h"
 #include <stdlib.h>
 #include <string.h>
 
+static void fibre_mem_report(os_mem_region_t *region, void *ctx);
+
 #ifdef OS_PLATFORM_HOST
 /*===========================================================================
  * HOST PLATFORM IMPLEMENTATION - setjmp/longjmp based
@@ -46,6 +49,9 @@ static struct {
   os_fibre_t *idle;
   uint32_t count;
   volatile os_tick_t ticks;
+  /* Whole seconds carried separately, so they outlive a tick wrap */
+  volatile uint32_t seconds;
+  os_tick_t second_ticks;
   jmp_buf scheduler_context;
 } sched = {0};
 
@@ -69,6 +75,8 @@ os_err_t os_fibre_init(void) {
     return err;
   }
 
+  os_mem_register("fibre.stacks", 0, fibre_mem_report, NULL);
+
   return OS_OK;
 }
 
@@ -240,6 +248,8 @@ os_tick_t os_now_ticks(void) { return sched.ticks; }
 
 os_time_ms_t os_uptime_ms(void) { return OS_TICKS_TO_MS(sched.ticks); }
 
+uint32_t os_uptime_s(void) { return sched.seconds; }
+
 uint32_t os_fibre_count(void) { return sched.count; }
 
 os_err_t os_fibre_get_info(uint32_t index, os_fibre_info_t *info) {
@@ -299,7 +309,13 @@ os_err_t os_fibre_get_stats(os_sched_stats_t *stats) {
   return OS_OK;
 }
 
-void os_tick_advance(void) { sched.ticks++; }
+void os_tick_advance(void) {
+  sched.ticks++;
+  if (++sched.second_ticks == OS_MS_TO_TICKS(1000)) {
+    sched.second_ticks = 0;
+    sched.seconds++;
+  }
+}
 
 static void fibre_idle_task(void *arg) {
   (void)arg;
@@ -341,6 +357,9 @@ static struct {
   os_fibre_t *idle;
   uint32_t count;
   volatile os_tick_t ticks;
+  /* Whole seconds carried separately, so they outlive a tick wrap */
+  volatile uint32_t seconds;
+  os_tick_t second_ticks;
 } sched = {0};
 
 /* Forward declarations */
@@ -363,6 +382,8 @@ os_err_t os_fibre_init(void) {
     return err;
   }
 
+  os_mem_register("fibre.stacks", 0, fibre_mem_report, NULL);
+
   return OS_OK;
 }
 
@@ -479,7 +500,7 @@ void os_fibre_start(void) {
    * advances our tick counter. */
   while (1) {
     vTaskDelay(pdMS_TO_TICKS(1));
-    sched.ticks++;
+    os_tick_advance();
   }
 }
 
@@ -510,6 +531,8 @@ os_tick_t os_now_ticks(void) { return sched.ticks; }
 
 os_time_ms_t os_uptime_ms(void) { return OS_TICKS_TO_MS(sched.ticks); }
 
+uint32_t os_uptime_s(void) { return sched.seconds; }
+
 uint32_t os_fibre_count(void) { return sched.count; }
 
 os_err_t os_fibre_get_info(uint32_t index, os_fibre_info_t *info) {
@@ -583,7 +606,13 @@ os_err_t os_fibre_get_stats(os_sched_stats_t *stats) {
   return OS_OK;
 }
 
-void os_tick_advance(void) { sched.ticks++; }
+void os_tick_advance(void) {
+  sched.ticks++;
+  if (++sched.second_ticks == OS_MS_TO_TICKS(1000)) {
+    sched.second_ticks = 0;
+    sched.seconds++;
+  }
+}
 
 static void fibre_idle_task(void *arg) {
   (void)arg;
@@ -594,3 +623,18 @@ static void fibre_idle_task(void *arg) {
 }
 
 #endif /* OS_PLATFORM_HOST */
+
+/* Control blocks and stacks are allocated per fibre */
+static void fibre_mem_report(os_mem_region_t *region, void *ctx) {
+  (void)ctx;
+
+  uint32_t count = os_fibre_count();
+  for (uint32_t i = 0; i < count; i++) {
+    os_fibre_info_t info;
+    if (os_fibre_get_info(i, &info) == OS_OK) {
+      region->dynamic_bytes += sizeof(os_fibre_t) + info.stack_size;
+    }
+  }
+  region->used = count;
+  region->capacity = OS_MAX_FIBRES;
+}
@@ -9,6 +9,7 @@
 
 #include "os_log.h"
 #include "os_fibre.h"
+#include "os_mem.h"
 #include <string.h>
 #include <strings.h>
 #include <stdio.h>
@@ -46,6 +47,12 @@ static const char *level_names[] = {
     "TRACE"
 };
 
+static void mem_report_ring(os_mem_region_t *region, void *ctx) {
+    (void)ctx;
+    region->used = logger.count;
+    region->capacity = OS_LOG_QUEUE_SIZE;
+}
+
 os_err_t os_log_init(void) {
     if (logger.initialized) {
         return OS_ERR_ALREADY_EXISTS;
@@ -55,6 +62,8 @@ os_err_t os_log_init(void) {
     logger.level = OS_LOG_DEFAULT_LEVEL;
     logger.initialized = true;
     
+    os_mem_register("log.ring", sizeof(logger.queue), mem_report_ring, NULL);
+    
     return OS_OK;
 }
 
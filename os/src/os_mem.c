@@ -0,0 +1,71 @@
+/**
+ * @file os_mem.c
+ * @brief Memory accounting implementation
+ *
+ * ESP32-C6 Zigbee Bridge OS - Per-subsystem RAM footprint
+ */
+
+#include "os_mem.h"
+#include "os_config.h"
+#include <string.h>
+
+typedef struct {
+  const char *name;
+  uint32_t static_bytes;
+  os_mem_report_fn report;
+  void *ctx;
+} mem_entry_t;
+
+/* Registered regions; needs no init, so OS modules can register early */
+static struct {
+  mem_entry_t entries[OS_MEM_MAX_REGIONS];
+  uint32_t count;
+} regions = {0};
+
+os_err_t os_mem_register(const char *name, uint32_t static_bytes,
+                         os_mem_report_fn report, void *ctx) {
+  if (!name) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  mem_entry_t *e = NULL;
+  for (uint32_t i = 0; i < regions.count; i++) {
+    if (strcmp(regions.entries[i].name, name) == 0) {
+      e = &regions.entries[i];
+      break;
+    }
+  }
+  if (!e) {
+    if (regions.count >= OS_MEM_MAX_REGIONS) {
+      return OS_ERR_FULL;
+    }
+    e = &regions.entries[regions.count++];
+  }
+
+  e->name = name;
+  e->static_bytes = static_bytes;
+  e->report = report;
+  e->ctx = ctx;
+  return OS_OK;
+}
+
+os_err_t os_mem_get_metrics(os_mem_metrics_t *metrics) {
+  if (!metrics) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  memset(metrics, 0, sizeof(*metrics));
+  for (uint32_t i = 0; i < regions.count; i++) {
+    const mem_entry_t *e = &regions.entries[i];
+    os_mem_region_t *r = &metrics->regions[i];
+    r->name = e->name;
+    r->static_bytes = e->static_bytes;
+    if (e->report) {
+      e->report(r, e->ctx);
+    }
+    metrics->static_total += r->static_bytes;
+    metrics->dynamic_total += r->dynamic_bytes;
+  }
+  metrics->region_count = regions.count;
+  return OS_OK;
+}
@@ -6,6 +6,24 @@
  *
  * On host: Uses file-based storage for testing.
  * On ESP32: Uses ESP-IDF NVS.
+ *
+ * Both backends sit behind two write buffers. Each holds dirty keys in an
+ * open-addressed hash index with values in a compact byte arena. Producers
+ * fill the active buffer; when it is full or the flush policy fires (see
+ * os_persist_flush_due) it is sealed and the persist fibre drains it one
+ * record at a time while the other buffer takes new writes. Producers only
+ * wait when both are full. A third buffer holds cache-tier values, written
+ * on a much longer period and dropped wholesale if it overflows.
+ *
+ * Every stored value is framed with its length and a CRC32. Damaged records
+ * read as absent and are moved aside (quarantined); a time-bounded scan at
+ * init finds them before the first load.
+ *
+ * Multi-key writes (a flush, or a committed transaction) go through a redo
+ * journal: every record is staged first, a commit marker makes the group
+ * durable, and only then are the live records replaced. A crash before the
+ * marker leaves the old values; after it, init replays the journal. Single
+ * records are replaced atomically on their own.
  */
 
 #include "os_persist.h"
@@ -13,49 +31,100 @@
 #include "os_event.h"
 #include "os_fibre.h"
 #include "os_log.h"
+#include "os_mem.h"
 #include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 
 #define PERSIST_MODULE "PERSIST"
 
+#define SCHEMA_KEY "_schema_version"
+
+/* Every stored value is framed: magic, frame version, payload length (LE)
+ * and a CRC32 (LE) over those four bytes and the payload. Stores written
+ * before framing are converted once by os_persist_scan(), which then sets
+ * FORMAT_KEY; from then on an unframed value is damage. */
+#define FRAME_MAGIC 0xF5
+#define FRAME_VERSION 1
+#define FRAME_HDR_LEN 8
+#define RECORD_MAX (FRAME_HDR_LEN + OS_PERSIST_VALUE_MAX)
+#define FORMAT_KEY "_store_format"
+#define FORMAT_FRAMED 1u
+
+/* Backend primitives (one implementation per platform) */
+static os_err_t backend_init(void);
+static os_err_t backend_write(const char *key, const void *data, size_t len);
+static os_err_t backend_read(const char *key, void *buf, size_t buf_len,
+                             size_t *out_len);
+static os_err_t backend_delete(const char *key);
+static bool backend_exists(const char *key);
+static os_err_t backend_commit(void);
+static os_err_t backend_erase_all(void);
+static os_err_t backend_iter_open(void **handle);
+static bool backend_iter_next(void **handle, char *key, size_t key_len);
+static void backend_iter_close(void **handle);
+/* Move a damaged record out of the live key space, keeping it for analysis */
+static void backend_quarantine(const char *key, const void *data, size_t len);
+/* Partition usage in 32-byte NVS entries */
+static void backend_usage(uint32_t *used, uint32_t *free_entries,
+                          uint32_t *total);
+
+/* Group writes: begin, add each record, commit (the durability point), then
+ * replace the live records with backend_write() and end */
+static os_err_t backend_group_begin(void);
+static os_err_t backend_group_add(const char *key, const void *data,
+                                  size_t len);
+static os_err_t backend_group_commit(uint32_t count);
+static void backend_group_end(void);
+static void backend_group_abort(void);
+static os_err_t backend_recover(uint32_t *replayed);
+
 #ifdef OS_PLATFORM_HOST
 /* Host implementation using simple file storage */
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #define PERSIST_DIR "/tmp/bridge_persist"
-#define SCHEMA_KEY "_schema_version"
-#define PATH_MAX_LEN 128
+#define PATH_MAX_LEN 160
 /* Maximum filename length within path buffer (accounts for PERSIST_DIR + "/" +
  * ".bin") */
 #define FILENAME_MAX_LEN (PATH_MAX_LEN - sizeof(PERSIST_DIR) - 6)
 
-/* Buffered write entry */
-typedef struct {
-  char key[OS_PERSIST_KEY_MAX];
-  uint8_t data[OS_PERSIST_VALUE_MAX];
-  size_t len;
-  bool valid;
-} write_buffer_entry_t;
-
-#define WRITE_BUFFER_SIZE 16
+/* Generate file path for key. Keys use '/' as a namespace separator, so '/'
+ * and the escape character itself are percent-encoded to keep one flat
+ * directory. */
+static void key_to_path(const char *key, char *path, size_t path_len) {
+  size_t n = (size_t)snprintf(path, path_len, "%s/", PERSIST_DIR);
+  for (size_t i = 0; key[i] && i < OS_PERSIST_KEY_MAX - 1; i++) {
+    if (n + 4 >= path_len) {
+      break;
+    }
+    if (key[i] == '/' || key[i] == '%') {
+      n += (size_t)snprintf(path + n, path_len - n, "%%%02X",
+                            (unsigned)(uint8_t)key[i]);
+    } else {
+      path[n++] = key[i];
+    }
+  }
+  snprintf(path + n, path_len - n, ".bin");
+}
 
-static struct {
-  bool initialized;
-  write_buffer_entry_t write_buffer[WRITE_BUFFER_SIZE];
-  uint32_t writes_buffered;
-  uint32_t total_writes;
-  uint32_t total_reads;
-  uint32_t schema_version;
-  os_tick_t last_flush_tick;
-  os_err_t last_error;
-} persist = {0};
+/* Make renames, creations and unlinks in the store durable */
+static os_err_t sync_dir(void) {
+  int fd = open(PERSIST_DIR, O_RDONLY);
+  if (fd < 0) {
+    return OS_ERR_BUSY;
+  }
+  int rc = fsync(fd);
+  close(fd);
+  return rc == 0 ? OS_OK : OS_ERR_BUSY;
+}
 
 /* Create storage directory */
-static os_err_t ensure_dir(void) {
+static os_err_t backend_init(void) {
   struct stat st;
   if (stat(PERSIST_DIR, &st) == 0) {
     return OS_OK;
@@ -67,27 +136,34 @@ static os_err_t ensure_dir(void) {
   return OS_OK;
 }
 
-/* Generate file path for key */
-static void key_to_path(const char *key, char *path, size_t path_len) {
-  snprintf(path, path_len, "%s/%.32s.bin", PERSIST_DIR, key);
-}
-
-/* Write data to file */
-static os_err_t write_file(const char *key, const void *data, size_t len) {
+/* Write data to a temporary file, sync it and rename it over the record,
+ * so a reader sees either the old or the new value even after power loss.
+ * The rename itself is durable after backend_commit() or group end. */
+static os_err_t backend_write(const char *key, const void *data, size_t len) {
   char path[PATH_MAX_LEN];
+  char tmp[PATH_MAX_LEN + 1];
   key_to_path(key, path, sizeof(path));
+  snprintf(tmp, sizeof(tmp), "%s~", path);
 
-  FILE *f = fopen(path, "wb");
+  FILE *f = fopen(tmp, "wb");
   if (!f) {
-    LOG_E(PERSIST_MODULE, "Failed to open %s for write", path);
+    LOG_E(PERSIST_MODULE, "Failed to open %s for write", tmp);
     return OS_ERR_BUSY;
   }
 
   size_t written = fwrite(data, 1, len, f);
+  bool synced = fflush(f) == 0 && fsync(fileno(f)) == 0;
   fclose(f);
 
-  if (written != len) {
+  if (written != len || !synced) {
     LOG_E(PERSIST_MODULE, "Write incomplete: %zu/%zu", written, len);
+    unlink(tmp);
+    return OS_ERR_BUSY;
+  }
+
+  if (rename(tmp, path) != 0) {
+    LOG_E(PERSIST_MODULE, "Failed to replace %s: %s", path, strerror(errno));
+    unlink(tmp);
     return OS_ERR_BUSY;
   }
 
@@ -95,8 +171,8 @@ static os_err_t write_file(const char *key, const void *data, size_t len) {
 }
 
 /* Read data from file */
-static os_err_t read_file(const char *key, void *buf, size_t buf_len,
-                          size_t *out_len) {
+static os_err_t backend_read(const char *key, void *buf, size_t buf_len,
+                             size_t *out_len) {
   char path[PATH_MAX_LEN];
   key_to_path(key, path, sizeof(path));
 
@@ -126,7 +202,7 @@ static os_err_t read_file(const char *key, void *buf, size_t buf_len,
 }
 
 /* Delete file */
-static os_err_t delete_file(const char *key) {
+static os_err_t backend_delete(const char *key) {
   char path[PATH_MAX_LEN];
   key_to_path(key, path, sizeof(path));
 
@@ -137,299 +213,1482 @@ static os_err_t delete_file(const char *key) {
   return OS_OK;
 }
 
-os_err_t os_persist_init(void) {
-  if (persist.initialized) {
-    return OS_ERR_ALREADY_EXISTS;
-  }
+static bool backend_exists(const char *key) {
+  char path[PATH_MAX_LEN];
+  key_to_path(key, path, sizeof(path));
 
-  memset(&persist, 0, sizeof(persist));
+  struct stat st;
+  return stat(path, &st) == 0;
+}
 
-  os_err_t err = ensure_dir();
-  if (err != OS_OK) {
-    return err;
+/* File contents are synced on write; this makes the renames durable */
+static os_err_t backend_commit(void) { return sync_dir(); }
+
+/* Renamed to .bad: invisible to reads and enumeration */
+static void backend_quarantine(const char *key, const void *data, size_t len) {
+  (void)data;
+  (void)len;
+  char path[PATH_MAX_LEN];
+  char bad[PATH_MAX_LEN];
+  key_to_path(key, path, sizeof(path));
+  size_t n = strlen(path);
+  snprintf(bad, sizeof(bad), "%.*s.bad", (int)(n - 4), path);
+  rename(path, bad);
+}
+
+/* Files sized as NVS would store them, against a modelled partition */
+static void backend_usage(uint32_t *used, uint32_t *free_entries,
+                          uint32_t *total) {
+  *used = 0;
+  DIR *dir = opendir(PERSIST_DIR);
+  if (dir) {
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+      char path[PATH_MAX_LEN];
+      struct stat st;
+      if (entry->d_name[0] != '.' &&
+          snprintf(path, sizeof(path), "%s/%.*s", PERSIST_DIR,
+                   (int)FILENAME_MAX_LEN, entry->d_name) > 0 &&
+          stat(path, &st) == 0) {
+        *used += 1 + (uint32_t)((st.st_size + 31) / 32);
+      }
+    }
+    closedir(dir);
   }
+  *total = OS_PERSIST_HOST_NVS_ENTRIES;
+  *free_entries = *used < *total ? *total - *used : 0;
+}
 
-  /* Load schema version if exists */
-  uint32_t version = 0;
-  size_t len;
-  if (read_file(SCHEMA_KEY, &version, sizeof(version), &len) == OS_OK) {
-    persist.schema_version = version;
+/* Remove all files in directory */
+static os_err_t backend_erase_all(void) {
+  DIR *dir = opendir(PERSIST_DIR);
+  if (dir) {
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+      if (entry->d_name[0] != '.') {
+        char path[PATH_MAX_LEN];
+        /* Limit filename to prevent buffer overflow */
+        int written = snprintf(path, sizeof(path), "%s/%.*s", PERSIST_DIR,
+                               (int)FILENAME_MAX_LEN, entry->d_name);
+        if (written > 0 && (size_t)written < sizeof(path)) {
+          unlink(path);
+        }
+      }
+    }
+    closedir(dir);
   }
+  return OS_OK;
+}
 
-  persist.initialized = true;
-  persist.last_error = OS_OK;
-  LOG_I(PERSIST_MODULE, "Persistence initialized (schema v%" PRIu32 ")",
-        persist.schema_version);
+/* Redo journal: records are (key_len u8, key, len u16, data), closed by a
+ * commit marker (0 u8, record count u32). Little-endian. */
+#define JOURNAL_PATH PERSIST_DIR "/_journal.log"
 
-  return OS_OK;
+static uint8_t journal_buf[RECORD_MAX];
+
+static bool journal_read_u16(FILE *f, uint16_t *v) {
+  uint8_t b[2];
+  if (fread(b, 1, sizeof(b), f) != sizeof(b)) {
+    return false;
+  }
+  *v = (uint16_t)(b[0] | (b[1] << 8));
+  return true;
 }
 
-os_err_t os_persist_put(const char *key, const void *data, size_t len) {
-  if (!persist.initialized || !key || !data) {
-    persist.last_error = OS_ERR_INVALID_ARG;
-    return OS_ERR_INVALID_ARG;
+/* Read one record header and key; false at the marker or on damage */
+static bool journal_read_record(FILE *f, char *key, uint16_t *len,
+                                uint32_t *marker_count, bool *is_marker) {
+  int kl = fgetc(f);
+  *is_marker = false;
+  if (kl == EOF) {
+    return false;
+  }
+  if (kl == 0) {
+    uint8_t b[4];
+    if (fread(b, 1, sizeof(b), f) != sizeof(b)) {
+      return false;
+    }
+    *marker_count = (uint32_t)b[0] | ((uint32_t)b[1] << 8) |
+                    ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+    *is_marker = true;
+    return false;
+  }
+  if (kl >= OS_PERSIST_KEY_MAX || fread(key, 1, (size_t)kl, f) != (size_t)kl) {
+    return false;
   }
+  key[kl] = '\0';
+  return journal_read_u16(f, len) && *len <= RECORD_MAX;
+}
 
-  if (len > OS_PERSIST_VALUE_MAX) {
-    persist.last_error = OS_ERR_INVALID_ARG;
-    return OS_ERR_INVALID_ARG;
+/* Replay a committed journal, discard an incomplete one */
+static os_err_t backend_recover(uint32_t *replayed) {
+  *replayed = 0;
+  FILE *f = fopen(JOURNAL_PATH, "rb");
+  if (!f) {
+    return OS_OK;
   }
 
-  /* Find or create buffer slot */
-  write_buffer_entry_t *slot = NULL;
+  char key[OS_PERSIST_KEY_MAX];
+  uint16_t len;
+  uint32_t records = 0;
+  uint32_t marker_count = 0;
+  bool is_marker = false;
 
-  /* First, look for existing entry with same key */
-  for (uint32_t i = 0; i < WRITE_BUFFER_SIZE; i++) {
-    if (persist.write_buffer[i].valid &&
-        strcmp(persist.write_buffer[i].key, key) == 0) {
-      slot = &persist.write_buffer[i];
+  while (journal_read_record(f, key, &len, &marker_count, &is_marker)) {
+    if (fseek(f, len, SEEK_CUR) != 0) {
       break;
     }
+    records++;
   }
 
-  /* If not found, find empty slot */
-  if (!slot) {
-    for (uint32_t i = 0; i < WRITE_BUFFER_SIZE; i++) {
-      if (!persist.write_buffer[i].valid) {
-        slot = &persist.write_buffer[i];
-        persist.writes_buffered++;
+  os_err_t result = OS_OK;
+  if (is_marker && marker_count == records) {
+    rewind(f);
+    for (uint32_t i = 0; i < records; i++) {
+      if (!journal_read_record(f, key, &len, &marker_count, &is_marker) ||
+          fread(journal_buf, 1, len, f) != len) {
+        result = OS_ERR_BUSY;
+        break;
+      }
+      result = backend_write(key, journal_buf, len);
+      if (result != OS_OK) {
         break;
       }
     }
+    if (result == OS_OK) {
+      *replayed = records;
+    }
   }
+  fclose(f);
 
-  if (!slot) {
-    /* Buffer full, flush first */
-    os_persist_flush();
-    slot = &persist.write_buffer[0];
-    persist.writes_buffered++;
+  /* A failed replay keeps the journal for the next attempt, as does one
+   * whose renames might not be on disk yet */
+  if (result == OS_OK && records > 0) {
+    result = sync_dir();
   }
+  if (result == OS_OK) {
+    unlink(JOURNAL_PATH);
+  }
+  return result;
+}
 
-  /* Copy to buffer */
-  strncpy(slot->key, key, OS_PERSIST_KEY_MAX - 1);
-  slot->key[OS_PERSIST_KEY_MAX - 1] = '\0';
-  memcpy(slot->data, data, len);
-  slot->len = len;
-  slot->valid = true;
+static FILE *journal;
 
-  LOG_T(PERSIST_MODULE, "Buffered write: %s (%zu bytes)", key, len);
+static os_err_t backend_group_begin(void) {
+  /* Finish a commit left over from a failed apply before reusing the log */
+  uint32_t replayed;
+  os_err_t err = backend_recover(&replayed);
+  if (err != OS_OK) {
+    return err;
+  }
 
-  persist.last_error = OS_OK;
+  journal = fopen(JOURNAL_PATH, "wb");
+  if (!journal) {
+    LOG_E(PERSIST_MODULE, "Failed to open journal: %s", strerror(errno));
+    return OS_ERR_BUSY;
+  }
   return OS_OK;
 }
 
-os_err_t os_persist_get(const char *key, void *buf, size_t buf_len,
-                        size_t *out_len) {
-  if (!persist.initialized || !key || !buf) {
-    persist.last_error = OS_ERR_INVALID_ARG;
-    return OS_ERR_INVALID_ARG;
-  }
+static os_err_t backend_group_add(const char *key, const void *data,
+                                  size_t len) {
+  size_t kl = strnlen(key, OS_PERSIST_KEY_MAX - 1);
+  uint8_t hdr[2] = {(uint8_t)len, (uint8_t)(len >> 8)};
+  fputc((int)kl, journal);
+  fwrite(key, 1, kl, journal);
+  fwrite(hdr, 1, sizeof(hdr), journal);
+  fwrite(data, 1, len, journal);
+  return ferror(journal) ? OS_ERR_BUSY : OS_OK;
+}
 
-  persist.total_reads++;
+/* Commit point: the group is durable once the marker is on disk */
+static os_err_t backend_group_commit(uint32_t count) {
+  uint8_t marker[5] = {0, (uint8_t)count, (uint8_t)(count >> 8),
+                       (uint8_t)(count >> 16), (uint8_t)(count >> 24)};
+  fwrite(marker, 1, sizeof(marker), journal);
+  bool ok = fflush(journal) == 0 && fsync(fileno(journal)) == 0 &&
+            !ferror(journal);
+  fclose(journal);
+  journal = NULL;
+  /* The journal's directory entry must survive too */
+  ok = ok && sync_dir() == OS_OK;
+  if (!ok) {
+    LOG_E(PERSIST_MODULE, "Journal write failed");
+    unlink(JOURNAL_PATH);
+    return OS_ERR_BUSY;
+  }
+  return OS_OK;
+}
 
-  /* Check write buffer first */
-  for (uint32_t i = 0; i < WRITE_BUFFER_SIZE; i++) {
-    if (persist.write_buffer[i].valid &&
-        strcmp(persist.write_buffer[i].key, key) == 0) {
-      size_t copy_len = persist.write_buffer[i].len;
-      if (copy_len > buf_len) {
-        copy_len = buf_len;
-      }
-      memcpy(buf, persist.write_buffer[i].data, copy_len);
-      if (out_len) {
-        *out_len = persist.write_buffer[i].len;
-      }
-      persist.last_error = OS_OK;
-      return OS_OK;
-    }
+/* All records applied: the journal may go only once their renames are on
+ * disk, or a power loss could leave neither the journal nor the records */
+static void backend_group_end(void) {
+  if (sync_dir() == OS_OK) {
+    unlink(JOURNAL_PATH);
   }
+}
 
-  /* Read from storage */
-  os_err_t err = read_file(key, buf, buf_len, out_len);
-  if (err != OS_OK) {
-    persist.last_error = err;
-  } else {
-    persist.last_error = OS_OK;
+/* Drop an uncommitted group */
+static void backend_group_abort(void) {
+  if (journal) {
+    fclose(journal);
+    journal = NULL;
   }
-  return err;
+  unlink(JOURNAL_PATH);
 }
 
-os_err_t os_persist_del(const char *key) {
-  if (!persist.initialized || !key) {
-    persist.last_error = OS_ERR_INVALID_ARG;
-    return OS_ERR_INVALID_ARG;
+/* Map a directory entry back to its key; false for non-record files */
+static bool path_to_key(const char *name, char *key, size_t key_len) {
+  size_t n = strlen(name);
+  if (n < 5 || strcmp(&name[n - 4], ".bin") != 0) {
+    return false;
   }
+  n -= 4;
 
-  /* Remove from buffer if present */
-  for (uint32_t i = 0; i < WRITE_BUFFER_SIZE; i++) {
-    if (persist.write_buffer[i].valid &&
-        strcmp(persist.write_buffer[i].key, key) == 0) {
-      persist.write_buffer[i].valid = false;
-      persist.writes_buffered--;
+  size_t k = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (k + 1 >= key_len) {
+      return false;
+    }
+    if (name[i] == '%' && i + 2 < n) {
+      unsigned int c = 0;
+      if (sscanf(&name[i + 1], "%2X", &c) != 1) {
+        return false;
+      }
+      key[k++] = (char)c;
+      i += 2;
+    } else {
+      key[k++] = name[i];
     }
   }
+  key[k] = '\0';
+  return true;
+}
 
-  /* Delete from storage */
-  os_err_t err = delete_file(key);
-  if (err != OS_OK) {
-    persist.last_error = err;
-  } else {
-    persist.last_error = OS_OK;
+/* The storage directory is the index: one file per key */
+static os_err_t backend_iter_open(void **handle) {
+  *handle = opendir(PERSIST_DIR);
+  return *handle ? OS_OK : OS_ERR_NOT_FOUND;
+}
+
+static bool backend_iter_next(void **handle, char *key, size_t key_len) {
+  struct dirent *entry;
+  while ((entry = readdir((DIR *)*handle)) != NULL) {
+    if (entry->d_name[0] != '.' && path_to_key(entry->d_name, key, key_len)) {
+      return true;
+    }
   }
-  return err;
+  return false;
 }
 
-bool os_persist_exists(const char *key) {
-  if (!persist.initialized || !key) {
-    return false;
+static void backend_iter_close(void **handle) {
+  if (*handle) {
+    closedir((DIR *)*handle);
+    *handle = NULL;
   }
+}
 
-  /* Check buffer */
-  for (uint32_t i = 0; i < WRITE_BUFFER_SIZE; i++) {
-    if (persist.write_buffer[i].valid &&
-        strcmp(persist.write_buffer[i].key, key) == 0) {
-      return true;
-    }
+#else
+/* ESP32 NVS implementation */
+#include "nvs.h"
+#include "nvs_flash.h"
+
+#define NVS_NAMESPACE "bridge"
+#define NVS_TXN_NAMESPACE "bridge_txn"
+#define NVS_TXN_MARKER "_txn_commit"
+#define NVS_BAD_NAMESPACE "bridge_bad"
+#define NVS_KEYS_NAMESPACE "bridge_keys"
+
+/* NVS names hold 15 characters, fewer than "node/<eui64>" needs. Longer
+ * keys (and any starting with the marker) are stored under the marker and
+ * a 56-bit FNV-1a hash in hex; the keys namespace maps that name back to
+ * the logical key for enumeration. */
+#define NVS_NAME_MAX (NVS_KEY_NAME_MAX_SIZE - 1)
+#define NVS_HASHED_MARK '#'
+
+static nvs_handle_t nvs_handle;
+static nvs_handle_t txn_handle;  /* Shadow namespace for staged commits */
+static nvs_handle_t bad_handle;  /* Quarantined records */
+static nvs_handle_t keys_handle; /* Hashed name -> logical key */
+
+typedef char nvs_name_t[NVS_KEY_NAME_MAX_SIZE];
+
+static bool name_hashed(const char *key) {
+  return strlen(key) > NVS_NAME_MAX || key[0] == NVS_HASHED_MARK;
+}
+
+static const char *nvs_name(const char *key, nvs_name_t name) {
+  if (!name_hashed(key)) {
+    return key;
+  }
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  for (const char *c = key; *c; c++) {
+    hash = (hash ^ (uint8_t)*c) * 0x100000001B3ULL;
   }
+  snprintf(name, sizeof(nvs_name_t), "%c%014" PRIx64, NVS_HASHED_MARK,
+           hash & 0x00FFFFFFFFFFFFFFULL);
+  return name;
+}
 
-  /* Check storage */
-  char path[PATH_MAX_LEN];
-  key_to_path(key, path, sizeof(path));
+/* Record the logical key behind a hashed name; fails on a collision */
+static os_err_t name_register(const char *key, const char *name) {
+  if (name == key) {
+    return OS_OK;
+  }
+  char stored[OS_PERSIST_KEY_MAX];
+  size_t len = sizeof(stored);
+  if (nvs_get_str(keys_handle, name, stored, &len) == ESP_OK) {
+    if (strcmp(stored, key) == 0) {
+      return OS_OK;
+    }
+    LOG_E(PERSIST_MODULE, "NVS name %s of %s taken by %s", name, key, stored);
+    return OS_ERR_ALREADY_EXISTS;
+  }
+  if (nvs_set_str(keys_handle, name, key) != ESP_OK ||
+      nvs_commit(keys_handle) != ESP_OK) {
+    return OS_ERR_BUSY;
+  }
+  return OS_OK;
+}
 
-  struct stat st;
-  return stat(path, &st) == 0;
+static void name_release(const char *key, const char *name) {
+  if (name != key) {
+    nvs_erase_key(keys_handle, name);
+    nvs_commit(keys_handle);
+  }
 }
 
-os_err_t os_persist_flush(void) {
-  if (!persist.initialized) {
-    persist.last_error = OS_ERR_NOT_INITIALIZED;
-    return OS_ERR_NOT_INITIALIZED;
+static os_err_t backend_init(void) {
+  /* Initialize NVS flash */
+  esp_err_t err = nvs_flash_init();
+  if (err == ESP_ERR_NVS_NO_FREE_PAGES ||
+      err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+    /* Erase and retry */
+    LOG_W(PERSIST_MODULE, "NVS partition issue, erasing...");
+    nvs_flash_erase();
+    err = nvs_flash_init();
   }
 
-  uint32_t flushed = 0;
+  if (err != ESP_OK) {
+    LOG_E(PERSIST_MODULE, "NVS flash init failed: %d", err);
+    return OS_ERR_BUSY;
+  }
 
-  for (uint32_t i = 0; i < WRITE_BUFFER_SIZE; i++) {
-    if (persist.write_buffer[i].valid) {
-      os_err_t err =
-          write_file(persist.write_buffer[i].key, persist.write_buffer[i].data,
-                     persist.write_buffer[i].len);
+  /* Open NVS namespace */
+  err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+  if (err != ESP_OK) {
+    LOG_E(PERSIST_MODULE, "NVS open failed: %d", err);
+    return OS_ERR_BUSY;
+  }
 
-      if (err == OS_OK) {
-        persist.write_buffer[i].valid = false;
-        persist.total_writes++;
-        flushed++;
-      } else {
-        persist.last_error = err;
-        LOG_E(PERSIST_MODULE, "Failed to flush %s",
-              persist.write_buffer[i].key);
-      }
-    }
+  err = nvs_open(NVS_TXN_NAMESPACE, NVS_READWRITE, &txn_handle);
+  if (err != ESP_OK) {
+    LOG_E(PERSIST_MODULE, "NVS txn namespace open failed: %d", err);
+    return OS_ERR_BUSY;
   }
 
-  persist.writes_buffered = 0;
+  err = nvs_open(NVS_BAD_NAMESPACE, NVS_READWRITE, &bad_handle);
+  if (err != ESP_OK) {
+    LOG_E(PERSIST_MODULE, "NVS quarantine namespace open failed: %d", err);
+    return OS_ERR_BUSY;
+  }
 
-  if (flushed > 0) {
-    LOG_D(PERSIST_MODULE, "Flushed %" PRIu32 " writes", flushed);
-    persist.last_flush_tick = os_now_ticks();
-    os_event_emit(OS_EVENT_PERSIST_FLUSH, &flushed, sizeof(flushed));
+  err = nvs_open(NVS_KEYS_NAMESPACE, NVS_READWRITE, &keys_handle);
+  if (err != ESP_OK) {
+    LOG_E(PERSIST_MODULE, "NVS keys namespace open failed: %d", err);
+    return OS_ERR_BUSY;
   }
 
   return OS_OK;
 }
 
-uint32_t os_persist_schema_version(void) { return persist.schema_version; }
+static os_err_t backend_write(const char *key, const void *data, size_t len) {
+  nvs_name_t buf;
+  const char *name = nvs_name(key, buf);
+  os_err_t reg = name_register(key, name);
+  if (reg != OS_OK) {
+    return reg;
+  }
+  esp_err_t err = nvs_set_blob(nvs_handle, name, data, len);
+  if (err != ESP_OK) {
+    LOG_E(PERSIST_MODULE, "NVS set %s failed: %d", key, err);
+    return OS_ERR_BUSY;
+  }
+  return OS_OK;
+}
 
-os_err_t os_persist_set_schema_version(uint32_t version) {
-  persist.schema_version = version;
-  return os_persist_put(SCHEMA_KEY, &version, sizeof(version));
+static os_err_t backend_read(const char *key, void *buf, size_t buf_len,
+                             size_t *out_len) {
+  nvs_name_t name;
+  size_t len = buf_len;
+  esp_err_t err = nvs_get_blob(nvs_handle, nvs_name(key, name), buf, &len);
+  if (err == ESP_ERR_NVS_NOT_FOUND) {
+    return OS_ERR_NOT_FOUND;
+  } else if (err == ESP_ERR_NVS_INVALID_LENGTH) {
+    return OS_ERR_NO_MEM;
+  } else if (err != ESP_OK) {
+    return OS_ERR_BUSY;
+  }
+
+  if (out_len) {
+    *out_len = len;
+  }
+  return OS_OK;
 }
 
-os_err_t os_persist_erase_all(void) {
-  if (!persist.initialized) {
-    persist.last_error = OS_ERR_NOT_INITIALIZED;
-    return OS_ERR_NOT_INITIALIZED;
+static os_err_t backend_delete(const char *key) {
+  nvs_name_t buf;
+  const char *name = nvs_name(key, buf);
+  esp_err_t err = nvs_erase_key(nvs_handle, name);
+  if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+    return OS_ERR_BUSY;
   }
+  name_release(key, name);
+  return OS_OK;
+}
 
-  /* Clear buffer */
-  memset(persist.write_buffer, 0, sizeof(persist.write_buffer));
-  persist.writes_buffered = 0;
+/* Check NVS - try to get size only */
+static bool backend_exists(const char *key) {
+  nvs_name_t name;
+  size_t len = 0;
+  return nvs_get_blob(nvs_handle, nvs_name(key, name), NULL, &len) == ESP_OK;
+}
 
-  /* Remove all files in directory */
-  DIR *dir = opendir(PERSIST_DIR);
-  if (dir) {
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-      if (entry->d_name[0] != '.') {
-        char path[PATH_MAX_LEN];
-        /* Limit filename to prevent buffer overflow */
-        int written = snprintf(path, sizeof(path), "%s/%.*s", PERSIST_DIR,
-                               (int)FILENAME_MAX_LEN, entry->d_name);
-        if (written > 0 && (size_t)written < sizeof(path)) {
-          unlink(path);
+static os_err_t backend_commit(void) {
+  esp_err_t err = nvs_commit(nvs_handle);
+  if (err != ESP_OK) {
+    LOG_E(PERSIST_MODULE, "NVS commit failed: %d", err);
+    return OS_ERR_BUSY;
+  }
+  return OS_OK;
+}
+
+/* Erase all keys in namespace */
+static os_err_t backend_erase_all(void) {
+  esp_err_t err = nvs_erase_all(nvs_handle);
+  if (err != ESP_OK) {
+    LOG_E(PERSIST_MODULE, "NVS erase failed: %d", err);
+    return OS_ERR_BUSY;
+  }
+  nvs_commit(nvs_handle);
+  nvs_erase_all(txn_handle);
+  nvs_commit(txn_handle);
+  nvs_erase_all(bad_handle);
+  nvs_commit(bad_handle);
+  nvs_erase_all(keys_handle);
+  nvs_commit(keys_handle);
+  return OS_OK;
+}
+
+/* Copied to a separate namespace, then erased from the live one */
+static void backend_quarantine(const char *key, const void *data, size_t len) {
+  nvs_name_t buf;
+  const char *name = nvs_name(key, buf);
+  if (nvs_set_blob(bad_handle, name, data, len) == ESP_OK) {
+    nvs_commit(bad_handle);
+  }
+  nvs_erase_key(nvs_handle, name);
+  nvs_commit(nvs_handle);
+}
+
+static void backend_usage(uint32_t *used, uint32_t *free_entries,
+                          uint32_t *total) {
+  nvs_stats_t st = {0};
+  nvs_get_stats(NULL, &st);
+  *used = (uint32_t)st.used_entries;
+  *free_entries = (uint32_t)st.free_entries;
+  *total = (uint32_t)st.total_entries;
+}
+
+
+static os_err_t backend_iter_open(void **handle) {
+  nvs_iterator_t it = NULL;
+  esp_err_t err = nvs_entry_find_in_handle(nvs_handle, NVS_TYPE_BLOB, &it);
+  if (err != ESP_OK) {
+    nvs_release_iterator(it);
+    *handle = NULL;
+    return err == ESP_ERR_NVS_NOT_FOUND ? OS_OK : OS_ERR_BUSY;
+  }
+  *handle = it;
+  return OS_OK;
+}
+
+/* Handle points at the next unread entry, or NULL once exhausted. Hashed
+ * names are returned as their logical key; any without one is skipped. */
+static bool backend_iter_next(void **handle, char *key, size_t key_len) {
+  nvs_iterator_t it = (nvs_iterator_t)*handle;
+  bool found = false;
+
+  while (it && !found) {
+    nvs_entry_info_t info;
+    nvs_entry_info(it, &info);
+    if (info.key[0] == NVS_HASHED_MARK) {
+      size_t len = key_len;
+      found = nvs_get_str(keys_handle, info.key, key, &len) == ESP_OK;
+    } else {
+      strncpy(key, info.key, key_len - 1);
+      key[key_len - 1] = '\0';
+      found = true;
+    }
+
+    if (nvs_entry_next(&it) != ESP_OK) {
+      nvs_release_iterator(it);
+      it = NULL;
+    }
+  }
+  *handle = it;
+  return found;
+}
+
+static void backend_iter_close(void **handle) {
+  nvs_release_iterator((nvs_iterator_t)*handle);
+  *handle = NULL;
+}
+
+/* Transactions are staged in the shadow namespace. A marker key written with
+ * the shadow's commit is the commit point; the records are then copied to
+ * the live namespace and the shadow is cleared. */
+static uint8_t journal_buf[RECORD_MAX];
+
+static os_err_t backend_recover(uint32_t *replayed) {
+  *replayed = 0;
+  uint32_t count = 0;
+  if (nvs_get_u32(txn_handle, NVS_TXN_MARKER, &count) != ESP_OK) {
+    /* Nothing committed: drop any partial stage */
+    nvs_erase_all(txn_handle);
+    nvs_commit(txn_handle);
+    return OS_OK;
+  }
+
+  nvs_iterator_t it = NULL;
+  esp_err_t err = nvs_entry_find_in_handle(txn_handle, NVS_TYPE_BLOB, &it);
+  while (err == ESP_OK) {
+    nvs_entry_info_t info;
+    nvs_entry_info(it, &info);
+    size_t len = sizeof(journal_buf);
+    if (nvs_get_blob(txn_handle, info.key, journal_buf, &len) != ESP_OK ||
+        nvs_set_blob(nvs_handle, info.key, journal_buf, len) != ESP_OK) {
+      nvs_release_iterator(it);
+      return OS_ERR_BUSY;
+    }
+    (*replayed)++;
+    err = nvs_entry_next(&it);
+  }
+  nvs_release_iterator(it);
+
+  if (backend_commit() != OS_OK) {
+    return OS_ERR_BUSY;
+  }
+
+  nvs_erase_all(txn_handle);
+  nvs_commit(txn_handle);
+  return OS_OK;
+}
+
+static os_err_t backend_group_begin(void) {
+  uint32_t replayed;
+  return backend_recover(&replayed);
+}
+
+/* Staged under the NVS name, so replay needs no mapping */
+static os_err_t backend_group_add(const char *key, const void *data,
+                                  size_t len) {
+  nvs_name_t buf;
+  const char *name = nvs_name(key, buf);
+  os_err_t reg = name_register(key, name);
+  if (reg != OS_OK) {
+    return reg;
+  }
+  esp_err_t err = nvs_set_blob(txn_handle, name, data, len);
+  return err == ESP_OK ? OS_OK : OS_ERR_BUSY;
+}
+
+/* Commit point */
+static os_err_t backend_group_commit(uint32_t count) {
+  if (nvs_set_u32(txn_handle, NVS_TXN_MARKER, count) != ESP_OK ||
+      nvs_commit(txn_handle) != ESP_OK) {
+    LOG_E(PERSIST_MODULE, "NVS txn commit failed");
+    return OS_ERR_BUSY;
+  }
+  return OS_OK;
+}
+
+static void backend_group_end(void) {
+  backend_commit();
+  nvs_erase_all(txn_handle);
+  nvs_commit(txn_handle);
+}
+
+static void backend_group_abort(void) {
+  nvs_erase_all(txn_handle);
+  nvs_commit(txn_handle);
+}
+
+#endif
+
+/* Write buffer sizing (see os_config.h) */
+#define CACHE_ENTRIES OS_PERSIST_CACHE_ENTRIES
+#define CACHE_ARENA_SIZE OS_PERSIST_CACHE_ARENA
+/* Index is kept at most half full so probe chains stay short */
+#define CACHE_INDEX_SIZE (CACHE_ENTRIES * 2)
+#define CACHE_INDEX_MASK (CACHE_INDEX_SIZE - 1)
+
+/* Most recent flush latencies kept for percentiles */
+#define LATENCY_SAMPLES 32
+/* Flusher poll period while there is nothing to drain */
+#define FLUSHER_POLL_MS 10
+/* Damaged keys remembered until they can be moved aside */
+#define QUARANTINE_QUEUE 8
+
+_Static_assert((CACHE_INDEX_SIZE & CACHE_INDEX_MASK) == 0,
+               "OS_PERSIST_CACHE_ENTRIES must be a power of two");
+_Static_assert(CACHE_ENTRIES < 255, "cache index stores entry + 1 in a byte");
+_Static_assert(CACHE_ARENA_SIZE >= OS_PERSIST_VALUE_MAX &&
+                   CACHE_ARENA_SIZE <= UINT16_MAX,
+               "cache arena must hold one maximum value");
+
+/* Dirty value; its bytes live in the arena at [offset, offset+cap) */
+typedef struct {
+  char key[OS_PERSIST_KEY_MAX];
+  uint32_t hash;
+  uint16_t offset;
+  uint16_t len;
+  uint16_t cap;
+  uint16_t puts; /* Puts coalesced into this value */
+  bool valid;
+  bool txn; /* Written inside the open transaction */
+} cache_entry_t;
+
+/* One write buffer: hashed entries over a compact value arena */
+typedef struct {
+  cache_entry_t entries[CACHE_ENTRIES];
+  uint8_t index[CACHE_INDEX_SIZE]; /* 0 = empty, else entry index + 1 */
+  uint8_t arena[CACHE_ARENA_SIZE];
+  uint16_t arena_used;    /* Bump pointer */
+  uint16_t arena_garbage; /* Bytes below arena_used owned by no entry */
+  uint32_t count;
+  os_tick_t dirty_since; /* When the first entry arrived */
+} write_buf_t;
+
+/* Progress of the sealed buffer's group write */
+typedef enum {
+  DRAIN_IDLE = 0,
+  DRAIN_JOURNAL, /* Staging records */
+  DRAIN_APPLY,   /* Committed; replacing live records */
+} drain_phase_t;
+
+static struct {
+  bool initialized;
+  write_buf_t bufs[2];
+  uint8_t active; /* Producers fill bufs[active]; the other one is sealed */
+  write_buf_t tier;  /* Cache-tier values, written lazily or dropped */
+  uint32_t tier_writes;
+  uint32_t tier_dropped;
+  drain_phase_t drain_phase;
+  uint32_t drain_pos;
+  uint32_t drain_count;
+  bool drain_journaled;
+  os_tick_t seal_tick;
+  uint32_t total_writes;
+  uint32_t total_reads;
+  uint32_t swaps;
+  uint32_t stalls;
+  uint32_t stall_ms_total;
+  uint32_t stall_ms_max;
+  uint32_t flushes;
+  uint32_t latency_ms[LATENCY_SAMPLES];
+  uint32_t puts;
+  uint32_t puts_absorbed;
+  uint32_t max_absorbed;
+  uint32_t flush_by_reason[OS_PERSIST_FLUSH_IDLE + 1];
+  os_tick_t last_put_tick;
+  bool backend_dirty; /* Single writes awaiting commit */
+  struct {
+    const char *prefix;
+    os_persist_migrate_fn fn;
+    uint8_t from_version;
+  } migrations[OS_PERSIST_MAX_MIGRATIONS];
+  uint32_t migration_count;
+  uint32_t migrated;
+  bool txn_active;
+  uint32_t txn_commits;
+  uint32_t txn_replayed; /* Records replayed from a journal at init */
+  uint32_t schema_version;
+  uint32_t scan_records;
+  uint32_t scan_ms;
+  bool scan_complete;
+  uint32_t corrupt;
+  uint32_t quarantined;
+  uint32_t legacy;
+  uint32_t put_bytes;
+  uint32_t bytes_written;
+  uint32_t records_written;
+  uint32_t entries_written;
+  os_tick_t init_tick;
+  char bad_keys[QUARANTINE_QUEUE][OS_PERSIST_KEY_MAX];
+  uint32_t bad_count;
+  /* Unframed values are accepted only until the one-time conversion
+   * completes; those found by the scan wait here to be reframed */
+  bool legacy_open;
+  char legacy_keys[QUARANTINE_QUEUE][OS_PERSIST_KEY_MAX];
+  uint32_t legacy_count;
+  os_tick_t last_flush_tick;
+  os_err_t last_error;
+} persist = {0};
+
+static write_buf_t *active_buf(void) { return &persist.bufs[persist.active]; }
+
+static write_buf_t *sealed_buf(void) {
+  return &persist.bufs[persist.active ^ 1];
+}
+
+static cache_entry_t *buf_find(write_buf_t *b, const char *key);
+
+#ifdef OS_PLATFORM_HOST
+static uint32_t crc_table[256];
+
+/* Table-driven CRC-32 (IEEE 802.3, reflected), zlib-compatible chaining */
+static uint32_t crc32_le(uint32_t crc, const uint8_t *p, size_t len) {
+  if (crc_table[1] == 0) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) {
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      }
+      crc_table[i] = c;
+    }
+  }
+  crc = ~crc;
+  while (len--) {
+    crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+#else
+#include "esp_rom_crc.h"
+
+/* ROM implementation, same polynomial and chaining as the host table */
+static uint32_t crc32_le(uint32_t crc, const uint8_t *p, size_t len) {
+  return esp_rom_crc32_le(crc, p, (uint32_t)len);
+}
+#endif
+
+/* One framed record in flight; backends copy it before returning */
+static uint8_t frame_buf[RECORD_MAX];
+
+typedef enum {
+  FRAME_OK = 0,
+  FRAME_LEGACY,  /* Written before framing; accepted during conversion */
+  FRAME_CORRUPT, /* Torn, truncated or bit-flipped */
+} frame_check_t;
+
+static size_t frame_record(const void *data, size_t len) {
+  frame_buf[0] = FRAME_MAGIC;
+  frame_buf[1] = FRAME_VERSION;
+  frame_buf[2] = (uint8_t)len;
+  frame_buf[3] = (uint8_t)(len >> 8);
+  memcpy(&frame_buf[FRAME_HDR_LEN], data, len);
+  uint32_t crc = crc32_le(0, frame_buf, 4);
+  crc = crc32_le(crc, &frame_buf[FRAME_HDR_LEN], len);
+  for (int i = 0; i < 4; i++) {
+    frame_buf[4 + i] = (uint8_t)(crc >> (8 * i));
+  }
+  return FRAME_HDR_LEN + len;
+}
+
+static frame_check_t frame_check(const uint8_t *rec, size_t len) {
+  if (len == 0 || rec[0] != FRAME_MAGIC) {
+    return persist.legacy_open ? FRAME_LEGACY : FRAME_CORRUPT;
+  }
+  if (len < FRAME_HDR_LEN || rec[1] != FRAME_VERSION ||
+      (size_t)(rec[2] | (rec[3] << 8)) != len - FRAME_HDR_LEN) {
+    return FRAME_CORRUPT;
+  }
+  uint32_t stored = (uint32_t)rec[4] | ((uint32_t)rec[5] << 8) |
+                    ((uint32_t)rec[6] << 16) | ((uint32_t)rec[7] << 24);
+  uint32_t crc = crc32_le(0, rec, 4);
+  crc = crc32_le(crc, &rec[FRAME_HDR_LEN], len - FRAME_HDR_LEN);
+  return crc == stored ? FRAME_OK : FRAME_CORRUPT;
+}
+
+/* Wear accounting: an NVS blob costs a header entry plus one 32-byte
+ * entry per started 32 bytes of data */
+static void count_write(size_t frame_len) {
+  persist.bytes_written += (uint32_t)frame_len;
+  persist.records_written++;
+  persist.entries_written += 1 + (uint32_t)((frame_len + 31) / 32);
+}
+
+static os_err_t record_write(const char *key, const void *data, size_t len) {
+  size_t n = frame_record(data, len);
+  count_write(n);
+  return backend_write(key, frame_buf, n);
+}
+
+static os_err_t record_group_add(const char *key, const void *data,
+                                 size_t len) {
+  size_t n = frame_record(data, len);
+  count_write(n);
+  return backend_group_add(key, frame_buf, n);
+}
+
+/* Remember a damaged key; it is moved aside once no reader holds a cursor */
+static void note_corrupt(const char *key) {
+  for (uint32_t i = 0; i < persist.bad_count; i++) {
+    if (strcmp(persist.bad_keys[i], key) == 0) {
+      return;
+    }
+  }
+  persist.corrupt++;
+  LOG_W(PERSIST_MODULE, "Corrupt record %s", key);
+  if (persist.bad_count < QUARANTINE_QUEUE) {
+    strncpy(persist.bad_keys[persist.bad_count], key, OS_PERSIST_KEY_MAX - 1);
+    persist.bad_keys[persist.bad_count][OS_PERSIST_KEY_MAX - 1] = '\0';
+    persist.bad_count++;
+  }
+}
+
+/* Whether the store has been converted to framed records */
+static bool format_framed(void) {
+  size_t n = 0;
+  if (backend_read(FORMAT_KEY, frame_buf, sizeof(frame_buf), &n) != OS_OK ||
+      n != FRAME_HDR_LEN + sizeof(uint32_t) || frame_buf[0] != FRAME_MAGIC ||
+      frame_check(frame_buf, n) != FRAME_OK) {
+    return false;
+  }
+  uint32_t format;
+  memcpy(&format, &frame_buf[FRAME_HDR_LEN], sizeof(format));
+  return format >= FORMAT_FRAMED;
+}
+
+static os_err_t mark_framed(void) {
+  uint32_t format = FORMAT_FRAMED;
+  os_err_t err = record_write(FORMAT_KEY, &format, sizeof(format));
+  if (err == OS_OK) {
+    err = backend_commit();
+  }
+  if (err == OS_OK) {
+    persist.legacy_open = false;
+  }
+  return err;
+}
+
+/* Rewrite queued unframed values with a frame; false if any is left */
+static bool reframe_pending(void) {
+  static uint8_t payload[OS_PERSIST_VALUE_MAX];
+  bool done = true;
+  for (uint32_t i = 0; i < persist.legacy_count; i++) {
+    const char *key = persist.legacy_keys[i];
+    size_t n = 0;
+    os_err_t err = backend_read(key, frame_buf, sizeof(frame_buf), &n);
+    if (err == OS_ERR_NOT_FOUND) {
+      continue;
+    }
+    if (err != OS_OK || n > sizeof(payload)) {
+      note_corrupt(key);
+      continue;
+    }
+    if (frame_check(frame_buf, n) != FRAME_LEGACY) {
+      continue; /* Rewritten since */
+    }
+    memcpy(payload, frame_buf, n);
+    if (record_write(key, payload, n) != OS_OK) {
+      done = false;
+    }
+  }
+  persist.legacy_count = 0;
+  return done;
+}
+
+static void quarantine_pending(void) {
+  for (uint32_t i = 0; i < persist.bad_count; i++) {
+    const char *key = persist.bad_keys[i];
+    size_t n = 0;
+    os_err_t err = backend_read(key, frame_buf, sizeof(frame_buf), &n);
+    /* Skip keys rewritten or deleted since they were found */
+    if (err == OS_ERR_NOT_FOUND ||
+        (err == OS_OK && frame_check(frame_buf, n) != FRAME_CORRUPT)) {
+      continue;
+    }
+    backend_quarantine(key, err == OS_OK ? frame_buf : NULL, n);
+    persist.quarantined++;
+    LOG_W(PERSIST_MODULE, "Quarantined %s", key);
+  }
+  persist.bad_count = 0;
+}
+
+/* Read and verify a record. A damaged one reads as absent. */
+static os_err_t record_read(const char *key, void *buf, size_t buf_len,
+                            size_t *out_len, bool *legacy) {
+  size_t n = 0;
+  os_err_t err = backend_read(key, frame_buf, sizeof(frame_buf), &n);
+  if (err == OS_ERR_NO_MEM) {
+    /* Longer than any record can be */
+    note_corrupt(key);
+    return OS_ERR_NOT_FOUND;
+  }
+  if (err != OS_OK) {
+    return err;
+  }
+
+  const uint8_t *payload = frame_buf;
+  frame_check_t check = frame_check(frame_buf, n);
+  if (check == FRAME_CORRUPT) {
+    note_corrupt(key);
+    return OS_ERR_NOT_FOUND;
+  } else if (check == FRAME_OK) {
+    payload += FRAME_HDR_LEN;
+    n -= FRAME_HDR_LEN;
+  }
+
+  if (n > buf_len) {
+    return OS_ERR_NO_MEM;
+  }
+  memcpy(buf, payload, n);
+  if (out_len) {
+    *out_len = n;
+  }
+  if (legacy) {
+    *legacy = check == FRAME_LEGACY;
+  }
+  return OS_OK;
+}
+
+/* Newest buffered value of a key in any buffer, or NULL */
+static cache_entry_t *find_buffered(const char *key, write_buf_t **owner) {
+  write_buf_t *order[3] = {active_buf(), sealed_buf(), &persist.tier};
+  for (uint32_t i = 0; i < 3; i++) {
+    cache_entry_t *e = buf_find(order[i], key);
+    if (e) {
+      *owner = order[i];
+      return e;
+    }
+  }
+  return NULL;
+}
+
+/* FNV-1a over the stored (possibly truncated) key */
+static uint32_t key_hash(const char *key) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < OS_PERSIST_KEY_MAX - 1 && key[i]; i++) {
+    h ^= (uint8_t)key[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/* Find index position holding key, or -1 */
+static int32_t buf_find_pos(const write_buf_t *b, const char *key,
+                            uint32_t hash) {
+  uint32_t pos = hash & CACHE_INDEX_MASK;
+  for (uint32_t n = 0; n < CACHE_INDEX_SIZE; n++) {
+    uint8_t slot = b->index[pos];
+    if (slot == 0) {
+      return -1;
+    }
+    const cache_entry_t *e = &b->entries[slot - 1];
+    if (e->hash == hash &&
+        strncmp(e->key, key, OS_PERSIST_KEY_MAX - 1) == 0) {
+      return (int32_t)pos;
+    }
+    pos = (pos + 1) & CACHE_INDEX_MASK;
+  }
+  return -1;
+}
+
+static cache_entry_t *buf_find(write_buf_t *b, const char *key) {
+  int32_t pos = buf_find_pos(b, key, key_hash(key));
+  return pos < 0 ? NULL : &b->entries[b->index[pos] - 1];
+}
+
+static void buf_index_insert(write_buf_t *b, uint32_t hash,
+                             uint8_t entry_idx) {
+  uint32_t pos = hash & CACHE_INDEX_MASK;
+  while (b->index[pos] != 0) {
+    pos = (pos + 1) & CACHE_INDEX_MASK;
+  }
+  b->index[pos] = (uint8_t)(entry_idx + 1);
+}
+
+/* Backward-shift deletion keeps linear probe chains intact without
+ * tombstones */
+static void buf_index_remove(write_buf_t *b, uint32_t pos) {
+  b->index[pos] = 0;
+  uint32_t hole = pos;
+  uint32_t j = pos;
+  while (1) {
+    j = (j + 1) & CACHE_INDEX_MASK;
+    uint8_t slot = b->index[j];
+    if (slot == 0) {
+      return;
+    }
+    uint32_t home = b->entries[slot - 1].hash & CACHE_INDEX_MASK;
+    /* Entry at j may move into the hole unless its home lies in (hole, j] */
+    bool home_between = (hole <= j) ? (home > hole && home <= j)
+                                    : (home > hole || home <= j);
+    if (!home_between) {
+      b->index[hole] = slot;
+      b->index[j] = 0;
+      hole = j;
+    }
+  }
+}
+
+static void buf_reset(write_buf_t *b) {
+  memset(b->entries, 0, sizeof(b->entries));
+  memset(b->index, 0, sizeof(b->index));
+  b->arena_used = 0;
+  b->arena_garbage = 0;
+  b->count = 0;
+}
+
+/* Drop an entry; its arena bytes become garbage */
+static void buf_drop(write_buf_t *b, cache_entry_t *e) {
+  int32_t pos = buf_find_pos(b, e->key, e->hash);
+  if (pos >= 0) {
+    buf_index_remove(b, (uint32_t)pos);
+  }
+  b->arena_garbage += e->cap;
+  e->valid = false;
+  b->count--;
+
+  if (b->count == 0) {
+    b->arena_used = 0;
+    b->arena_garbage = 0;
+  }
+}
+
+/* Slide live values to the start of the arena in offset order */
+static void buf_compact(write_buf_t *b) {
+  uint8_t order[CACHE_ENTRIES];
+  uint32_t n = 0;
+
+  for (uint32_t i = 0; i < CACHE_ENTRIES; i++) {
+    if (!b->entries[i].valid) {
+      continue;
+    }
+    uint32_t j = n++;
+    while (j > 0 && b->entries[order[j - 1]].offset > b->entries[i].offset) {
+      order[j] = order[j - 1];
+      j--;
+    }
+    order[j] = (uint8_t)i;
+  }
+
+  uint16_t cursor = 0;
+  for (uint32_t k = 0; k < n; k++) {
+    cache_entry_t *e = &b->entries[order[k]];
+    if (e->offset != cursor) {
+      memmove(&b->arena[cursor], &b->arena[e->offset], e->len);
+      e->offset = cursor;
+    }
+    e->cap = e->len;
+    cursor = (uint16_t)(cursor + e->len);
+  }
+
+  b->arena_used = cursor;
+  b->arena_garbage = 0;
+}
+
+/* Reserve len bytes at the arena tail; the caller checked they exist */
+static uint16_t buf_alloc(write_buf_t *b, size_t len) {
+  if ((size_t)(CACHE_ARENA_SIZE - b->arena_used) < len) {
+    buf_compact(b);
+  }
+  uint16_t offset = b->arena_used;
+  b->arena_used = (uint16_t)(b->arena_used + len);
+  return offset;
+}
+
+/* Store a value in a buffer, OS_ERR_FULL if it has no room left */
+static os_err_t buf_store(write_buf_t *b, const char *key, const void *data,
+                          size_t len, bool txn) {
+  cache_entry_t *slot = buf_find(b, key);
+  size_t avail =
+      (size_t)(CACHE_ARENA_SIZE - b->arena_used + b->arena_garbage);
+
+  if (slot && len > slot->cap) {
+    /* Grow: release the old region and take a new one */
+    if (avail + slot->cap < len) {
+      return OS_ERR_FULL;
+    }
+    b->arena_garbage += slot->cap;
+    slot->cap = 0;
+    slot->len = 0;
+    slot->offset = buf_alloc(b, len);
+    slot->cap = (uint16_t)len;
+  }
+
+  if (!slot) {
+    if (b->count >= CACHE_ENTRIES || avail < len) {
+      return OS_ERR_FULL;
+    }
+    for (uint32_t i = 0; i < CACHE_ENTRIES; i++) {
+      if (!b->entries[i].valid) {
+        slot = &b->entries[i];
+        strncpy(slot->key, key, OS_PERSIST_KEY_MAX - 1);
+        slot->key[OS_PERSIST_KEY_MAX - 1] = '\0';
+        slot->hash = key_hash(key);
+        slot->offset = buf_alloc(b, len);
+        slot->cap = (uint16_t)len;
+        slot->puts = 1;
+        slot->valid = true;
+        if (b->count == 0) {
+          b->dirty_since = os_now_ticks();
         }
+        buf_index_insert(b, slot->hash, (uint8_t)i);
+        b->count++;
+        break;
       }
     }
-    closedir(dir);
   }
 
-  persist.schema_version = 0;
-  persist.last_flush_tick = os_now_ticks();
-  LOG_I(PERSIST_MODULE, "Storage erased");
+  memcpy(&b->arena[slot->offset], data, len);
+  slot->len = (uint16_t)len;
+  slot->txn = txn;
+  return OS_OK;
+}
+
+static cache_entry_t *buf_next(write_buf_t *b, uint32_t *pos) {
+  while (*pos < CACHE_ENTRIES) {
+    cache_entry_t *e = &b->entries[(*pos)++];
+    if (e->valid) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+/* Entries an ordinary flush may write (all but open transaction ones) */
+static uint32_t buf_flushable(const write_buf_t *b) {
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < CACHE_ENTRIES; i++) {
+    if (b->entries[i].valid && !b->entries[i].txn) {
+      n++;
+    }
+  }
+  return n;
+}
+
+static void drain_finish(void) {
+  write_buf_t *b = sealed_buf();
+  uint32_t flushed = b->count;
+  buf_reset(b);
+
+  os_tick_t now = os_now_ticks();
+  persist.latency_ms[persist.flushes % LATENCY_SAMPLES] =
+      OS_TICKS_TO_MS(now - persist.seal_tick);
+  persist.flushes++;
+  persist.total_writes += flushed;
+  persist.last_flush_tick = now;
+  persist.drain_phase = DRAIN_IDLE;
+
+  LOG_D(PERSIST_MODULE, "Flushed %" PRIu32 " writes", flushed);
+  os_event_emit(OS_EVENT_PERSIST_FLUSH, &flushed, sizeof(flushed));
+}
+
+static bool drain_fail(os_err_t err, os_err_t *out) {
+  /* Entries stay sealed and are retried; a committed journal is replayed
+   * by the next group write or at init */
+  LOG_E(PERSIST_MODULE, "Flush failed: %d", err);
+  persist.last_error = err;
+  persist.drain_phase = DRAIN_IDLE;
+  *out = err;
+  return true;
+}
+
+/* Advance the sealed buffer's group write by one record. Returns true when
+ * the sealed buffer is empty or the write failed (*err says which). */
+static bool drain_step(os_err_t *err) {
+  write_buf_t *b = sealed_buf();
+  cache_entry_t *e;
+  *err = OS_OK;
+
+  switch (persist.drain_phase) {
+  case DRAIN_IDLE:
+    if (b->count == 0) {
+      return true;
+    }
+    persist.drain_pos = 0;
+    persist.drain_count = 0;
+    /* A single record is replaced atomically without the journal */
+    persist.drain_journaled = b->count > 1;
+    if (persist.drain_journaled) {
+      os_err_t e2 = backend_group_begin();
+      if (e2 != OS_OK) {
+        return drain_fail(e2, err);
+      }
+      persist.drain_phase = DRAIN_JOURNAL;
+    } else {
+      persist.drain_phase = DRAIN_APPLY;
+    }
+    return false;
+
+  case DRAIN_JOURNAL:
+    e = buf_next(b, &persist.drain_pos);
+    if (e) {
+      os_err_t e2 = record_group_add(e->key, &b->arena[e->offset], e->len);
+      if (e2 != OS_OK) {
+        backend_group_abort();
+        return drain_fail(e2, err);
+      }
+      persist.drain_count++;
+      return false;
+    }
+    {
+      os_err_t e2 = backend_group_commit(persist.drain_count);
+      if (e2 != OS_OK) {
+        return drain_fail(e2, err);
+      }
+    }
+    persist.drain_pos = 0;
+    persist.drain_phase = DRAIN_APPLY;
+    return false;
+
+  case DRAIN_APPLY:
+    e = buf_next(b, &persist.drain_pos);
+    if (e) {
+      os_err_t e2 = record_write(e->key, &b->arena[e->offset], e->len);
+      if (e2 != OS_OK) {
+        return drain_fail(e2, err);
+      }
+      return false;
+    }
+    if (persist.drain_journaled) {
+      backend_group_end();
+    } else {
+      backend_commit();
+    }
+    drain_finish();
+    return true;
+  }
+
+  return true;
+}
+
+static os_err_t drain_all(void) {
+  os_err_t err = OS_OK;
+  while (!drain_step(&err)) {
+  }
+  return err;
+}
+
+/* Discard the open transaction's entries from a buffer */
+static void txn_drop(write_buf_t *b) {
+  for (uint32_t i = 0; i < CACHE_ENTRIES; i++) {
+    cache_entry_t *e = &b->entries[i];
+    if (e->valid && e->txn) {
+      buf_drop(b, e);
+    }
+  }
+}
+
+/* Seal the active buffer for the flusher and start filling the other one.
+ * If the sealed buffer is still draining, the caller finishes it first:
+ * the only point where producers stall. */
+static os_err_t seal_active(void) {
+  if (sealed_buf()->count > 0) {
+    os_tick_t start = os_now_ticks();
+    os_err_t err = drain_all();
+    uint32_t ms = OS_TICKS_TO_MS(os_now_ticks() - start);
+    persist.stalls++;
+    persist.stall_ms_total += ms;
+    if (ms > persist.stall_ms_max) {
+      persist.stall_ms_max = ms;
+    }
+    if (err != OS_OK) {
+      return err;
+    }
+  }
+
+  write_buf_t *old = active_buf();
+  persist.active ^= 1;
+  persist.seal_tick = os_now_ticks();
+
+  /* Open transaction entries must not reach storage before commit. One
+   * that cannot move would be lost, so then the whole transaction is. */
+  os_err_t err = OS_OK;
+  for (uint32_t i = 0; i < CACHE_ENTRIES; i++) {
+    cache_entry_t *e = &old->entries[i];
+    if (e->valid && e->txn) {
+      if (err == OS_OK) {
+        err = buf_store(active_buf(), e->key, &old->arena[e->offset], e->len,
+                        true);
+      }
+      buf_drop(old, e);
+    }
+  }
+  if (err != OS_OK) {
+    LOG_E(PERSIST_MODULE, "Transaction no longer fits a buffer, aborted");
+    txn_drop(active_buf());
+    persist.txn_active = false;
+  }
+  return err;
+}
+
+/* Write the open transaction's entries as one group, synchronously */
+static os_err_t write_txn_entries(void) {
+  write_buf_t *b = active_buf();
+  cache_entry_t *group[CACHE_ENTRIES];
+  uint32_t n = 0;
+
+  for (uint32_t i = 0; i < CACHE_ENTRIES; i++) {
+    if (b->entries[i].valid && b->entries[i].txn) {
+      group[n++] = &b->entries[i];
+    }
+  }
+  if (n == 0) {
+    return OS_OK;
+  }
+
+  os_err_t err = OS_OK;
+  if (n > 1) {
+    err = backend_group_begin();
+    for (uint32_t i = 0; i < n && err == OS_OK; i++) {
+      err = record_group_add(group[i]->key, &b->arena[group[i]->offset],
+                              group[i]->len);
+    }
+    if (err != OS_OK) {
+      backend_group_abort();
+      return err;
+    }
+    err = backend_group_commit(n);
+    if (err != OS_OK) {
+      return err;
+    }
+  }
+
+  for (uint32_t i = 0; i < n; i++) {
+    err = record_write(group[i]->key, &b->arena[group[i]->offset],
+                        group[i]->len);
+    if (err != OS_OK) {
+      return err;
+    }
+  }
+
+  if (n > 1) {
+    backend_group_end();
+  } else {
+    backend_commit();
+  }
+
+  for (uint32_t i = 0; i < n; i++) {
+    buf_drop(b, group[i]);
+  }
+  persist.total_writes += n;
+  return OS_OK;
+}
+
+/* Write out pending cache-tier values. Best effort: single records, no
+ * journal, and nothing here is allowed to wait for the essential tier. */
+static os_err_t tier_flush(void) {
+  write_buf_t *b = &persist.tier;
+  if (b->count == 0) {
+    return OS_OK;
+  }
+
+  for (uint32_t i = 0; i < CACHE_ENTRIES; i++) {
+    cache_entry_t *e = &b->entries[i];
+    if (!e->valid) {
+      continue;
+    }
+    os_err_t err = record_write(e->key, &b->arena[e->offset], e->len);
+    if (err != OS_OK) {
+      persist.last_error = err;
+      return err;
+    }
+    persist.tier_writes++;
+    buf_drop(b, e);
+  }
+
+  backend_commit();
+  return OS_OK;
+}
+
+/* Migration scratch: chain steps ping-pong between the two halves */
+static uint8_t migrate_buf[2][OS_PERSIST_VALUE_MAX];
+
+static os_persist_migrate_fn find_migration(const char *key,
+                                            uint8_t from_version) {
+  for (uint32_t i = 0; i < persist.migration_count; i++) {
+    if (persist.migrations[i].from_version == from_version &&
+        strncmp(key, persist.migrations[i].prefix,
+                strlen(persist.migrations[i].prefix)) == 0) {
+      return persist.migrations[i].fn;
+    }
+  }
+  return NULL;
+}
+
+/* Bring an old-version record up to date and store it back. The version
+ * byte travels inside the record, so the rewrite replaces the record and
+ * its version in one put. */
+static os_err_t migrate_record(const char *key, void *buf, size_t buf_len,
+                               size_t *len) {
+  if (*len == 0 || *len > buf_len) {
+    return OS_OK;
+  }
+
+  const uint8_t *rec = (const uint8_t *)buf;
+  os_persist_migrate_fn fn = find_migration(key, rec[0]);
+  if (!fn) {
+    return OS_OK;
+  }
+
+  uint8_t from = rec[0];
+  uint32_t cur = 0;
+  size_t cur_len = *len;
+  memcpy(migrate_buf[cur], buf, cur_len);
+
+  while (fn) {
+    size_t new_len = 0;
+    uint8_t version = migrate_buf[cur][0];
+    os_err_t err = fn(migrate_buf[cur], cur_len, migrate_buf[cur ^ 1],
+                      OS_PERSIST_VALUE_MAX, &new_len);
+    if (err != OS_OK || new_len == 0 || new_len > OS_PERSIST_VALUE_MAX ||
+        migrate_buf[cur ^ 1][0] != (uint8_t)(version + 1)) {
+      LOG_E(PERSIST_MODULE, "Migration of %s from v%u failed", key, version);
+      return err != OS_OK ? err : OS_ERR_INVALID_ARG;
+    }
+    cur ^= 1;
+    cur_len = new_len;
+    fn = find_migration(key, migrate_buf[cur][0]);
+  }
+
+  if (cur_len > buf_len) {
+    return OS_ERR_NO_MEM;
+  }
+
+  os_err_t err = os_persist_put(key, migrate_buf[cur], cur_len);
+  if (err != OS_OK) {
+    return err;
+  }
 
+  memcpy(buf, migrate_buf[cur], cur_len);
+  *len = cur_len;
+  persist.migrated++;
+  LOG_I(PERSIST_MODULE, "Migrated %s v%u -> v%u", key, from,
+        migrate_buf[cur][0]);
   return OS_OK;
 }
 
-void os_persist_get_stats(uint32_t *writes_buffered, uint32_t *total_writes,
-                          uint32_t *total_reads) {
-  if (writes_buffered)
-    *writes_buffered = persist.writes_buffered;
-  if (total_writes)
-    *total_writes = persist.total_writes;
-  if (total_reads)
-    *total_reads = persist.total_reads;
+/* Live bytes of a write buffer's arena */
+static uint32_t buf_live_bytes(const write_buf_t *b) {
+  return (uint32_t)(b->arena_used - b->arena_garbage);
 }
 
-void os_persist_get_stats_ex(os_persist_stats_t *stats) {
-  if (!stats) {
-    return;
-  }
-
-  stats->writes_buffered = persist.writes_buffered;
-  stats->total_writes = persist.total_writes;
-  stats->total_reads = persist.total_reads;
-  stats->last_flush_tick = persist.last_flush_tick;
-  stats->last_error = persist.last_error;
+static void mem_report_buffers(os_mem_region_t *region, void *ctx) {
+  (void)ctx;
+  region->used = buf_live_bytes(&persist.bufs[0]) +
+                 buf_live_bytes(&persist.bufs[1]);
+  region->capacity = 2 * CACHE_ARENA_SIZE;
 }
 
-#else
-/* ESP32 NVS implementation */
-#include "nvs.h"
-#include "nvs_flash.h"
-
-#define NVS_NAMESPACE "bridge"
-#define SCHEMA_KEY "_schema_version"
-
-/* Buffered write entry */
-typedef struct {
-  char key[OS_PERSIST_KEY_MAX];
-  uint8_t data[OS_PERSIST_VALUE_MAX];
-  size_t len;
-  bool valid;
-} write_buffer_entry_t;
-
-#define WRITE_BUFFER_SIZE 16
-
-static struct {
-  bool initialized;
-  nvs_handle_t nvs_handle;
-  write_buffer_entry_t write_buffer[WRITE_BUFFER_SIZE];
-  uint32_t writes_buffered;
-  uint32_t total_writes;
-  uint32_t total_reads;
-  uint32_t schema_version;
-  os_tick_t last_flush_tick;
-  os_err_t last_error;
-} persist = {0};
+static void mem_report_tier(os_mem_region_t *region, void *ctx) {
+  (void)ctx;
+  region->used = buf_live_bytes(&persist.tier);
+  region->capacity = CACHE_ARENA_SIZE;
+}
 
 os_err_t os_persist_init(void) {
   if (persist.initialized) {
@@ -438,36 +1697,33 @@ os_err_t os_persist_init(void) {
 
   memset(&persist, 0, sizeof(persist));
 
-  /* Initialize NVS flash */
-  esp_err_t err = nvs_flash_init();
-  if (err == ESP_ERR_NVS_NO_FREE_PAGES ||
-      err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-    /* Erase and retry */
-    LOG_W(PERSIST_MODULE, "NVS partition issue, erasing...");
-    nvs_flash_erase();
-    err = nvs_flash_init();
+  os_err_t err = backend_init();
+  if (err != OS_OK) {
+    return err;
   }
 
-  if (err != ESP_OK) {
-    LOG_E(PERSIST_MODULE, "NVS flash init failed: %d", err);
-    return OS_ERR_BUSY;
-  }
+  persist.init_tick = os_now_ticks();
 
-  /* Open NVS namespace */
-  err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &persist.nvs_handle);
-  if (err != ESP_OK) {
-    LOG_E(PERSIST_MODULE, "NVS open failed: %d", err);
-    return OS_ERR_BUSY;
-  }
+  /* Value bytes buffered, against arena size */
+  os_mem_register("persist.buffers", sizeof(persist.bufs), mem_report_buffers,
+                  NULL);
+  os_mem_register("persist.tier", sizeof(persist.tier), mem_report_tier,
+                  NULL);
+
+  /* Finish or discard a group write interrupted by a reset, then set
+   * damaged records aside before anyone loads them */
+  persist.initialized = true;
+  os_persist_recover();
+  os_persist_scan();
 
   /* Load schema version if exists */
   uint32_t version = 0;
-  size_t len = sizeof(version);
-  if (nvs_get_blob(persist.nvs_handle, SCHEMA_KEY, &version, &len) == ESP_OK) {
+  size_t len;
+  if (record_read(SCHEMA_KEY, &version, sizeof(version), &len, NULL) ==
+      OS_OK) {
     persist.schema_version = version;
   }
 
-  persist.initialized = true;
   persist.last_error = OS_OK;
   LOG_I(PERSIST_MODULE, "Persistence initialized (schema v%" PRIu32 ")",
         persist.schema_version);
@@ -486,42 +1742,52 @@ os_err_t os_persist_put(const char *key, const void *data, size_t len) {
     return OS_ERR_INVALID_ARG;
   }
 
-  /* Find or create buffer slot */
-  write_buffer_entry_t *slot = NULL;
-
-  /* First, look for existing entry with same key */
-  for (uint32_t i = 0; i < WRITE_BUFFER_SIZE; i++) {
-    if (persist.write_buffer[i].valid &&
-        strcmp(persist.write_buffer[i].key, key) == 0) {
-      slot = &persist.write_buffer[i];
-      break;
+  /* Keep a pre-transaction dirty value safe from abort by storing it now */
+  cache_entry_t *slot = buf_find(active_buf(), key);
+  if (slot && persist.txn_active && !slot->txn) {
+    write_buf_t *b = active_buf();
+    if (buf_find(sealed_buf(), key)) {
+      /* The older sealed value must not land on top of it later */
+      drain_all();
+    }
+    os_err_t err = record_write(slot->key, &b->arena[slot->offset], slot->len);
+    if (err != OS_OK) {
+      persist.last_error = err;
+      return err;
     }
+    persist.total_writes++;
+    persist.backend_dirty = true;
   }
 
-  /* If not found, find empty slot */
-  if (!slot) {
-    for (uint32_t i = 0; i < WRITE_BUFFER_SIZE; i++) {
-      if (!persist.write_buffer[i].valid) {
-        slot = &persist.write_buffer[i];
-        persist.writes_buffered++;
-        break;
-      }
+  os_err_t err = buf_store(active_buf(), key, data, len, persist.txn_active);
+  if (err == OS_ERR_FULL) {
+    /* Hand the full buffer to the flusher and continue in the other one */
+    persist.swaps++;
+    slot = NULL;
+    err = seal_active();
+    if (err == OS_OK) {
+      err = buf_store(active_buf(), key, data, len, persist.txn_active);
     }
   }
 
-  if (!slot) {
-    /* Buffer full, flush first */
-    os_persist_flush();
-    slot = &persist.write_buffer[0];
-    persist.writes_buffered++;
+  if (err != OS_OK) {
+    persist.last_error = err;
+    return err;
   }
 
-  /* Copy to buffer */
-  strncpy(slot->key, key, OS_PERSIST_KEY_MAX - 1);
-  slot->key[OS_PERSIST_KEY_MAX - 1] = '\0';
-  memcpy(slot->data, data, len);
-  slot->len = len;
-  slot->valid = true;
+  /* Overwrote a buffered value: one flash write saved */
+  if (slot) {
+    persist.puts_absorbed++;
+    if (slot->puts < UINT16_MAX) {
+      slot->puts++;
+    }
+    if ((uint32_t)(slot->puts - 1) > persist.max_absorbed) {
+      persist.max_absorbed = slot->puts - 1;
+    }
+  }
+  persist.puts++;
+  persist.put_bytes += (uint32_t)len;
+  persist.last_put_tick = os_now_ticks();
 
   LOG_T(PERSIST_MODULE, "Buffered write: %s (%zu bytes)", key, len);
 
@@ -529,6 +1795,36 @@ os_err_t os_persist_put(const char *key, const void *data, size_t len) {
   return OS_OK;
 }
 
+os_err_t os_persist_put_tier(const char *key, const void *data, size_t len,
+                             os_persist_tier_t tier) {
+  if (tier == OS_PERSIST_TIER_ESSENTIAL) {
+    return os_persist_put(key, data, len);
+  }
+
+  if (!persist.initialized || !key || !data || len > OS_PERSIST_VALUE_MAX ||
+      tier != OS_PERSIST_TIER_CACHE) {
+    persist.last_error = OS_ERR_INVALID_ARG;
+    return OS_ERR_INVALID_ARG;
+  }
+
+  os_err_t err = buf_store(&persist.tier, key, data, len, false);
+  if (err == OS_ERR_FULL) {
+    /* Under pressure cache values are the first thing to go */
+    LOG_D(PERSIST_MODULE, "Dropping %" PRIu32 " cache-tier values",
+          persist.tier.count);
+    persist.tier_dropped += persist.tier.count;
+    buf_reset(&persist.tier);
+    err = buf_store(&persist.tier, key, data, len, false);
+  }
+  if (err == OS_OK) {
+    persist.puts++;
+    persist.put_bytes += (uint32_t)len;
+  }
+
+  persist.last_error = err;
+  return err;
+}
+
 os_err_t os_persist_get(const char *key, void *buf, size_t buf_len,
                         size_t *out_len) {
   if (!persist.initialized || !key || !buf) {
@@ -538,40 +1834,40 @@ os_err_t os_persist_get(const char *key, void *buf, size_t buf_len,
 
   persist.total_reads++;
 
-  /* Check write buffer first */
-  for (uint32_t i = 0; i < WRITE_BUFFER_SIZE; i++) {
-    if (persist.write_buffer[i].valid &&
-        strcmp(persist.write_buffer[i].key, key) == 0) {
-      size_t copy_len = persist.write_buffer[i].len;
-      if (copy_len > buf_len) {
-        copy_len = buf_len;
-      }
-      memcpy(buf, persist.write_buffer[i].data, copy_len);
-      if (out_len) {
-        *out_len = persist.write_buffer[i].len;
-      }
-      persist.last_error = OS_OK;
-      return OS_OK;
+  size_t len = 0;
+  os_err_t err;
+
+  /* Newest value first: active buffer, the one being flushed, cache tier */
+  write_buf_t *b = NULL;
+  cache_entry_t *e = find_buffered(key, &b);
+
+  if (e) {
+    size_t copy_len = e->len;
+    if (copy_len > buf_len) {
+      copy_len = buf_len;
+    }
+    memcpy(buf, &b->arena[e->offset], copy_len);
+    len = e->len;
+    err = OS_OK;
+  } else {
+    /* Read from storage */
+    bool legacy = false;
+    err = record_read(key, buf, buf_len, &len, &legacy);
+    if (err == OS_OK && legacy) {
+      /* Reframe unframed records as they are used */
+      os_persist_put(key, buf, len);
     }
   }
 
-  /* Read from NVS */
-  size_t len = buf_len;
-  esp_err_t err = nvs_get_blob(persist.nvs_handle, key, buf, &len);
-  if (err == ESP_ERR_NVS_NOT_FOUND) {
-    persist.last_error = OS_ERR_NOT_FOUND;
-    return OS_ERR_NOT_FOUND;
-  } else if (err != ESP_OK) {
-    persist.last_error = OS_ERR_BUSY;
-    return OS_ERR_BUSY;
+  if (err == OS_OK && persist.migration_count > 0) {
+    err = migrate_record(key, buf, buf_len, &len);
   }
 
-  if (out_len) {
+  if (err == OS_OK && out_len) {
     *out_len = len;
   }
-
-  persist.last_error = OS_OK;
-  return OS_OK;
+  persist.last_error = err;
+  return err;
 }
 
 os_err_t os_persist_del(const char *key) {
@@ -580,24 +1876,30 @@ os_err_t os_persist_del(const char *key) {
     return OS_ERR_INVALID_ARG;
   }
 
-  /* Remove from buffer if present */
-  for (uint32_t i = 0; i < WRITE_BUFFER_SIZE; i++) {
-    if (persist.write_buffer[i].valid &&
-        strcmp(persist.write_buffer[i].key, key) == 0) {
-      persist.write_buffer[i].valid = false;
-      persist.writes_buffered--;
+  /* A sealed value must not be written after the delete: drop it, or
+   * finish the flush that already includes it */
+  cache_entry_t *e = buf_find(sealed_buf(), key);
+  if (e) {
+    if (persist.drain_phase == DRAIN_IDLE) {
+      buf_drop(sealed_buf(), e);
+    } else {
+      drain_all();
     }
   }
 
-  /* Delete from NVS */
-  esp_err_t err = nvs_erase_key(persist.nvs_handle, key);
-  if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
-    persist.last_error = OS_ERR_BUSY;
-    return OS_ERR_BUSY;
+  e = buf_find(active_buf(), key);
+  if (e) {
+    buf_drop(active_buf(), e);
+  }
+  e = buf_find(&persist.tier, key);
+  if (e) {
+    buf_drop(&persist.tier, e);
   }
 
-  persist.last_error = OS_OK;
-  return OS_OK;
+  /* Delete from storage */
+  os_err_t err = backend_delete(key);
+  persist.last_error = err;
+  return err;
 }
 
 bool os_persist_exists(const char *key) {
@@ -605,18 +1907,12 @@ bool os_persist_exists(const char *key) {
     return false;
   }
 
-  /* Check buffer */
-  for (uint32_t i = 0; i < WRITE_BUFFER_SIZE; i++) {
-    if (persist.write_buffer[i].valid &&
-        strcmp(persist.write_buffer[i].key, key) == 0) {
-      return true;
-    }
+  write_buf_t *b;
+  if (find_buffered(key, &b)) {
+    return true;
   }
 
-  /* Check NVS - try to get size only */
-  size_t len = 0;
-  esp_err_t err = nvs_get_blob(persist.nvs_handle, key, NULL, &len);
-  return (err == ESP_OK);
+  return backend_exists(key);
 }
 
 os_err_t os_persist_flush(void) {
@@ -625,42 +1921,196 @@ os_err_t os_persist_flush(void) {
     return OS_ERR_NOT_INITIALIZED;
   }
 
-  uint32_t flushed = 0;
+  /* Finish the sealed buffer, then seal and write the active one. Entries
+   * of an open transaction wait for its commit. */
+  os_err_t err = drain_all();
+  if (err == OS_OK && buf_flushable(active_buf()) > 0) {
+    err = seal_active();
+    if (err == OS_OK) {
+      err = drain_all();
+    }
+  }
+
+  if (err == OS_OK) {
+    err = tier_flush();
+  }
+  quarantine_pending();
 
-  for (uint32_t i = 0; i < WRITE_BUFFER_SIZE; i++) {
-    if (persist.write_buffer[i].valid) {
-      esp_err_t err = nvs_set_blob(
-          persist.nvs_handle, persist.write_buffer[i].key,
-          persist.write_buffer[i].data, persist.write_buffer[i].len);
+  /* Commit single writes made outside a flush */
+  if (persist.backend_dirty) {
+    backend_commit();
+    persist.backend_dirty = false;
+  }
 
-      if (err == ESP_OK) {
-        persist.write_buffer[i].valid = false;
-        persist.total_writes++;
-        flushed++;
-      } else {
-        persist.last_error = OS_ERR_BUSY;
-        LOG_E(PERSIST_MODULE, "Failed to flush %s: %d",
-              persist.write_buffer[i].key, err);
+  if (err != OS_OK) {
+    persist.last_error = err;
+  }
+  return OS_OK;
+}
+
+os_err_t os_persist_recover(void) {
+  if (!persist.initialized) {
+    return OS_ERR_NOT_INITIALIZED;
+  }
+
+  uint32_t replayed = 0;
+  os_err_t err = backend_recover(&replayed);
+  if (err != OS_OK) {
+    LOG_E(PERSIST_MODULE, "Journal recovery failed: %d", err);
+    return err;
+  }
+
+  if (replayed > 0) {
+    LOG_W(PERSIST_MODULE, "Replayed %" PRIu32 " committed records", replayed);
+    persist.txn_replayed += replayed;
+  }
+  return OS_OK;
+}
+
+os_err_t os_persist_scan(void) {
+  if (!persist.initialized) {
+    return OS_ERR_NOT_INITIALIZED;
+  }
+
+  os_tick_t start = os_now_ticks();
+  uint32_t records = 0;
+  uint32_t corrupt = persist.corrupt;
+  uint32_t legacy = 0;
+  bool complete = true;
+  bool converted = true;
+  persist.legacy_open = !format_framed();
+  persist.legacy_count = 0;
+
+  void *handle = NULL;
+  if (backend_iter_open(&handle) == OS_OK) {
+    char key[OS_PERSIST_KEY_MAX];
+    while (backend_iter_next(&handle, key, sizeof(key))) {
+      /* Bounded: whatever is left is still verified when it is read */
+      if (OS_TICKS_TO_MS(os_now_ticks() - start) >= OS_PERSIST_SCAN_MS) {
+        complete = false;
+        break;
+      }
+      if (strcmp(key, FORMAT_KEY) == 0) {
+        continue;
       }
+      size_t n = 0;
+      os_err_t err = backend_read(key, frame_buf, sizeof(frame_buf), &n);
+      if (err == OS_ERR_NO_MEM) {
+        note_corrupt(key);
+      } else if (err == OS_OK) {
+        frame_check_t check = frame_check(frame_buf, n);
+        if (check == FRAME_CORRUPT) {
+          note_corrupt(key);
+        } else if (check == FRAME_LEGACY) {
+          legacy++;
+          if (persist.legacy_count < QUARANTINE_QUEUE) {
+            strncpy(persist.legacy_keys[persist.legacy_count], key,
+                    OS_PERSIST_KEY_MAX - 1);
+            persist.legacy_keys[persist.legacy_count][OS_PERSIST_KEY_MAX - 1] =
+                '\0';
+            persist.legacy_count++;
+          } else {
+            converted = false;
+          }
+        }
+      }
+      records++;
     }
+    backend_iter_close(&handle);
   }
 
-  /* Commit to flash */
-  if (flushed > 0) {
-    esp_err_t err = nvs_commit(persist.nvs_handle);
-    if (err != ESP_OK) {
-      LOG_E(PERSIST_MODULE, "NVS commit failed: %d", err);
+  /* Convert after iterating: some backends cannot write mid-walk */
+  if (persist.legacy_open) {
+    converted = reframe_pending() && converted;
+    if (complete && converted && mark_framed() == OS_OK) {
+      LOG_I(PERSIST_MODULE, "Store converted to framed records");
     }
   }
+  quarantine_pending();
+
+  persist.scan_records = records;
+  persist.scan_ms = OS_TICKS_TO_MS(os_now_ticks() - start);
+  persist.scan_complete = complete;
+  persist.legacy = legacy;
+
+  LOG_I(PERSIST_MODULE,
+        "Scanned %" PRIu32 " records in %" PRIu32 " ms: %" PRIu32
+        " corrupt, %" PRIu32 " unframed%s",
+        records, persist.scan_ms, persist.corrupt - corrupt, legacy,
+        complete ? "" : " (budget reached)");
+  return OS_OK;
+}
+
+os_err_t os_persist_txn_begin(void) {
+  if (!persist.initialized) {
+    return OS_ERR_NOT_INITIALIZED;
+  }
+  if (persist.txn_active) {
+    return OS_ERR_BUSY;
+  }
+
+  persist.txn_active = true;
+  return OS_OK;
+}
+
+os_err_t os_persist_txn_commit(void) {
+  if (!persist.initialized || !persist.txn_active) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  /* The journal holds one group at a time */
+  os_err_t err = drain_all();
+  if (err == OS_OK) {
+    err = write_txn_entries();
+  }
+  if (err != OS_OK) {
+    /* Entries stay in the transaction; caller may retry or abort */
+    persist.last_error = err;
+    return err;
+  }
+
+  if (persist.backend_dirty) {
+    backend_commit();
+    persist.backend_dirty = false;
+  }
+  persist.txn_active = false;
+  persist.txn_commits++;
+  persist.last_flush_tick = os_now_ticks();
+  return OS_OK;
+}
+
+os_err_t os_persist_txn_abort(void) {
+  if (!persist.initialized || !persist.txn_active) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  txn_drop(active_buf());
+  persist.txn_active = false;
+  return OS_OK;
+}
+
+os_err_t os_persist_register_migration(const char *prefix, uint8_t from_version,
+                                       os_persist_migrate_fn fn) {
+  if (!persist.initialized || !prefix || !fn) {
+    return OS_ERR_INVALID_ARG;
+  }
 
-  persist.writes_buffered = 0;
+  for (uint32_t i = 0; i < persist.migration_count; i++) {
+    if (persist.migrations[i].from_version == from_version &&
+        strcmp(persist.migrations[i].prefix, prefix) == 0) {
+      return OS_ERR_ALREADY_EXISTS;
+    }
+  }
 
-  if (flushed > 0) {
-    LOG_D(PERSIST_MODULE, "Flushed %" PRIu32 " writes", flushed);
-    persist.last_flush_tick = os_now_ticks();
-    os_event_emit(OS_EVENT_PERSIST_FLUSH, &flushed, sizeof(flushed));
+  if (persist.migration_count >= OS_PERSIST_MAX_MIGRATIONS) {
+    return OS_ERR_FULL;
   }
 
+  persist.migrations[persist.migration_count].prefix = prefix;
+  persist.migrations[persist.migration_count].fn = fn;
+  persist.migrations[persist.migration_count].from_version = from_version;
+  persist.migration_count++;
+
   return OS_OK;
 }
 
@@ -677,31 +2127,112 @@ os_err_t os_persist_erase_all(void) {
     return OS_ERR_NOT_INITIALIZED;
   }
 
-  /* Clear buffer */
-  memset(persist.write_buffer, 0, sizeof(persist.write_buffer));
-  persist.writes_buffered = 0;
-
-  /* Erase all keys in namespace */
-  esp_err_t err = nvs_erase_all(persist.nvs_handle);
-  if (err != ESP_OK) {
-    LOG_E(PERSIST_MODULE, "NVS erase failed: %d", err);
-    persist.last_error = OS_ERR_BUSY;
-    return OS_ERR_BUSY;
+  /* Clear both buffers and any group write in progress */
+  if (persist.drain_phase == DRAIN_JOURNAL) {
+    backend_group_abort();
   }
+  persist.drain_phase = DRAIN_IDLE;
+  buf_reset(&persist.bufs[0]);
+  buf_reset(&persist.bufs[1]);
+  buf_reset(&persist.tier);
+  persist.txn_active = false;
 
-  nvs_commit(persist.nvs_handle);
+  os_err_t err = backend_erase_all();
+  if (err != OS_OK) {
+    persist.last_error = err;
+    return err;
+  }
 
   persist.schema_version = 0;
   persist.last_flush_tick = os_now_ticks();
   LOG_I(PERSIST_MODULE, "Storage erased");
 
+  /* Nothing unframed can be left in an empty store */
+  err = mark_framed();
+  if (err != OS_OK) {
+    persist.last_error = err;
+    return err;
+  }
+
+  return OS_OK;
+}
+
+os_err_t os_persist_iter_begin(os_persist_iter_t *it, const char *prefix) {
+  if (!persist.initialized || !it) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  memset(it, 0, sizeof(*it));
+  if (prefix) {
+    strncpy(it->prefix, prefix, OS_PERSIST_KEY_MAX - 1);
+  }
+
+  if (backend_iter_open(&it->handle) != OS_OK) {
+    it->backend_done = true;
+  }
   return OS_OK;
 }
 
+os_err_t os_persist_iter_next(os_persist_iter_t *it, char *key,
+                              size_t key_len) {
+  if (!persist.initialized || !it || !key || key_len == 0) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  size_t prefix_len = strlen(it->prefix);
+
+  /* Stored keys first (a buffered value may shadow one, visit it once here) */
+  while (!it->backend_done) {
+    char name[OS_PERSIST_KEY_MAX];
+    if (!backend_iter_next(&it->handle, name, sizeof(name))) {
+      backend_iter_close(&it->handle);
+      it->backend_done = true;
+      break;
+    }
+    if (strncmp(name, it->prefix, prefix_len) == 0 &&
+        strcmp(name, SCHEMA_KEY) != 0 && strcmp(name, FORMAT_KEY) != 0) {
+      strncpy(key, name, key_len - 1);
+      key[key_len - 1] = '\0';
+      return OS_OK;
+    }
+  }
+
+  /* Then keys that so far exist only in the write buffers */
+  write_buf_t *order[3] = {active_buf(), sealed_buf(), &persist.tier};
+  while (it->cache_pos < 3 * CACHE_ENTRIES) {
+    uint32_t nbuf = it->cache_pos / CACHE_ENTRIES;
+    cache_entry_t *e = &order[nbuf]->entries[it->cache_pos++ % CACHE_ENTRIES];
+    if (!e->valid || strncmp(e->key, it->prefix, prefix_len) != 0 ||
+        strcmp(e->key, SCHEMA_KEY) == 0 || backend_exists(e->key)) {
+      continue;
+    }
+    /* Visit a key held by several buffers only in the first one */
+    bool seen = false;
+    for (uint32_t i = 0; i < nbuf; i++) {
+      seen = seen || buf_find(order[i], e->key) != NULL;
+    }
+    if (!seen) {
+      strncpy(key, e->key, key_len - 1);
+      key[key_len - 1] = '\0';
+      return OS_OK;
+    }
+  }
+
+  return OS_ERR_NOT_FOUND;
+}
+
+void os_persist_iter_end(os_persist_iter_t *it) {
+  if (it) {
+    backend_iter_close(&it->handle);
+    it->backend_done = true;
+    it->cache_pos = 3 * CACHE_ENTRIES;
+  }
+}
+
 void os_persist_get_stats(uint32_t *writes_buffered, uint32_t *total_writes,
                           uint32_t *total_reads) {
   if (writes_buffered)
-    *writes_buffered = persist.writes_buffered;
+    *writes_buffered = persist.bufs[0].count + persist.bufs[1].count;
   if (total_writes)
     *total_writes = persist.total_writes;
   if (total_reads)
@@ -713,14 +2244,104 @@ void os_persist_get_stats_ex(os_persist_stats_t *stats) {
     return;
   }
 
-  stats->writes_buffered = persist.writes_buffered;
+  memset(stats, 0, sizeof(*stats));
+  stats->writes_buffered = persist.bufs[0].count + persist.bufs[1].count;
   stats->total_writes = persist.total_writes;
   stats->total_reads = persist.total_reads;
+  stats->buffer_swaps = persist.swaps;
+  for (uint32_t i = 0; i < 2; i++) {
+    stats->cache_bytes_used += (uint32_t)(persist.bufs[i].arena_used -
+                                          persist.bufs[i].arena_garbage);
+  }
+  stats->migrations = persist.migrated;
+  stats->txn_commits = persist.txn_commits;
+  stats->txn_replayed = persist.txn_replayed;
+  stats->stalls = persist.stalls;
+  stats->stall_ms_total = persist.stall_ms_total;
+  stats->stall_ms_max = persist.stall_ms_max;
+  stats->flushes = persist.flushes;
+  stats->puts = persist.puts;
+  stats->puts_absorbed = persist.puts_absorbed;
+  stats->max_absorbed = persist.max_absorbed;
+  stats->flush_deadline = persist.flush_by_reason[OS_PERSIST_FLUSH_DEADLINE];
+  stats->flush_volume = persist.flush_by_reason[OS_PERSIST_FLUSH_VOLUME];
+  stats->flush_idle = persist.flush_by_reason[OS_PERSIST_FLUSH_IDLE];
+  stats->tier_buffered = persist.tier.count;
+  stats->tier_writes = persist.tier_writes;
+  stats->tier_dropped = persist.tier_dropped;
+  stats->scan_records = persist.scan_records;
+  stats->scan_ms = persist.scan_ms;
+  stats->scan_complete = persist.scan_complete;
+  stats->corrupt = persist.corrupt;
+  stats->quarantined = persist.quarantined;
+  stats->legacy = persist.legacy;
+  stats->put_bytes = persist.put_bytes;
+  stats->bytes_written = persist.bytes_written;
+  stats->records_written = persist.records_written;
+  stats->entries_written = persist.entries_written;
+  stats->init_tick = persist.init_tick;
+
+  /* Percentiles over the most recent flushes */
+  uint32_t n = persist.flushes < LATENCY_SAMPLES ? persist.flushes
+                                                 : LATENCY_SAMPLES;
+  if (n > 0) {
+    uint32_t sorted[LATENCY_SAMPLES];
+    for (uint32_t i = 0; i < n; i++) {
+      uint32_t v = persist.latency_ms[i];
+      uint32_t j = i;
+      while (j > 0 && sorted[j - 1] > v) {
+        sorted[j] = sorted[j - 1];
+        j--;
+      }
+      sorted[j] = v;
+    }
+    stats->flush_p50_ms = sorted[(n - 1) * 50 / 100];
+    stats->flush_p90_ms = sorted[(n - 1) * 90 / 100];
+    stats->flush_p99_ms = sorted[(n - 1) * 99 / 100];
+  }
+
   stats->last_flush_tick = persist.last_flush_tick;
   stats->last_error = persist.last_error;
 }
 
-#endif
+void os_persist_get_usage(uint32_t *used_entries, uint32_t *free_entries,
+                          uint32_t *total_entries) {
+  uint32_t used = 0, free_e = 0, total = 0;
+  if (persist.initialized) {
+    backend_usage(&used, &free_e, &total);
+  }
+  if (used_entries)
+    *used_entries = used;
+  if (free_entries)
+    *free_entries = free_e;
+  if (total_entries)
+    *total_entries = total;
+}
+
+os_persist_flush_reason_t os_persist_flush_due(void) {
+  write_buf_t *b = active_buf();
+  if (!persist.initialized || buf_flushable(b) == 0) {
+    return OS_PERSIST_FLUSH_NONE;
+  }
+
+  os_tick_t now = os_now_ticks();
+  if ((uint32_t)(b->arena_used - b->arena_garbage) >= OS_PERSIST_FLUSH_BYTES) {
+    return OS_PERSIST_FLUSH_VOLUME;
+  }
+  if (now - b->dirty_since >= OS_MS_TO_TICKS(OS_PERSIST_FLUSH_MS)) {
+    return OS_PERSIST_FLUSH_DEADLINE;
+  }
+
+  /* Debounce: wait for a quiet spell while nothing else needs the CPU */
+  if (now - persist.last_put_tick >= OS_MS_TO_TICKS(OS_PERSIST_DEBOUNCE_MS)) {
+    os_event_stats_t bus;
+    if (os_event_get_stats(&bus) != OS_OK || bus.current_queue_size == 0) {
+      return OS_PERSIST_FLUSH_IDLE;
+    }
+  }
+
+  return OS_PERSIST_FLUSH_NONE;
+}
 
 void os_persist_task(void *arg) {
   (void)arg;
@@ -728,10 +2349,29 @@ void os_persist_task(void *arg) {
   LOG_I(PERSIST_MODULE, "Persistence task started");
 
   while (1) {
-    os_sleep(OS_PERSIST_FLUSH_MS);
+    if (sealed_buf()->count > 0) {
+      /* One record per turn: producers run between flash writes */
+      os_err_t err;
+      if (drain_step(&err) && err != OS_OK) {
+        os_sleep(OS_PERSIST_FLUSH_MS);
+      } else {
+        os_yield();
+      }
+      continue;
+    }
 
-    if (persist.writes_buffered > 0) {
-      os_persist_flush();
+    os_sleep(FLUSHER_POLL_MS);
+
+    /* Hand buffered writes to the flusher when the policy says so */
+    os_persist_flush_reason_t reason = os_persist_flush_due();
+    if (reason != OS_PERSIST_FLUSH_NONE && seal_active() == OS_OK) {
+      persist.flush_by_reason[reason]++;
+    } else if (persist.tier.count > 0 &&
+               os_now_ticks() - persist.tier.dirty_since >=
+                   OS_MS_TO_TICKS(OS_PERSIST_TIER_FLUSH_MS)) {
+      tier_flush();
+    } else if (persist.bad_count > 0) {
+      quarantine_pending();
     }
   }
 }
@@ -0,0 +1,106 @@
+/**
+ * @file os_persist_telemetry.c
+ * @brief Flash wear and write-amplification telemetry
+ *
+ * ESP32-C6 Zigbee Bridge OS - Derived from os_persist counters
+ *
+ * os_persist keeps only cheap running totals; everything here is computed
+ * on demand, so telemetry costs nothing until it is read.
+ */
+
+#include "os_persist_telemetry.h"
+#include "mqtt_adapter.h"
+#include "os_config.h"
+#include "os_fibre.h"
+#include "os_log.h"
+#include "os_persist.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TELEMETRY_MODULE "PERSIST"
+#define TELEMETRY_TOPIC "bridge/telemetry/persist"
+
+/* Per-hour rate of a counter over elapsed_ms */
+static uint32_t per_hour(uint32_t count, uint32_t elapsed_ms) {
+  if (elapsed_ms == 0) {
+    return 0;
+  }
+  uint64_t rate = (uint64_t)count * 3600000u / elapsed_ms;
+  return rate > UINT32_MAX ? UINT32_MAX : (uint32_t)rate;
+}
+
+static uint32_t ratio_x100(uint32_t num, uint32_t den) {
+  return den ? (uint32_t)((uint64_t)num * 100u / den) : 0;
+}
+
+os_err_t os_persist_telemetry_get(os_persist_telemetry_t *out) {
+  if (!out) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  os_persist_stats_t stats;
+  os_persist_get_stats_ex(&stats);
+
+  memset(out, 0, sizeof(*out));
+  uint32_t elapsed_ms = OS_TICKS_TO_MS(os_now_ticks() - stats.init_tick);
+  out->elapsed_s = elapsed_ms / 1000;
+  out->bytes_per_hour = per_hour(stats.bytes_written, elapsed_ms);
+  out->entries_per_hour = per_hour(stats.entries_written, elapsed_ms);
+  out->avg_value_size = stats.puts ? stats.put_bytes / stats.puts : 0;
+  out->puts_per_flush_x100 = ratio_x100(stats.puts, stats.flushes);
+  out->write_amp_x100 = ratio_x100(stats.bytes_written, stats.put_bytes);
+
+  os_persist_get_usage(&out->nvs_used_entries, &out->nvs_free_entries,
+                       &out->nvs_total_entries);
+
+  /* Erase budget of the partition, in entries, over the write rate */
+  out->lifetime_days = UINT32_MAX;
+  if (stats.entries_written > 0 && elapsed_ms > 0) {
+    uint64_t budget =
+        (uint64_t)out->nvs_total_entries * OS_PERSIST_FLASH_ENDURANCE;
+    uint64_t per_day =
+        (uint64_t)stats.entries_written * 86400000u / elapsed_ms;
+    if (per_day > 0 && budget / per_day < UINT32_MAX) {
+      out->lifetime_days = (uint32_t)(budget / per_day);
+    }
+  }
+
+  return OS_OK;
+}
+
+os_err_t os_persist_telemetry_publish(void) {
+  os_persist_telemetry_t t;
+  os_err_t err = os_persist_telemetry_get(&t);
+  if (err != OS_OK) {
+    return err;
+  }
+
+  char payload[256];
+  snprintf(payload, sizeof(payload),
+           "{\"bytes_per_hour\":%" PRIu32 ",\"entries_per_hour\":%" PRIu32
+           ",\"avg_value_size\":%" PRIu32 ",\"puts_per_flush\":%" PRIu32
+           ".%02" PRIu32 ",\"write_amp\":%" PRIu32 ".%02" PRIu32
+           ",\"nvs_used\":%" PRIu32 ",\"nvs_free\":%" PRIu32
+           ",\"lifetime_days\":%" PRIu32 "}",
+           t.bytes_per_hour, t.entries_per_hour, t.avg_value_size,
+           t.puts_per_flush_x100 / 100, t.puts_per_flush_x100 % 100,
+           t.write_amp_x100 / 100, t.write_amp_x100 % 100, t.nvs_used_entries,
+           t.nvs_free_entries, t.lifetime_days);
+
+  return mqtt_publish(TELEMETRY_TOPIC, payload, strlen(payload));
+}
+
+void os_persist_telemetry_task(void *arg) {
+  (void)arg;
+
+  LOG_I(TELEMETRY_MODULE, "Persistence telemetry every %u s",
+        OS_PERSIST_TELEMETRY_MS / 1000);
+
+  while (1) {
+    os_sleep(OS_PERSIST_TELEMETRY_MS);
+    if (mqtt_get_state() == MQTT_STATE_CONNECTED) {
+      os_persist_telemetry_publish();
+    }
+  }
+}
@@ -12,7 +12,9 @@
 #include "os_event.h"
 #include "os_fibre.h"
 #include "os_log.h"
+#include "os_mem.h"
 #include "os_persist.h"
+#include "os_persist_telemetry.h"
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -38,6 +40,7 @@ static int cmd_sched(int argc, char *argv[]);
 static int cmd_events(int argc, char *argv[]);
 static int cmd_persist(int argc, char *argv[]);
 static int cmd_mqtt(int argc, char *argv[]);
+static int cmd_mem(int argc, char *argv[]);
 
 /* Built-in commands */
 static const os_shell_cmd_t builtin_commands[] = {
@@ -50,6 +53,7 @@ static const os_shell_cmd_t builtin_commands[] = {
     {"events", "Alias for 'stats'", cmd_events},
     {"persist", "Show persistence statistics", cmd_persist},
     {"mqtt", "Show MQTT statistics", cmd_mqtt},
+    {"mem", "Show memory use per subsystem", cmd_mem},
     {NULL, NULL, NULL}};
 
 os_err_t os_shell_init(void) {
@@ -298,6 +302,45 @@ static int cmd_persist(int argc, char *argv[]) {
   printf("  Buffered:     %" PRIu32 "\n", stats.writes_buffered);
   printf("  Writes:       %" PRIu32 "\n", stats.total_writes);
   printf("  Reads:        %" PRIu32 "\n", stats.total_reads);
+  printf("  Swaps:        %" PRIu32 "\n", stats.buffer_swaps);
+  printf("  Cache bytes:  %" PRIu32 "\n", stats.cache_bytes_used);
+  printf("  Migrations:   %" PRIu32 "\n", stats.migrations);
+  printf("  Txn commits:  %" PRIu32 "\n", stats.txn_commits);
+  printf("  Replayed:     %" PRIu32 "\n", stats.txn_replayed);
+  printf("  Flushes:      %" PRIu32 "\n", stats.flushes);
+  printf("  Flush p50/90/99: %" PRIu32 "/%" PRIu32 "/%" PRIu32 " ms\n",
+         stats.flush_p50_ms, stats.flush_p90_ms, stats.flush_p99_ms);
+  printf("  Puts:         %" PRIu32 " (%" PRIu32 " absorbed, max %" PRIu32
+         " per key)\n",
+         stats.puts, stats.puts_absorbed, stats.max_absorbed);
+  printf("  Triggers:     deadline %" PRIu32 ", volume %" PRIu32
+         ", idle %" PRIu32 "\n",
+         stats.flush_deadline, stats.flush_volume, stats.flush_idle);
+  printf("  Cache tier:   %" PRIu32 " pending, %" PRIu32 " written, %" PRIu32
+         " dropped\n",
+         stats.tier_buffered, stats.tier_writes, stats.tier_dropped);
+  printf("  Stalls:       %" PRIu32 " (%" PRIu32 " ms total, %" PRIu32
+         " ms max)\n",
+         stats.stalls, stats.stall_ms_total, stats.stall_ms_max);
+
+  os_persist_telemetry_t t;
+  if (os_persist_telemetry_get(&t) == OS_OK) {
+    printf("  Wear:         %" PRIu32 " B/h, %" PRIu32 " entries/h\n",
+           t.bytes_per_hour, t.entries_per_hour);
+    printf("  Avg value:    %" PRIu32 " B, %" PRIu32 ".%02" PRIu32
+           " puts/flush, write amp %" PRIu32 ".%02" PRIu32 "\n",
+           t.avg_value_size, t.puts_per_flush_x100 / 100,
+           t.puts_per_flush_x100 % 100, t.write_amp_x100 / 100,
+           t.write_amp_x100 % 100);
+    printf("  NVS entries:  %" PRIu32 " used, %" PRIu32 " free of %" PRIu32
+           "\n",
+           t.nvs_used_entries, t.nvs_free_entries, t.nvs_total_entries);
+    if (t.lifetime_days == UINT32_MAX) {
+      printf("  Lifetime:     n/a\n");
+    } else {
+      printf("  Lifetime:     %" PRIu32 " days\n", t.lifetime_days);
+    }
+  }
   printf("  Last flush:   %" PRIu32 "\n", (uint32_t)stats.last_flush_tick);
   printf("  Last error:   %d\n", stats.last_error);
 
@@ -323,3 +366,31 @@ static int cmd_mqtt(int argc, char *argv[]) {
 
   return 0;
 }
+
+static int cmd_mem(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+
+  static os_mem_metrics_t m;
+  os_mem_get_metrics(&m);
+
+  printf("%-20s %8s %8s %8s %8s %5s\n", "REGION", "STATIC", "DYNAMIC",
+         "USED", "CAPACITY", "FILL");
+  printf("-------------------- -------- -------- -------- -------- -----\n");
+  for (uint32_t i = 0; i < m.region_count; i++) {
+    const os_mem_region_t *r = &m.regions[i];
+    if (r->capacity) {
+      printf("%-20s %8" PRIu32 " %8" PRIu32 " %8" PRIu32 " %8" PRIu32
+             " %4" PRIu32 "%%\n",
+             r->name, r->static_bytes, r->dynamic_bytes, r->used, r->capacity,
+             (uint32_t)((uint64_t)r->used * 100 / r->capacity));
+    } else {
+      printf("%-20s %8" PRIu32 " %8" PRIu32 " %8s %8s %5s\n", r->name,
+             r->static_bytes, r->dynamic_bytes, "-", "-", "-");
+    }
+  }
+  printf("\nTotal: %" PRIu32 " bytes static, %" PRIu32 " bytes dynamic\n",
+         m.static_total, m.dynamic_total);
+
+  return 0;
+}
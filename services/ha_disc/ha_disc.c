@@ -21,8 +21,14 @@
 /* HA Discovery topic prefix */
 #define HA_DISCOVERY_PREFIX "homeassistant"
 
-/* Availability topic */
+/* Availability: entities are available while both the bridge and their
+ * node are online */
 #define HA_AVAILABILITY_TOPIC "bridge/status"
+#define HA_NODE_AVAILABILITY_FMT TOPIC_BASE "/" OS_EUI64_FMT "/availability"
+#define HA_AVAILABILITY_JSON                                                  \
+  "\"availability\":[{\"topic\":\"" HA_AVAILABILITY_TOPIC "\"},"              \
+  "{\"topic\":\"" HA_NODE_AVAILABILITY_FMT "\"}],"                            \
+  "\"availability_mode\":\"all\","
 
 /* Bridge ID (should come from persistence in production) */
 #define HA_BRIDGE_ID "zigbee_bridge"
@@ -30,8 +36,9 @@
 /* Topic base for state/commands */
 #define TOPIC_BASE "bridge"
 
-/* Maximum payload size for discovery config JSON */
-#define HA_MAX_PAYLOAD_SIZE 1024
+/* Maximum payload size for discovery config JSON; payloads are built in
+ * a static buffer to keep them off the fibre stacks */
+#define HA_MAX_PAYLOAD_SIZE 1280
 
 /* Timing constants */
 #define HA_DISC_STARTUP_DELAY_MS 2000
@@ -44,6 +51,9 @@ static const char *component_names[] = {"light", "switch", "sensor",
 /* Pending publish tracking */
 #define HA_MAX_PENDING 32
 
+/* Registry changes read per journal pass */
+#define HA_CHANGE_BATCH 8
+
 typedef struct {
   os_eui64_t node_addr;
   bool pending;
@@ -54,16 +64,20 @@ static struct {
   bool initialized;
   ha_pending_t pending[HA_MAX_PENDING];
   uint32_t pending_count;
+  uint32_t reg_gen; /* Registry generation discovery has caught up to */
 } service = {0};
 
 /* Forward declarations */
-static os_err_t publish_light_discovery(os_eui64_t node_addr, bool has_level);
-static os_err_t publish_sensor_discovery(os_eui64_t node_addr, cap_id_t cap_id);
+static os_err_t publish_light_discovery(const reg_node_view_t *node,
+                                        const cap_state_t *on,
+                                        const cap_state_t *level);
+static os_err_t publish_sensor_discovery(const reg_node_view_t *node,
+                                         const cap_state_t *cap);
 static void handle_reg_node_ready(const os_event_t *event, void *ctx);
 static void handle_mqtt_connected(const os_event_t *event, void *ctx);
 static void handle_node_removed(const os_event_t *event, void *ctx);
+static void handle_cap_removed(const os_event_t *event, void *ctx);
 static void add_pending(os_eui64_t node_addr);
-static bool check_node_has_cap(os_eui64_t node_addr, cap_id_t cap_id);
 
 /**
  * @brief Escape a string for JSON encoding
@@ -120,13 +134,24 @@ done:
   return written;
 }
 
+static void mem_report_pending(os_mem_region_t *region, void *ctx) {
+  (void)ctx;
+  region->used = service.pending_count;
+  region->capacity = HA_MAX_PENDING;
+}
+
 os_err_t ha_disc_init(void) {
   if (service.initialized) {
     return OS_ERR_ALREADY_EXISTS;
   }
 
   memset(&service, 0, sizeof(service));
+  os_mem_register("ha.pending", sizeof(service.pending), mem_report_pending,
+                  NULL);
+  /* Light and sensor payload buffers */
+  os_mem_register("ha.payloads", 2 * HA_MAX_PAYLOAD_SIZE, NULL, NULL);
   service.initialized = true;
+  service.reg_gen = reg_generation();
 
   /* Subscribe to relevant events */
   os_event_filter_t filter_cap = {OS_EVENT_CAP_STATE_CHANGED,
@@ -140,6 +165,10 @@ os_err_t ha_disc_init(void) {
                                    OS_EVENT_ZB_DEVICE_LEFT};
   os_event_subscribe(&filter_left, handle_node_removed, NULL);
 
+  os_event_filter_t filter_removed = {OS_EVENT_CAP_REMOVED,
+                                      OS_EVENT_CAP_REMOVED};
+  os_event_subscribe(&filter_removed, handle_cap_removed, NULL);
+
   LOG_I(HA_MODULE, "HA Discovery service initialized");
 
   return OS_OK;
@@ -158,8 +187,15 @@ os_err_t ha_disc_publish_node(os_eui64_t node_addr) {
     return OS_OK;
   }
 
-  reg_node_t *node = reg_find_node(node_addr);
+  /* Payloads are built from a snapshot view, which stays as of
+   * reg_snapshot_begin() however long publishing takes */
+  reg_snapshot_t snap = {0};
+  if (reg_snapshot_begin(&snap) != OS_OK) {
+    return OS_ERR_BUSY;
+  }
+  const reg_node_view_t *node = reg_snapshot_node(&snap, node_addr);
   if (!node || node->state != REG_STATE_READY) {
+    reg_snapshot_end(&snap);
     return OS_ERR_NOT_FOUND;
   }
 
@@ -168,69 +204,53 @@ os_err_t ha_disc_publish_node(os_eui64_t node_addr) {
 
   os_err_t result = OS_OK;
 
-  /* Check for light capabilities and merge if both present */
-  bool has_light_on = check_node_has_cap(node_addr, CAP_LIGHT_ON);
-  bool has_light_level = check_node_has_cap(node_addr, CAP_LIGHT_LEVEL);
-
-  if (has_light_on) {
-    /* Publish merged light discovery (with or without brightness) */
-    os_err_t err = publish_light_discovery(node_addr, has_light_level);
-    if (err != OS_OK) {
-      LOG_E(HA_MODULE,
-            "Failed to publish light discovery for node " OS_EUI64_FMT
-            " (err=%d)",
-            OS_EUI64_ARG(node_addr), err);
-      if (result == OS_OK)
-        result = err;
-    }
-  }
-
-  /* Publish sensor discoveries */
-  if (check_node_has_cap(node_addr, CAP_SENSOR_TEMPERATURE)) {
-    os_err_t err = publish_sensor_discovery(node_addr, CAP_SENSOR_TEMPERATURE);
-    if (err != OS_OK) {
-      LOG_E(HA_MODULE,
-            "Failed to publish temperature sensor discovery for "
-            "node " OS_EUI64_FMT " (err=%d)",
-            OS_EUI64_ARG(node_addr), err);
-      if (result == OS_OK)
-        result = err;
-    }
-  }
-  if (check_node_has_cap(node_addr, CAP_SENSOR_HUMIDITY)) {
-    os_err_t err = publish_sensor_discovery(node_addr, CAP_SENSOR_HUMIDITY);
-    if (err != OS_OK) {
-      LOG_E(HA_MODULE,
-            "Failed to publish humidity sensor discovery for node " OS_EUI64_FMT
-            " (err=%d)",
-            OS_EUI64_ARG(node_addr), err);
-      if (result == OS_OK)
-        result = err;
+  /* One entity per capability instance; a light merges the on/off and
+   * level instances of its endpoint */
+  static cap_state_t caps[CAP_MAX_NODE_STATES];
+  uint32_t count = cap_get_instances(node_addr, caps, CAP_MAX_NODE_STATES);
+  for (uint32_t i = 0; i < count; i++) {
+    const cap_state_t *cap = &caps[i];
+    os_err_t err;
+    switch (cap->id) {
+    case CAP_LIGHT_ON: {
+      const cap_state_t *level = NULL;
+      for (uint32_t j = 0; j < count; j++) {
+        if (caps[j].id == CAP_LIGHT_LEVEL &&
+            caps[j].endpoint_id == cap->endpoint_id) {
+          level = &caps[j];
+        }
+      }
+      err = publish_light_discovery(node, cap, level);
+      break;
     }
-  }
-  if (check_node_has_cap(node_addr, CAP_SENSOR_CONTACT)) {
-    os_err_t err = publish_sensor_discovery(node_addr, CAP_SENSOR_CONTACT);
-    if (err != OS_OK) {
-      LOG_E(HA_MODULE,
-            "Failed to publish contact sensor discovery for node " OS_EUI64_FMT
-            " (err=%d)",
-            OS_EUI64_ARG(node_addr), err);
-      if (result == OS_OK)
-        result = err;
+    case CAP_SENSOR_TEMPERATURE:
+    case CAP_SENSOR_HUMIDITY:
+    case CAP_SENSOR_CONTACT:
+    case CAP_SENSOR_MOTION:
+      err = publish_sensor_discovery(node, cap);
+      break;
+    default:
+      continue;
     }
-  }
-  if (check_node_has_cap(node_addr, CAP_SENSOR_MOTION)) {
-    os_err_t err = publish_sensor_discovery(node_addr, CAP_SENSOR_MOTION);
+
     if (err != OS_OK) {
+      char instance[CAP_INSTANCE_NAME_LEN];
       LOG_E(HA_MODULE,
-            "Failed to publish motion sensor discovery for node " OS_EUI64_FMT
+            "Failed to publish %s discovery for node " OS_EUI64_FMT
             " (err=%d)",
+            cap_instance_name(instance, sizeof(instance), cap->id,
+                              cap->endpoint_id, cap->instances),
             OS_EUI64_ARG(node_addr), err);
       if (result == OS_OK)
         result = err;
     }
   }
 
+  /* The configs point at the node availability topic; only READY nodes
+   * get here */
+  mqtt_publish_availability(node_addr, true);
+  reg_snapshot_end(&snap);
+
   return result;
 }
 
@@ -303,16 +323,14 @@ uint32_t ha_disc_publish_all(void) {
   }
 
   uint32_t count = 0;
-  uint32_t node_count = reg_node_count();
-
-  for (uint32_t i = 0; i < node_count; i++) {
-    reg_node_info_t info;
-    if (reg_get_node_info(i, &info) == OS_OK) {
-      if (info.state == REG_STATE_READY) {
-        if (ha_disc_publish_node(info.ieee_addr) == OS_OK) {
-          count++;
-        }
-      }
+  reg_filter_t filter = {.states = REG_STATE_BIT(REG_STATE_READY)};
+  reg_iter_t it;
+  reg_iter_begin(&it, &filter);
+
+  for (reg_node_t *node = reg_iter_next(&it); node;
+       node = reg_iter_next(&it)) {
+    if (ha_disc_publish_node(node->ieee_addr) == OS_OK) {
+      count++;
     }
   }
 
@@ -352,7 +370,8 @@ const char *ha_disc_component_name(ha_component_t component) {
   return "unknown";
 }
 
-os_err_t ha_disc_generate_config(os_eui64_t node_addr, cap_id_t cap_id,
+os_err_t ha_disc_generate_config(os_eui64_t node_addr, uint8_t endpoint_id,
+                                 cap_id_t cap_id,
                                  ha_disc_config_t *out_config) {
   if (!service.initialized || !out_config) {
     return OS_ERR_INVALID_ARG;
@@ -383,10 +402,20 @@ os_err_t ha_disc_generate_config(os_eui64_t node_addr, cap_id_t cap_id,
     break;
   }
 
+  /* Instances are named after their endpoint once a node has several */
+  cap_state_t state;
+  uint8_t instances = 1;
+  if (cap_get_instance_state(node_addr, endpoint_id, cap_id, &state) == OS_OK) {
+    instances = state.instances;
+  }
+  char instance[CAP_INSTANCE_NAME_LEN];
+  cap_instance_name(instance, sizeof(instance), cap_id, endpoint_id,
+                    instances);
+
   /* Generate unique_id */
   snprintf(out_config->unique_id, sizeof(out_config->unique_id),
            "%s_" OS_EUI64_FMT "_%s", HA_BRIDGE_ID, OS_EUI64_ARG(node_addr),
-           cap_info->name);
+           instance);
 
   /* Sanitize unique_id (replace '.' with '_') */
   for (char *p = out_config->unique_id; *p; p++) {
@@ -395,32 +424,36 @@ os_err_t ha_disc_generate_config(os_eui64_t node_addr, cap_id_t cap_id,
   }
 
   /* Get node info for name */
-  reg_node_t *node = reg_find_node(node_addr);
-  if (node && node->friendly_name[0]) {
-    strncpy(out_config->name, node->friendly_name,
+  reg_snapshot_t snap = {0};
+  const reg_node_view_t *node = reg_snapshot_begin(&snap) == OS_OK
+                                    ? reg_snapshot_node(&snap, node_addr)
+                                    : NULL;
+  if (node && node->friendly_name) {
+    strncpy(out_config->name, reg_str(node->friendly_name),
             sizeof(out_config->name) - 1);
     out_config->name[sizeof(out_config->name) - 1] = '\0';
-  } else if (node && node->model[0]) {
-    strncpy(out_config->name, node->model, sizeof(out_config->name) - 1);
+  } else if (node && node->model) {
+    strncpy(out_config->name, reg_str(node->model),
+            sizeof(out_config->name) - 1);
     out_config->name[sizeof(out_config->name) - 1] = '\0';
   } else {
     snprintf(out_config->name, sizeof(out_config->name), "Zigbee " OS_EUI64_FMT,
              OS_EUI64_ARG(node_addr));
   }
+  reg_snapshot_end(&snap);
 
   /* Generate topics */
   snprintf(out_config->state_topic, sizeof(out_config->state_topic),
            TOPIC_BASE "/" OS_EUI64_FMT "/%s/state", OS_EUI64_ARG(node_addr),
-           cap_info->name);
+           instance);
 
   snprintf(out_config->command_topic, sizeof(out_config->command_topic),
            TOPIC_BASE "/" OS_EUI64_FMT "/%s/set", OS_EUI64_ARG(node_addr),
-           cap_info->name);
+           instance);
 
-  strncpy(out_config->availability_topic, HA_AVAILABILITY_TOPIC,
-          sizeof(out_config->availability_topic) - 1);
-  out_config->availability_topic[sizeof(out_config->availability_topic) - 1] =
-      '\0';
+  snprintf(out_config->availability_topic,
+           sizeof(out_config->availability_topic), HA_NODE_AVAILABILITY_FMT,
+           OS_EUI64_ARG(node_addr));
 
   return OS_OK;
 }
@@ -445,54 +478,69 @@ void ha_disc_task(void *arg) {
 
 /* Internal functions */
 
-static os_err_t publish_light_discovery(os_eui64_t node_addr, bool has_level) {
+static os_err_t publish_light_discovery(const reg_node_view_t *node,
+                                        const cap_state_t *on,
+                                        const cap_state_t *level) {
   char topic[256];
-  char payload[HA_MAX_PAYLOAD_SIZE];
-
-  reg_node_t *node = reg_find_node(node_addr);
+  static char payload[HA_MAX_PAYLOAD_SIZE];
+  os_eui64_t node_addr = node->ieee_addr;
 
   /* Get device info and escape for JSON */
   char name_escaped[64];
   char manufacturer_escaped[64];
   char model_escaped[64];
 
-  const char *name_raw = (node && node->friendly_name[0]) ? node->friendly_name
-                         : (node && node->model[0])       ? node->model
-                                                          : "Zigbee Light";
-  const char *manufacturer_raw =
-      (node && node->manufacturer[0]) ? node->manufacturer : "";
-  const char *model_raw = (node && node->model[0]) ? node->model : "";
+  const char *name_raw = node->friendly_name ? reg_str(node->friendly_name)
+                         : node->model        ? reg_str(node->model)
+                                              : "Zigbee Light";
+  const char *manufacturer_raw = reg_str(node->manufacturer);
+  const char *model_raw = reg_str(node->model);
 
   json_escape_string(name_escaped, sizeof(name_escaped), name_raw);
   json_escape_string(manufacturer_escaped, sizeof(manufacturer_escaped),
                      manufacturer_raw);
   json_escape_string(model_escaped, sizeof(model_escaped), model_raw);
 
+  /* One light per endpoint on multi-gang devices */
+  char suffix[8] = "";
+  char name_suffix[8] = "";
+  if (on->instances > 1) {
+    snprintf(suffix, sizeof(suffix), "_ep%u", on->endpoint_id);
+    snprintf(name_suffix, sizeof(name_suffix), " ep%u", on->endpoint_id);
+  }
+  char on_name[CAP_INSTANCE_NAME_LEN];
+  cap_instance_name(on_name, sizeof(on_name), on->id, on->endpoint_id,
+                    on->instances);
+
   /* Build discovery topic */
-  snprintf(topic, sizeof(topic), "%s/light/%s_" OS_EUI64_FMT "_light/config",
-           HA_DISCOVERY_PREFIX, HA_BRIDGE_ID, OS_EUI64_ARG(node_addr));
+  snprintf(topic, sizeof(topic), "%s/light/%s_" OS_EUI64_FMT "_light%s/config",
+           HA_DISCOVERY_PREFIX, HA_BRIDGE_ID, OS_EUI64_ARG(node_addr), suffix);
 
   /* Build discovery payload JSON */
-  if (has_level) {
+  if (level) {
+    char level_name[CAP_INSTANCE_NAME_LEN];
+    cap_instance_name(level_name, sizeof(level_name), level->id,
+                      level->endpoint_id, level->instances);
+
     /* Merged light with brightness */
     snprintf(
         payload, sizeof(payload),
         "{"
-        "\"name\":\"%s\","
-        "\"unique_id\":\"%s_" OS_EUI64_FMT "_light\","
-        "\"availability_topic\":\"%s\","
+        "\"name\":\"%s%s\","
+        "\"unique_id\":\"%s_" OS_EUI64_FMT "_light%s\","
+        HA_AVAILABILITY_JSON
         "\"payload_available\":\"online\","
         "\"payload_not_available\":\"offline\","
-        "\"state_topic\":\"" TOPIC_BASE "/" OS_EUI64_FMT "/light.on/state\","
-        "\"command_topic\":\"" TOPIC_BASE "/" OS_EUI64_FMT "/light.on/set\","
+        "\"state_topic\":\"" TOPIC_BASE "/" OS_EUI64_FMT "/%s/state\","
+        "\"command_topic\":\"" TOPIC_BASE "/" OS_EUI64_FMT "/%s/set\","
         "\"value_template\":\"{{ value_json.v }}\","
         "\"state_value_template\":\"{{ 'ON' if value_json.v else 'OFF' }}\","
         "\"payload_on\":\"{\\\"v\\\":true}\","
         "\"payload_off\":\"{\\\"v\\\":false}\","
         "\"brightness_state_topic\":\"" TOPIC_BASE "/" OS_EUI64_FMT
-        "/light.level/state\","
+        "/%s/state\","
         "\"brightness_command_topic\":\"" TOPIC_BASE "/" OS_EUI64_FMT
-        "/light.level/set\","
+        "/%s/set\","
         "\"brightness_value_template\":\"{{ (value_json.v | float * 2.55) | "
         "int }}\","
         "\"brightness_scale\":255,"
@@ -503,23 +551,24 @@ static os_err_t publish_light_discovery(os_eui64_t node_addr, bool has_level) {
         "\"model\":\"%s\""
         "}"
         "}",
-        name_escaped, HA_BRIDGE_ID, OS_EUI64_ARG(node_addr),
-        HA_AVAILABILITY_TOPIC, OS_EUI64_ARG(node_addr), OS_EUI64_ARG(node_addr),
-        OS_EUI64_ARG(node_addr), OS_EUI64_ARG(node_addr), HA_BRIDGE_ID,
-        OS_EUI64_ARG(node_addr), name_escaped, manufacturer_escaped,
-        model_escaped);
+        name_escaped, name_suffix, HA_BRIDGE_ID, OS_EUI64_ARG(node_addr),
+        suffix, OS_EUI64_ARG(node_addr), OS_EUI64_ARG(node_addr), on_name,
+        OS_EUI64_ARG(node_addr), on_name,
+        OS_EUI64_ARG(node_addr), level_name, OS_EUI64_ARG(node_addr),
+        level_name, HA_BRIDGE_ID, OS_EUI64_ARG(node_addr), name_escaped,
+        manufacturer_escaped, model_escaped);
   } else {
     /* Simple on/off light */
     snprintf(
         payload, sizeof(payload),
         "{"
-        "\"name\":\"%s\","
-        "\"unique_id\":\"%s_" OS_EUI64_FMT "_light\","
-        "\"availability_topic\":\"%s\","
+        "\"name\":\"%s%s\","
+        "\"unique_id\":\"%s_" OS_EUI64_FMT "_light%s\","
+        HA_AVAILABILITY_JSON
         "\"payload_available\":\"online\","
         "\"payload_not_available\":\"offline\","
-        "\"state_topic\":\"" TOPIC_BASE "/" OS_EUI64_FMT "/light.on/state\","
-        "\"command_topic\":\"" TOPIC_BASE "/" OS_EUI64_FMT "/light.on/set\","
+        "\"state_topic\":\"" TOPIC_BASE "/" OS_EUI64_FMT "/%s/state\","
+        "\"command_topic\":\"" TOPIC_BASE "/" OS_EUI64_FMT "/%s/set\","
         "\"value_template\":\"{{ value_json.v }}\","
         "\"state_value_template\":\"{{ 'ON' if value_json.v else 'OFF' }}\","
         "\"payload_on\":\"{\\\"v\\\":true}\","
@@ -531,8 +580,9 @@ static os_err_t publish_light_discovery(os_eui64_t node_addr, bool has_level) {
         "\"model\":\"%s\""
         "}"
         "}",
-        name_escaped, HA_BRIDGE_ID, OS_EUI64_ARG(node_addr),
-        HA_AVAILABILITY_TOPIC, OS_EUI64_ARG(node_addr), OS_EUI64_ARG(node_addr),
+        name_escaped, name_suffix, HA_BRIDGE_ID, OS_EUI64_ARG(node_addr),
+        suffix, OS_EUI64_ARG(node_addr), OS_EUI64_ARG(node_addr), on_name,
+        OS_EUI64_ARG(node_addr), on_name,
         HA_BRIDGE_ID, OS_EUI64_ARG(node_addr), name_escaped,
         manufacturer_escaped, model_escaped);
   }
@@ -540,17 +590,35 @@ static os_err_t publish_light_discovery(os_eui64_t node_addr, bool has_level) {
   return mqtt_publish(topic, payload, strlen(payload));
 }
 
-static os_err_t publish_sensor_discovery(os_eui64_t node_addr,
-                                         cap_id_t cap_id) {
+/* HA component of a sensor capability */
+static const char *sensor_component(cap_id_t cap_id) {
+  return cap_id == CAP_SENSOR_CONTACT || cap_id == CAP_SENSOR_MOTION
+             ? "binary_sensor"
+             : "sensor";
+}
+
+/* Instance name with '.' replaced, for unique_ids and object ids */
+static void sanitized_instance_name(char *buf, size_t len, cap_id_t cap_id,
+                                    uint8_t endpoint_id, uint8_t instances) {
+  cap_instance_name(buf, len, cap_id, endpoint_id, instances);
+  for (char *p = buf; *p; p++) {
+    if (*p == '.')
+      *p = '_';
+  }
+}
+
+static os_err_t publish_sensor_discovery(const reg_node_view_t *node,
+                                         const cap_state_t *cap) {
   char topic[256];
-  char payload[HA_MAX_PAYLOAD_SIZE];
+  static char payload[HA_MAX_PAYLOAD_SIZE];
+  cap_id_t cap_id = cap->id;
 
   const cap_info_t *cap_info = cap_get_info(cap_id);
   if (!cap_info) {
     return OS_ERR_INVALID_ARG;
   }
 
-  reg_node_t *node = reg_find_node(node_addr);
+  os_eui64_t node_addr = node->ieee_addr;
 
   /* Get device info and escape for JSON */
   char device_name_escaped[64];
@@ -558,13 +626,12 @@ static os_err_t publish_sensor_discovery(os_eui64_t node_addr,
   char model_escaped[64];
   char unit_escaped[16];
 
-  const char *device_name_raw = (node && node->friendly_name[0])
-                                    ? node->friendly_name
-                                : (node && node->model[0]) ? node->model
-                                                           : "Zigbee Sensor";
-  const char *manufacturer_raw =
-      (node && node->manufacturer[0]) ? node->manufacturer : "";
-  const char *model_raw = (node && node->model[0]) ? node->model : "";
+  const char *device_name_raw = node->friendly_name
+                                    ? reg_str(node->friendly_name)
+                                : node->model ? reg_str(node->model)
+                                              : "Zigbee Sensor";
+  const char *manufacturer_raw = reg_str(node->manufacturer);
+  const char *model_raw = reg_str(node->model);
 
   json_escape_string(device_name_escaped, sizeof(device_name_escaped),
                      device_name_raw);
@@ -573,17 +640,15 @@ static os_err_t publish_sensor_discovery(os_eui64_t node_addr,
   json_escape_string(model_escaped, sizeof(model_escaped), model_raw);
   json_escape_string(unit_escaped, sizeof(unit_escaped), cap_info->unit);
 
-  /* Sanitize capability name */
-  char cap_sanitized[32];
-  strncpy(cap_sanitized, cap_info->name, sizeof(cap_sanitized) - 1);
-  cap_sanitized[sizeof(cap_sanitized) - 1] = '\0';
-  for (char *p = cap_sanitized; *p; p++) {
-    if (*p == '.')
-      *p = '_';
-  }
+  char instance[CAP_INSTANCE_NAME_LEN];
+  char cap_sanitized[CAP_INSTANCE_NAME_LEN];
+  cap_instance_name(instance, sizeof(instance), cap_id, cap->endpoint_id,
+                    cap->instances);
+  sanitized_instance_name(cap_sanitized, sizeof(cap_sanitized), cap_id,
+                          cap->endpoint_id, cap->instances);
 
   /* Determine HA component and device class */
-  const char *component = "sensor";
+  const char *component = sensor_component(cap_id);
   const char *device_class = "";
 
   switch (cap_id) {
@@ -594,11 +659,9 @@ static os_err_t publish_sensor_discovery(os_eui64_t node_addr,
     device_class = "humidity";
     break;
   case CAP_SENSOR_CONTACT:
-    component = "binary_sensor";
     device_class = "door";
     break;
   case CAP_SENSOR_MOTION:
-    component = "binary_sensor";
     device_class = "motion";
     break;
   default:
@@ -619,7 +682,7 @@ static os_err_t publish_sensor_discovery(os_eui64_t node_addr,
            "\"state_topic\":\"" TOPIC_BASE "/" OS_EUI64_FMT "/%s/state\","
            "\"value_template\":\"{{ value_json.v }}\","
            "\"unit_of_measurement\":\"%s\","
-           "\"availability_topic\":\"%s\","
+           HA_AVAILABILITY_JSON
            "\"payload_available\":\"online\","
            "\"payload_not_available\":\"offline\","
            "\"device\":{"
@@ -629,33 +692,64 @@ static os_err_t publish_sensor_discovery(os_eui64_t node_addr,
            "\"model\":\"%s\""
            "}"
            "}",
-           device_name_escaped, cap_info->name, HA_BRIDGE_ID,
+           device_name_escaped, instance, HA_BRIDGE_ID,
            OS_EUI64_ARG(node_addr), cap_sanitized, device_class,
-           OS_EUI64_ARG(node_addr), cap_info->name, unit_escaped,
-           HA_AVAILABILITY_TOPIC, HA_BRIDGE_ID, OS_EUI64_ARG(node_addr),
+           OS_EUI64_ARG(node_addr), instance, unit_escaped,
+           OS_EUI64_ARG(node_addr), HA_BRIDGE_ID, OS_EUI64_ARG(node_addr),
            device_name_escaped, manufacturer_escaped, model_escaped);
 
   return mqtt_publish(topic, payload, strlen(payload));
 }
 
+/* Changes that alter what discovery says about a node */
+static bool change_affects_discovery(const reg_change_t *change) {
+  switch (change->kind) {
+  case REG_CHANGE_STATE:
+  case REG_CHANGE_META:
+  case REG_CHANGE_ENDPOINT:
+  case REG_CHANGE_CLUSTER:
+    return true;
+  default:
+    return false;
+  }
+}
+
 static void handle_reg_node_ready(const os_event_t *event, void *ctx) {
   (void)ctx;
   (void)event;
 
   /*
-   * This handler is subscribed to OS_EVENT_CAP_STATE_CHANGED.
-   * In the current implementation, ha_disc_publish_node() is called explicitly
-   * when nodes transition to READY state (typically from the interview
-   * service).
-   *
-   * In a full implementation, this handler would:
-   * 1. Track which nodes have had discovery published
-   * 2. Detect capability additions/changes
-   * 3. Republish discovery when capabilities change
-   *
-   * For now, discovery is triggered explicitly via ha_disc_publish_node()
-   * and ha_disc_publish_all() calls from other services.
+   * Subscribed to OS_EVENT_CAP_STATE_CHANGED, which the interview emits on
+   * completion. Work is proportional to the registry changes since the
+   * last pass: only READY nodes whose state, metadata or clusters changed
+   * are republished.
    */
+  reg_change_t changes[HA_CHANGE_BATCH];
+  bool resync = false;
+  uint32_t n;
+  while ((n = reg_changes_read(&service.reg_gen, changes, HA_CHANGE_BATCH,
+                               &resync)) > 0 ||
+         resync) {
+    if (resync) {
+      LOG_D(HA_MODULE, "Registry journal overrun, republishing all");
+      ha_disc_publish_all();
+      resync = false;
+      continue;
+    }
+
+    os_eui64_t last = 0;
+    for (uint32_t i = 0; i < n; i++) {
+      if (!change_affects_discovery(&changes[i]) ||
+          changes[i].ieee_addr == last) {
+        continue;
+      }
+      reg_node_t *node = reg_find_node(changes[i].ieee_addr);
+      if (node && node->state == REG_STATE_READY) {
+        ha_disc_publish_node(node->ieee_addr);
+        last = node->ieee_addr;
+      }
+    }
+  }
 }
 
 static void handle_mqtt_connected(const os_event_t *event, void *ctx) {
@@ -676,6 +770,47 @@ static void handle_node_removed(const os_event_t *event, void *ctx) {
   }
 }
 
+/*
+ * Whole-node removal clears the single-instance entities by name; entities
+ * of multi-endpoint devices carry the endpoint, so they are cleared as the
+ * capability service drops each instance.
+ */
+static void handle_cap_removed(const os_event_t *event, void *ctx) {
+  (void)ctx;
+
+  cap_event_t cap;
+  memset(&cap, 0, sizeof(cap));
+  memcpy(&cap, event->payload,
+         event->payload_len < sizeof(cap) ? event->payload_len : sizeof(cap));
+  if (cap.instances <= 1) {
+    return;
+  }
+
+  char topic[256];
+  if (cap.cap_id == CAP_LIGHT_ON) {
+    snprintf(topic, sizeof(topic),
+             "%s/light/%s_" OS_EUI64_FMT "_light_ep%u/config",
+             HA_DISCOVERY_PREFIX, HA_BRIDGE_ID, OS_EUI64_ARG(cap.node_addr),
+             cap.endpoint_id);
+  } else if (cap.cap_id == CAP_SENSOR_TEMPERATURE ||
+             cap.cap_id == CAP_SENSOR_HUMIDITY ||
+             cap.cap_id == CAP_SENSOR_CONTACT ||
+             cap.cap_id == CAP_SENSOR_MOTION) {
+    char cap_sanitized[CAP_INSTANCE_NAME_LEN];
+    sanitized_instance_name(cap_sanitized, sizeof(cap_sanitized), cap.cap_id,
+                            cap.endpoint_id, cap.instances);
+    snprintf(topic, sizeof(topic), "%s/%s/%s_" OS_EUI64_FMT "_%s/config",
+             HA_DISCOVERY_PREFIX, sensor_component(cap.cap_id), HA_BRIDGE_ID,
+             OS_EUI64_ARG(cap.node_addr), cap_sanitized);
+  } else {
+    return;
+  }
+
+  if (mqtt_publish(topic, "", 0) != OS_OK) {
+    LOG_W(HA_MODULE, "Failed to unpublish %s", topic);
+  }
+}
+
 static void add_pending(os_eui64_t node_addr) {
   /* Check if already pending */
   for (uint32_t i = 0; i < HA_MAX_PENDING; i++) {
@@ -698,8 +833,3 @@ static void add_pending(os_eui64_t node_addr) {
   LOG_W(HA_MODULE, "Pending queue full, cannot add node " OS_EUI64_FMT,
         OS_EUI64_ARG(node_addr));
 }
-
-static bool check_node_has_cap(os_eui64_t node_addr, cap_id_t cap_id) {
-  cap_state_t state;
-  return cap_get_state(node_addr, cap_id, &state) == OS_OK;
-}
@@ -36,7 +36,7 @@ typedef struct {
     char name[32];
     char state_topic[128];
     char command_topic[128];
-    char availability_topic[32];
+    char availability_topic[48]; /* Per-node; bridge/status also applies */
     bool has_brightness;
     char brightness_state_topic[128];
     char brightness_command_topic[128];
@@ -82,13 +82,19 @@ uint32_t ha_disc_flush_pending(void);
 const char *ha_disc_component_name(ha_component_t component);
 
 /**
- * @brief Generate discovery config for a node capability
+ * @brief Generate discovery config for a node capability instance
+ *
+ * Topics and unique_id use the instance name, so a capability present on
+ * several endpoints yields one config per endpoint.
+ *
  * @param node_addr Node IEEE address
+ * @param endpoint_id Endpoint of the instance
  * @param cap_id Capability ID
  * @param out_config Output configuration
  * @return OS_OK on success
  */
-os_err_t ha_disc_generate_config(os_eui64_t node_addr, cap_id_t cap_id,
+os_err_t ha_disc_generate_config(os_eui64_t node_addr, uint8_t endpoint_id,
+                                  cap_id_t cap_id,
                                   ha_disc_config_t *out_config);
 
 /**
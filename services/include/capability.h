@@ -17,27 +17,52 @@
 extern "C" {
 #endif
 
+/* State store limits */
+#ifdef ESP_PLATFORM
+#define CAP_MAX_NODES 64    /* Nodes with capabilities */
+#define CAP_MAX_STATES 256  /* Capability states across all nodes */
+#define CAP_INDEX_SIZE 128  /* Node lookup: power of two >= 2x nodes */
+#else
+#define CAP_MAX_NODES 128
+#define CAP_MAX_STATES 1024
+#define CAP_INDEX_SIZE 256
+#endif
+#define CAP_MAX_NODE_STATES 16 /* Capability instances of one node */
+#define CAP_MAX_XFORMS 16      /* Distinct compiled quirk transforms */
+
+/* Longest instance name, "<capability>_ep<endpoint>", with terminator */
+#define CAP_INSTANCE_NAME_LEN 32
+
+/* Default heartbeat of filtered sensor capabilities */
+#define CAP_FILTER_HEARTBEAT_MS (15u * 60u * 1000u)
+
+/* How often cap_task() passes on values held back by min_interval */
+#define CAP_FLUSH_PERIOD_MS 100
+
+/*
+ * Capability IDs in value order, CAP_UNKNOWN (0) first. Append only: IDs
+ * are stored in persisted value records. Names, types and sources are in
+ * the CAP_DEFS table in capability.c, which needs one row per ID.
+ */
+#define CAP_IDS(X)              \
+    X(CAP_UNKNOWN)              \
+    X(CAP_SWITCH_ON)            \
+    X(CAP_LIGHT_ON)             \
+    X(CAP_LIGHT_LEVEL)          \
+    X(CAP_LIGHT_COLOR_TEMP)     \
+    X(CAP_SENSOR_TEMPERATURE)   \
+    X(CAP_SENSOR_HUMIDITY)      \
+    X(CAP_SENSOR_CONTACT)       \
+    X(CAP_SENSOR_MOTION)        \
+    X(CAP_SENSOR_ILLUMINANCE)   \
+    X(CAP_POWER_WATTS)          \
+    X(CAP_ENERGY_KWH)
+
+#define CAP_ID_ROW(id) id,
+
 /* Capability IDs */
 typedef enum {
-    CAP_UNKNOWN = 0,
-    
-    /* Actuators */
-    CAP_SWITCH_ON,       /* bool */
-    CAP_LIGHT_ON,        /* bool */
-    CAP_LIGHT_LEVEL,     /* int 0-100 */
-    CAP_LIGHT_COLOR_TEMP,/* int (mireds) */
-    
-    /* Sensors */
-    CAP_SENSOR_TEMPERATURE,  /* float degC */
-    CAP_SENSOR_HUMIDITY,     /* float % */
-    CAP_SENSOR_CONTACT,      /* bool */
-    CAP_SENSOR_MOTION,       /* bool */
-    CAP_SENSOR_ILLUMINANCE,  /* int lux */
-    
-    /* Power */
-    CAP_POWER_WATTS,     /* float W */
-    CAP_ENERGY_KWH,      /* float kWh */
-    
+    CAP_IDS(CAP_ID_ROW)
     CAP_MAX
 } cap_id_t;
 
@@ -57,15 +82,67 @@ typedef union {
     char str[32];
 } cap_value_t;
 
-/* Capability state structure */
+/* Capability state structure; one per (node, endpoint, capability) */
 typedef struct {
     cap_id_t id;
     cap_value_type_t type;
     cap_value_t value;
     os_tick_t timestamp;
     bool valid;
+    uint8_t endpoint_id;
+    uint8_t instances;   /* Instances of id on the node, this one included */
+    uint8_t xform;       /* Compiled quirk transform, 1-based; 0 = none */
+    bool sent;           /* A live report has been passed on */
+    bool held;           /* A report was held back by min_interval */
+    float sent_value;    /* Value last passed on, as a number */
+    os_tick_t sent_at;   /* When it was passed on */
 } cap_state_t;
 
+/* Payload of OS_EVENT_CAP_STATE_CHANGED and OS_EVENT_CAP_REMOVED. The event
+ * bus keeps the first OS_EVENT_PAYLOAD_SIZE bytes, so string values arrive
+ * truncated. */
+typedef struct {
+    os_eui64_t node_addr;
+    cap_id_t cap_id;
+    uint8_t endpoint_id;
+    uint8_t instances;
+    cap_value_t value;
+} cap_event_t;
+
+/*
+ * Quirk transform compiled for one capability of one device model: numbers
+ * become clamp(value * mul + add, lo, hi), booleans are xored with invert.
+ */
+typedef struct {
+    float mul;
+    float add;
+    float lo;
+    float hi;
+    bool invert;
+} cap_xform_t;
+
+/*
+ * Report filter of a capability. A report is passed on (event, MQTT,
+ * history, persistence) when it is the first since boot, when max_interval
+ * has passed since the last one passed on, or when min_interval has passed
+ * and the value moved by at least max(abs_delta, rel_delta * |last|); with
+ * both deltas 0, any change. Bool and int values compare as numbers. A
+ * change held back by min_interval is not lost: the latest value is passed
+ * on when the interval ends, if it still differs by the delta.
+ */
+typedef struct {
+    float abs_delta;          /* Capability units */
+    float rel_delta;          /* Fraction of the last value passed on */
+    uint32_t min_interval_ms; /* 0 = no rate limit */
+    uint32_t max_interval_ms; /* Heartbeat; 0 = never resend unchanged */
+} cap_filter_t;
+
+/* Report filter counters of a capability */
+typedef struct {
+    uint32_t passed;
+    uint32_t suppressed;
+} cap_filter_stats_t;
+
 /* Capability info */
 typedef struct {
     cap_id_t id;
@@ -92,21 +169,83 @@ typedef struct {
     os_corr_id_t corr_id;
 } cap_command_t;
 
+/* State store usage */
+typedef struct {
+    uint16_t nodes_used;
+    uint16_t nodes_total;
+    uint16_t states_used;
+    uint16_t states_total;
+    uint32_t reports_passed;     /* Across all capabilities */
+    uint32_t reports_suppressed;
+} cap_stats_t;
+
 /**
  * @brief Initialize capability service
+ *
+ * Subscribes to OS_EVENT_ZB_DEVICE_LEFT so departed nodes release their
+ * states.
+ *
  * @return OS_OK on success
  */
 os_err_t cap_init(void);
 
+/**
+ * @brief Check the attribute map generated from CAP_DEFS
+ *
+ * Lookups binary search it, so rows with a source must be in strictly
+ * ascending (cluster, attribute) order, with the unsourced rows last.
+ * cap_init() refuses to start otherwise, and the unit tests assert it.
+ *
+ * @return true if the map is in order
+ */
+bool cap_attr_map_sorted(void);
+
 /**
  * @brief Compute capabilities for a node from its clusters
+ *
+ * Each endpoint exposing a mapped cluster gets its own instance, so a
+ * 4-gang switch has four light.on states. The node's quirks entry is
+ * looked up here, once, and compiled into a transform per instance that
+ * attribute reports then apply without any string matching; the interview
+ * calls this when it completes. Recomputing a known node emits
+ * OS_EVENT_CAP_REMOVED for each instance that is gone or renamed.
+ *
  * @param node Node pointer
- * @return Number of capabilities found
+ * @return Number of capability instances found
  */
 uint32_t cap_compute_for_node(reg_node_t *node);
 
+/**
+ * @brief Compute capabilities for every registry node
+ *
+ * Call after reg_restore(). Each node starts from the last known values
+ * kept in the cache persistence tier (timestamp 0), so consumers see real
+ * states before the devices report again.
+ *
+ * @return Number of nodes with capabilities
+ */
+uint32_t cap_restore(void);
+
+/**
+ * @brief Drop a node's capability states and stored values
+ *
+ * Emits OS_EVENT_CAP_REMOVED for each instance.
+ *
+ * @param node_addr Node IEEE address
+ */
+void cap_forget_node(os_eui64_t node_addr);
+
+/**
+ * @brief Get state store usage
+ * @param stats Output statistics
+ */
+void cap_get_stats(cap_stats_t *stats);
+
 /**
  * @brief Get capability state for a node
+ *
+ * With several instances, returns the one on the lowest endpoint.
+ *
  * @param node_addr Node IEEE address
  * @param cap_id Capability ID
  * @param out_state Output state
@@ -114,8 +253,51 @@ uint32_t cap_compute_for_node(reg_node_t *node);
  */
 os_err_t cap_get_state(os_eui64_t node_addr, cap_id_t cap_id, cap_state_t *out_state);
 
+/**
+ * @brief Get the state of one capability instance
+ * @param node_addr Node IEEE address
+ * @param endpoint_id Endpoint ID
+ * @param cap_id Capability ID
+ * @param out_state Output state
+ * @return OS_OK, or OS_ERR_NOT_FOUND if the endpoint has no such instance
+ */
+os_err_t cap_get_instance_state(os_eui64_t node_addr, uint8_t endpoint_id,
+                                cap_id_t cap_id, cap_state_t *out_state);
+
+/**
+ * @brief Copy every capability instance of a node
+ * @param node_addr Node IEEE address
+ * @param out Output states, ordered by endpoint
+ * @param max Capacity of out
+ * @return Number of instances copied
+ */
+uint32_t cap_get_instances(os_eui64_t node_addr, cap_state_t *out, uint32_t max);
+
+/**
+ * @brief Name of a capability instance in topics and unique IDs
+ *
+ * The capability name while the node has one instance of it, so single
+ * endpoint devices keep their names; "<name>_ep<endpoint>" otherwise.
+ *
+ * @param buf Output buffer (CAP_INSTANCE_NAME_LEN bytes suffice)
+ * @param len Size of buf
+ * @param cap_id Capability ID
+ * @param endpoint_id Endpoint ID
+ * @param instances Instances of cap_id on the node
+ * @return buf
+ */
+const char *cap_instance_name(char *buf, size_t len, cap_id_t cap_id,
+                              uint8_t endpoint_id, uint8_t instances);
+
 /**
  * @brief Update capability state from Zigbee attribute report
+ *
+ * Updates the instance on endpoint_id; a report from another endpoint goes
+ * to the node's instance only when it has exactly one. The instance's
+ * quirk transform is applied to the decoded value. The state always
+ * takes the new value; OS_EVENT_CAP_STATE_CHANGED is emitted only if the
+ * capability's report filter passes it.
+ *
  * @param node_addr Node IEEE address
  * @param endpoint_id Endpoint ID
  * @param cluster_id Cluster ID
@@ -127,6 +309,58 @@ os_err_t cap_handle_attribute_report(os_eui64_t node_addr, uint8_t endpoint_id,
                                       uint16_t cluster_id, uint16_t attr_id,
                                       const reg_attr_value_t *value);
 
+/**
+ * @brief Pass on values held back by min_interval whose interval has ended
+ *
+ * Called periodically by cap_task().
+ *
+ * @param now Current tick count
+ * @return Number of values passed on
+ */
+uint32_t cap_flush_held(os_tick_t now);
+
+/**
+ * @brief Get the report filter of a capability
+ * @param cap_id Capability ID
+ * @param out Output filter
+ * @return OS_OK, or OS_ERR_INVALID_ARG for an unknown capability
+ */
+os_err_t cap_get_filter(cap_id_t cap_id, cap_filter_t *out);
+
+/**
+ * @brief Replace the report filter of a capability
+ *
+ * Sensors default to a small deadband with a CAP_FILTER_HEARTBEAT_MS
+ * heartbeat, everything else to change-only. cap_init() restores the
+ * defaults.
+ *
+ * @param cap_id Capability ID
+ * @param filter New filter
+ * @return OS_OK, or OS_ERR_INVALID_ARG for an unknown capability or a
+ *         negative delta
+ */
+os_err_t cap_set_filter(cap_id_t cap_id, const cap_filter_t *filter);
+
+/**
+ * @brief Get the report filter counters of a capability
+ * @param cap_id Capability ID
+ * @param out Output counters
+ * @return OS_OK, or OS_ERR_INVALID_ARG for an unknown capability
+ */
+os_err_t cap_get_filter_stats(cap_id_t cap_id, cap_filter_stats_t *out);
+
+/**
+ * @brief Map a Zigbee attribute to the capability it feeds
+ *
+ * Binary search of the (cluster << 16 | attribute) table generated from
+ * the capability definitions.
+ *
+ * @param cluster_id Cluster ID
+ * @param attr_id Attribute ID
+ * @return Capability ID, or CAP_UNKNOWN if the attribute is not mapped
+ */
+cap_id_t cap_lookup_attr(uint16_t cluster_id, uint16_t attr_id);
+
 /**
  * @brief Execute a capability command
  * @param cmd Command to execute
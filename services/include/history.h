@@ -0,0 +1,134 @@
+/**
+ * @file history.h
+ * @brief Capability time-series history API
+ *
+ * ESP32-C6 Zigbee Bridge OS - Fixed-memory trend store
+ *
+ * Selected (node, capability) pairs get a series: a byte ring of recent
+ * samples, delta encoded, plus min/max/avg rollups at 1 min and 1 h
+ * resolution. Values are fixed point x100 (the C6 has no FPU) and times are
+ * seconds since boot. Nothing is persisted; memory is allocated up front.
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "capability.h"
+#include "os_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Store limits */
+#ifdef ESP_PLATFORM
+#define HISTORY_MAX_SERIES 8
+#define HISTORY_RAW_BYTES 128   /* Delta-encoded sample ring per series */
+#define HISTORY_MINUTE_SLOTS 30 /* 1 min rollups kept */
+#else
+#define HISTORY_MAX_SERIES 16
+#define HISTORY_RAW_BYTES 256
+#define HISTORY_MINUTE_SLOTS 60
+#endif
+#define HISTORY_HOUR_SLOTS 24 /* 1 h rollups kept */
+
+/* Query resolution */
+typedef enum {
+  HISTORY_RES_RAW = 0,
+  HISTORY_RES_MINUTE,
+  HISTORY_RES_HOUR,
+} history_res_t;
+
+/* One point of a query; raw samples have min == max == avg, count 1 */
+typedef struct {
+  uint32_t time_s; /* Sample time, or bucket start */
+  int32_t min;
+  int32_t max;
+  int32_t avg;
+  uint32_t count;
+} history_point_t;
+
+/* Store occupancy */
+typedef struct {
+  uint32_t series_used;
+  uint32_t series_total;
+  uint32_t bytes_total; /* Fixed footprint of the store */
+} history_stats_t;
+
+/**
+ * @brief Initialize the history store
+ *
+ * Subscribes to OS_EVENT_ZB_DEVICE_LEFT so departed nodes release their
+ * series.
+ *
+ * @return OS_OK on success
+ */
+os_err_t history_init(void);
+
+/**
+ * @brief Start recording a capability of a node
+ * @param node_addr Node IEEE address
+ * @param cap_id Numeric capability (int or float)
+ * @return OS_OK (also if already tracked), OS_ERR_INVALID_ARG for bool or
+ *         string capabilities, OS_ERR_NO_MEM if every series is in use
+ */
+os_err_t history_track(os_eui64_t node_addr, cap_id_t cap_id);
+
+/**
+ * @brief Stop recording and drop the samples of one series
+ * @return OS_OK, or OS_ERR_NOT_FOUND if not tracked
+ */
+os_err_t history_untrack(os_eui64_t node_addr, cap_id_t cap_id);
+
+/**
+ * @brief Drop every series of a node
+ * @param node_addr Node IEEE address
+ */
+void history_forget_node(os_eui64_t node_addr);
+
+/**
+ * @brief Check whether a series is being recorded
+ */
+bool history_is_tracked(os_eui64_t node_addr, cap_id_t cap_id);
+
+/**
+ * @brief Add a sample to a tracked series
+ *
+ * Untracked pairs are ignored. When the raw ring is full the oldest samples
+ * are dropped; rollups are unaffected. Samples older than the newest one are
+ * recorded at the newest time.
+ *
+ * @param node_addr Node IEEE address
+ * @param cap_id Capability ID
+ * @param value_x100 Value x100
+ * @param time_s Seconds since boot, from os_uptime_s()
+ * @return OS_OK if recorded, OS_ERR_NOT_FOUND if not tracked
+ */
+os_err_t history_record(os_eui64_t node_addr, cap_id_t cap_id,
+                        int32_t value_x100, uint32_t time_s);
+
+/**
+ * @brief Read the most recent points of a series, oldest first
+ * @param node_addr Node IEEE address
+ * @param cap_id Capability ID
+ * @param res Resolution
+ * @param since_s Skip points (or buckets) that start before this time
+ * @param out Output points
+ * @param max Capacity of out
+ * @return Number of points written
+ */
+uint32_t history_query(os_eui64_t node_addr, cap_id_t cap_id,
+                       history_res_t res, uint32_t since_s,
+                       history_point_t *out, uint32_t max);
+
+/**
+ * @brief Get store occupancy
+ * @param stats Output statistics
+ */
+void history_get_stats(history_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HISTORY_H */
@@ -0,0 +1,115 @@
+/**
+ * @file liveness.h
+ * @brief Node liveness tracking API
+ *
+ * ESP32-C6 Zigbee Bridge OS - Node availability service
+ *
+ * Any frame from a node (attribute report, device announce) touches it in
+ * the registry. READY nodes that stay silent past the timeout of their
+ * liveness class go OFFLINE, and come back READY when next heard from; each
+ * transition is published on bridge/<ieee>/availability. The registry keeps
+ * READY nodes in per-class lists ordered by last_seen, so touching a node is
+ * O(1) and a sweep only visits the nodes that expire.
+ *
+ * Mains nodes are not required to report on their own, so at its deadline
+ * a mains node is first asked for its Basic cluster ZCL version and only
+ * goes OFFLINE if that goes unanswered for LIVENESS_PROBE_TIMEOUT_S. One
+ * that cannot be asked stays READY. A confirm for a capability command
+ * counts as traffic from the node it was sent to.
+ */
+
+#ifndef LIVENESS_H
+#define LIVENESS_H
+
+#include "os_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Class timeouts: a few missed reports for routers, a missed daily
+ * check-in for sleepy end devices */
+#define LIVENESS_MAINS_TIMEOUT_S 600
+#define LIVENESS_SLEEPY_TIMEOUT_S 90000 /* 25 h */
+
+/* Time a probed mains node has to answer, and probes in flight at once */
+#define LIVENESS_PROBE_TIMEOUT_S 30
+#define LIVENESS_PROBE_MAX 8
+
+/* Recent commands whose confirm is credited to their node */
+#define LIVENESS_CMD_TRACK 8
+
+/* Shortest task sleep, so nodes expiring close together share a sweep */
+#define LIVENESS_MIN_SLEEP_MS 1000
+
+/* Transition counters */
+typedef struct {
+  uint32_t expired;  /* READY -> OFFLINE on timeout */
+  uint32_t revived;  /* OFFLINE -> READY on traffic */
+  uint32_t probed;   /* Mains nodes asked at their deadline */
+  uint32_t answered; /* Probes answered in time */
+  uint32_t unprobed; /* Mains nodes kept READY as they could not be asked */
+} liveness_stats_t;
+
+/**
+ * @brief Initialize the liveness service
+ *
+ * Subscribes to OS_EVENT_ZB_ATTR_REPORT and OS_EVENT_ZB_ANNOUNCE to touch
+ * nodes, to OS_EVENT_CAP_COMMAND and OS_EVENT_ZB_CMD_CONFIRM for probe
+ * answers and confirmed commands, and to OS_EVENT_NET_UP to republish
+ * OFFLINE nodes.
+ *
+ * @return OS_OK on success
+ */
+os_err_t liveness_init(void);
+
+/**
+ * @brief Record traffic from a node
+ *
+ * Unknown nodes are ignored. An OFFLINE node is set READY and announced
+ * online. Any traffic answers a pending probe.
+ *
+ * @param node_addr Node IEEE address
+ */
+void liveness_touch(os_eui64_t node_addr);
+
+/**
+ * @brief Set every READY node whose timeout has passed OFFLINE
+ *
+ * A mains node is probed instead, and set OFFLINE by a later sweep if the
+ * probe is not answered. One without a known endpoint, or whose probe
+ * cannot be sent, stays READY until its next deadline.
+ *
+ * @param now Current tick count
+ * @return Number of nodes that went OFFLINE
+ */
+uint32_t liveness_sweep(os_tick_t now);
+
+/**
+ * @brief Time until the next READY node or probe expires
+ * @param now Current tick count
+ * @return Milliseconds (0 if one is already due), or the mains timeout if
+ *         no node is READY
+ */
+uint32_t liveness_next_deadline_ms(os_tick_t now);
+
+/**
+ * @brief Get transition counters
+ * @param stats Output statistics
+ */
+void liveness_get_stats(liveness_stats_t *stats);
+
+/**
+ * @brief Liveness task entry (run as fibre)
+ *
+ * Sleeps until the next deadline and sweeps.
+ *
+ * @param arg Unused
+ */
+void liveness_task(void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIVENESS_H */
@@ -90,8 +90,28 @@ os_err_t quirks_init(void);
  */
 const quirk_entry_t *quirks_find(const char *manufacturer, const char *model);
 
+/**
+ * @brief Compile the actions of a quirk entry for one capability
+ *
+ * Folds the entry's clamp, scale and invert actions on cap_id, in table
+ * order, into a single transform (see cap_xform_t). Resolve the entry once
+ * per node with quirks_find() and compile per capability; applying the
+ * result needs no string compares.
+ *
+ * @param entry Quirk entry (NULL compiles nothing)
+ * @param cap_id Capability ID
+ * @param out Output transform, identity when nothing applies
+ * @return Number of actions folded into out
+ */
+uint8_t quirks_compile(const quirk_entry_t *entry, cap_id_t cap_id,
+                       cap_xform_t *out);
+
 /**
  * @brief Apply quirks to a capability value
+ *
+ * Matches the device on every call; reports go through the transform
+ * compiled by quirks_compile() instead.
+ *
  * @param manufacturer Device manufacturer
  * @param model Device model
  * @param cap_id Capability ID
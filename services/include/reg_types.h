@@ -18,24 +18,58 @@ extern "C" {
 
 /* Limits - reduced for ESP32 RAM constraints (~512KB)
  * Full limits used on host for testing
+ *
+ * Endpoints, clusters and attributes come from shared pools, so a node
+ * costs only what it exposes. REG_MAX_ENDPOINTS/CLUSTERS/ATTRIBUTES cap a
+ * single node, endpoint and cluster; the pools bound the whole network.
  */
 #if defined(ESP_PLATFORM)
-/* ESP32: ~32KB per node with these limits */
-#define REG_MAX_NODES 8
+/* ESP32: ~60KB in total; a typical 1-2 endpoint device uses ~400 bytes */
+#define REG_MAX_NODES 128
 #define REG_MAX_ENDPOINTS 4
 #define REG_MAX_CLUSTERS 8
 #define REG_MAX_ATTRIBUTES 8
+#define REG_POOL_ENDPOINTS 192
+#define REG_POOL_CLUSTERS 768
+#define REG_POOL_ATTRIBUTES 512
+#define REG_INDEX_SIZE 256 /* Lookup tables: power of two >= 2x nodes */
+#define REG_JOURNAL_SIZE 32
+#define REG_CLUSTER_INDEX_SIZE 48 /* Distinct cluster IDs indexed */
+#define REG_STR_MAX 192   /* Distinct interned strings */
+#define REG_STR_ARENA 4096 /* Bytes of interned text */
+#define REG_SNAP_VIEWS 16  /* Node copies shared by snapshot readers */
+#define REG_SNAP_ENDPOINTS 24 /* Endpoints, clusters, attributes of views */
+#define REG_SNAP_CLUSTERS 64
+#define REG_SNAP_ATTRIBUTES 96
 #else
 /* Host: Full limits for comprehensive testing */
-#define REG_MAX_NODES 32
+#define REG_MAX_NODES 128
 #define REG_MAX_ENDPOINTS 8
 #define REG_MAX_CLUSTERS 16
 #define REG_MAX_ATTRIBUTES 32
+#define REG_POOL_ENDPOINTS 512
+#define REG_POOL_CLUSTERS 2048
+#define REG_POOL_ATTRIBUTES 2048
+#define REG_INDEX_SIZE 256 /* Lookup tables: power of two >= 2x nodes */
+#define REG_JOURNAL_SIZE 64
+#define REG_CLUSTER_INDEX_SIZE 96 /* Distinct cluster IDs indexed */
+#define REG_STR_MAX 384
+#define REG_STR_ARENA 8192
+#define REG_SNAP_VIEWS 32
+#define REG_SNAP_ENDPOINTS 64
+#define REG_SNAP_CLUSTERS 256
+#define REG_SNAP_ATTRIBUTES 512
 #endif
+#define REG_SNAP_READERS 4 /* Snapshots open at once */
 
 #define REG_NAME_MAX_LEN 32
 #define REG_MANUFACTURER_LEN 32
 #define REG_MODEL_LEN 32
+#define REG_STR_MAX_LEN 32 /* Longest interned string, with terminator */
+
+/* Interned string ID; read with reg_str(), equal strings have equal IDs */
+typedef uint16_t reg_str_t;
+#define REG_STR_NONE 0 /* Empty string */
 
 /* Device lifecycle states (per 00_context_and_guardrails.yaml FSM) */
 typedef enum {
@@ -63,6 +97,14 @@ typedef enum {
   REG_POWER_DC,
 } reg_power_source_t;
 
+/* Liveness classes: READY nodes are expected to be heard from within their
+ * class timeout; unknown power sources are treated as sleepy */
+typedef enum {
+  REG_LIVENESS_MAINS = 0, /* Routers: mains or DC powered */
+  REG_LIVENESS_SLEEPY,    /* Battery end devices */
+  REG_LIVENESS_CLASSES,
+} reg_liveness_class_t;
+
 /* Attribute data type */
 typedef enum {
   REG_ATTR_TYPE_UNKNOWN = 0,
@@ -95,6 +137,8 @@ typedef struct {
   reg_attr_type_t type;
   reg_attr_value_t value;
   os_tick_t last_updated;
+  uint32_t generation; /* Registry generation of the last update */
+  uint16_t next;       /* Next attribute of the cluster (pool index + 1) */
   bool valid;
 } reg_attribute_t;
 
@@ -102,7 +146,9 @@ typedef struct {
 typedef struct {
   uint16_t cluster_id;
   reg_cluster_dir_t direction;
-  reg_attribute_t attributes[REG_MAX_ATTRIBUTES];
+  uint16_t attributes; /* First attribute (pool index + 1, 0 = none) */
+  uint16_t next;       /* Next cluster of the endpoint */
+  uint16_t endpoint;   /* Owning endpoint */
   uint8_t attr_count;
   bool valid;
 } reg_cluster_t;
@@ -112,7 +158,9 @@ typedef struct {
   uint8_t endpoint_id;
   uint16_t profile_id;
   uint16_t device_id;
-  reg_cluster_t clusters[REG_MAX_CLUSTERS];
+  uint16_t clusters; /* First cluster (pool index + 1, 0 = none) */
+  uint16_t next;     /* Next endpoint of the node */
+  uint16_t node;     /* Registry slot + 1; 0 for a node outside the registry */
   uint8_t cluster_count;
   bool valid;
 } reg_endpoint_t;
@@ -121,15 +169,15 @@ typedef struct {
 typedef struct {
   /* Identity */
   os_eui64_t ieee_addr;
-  uint16_t nwk_addr;
+  uint16_t nwk_addr; /* Indexed: change only via reg_set_nwk_addr() */
 
   /* State */
   reg_state_t state;
 
-  /* Metadata */
-  char manufacturer[REG_MANUFACTURER_LEN];
-  char model[REG_MODEL_LEN];
-  char friendly_name[REG_NAME_MAX_LEN];
+  /* Metadata: interned, set with reg_set_manufacturer() and friends */
+  reg_str_t manufacturer;
+  reg_str_t model;
+  reg_str_t friendly_name;
   uint32_t sw_build;
 
   /* Telemetry */
@@ -137,8 +185,8 @@ typedef struct {
   int8_t rssi;
   reg_power_source_t power_source;
 
-  /* Endpoints */
-  reg_endpoint_t endpoints[REG_MAX_ENDPOINTS];
+  /* Endpoints: walk with reg_first_endpoint()/reg_next_endpoint() */
+  uint16_t endpoints; /* First endpoint (pool index + 1, 0 = none) */
   uint8_t endpoint_count;
 
   /* Timestamps */
@@ -149,7 +197,10 @@ typedef struct {
   uint8_t interview_stage;
 
   /* Slot management */
+  uint32_t added_gen;   /* Registry generation when added */
+  uint32_t changed_gen; /* Registry generation of the last change */
   bool valid;
+  bool dirty; /* Persisted fields changed since last reg_persist() */
 } reg_node_t;
 
 /* Node info for shell/API (minimal subset) */
@@ -162,8 +213,113 @@ typedef struct {
   const char *friendly_name;
   uint8_t lqi;
   uint8_t endpoint_count;
+  uint32_t mem_bytes; /* Node plus its pooled endpoints/clusters/attributes */
 } reg_node_info_t;
 
+/* Registry change kinds, one journal entry each */
+typedef enum {
+  REG_CHANGE_ADDED = 0,
+  REG_CHANGE_REMOVED,
+  REG_CHANGE_STATE,
+  REG_CHANGE_NWK,
+  REG_CHANGE_META, /* Fields written directly, see reg_mark_dirty() */
+  REG_CHANGE_ENDPOINT,
+  REG_CHANGE_CLUSTER,
+  REG_CHANGE_ATTRIBUTE,
+} reg_change_kind_t;
+
+/* Change journal entry; fields below kind are set where they apply */
+typedef struct {
+  uint32_t generation;
+  os_eui64_t ieee_addr;
+  reg_change_kind_t kind;
+  uint8_t endpoint_id;
+  uint16_t cluster_id;
+  uint16_t attr_id;
+} reg_change_t;
+
+/* Node filter for reg_iter_t; zero-initialised matches every node */
+typedef struct {
+  uint32_t states;     /* Bitmask of REG_STATE_BIT(state); 0 = any */
+  uint16_t cluster_id; /* Cluster on any endpoint, if has_cluster */
+  bool has_cluster;
+  bool has_power_source;
+  reg_power_source_t power_source;
+} reg_filter_t;
+
+#define REG_STATE_BIT(state) (1u << (state))
+
+/* Set of nodes, one bit per registry slot */
+#define REG_NODE_SET_WORDS ((REG_MAX_NODES + 31) / 32)
+
+typedef struct {
+  uint32_t bits[REG_NODE_SET_WORDS];
+} reg_node_set_t;
+
+/* Node cursor: walks slots once, so full scans are linear. State and
+ * cluster filters are answered from the registry's secondary indices, so
+ * only candidate slots are visited. */
+typedef struct {
+  reg_filter_t filter;
+  reg_node_set_t candidates;
+  uint32_t generation; /* Nodes added after reg_iter_begin() are skipped */
+  uint16_t pos;        /* Next slot */
+} reg_iter_t;
+
+/* Shared pool occupancy */
+typedef struct {
+  uint16_t endpoints_used;
+  uint16_t endpoints_total;
+  uint16_t clusters_used;
+  uint16_t clusters_total;
+  uint16_t attributes_used;
+  uint16_t attributes_total;
+  uint32_t bytes_total; /* Nodes and pools */
+} reg_pool_stats_t;
+
+/* Copy of a node as a snapshot sees it, see reg_snapshot_node(). Its
+ * endpoints, clusters and attributes are copied too; walk them with
+ * reg_view_first_endpoint() and friends. last_seen is not part of it. */
+typedef struct {
+  os_eui64_t ieee_addr;
+  uint16_t nwk_addr;
+  reg_state_t state;
+  reg_str_t manufacturer; /* Held by the view: valid while it is */
+  reg_str_t model;
+  reg_str_t friendly_name;
+  uint32_t sw_build;
+  uint8_t lqi;
+  int8_t rssi;
+  reg_power_source_t power_source;
+  uint8_t endpoint_count;
+  uint16_t endpoints;  /* First endpoint copy (view pool index + 1) */
+  uint32_t generation; /* Node change the view reflects */
+} reg_node_view_t;
+
+/* Open snapshot; filled by reg_snapshot_begin() */
+typedef struct {
+  uint32_t epoch;
+  uint8_t reader;
+} reg_snapshot_t;
+
+/* Snapshot view pool occupancy */
+typedef struct {
+  uint16_t views_used;
+  uint16_t views_total;
+  uint8_t readers; /* Snapshots open */
+  uint32_t copies; /* Versions kept for snapshots older than a change */
+  uint32_t lost;   /* Versions that did not fit; their readers got NULL */
+} reg_snap_stats_t;
+
+/* String table occupancy */
+typedef struct {
+  uint16_t strings_used;
+  uint16_t strings_total;
+  uint16_t arena_used; /* Bytes of live text */
+  uint16_t arena_total;
+  uint32_t refs; /* Node fields pointing at the strings */
+} reg_str_stats_t;
+
 #ifdef __cplusplus
 }
 #endif
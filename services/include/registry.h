@@ -44,6 +44,17 @@ reg_node_t *reg_find_node(os_eui64_t ieee_addr);
  */
 reg_node_t *reg_find_node_by_nwk(uint16_t nwk_addr);
 
+/**
+ * @brief Change a node's network short address
+ *
+ * Keeps the NWK lookup table in step. If another node still holds the
+ * address (e.g. it left without us noticing), the new holder wins.
+ * @param node Node pointer
+ * @param nwk_addr New network short address
+ * @return OS_OK on success
+ */
+os_err_t reg_set_nwk_addr(reg_node_t *node, uint16_t nwk_addr);
+
 /**
  * @brief Remove a node from the registry
  * @param ieee_addr IEEE EUI64 address
@@ -55,16 +66,36 @@ os_err_t reg_remove_node(os_eui64_t ieee_addr);
  * @brief Set node state
  * @param node Node pointer
  * @param state New state
- * @return OS_OK on success
+ * @return OS_OK on success, OS_ERR_INVALID_ARG for an unknown state
  */
 os_err_t reg_set_state(reg_node_t *node, reg_state_t state);
 
 /**
  * @brief Update node last seen time
+ *
+ * O(1): READY nodes are kept in one list per liveness class, ordered by
+ * last_seen, and a touch moves the node to the tail of its list.
+ *
  * @param node Node pointer
  */
 void reg_touch_node(reg_node_t *node);
 
+/**
+ * @brief Liveness class of a node, from its power source
+ */
+reg_liveness_class_t reg_liveness_class(const reg_node_t *node);
+
+/**
+ * @brief READY node of a class heard from least recently
+ *
+ * Its last_seen bounds every other node of the class, so a sweeper only
+ * needs to look at this node to find the next deadline.
+ *
+ * @param cls Liveness class
+ * @return Node, or NULL if no READY node is in the class
+ */
+reg_node_t *reg_liveness_oldest(reg_liveness_class_t cls);
+
 /**
  * @brief Get total node count
  * @return Number of valid nodes
@@ -73,12 +104,88 @@ uint32_t reg_node_count(void);
 
 /**
  * @brief Get node info by index
+ *
+ * Counts valid nodes from the first slot on every call; loop with
+ * reg_iter_begin()/reg_iter_next() instead.
  * @param index Node index
  * @param info Output info structure
  * @return OS_OK on success
  */
 os_err_t reg_get_node_info(uint32_t index, reg_node_info_t *info);
 
+/**
+ * @brief Fill the shell/API summary of a node
+ * @param node Node pointer
+ * @param info Output info structure
+ * @return OS_OK on success
+ */
+os_err_t reg_node_get_info(const reg_node_t *node, reg_node_info_t *info);
+
+/**
+ * @brief Start iterating over nodes
+ *
+ * Removing nodes while iterating is safe: each node that stays in the
+ * registry is returned exactly once. Nodes added after this call,
+ * including removed nodes that rejoin, are not returned.
+ * @param it Cursor to initialise
+ * @param filter Nodes to return, or NULL for all
+ */
+void reg_iter_begin(reg_iter_t *it, const reg_filter_t *filter);
+
+/**
+ * @brief Start iterating over the nodes of a set
+ *
+ * Same guarantees as reg_iter_begin(); nodes removed since the set was
+ * queried are skipped.
+ * @param it Cursor to initialise
+ * @param set Nodes to return
+ */
+void reg_iter_begin_set(reg_iter_t *it, const reg_node_set_t *set);
+
+/**
+ * @brief Next node matching the cursor's filter
+ * @param it Cursor
+ * @return Node, or NULL when done
+ */
+reg_node_t *reg_iter_next(reg_iter_t *it);
+
+/**
+ * @brief Nodes currently in a state
+ * @param state State
+ * @param out Output set
+ * @return OS_OK on success
+ */
+os_err_t reg_query_state(reg_state_t state, reg_node_set_t *out);
+
+/**
+ * @brief Nodes exposing a cluster on any endpoint
+ * @param cluster_id Cluster ID
+ * @param out Output set (empty if no node has it)
+ * @return OS_OK on success
+ */
+os_err_t reg_query_cluster(uint16_t cluster_id, reg_node_set_t *out);
+
+/**
+ * @brief Intersect two node sets
+ * @param set Set to narrow, in place
+ * @param other Set to intersect with
+ */
+void reg_node_set_and(reg_node_set_t *set, const reg_node_set_t *other);
+
+/**
+ * @brief Union of two node sets
+ * @param set Set to widen, in place
+ * @param other Set to add
+ */
+void reg_node_set_or(reg_node_set_t *set, const reg_node_set_t *other);
+
+/**
+ * @brief Number of nodes in a set
+ * @param set Node set
+ * @return Count
+ */
+uint32_t reg_node_set_count(const reg_node_set_t *set);
+
 /**
  * @brief Add endpoint to a node
  * @param node Node pointer
@@ -98,6 +205,20 @@ reg_endpoint_t *reg_add_endpoint(reg_node_t *node, uint8_t endpoint_id,
  */
 reg_endpoint_t *reg_find_endpoint(reg_node_t *node, uint8_t endpoint_id);
 
+/**
+ * @brief First endpoint of a node
+ * @param node Node pointer
+ * @return Endpoint, or NULL if the node has none
+ */
+reg_endpoint_t *reg_first_endpoint(const reg_node_t *node);
+
+/**
+ * @brief Next endpoint of the same node
+ * @param endpoint Endpoint pointer
+ * @return Endpoint, or NULL at the end
+ */
+reg_endpoint_t *reg_next_endpoint(const reg_endpoint_t *endpoint);
+
 /**
  * @brief Add cluster to an endpoint
  * @param endpoint Endpoint pointer
@@ -116,6 +237,20 @@ reg_cluster_t *reg_add_cluster(reg_endpoint_t *endpoint, uint16_t cluster_id,
  */
 reg_cluster_t *reg_find_cluster(reg_endpoint_t *endpoint, uint16_t cluster_id);
 
+/**
+ * @brief First cluster of an endpoint
+ * @param endpoint Endpoint pointer
+ * @return Cluster, or NULL if the endpoint has none
+ */
+reg_cluster_t *reg_first_cluster(const reg_endpoint_t *endpoint);
+
+/**
+ * @brief Next cluster of the same endpoint
+ * @param cluster Cluster pointer
+ * @return Cluster, or NULL at the end
+ */
+reg_cluster_t *reg_next_cluster(const reg_cluster_t *cluster);
+
 /**
  * @brief Update attribute value
  * @param cluster Cluster pointer
@@ -136,17 +271,277 @@ os_err_t reg_update_attribute(reg_cluster_t *cluster, uint16_t attr_id,
 reg_attribute_t *reg_find_attribute(reg_cluster_t *cluster, uint16_t attr_id);
 
 /**
- * @brief Persist registry to storage
+ * @brief First attribute of a cluster
+ * @param cluster Cluster pointer
+ * @return Attribute, or NULL if the cluster has none
+ */
+reg_attribute_t *reg_first_attribute(const reg_cluster_t *cluster);
+
+/**
+ * @brief Next attribute of the same cluster
+ * @param attr Attribute pointer
+ * @return Attribute, or NULL at the end
+ */
+reg_attribute_t *reg_next_attribute(const reg_attribute_t *attr);
+
+/**
+ * @brief Return a node's endpoints, clusters and attributes to the pools
+ *
+ * reg_remove_node() does this itself. Call it for nodes decoded outside
+ * the registry once they are no longer needed.
+ * @param node Node pointer
+ */
+void reg_node_clear(reg_node_t *node);
+
+/**
+ * @brief RAM used by a node, including its pooled children
+ * @param node Node pointer
+ * @return Bytes
+ */
+uint32_t reg_node_mem(const reg_node_t *node);
+
+/**
+ * @brief Get shared pool occupancy
+ * @param stats Output statistics
+ */
+void reg_get_pool_stats(reg_pool_stats_t *stats);
+
+/**
+ * @brief Announce a direct write to a node's fields
+ *
+ * Registry mutators do this themselves; call it before writing node fields
+ * (sw_build, power source...) directly, so open snapshots keep the node as
+ * it was, and reg_mark_dirty() after.
+ * @param node Node pointer
+ */
+void reg_will_write(reg_node_t *node);
+
+/**
+ * @brief Mark a node's persisted fields as changed
+ *
+ * Registry mutators do this themselves; call it after writing node fields
+ * (sw_build, power source...) directly.
+ * @param node Node pointer
+ */
+void reg_mark_dirty(reg_node_t *node);
+
+/**
+ * @brief Set a node's manufacturer, model or friendly name
+ *
+ * The string is interned (truncated to REG_STR_MAX_LEN - 1 characters) and
+ * the previous one released. NULL or "" clears the field.
+ *
+ * @param node Node pointer
+ * @param s New value
+ * @return OS_OK on success, OS_ERR_NO_MEM if the string table is full
+ */
+os_err_t reg_set_manufacturer(reg_node_t *node, const char *s);
+os_err_t reg_set_model(reg_node_t *node, const char *s);
+os_err_t reg_set_friendly_name(reg_node_t *node, const char *s);
+
+/**
+ * @brief Intern a string, taking a reference
+ * @param s String (NULL or "" gives REG_STR_NONE)
+ * @return String ID, or REG_STR_NONE if the table is full
+ */
+reg_str_t reg_str_intern(const char *s);
+
+/**
+ * @brief Take another reference on an interned string
+ * @return id, or REG_STR_NONE if id is not in the table
+ */
+reg_str_t reg_str_acquire(reg_str_t id);
+
+/**
+ * @brief Drop a reference; the string is freed with its last one
+ */
+void reg_str_release(reg_str_t id);
+
+/**
+ * @brief Text of an interned string
+ * @return The string, "" for REG_STR_NONE or unknown IDs
+ */
+const char *reg_str(reg_str_t id);
+
+/**
+ * @brief Look up a string without taking a reference
+ * @return String ID, or REG_STR_NONE if not interned
+ */
+reg_str_t reg_str_find(const char *s);
+
+/**
+ * @brief Get string table occupancy
+ * @param stats Output statistics
+ */
+void reg_str_get_stats(reg_str_stats_t *stats);
+
+/* String table persistence, driven by reg_persist() and reg_restore() */
+os_err_t reg_str_persist_stage(void);          /* Put unsaved strings */
+void reg_str_persist_done(bool committed);     /* After commit or abort */
+uint32_t reg_str_persist_purge(void);          /* Delete unreferenced */
+uint32_t reg_str_restore(void);                /* Load before node records */
+void reg_str_restore_done(void);               /* Free unreferenced */
+void reg_str_reset(void);
+
+/**
+ * @brief Encode a node into its compact persisted form
+ * @param node Node to encode
+ * @param buf Output buffer
+ * @param buf_len Buffer size
+ * @param out_len Encoded length (can be NULL)
+ * @return OS_OK on success, OS_ERR_NO_MEM if the buffer is too small
+ */
+os_err_t reg_node_encode(const reg_node_t *node, uint8_t *buf, size_t buf_len,
+                         size_t *out_len);
+
+/**
+ * @brief Decode a persisted node record
+ *
+ * Endpoints, clusters and attributes are taken from the registry pools;
+ * release them with reg_node_clear() if the node is not kept.
+ * @param buf Encoded record
+ * @param len Record length
+ * @param node Output node (fully overwritten)
+ * @return OS_OK on success, OS_ERR_INVALID_ARG if the record is malformed
+ *         or holds an unknown state or power source
+ */
+os_err_t reg_node_decode(const uint8_t *buf, size_t len, reg_node_t *node);
+
+/**
+ * @brief Register upgrades of older node record versions with os_persist
+ * @param prefix Key prefix of node records
+ * @return OS_OK on success
+ */
+os_err_t reg_codec_register_migrations(const char *prefix);
+
+/**
+ * @brief Persist changed (dirty) nodes to storage
  * @return OS_OK on success
  */
 os_err_t reg_persist(void);
 
 /**
  * @brief Restore registry from storage
+ *
+ * Streams every persisted node record in one pass. Nodes already in the
+ * registry are kept as they are.
+ *
  * @return OS_OK on success
  */
 os_err_t reg_restore(void);
 
+/**
+ * @brief Current registry generation
+ *
+ * Every change (node added/removed, state, NWK address, metadata,
+ * endpoint, cluster, attribute) bumps it by one and is journaled.
+ * @return Generation
+ */
+uint32_t reg_generation(void);
+
+/**
+ * @brief Read journaled changes newer than a consumer's generation
+ *
+ * A consumer keeps the generation it has caught up to, starting from
+ * reg_generation() after its initial full scan. If it fell more than
+ * REG_JOURNAL_SIZE changes behind, the missed entries are gone: *resync is
+ * set, *since jumps to the current generation and the consumer must
+ * rescan with reg_iter_begin().
+ * @param since Consumer generation; advanced past the changes returned
+ * @param out Output changes, oldest first
+ * @param max Capacity of out
+ * @param resync Set when a full rescan is needed
+ * @return Number of changes copied
+ */
+uint32_t reg_changes_read(uint32_t *since, reg_change_t *out, uint32_t max,
+                          bool *resync);
+
+/**
+ * @brief Open a read snapshot
+ *
+ * Pins a new epoch: every node read under it is as it was at
+ * reg_snapshot_begin(), with its endpoints, clusters and attributes, however
+ * long the snapshot stays open. Writers changing or removing a node while an
+ * older snapshot is open first keep a copy of the node tagged with that
+ * epoch; nodes added since are not seen.
+ * @param snap Snapshot to fill
+ * @return OS_OK, or OS_ERR_BUSY if REG_SNAP_READERS snapshots are open
+ */
+os_err_t reg_snapshot_begin(reg_snapshot_t *snap);
+
+/**
+ * @brief Close a snapshot; its views may be reclaimed
+ * @param snap Snapshot from reg_snapshot_begin()
+ */
+void reg_snapshot_end(reg_snapshot_t *snap);
+
+/**
+ * @brief A node as of a snapshot's epoch
+ *
+ * The view and its endpoints, clusters and attributes (see
+ * reg_view_first_endpoint()) stay unchanged until reg_snapshot_end().
+ * Nodes removed after reg_snapshot_begin() are still found.
+ *
+ * @param snap Open snapshot
+ * @param ieee_addr IEEE address
+ * @return View, or NULL if the node did not exist at the epoch, every view
+ *         is held by open snapshots, or a version this snapshot needed did
+ *         not fit in the view pools (see reg_snap_stats_t.lost)
+ */
+const reg_node_view_t *reg_snapshot_node(const reg_snapshot_t *snap,
+                                         os_eui64_t ieee_addr);
+
+/**
+ * @brief First endpoint of a snapshot view
+ *
+ * Endpoints, clusters and attributes of a view are copies: walk them with
+ * the reg_view_* functions, not reg_next_endpoint() and friends.
+ * @param view View from reg_snapshot_node()
+ * @return Endpoint, or NULL if the node had none
+ */
+const reg_endpoint_t *reg_view_first_endpoint(const reg_node_view_t *view);
+
+/**
+ * @brief Next endpoint of the same view
+ * @param endpoint Endpoint of a view
+ * @return Endpoint, or NULL at the end
+ */
+const reg_endpoint_t *reg_view_next_endpoint(const reg_endpoint_t *endpoint);
+
+/**
+ * @brief First cluster of a view's endpoint
+ * @param endpoint Endpoint of a view
+ * @return Cluster, or NULL if the endpoint had none
+ */
+const reg_cluster_t *reg_view_first_cluster(const reg_endpoint_t *endpoint);
+
+/**
+ * @brief Next cluster of the same endpoint
+ * @param cluster Cluster of a view
+ * @return Cluster, or NULL at the end
+ */
+const reg_cluster_t *reg_view_next_cluster(const reg_cluster_t *cluster);
+
+/**
+ * @brief First attribute of a view's cluster
+ * @param cluster Cluster of a view
+ * @return Attribute, or NULL if the cluster had none
+ */
+const reg_attribute_t *reg_view_first_attribute(const reg_cluster_t *cluster);
+
+/**
+ * @brief Next attribute of the same cluster
+ * @param attr Attribute of a view
+ * @return Attribute, or NULL at the end
+ */
+const reg_attribute_t *reg_view_next_attribute(const reg_attribute_t *attr);
+
+/**
+ * @brief Get snapshot view pool occupancy
+ * @param stats Output statistics
+ */
+void reg_snapshot_get_stats(reg_snap_stats_t *stats);
+
 /**
  * @brief Get state name string
  * @param state State value
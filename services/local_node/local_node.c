@@ -7,6 +7,7 @@
 #include "capability.h"
 #include "gpio_button.h"
 #include "i2c_sensor.h"
+#include "liveness.h"
 #include "os.h"
 #include "registry.h"
 #include <string.h>
@@ -62,9 +63,9 @@ os_err_t local_node_init(void) {
         return OS_ERR_NO_MEM;
     }
 
-    strncpy(node->manufacturer, "ESP32", REG_MANUFACTURER_LEN - 1);
-    strncpy(node->model, "local-node", REG_MODEL_LEN - 1);
-    strncpy(node->friendly_name, "Bridge Node", REG_NAME_MAX_LEN - 1);
+    reg_set_manufacturer(node, "ESP32");
+    reg_set_model(node, "local-node");
+    reg_set_friendly_name(node, "Bridge Node");
 
     reg_endpoint_t *ep = reg_add_endpoint(node, 1, 0x0104, 0x0000);
     if (!ep) {
@@ -95,6 +96,9 @@ void local_node_task(void *arg) {
     LOG_I(LOCAL_NODE_MODULE, "Local node task started");
 
     while (1) {
+        /* No Zigbee frames arrive for it: alive while this task polls */
+        liveness_touch(LOCAL_NODE_EUI64);
+
         bool button = gpio_button_read();
         if (button != local_node.last_button) {
             local_node.last_button = button;
@@ -8,8 +8,12 @@
  */
 
 #include "capability.h"
+#include "history.h"
+#include "quirks.h"
 #include "registry.h"
 #include "os.h"
+#include <inttypes.h>
+#include <stdio.h>
 #include <string.h>
 
 #define CAP_MODULE "CAP"
@@ -34,71 +38,179 @@
 #define ZCL_ATTR_TEMPERATURE     0x0000
 #define ZCL_ATTR_HUMIDITY        0x0000
 
+/* Source cluster of capabilities no single attribute feeds (quirks, local
+ * drivers); sorts after every real cluster */
+#define CAP_SRC_NONE             0xFFFF
+
+/*
+ * Capability definitions, one row per CAP_IDS entry:
+ *   X(id, name, value type, unit, source cluster, source attribute)
+ * Rows are kept in (cluster, attribute) order, so the attribute map
+ * generated from them needs no sorting; the unit tests check the order
+ * with cap_attr_map_sorted().
+ */
+#define CAP_DEFS(X) \
+    X(CAP_LIGHT_ON,           "light.on",           CAP_VALUE_BOOL,  "",       ZCL_CLUSTER_ONOFF,       ZCL_ATTR_ONOFF)       \
+    X(CAP_LIGHT_LEVEL,        "light.level",        CAP_VALUE_INT,   "%",      ZCL_CLUSTER_LEVEL,       ZCL_ATTR_LEVEL)       \
+    X(CAP_LIGHT_COLOR_TEMP,   "light.color_temp",   CAP_VALUE_INT,   "mireds", ZCL_CLUSTER_COLOR,       ZCL_ATTR_COLOR_TEMP)  \
+    X(CAP_SENSOR_TEMPERATURE, "sensor.temperature", CAP_VALUE_FLOAT, "°C",     ZCL_CLUSTER_TEMPERATURE, ZCL_ATTR_TEMPERATURE) \
+    X(CAP_SENSOR_HUMIDITY,    "sensor.humidity",    CAP_VALUE_FLOAT, "%",      ZCL_CLUSTER_HUMIDITY,    ZCL_ATTR_HUMIDITY)    \
+    X(CAP_UNKNOWN,            "unknown",            CAP_VALUE_INT,   "",       CAP_SRC_NONE,            CAP_SRC_NONE)         \
+    X(CAP_SWITCH_ON,          "switch.on",          CAP_VALUE_BOOL,  "",       CAP_SRC_NONE,            CAP_SRC_NONE)         \
+    X(CAP_SENSOR_CONTACT,     "sensor.contact",     CAP_VALUE_BOOL,  "",       CAP_SRC_NONE,            CAP_SRC_NONE)         \
+    X(CAP_SENSOR_MOTION,      "sensor.motion",      CAP_VALUE_BOOL,  "",       CAP_SRC_NONE,            CAP_SRC_NONE)         \
+    X(CAP_SENSOR_ILLUMINANCE, "sensor.illuminance", CAP_VALUE_INT,   "lux",    CAP_SRC_NONE,            CAP_SRC_NONE)         \
+    X(CAP_POWER_WATTS,        "power.watts",        CAP_VALUE_FLOAT, "W",      CAP_SRC_NONE,            CAP_SRC_NONE)         \
+    X(CAP_ENERGY_KWH,         "energy.kwh",         CAP_VALUE_FLOAT, "kWh",    CAP_SRC_NONE,            CAP_SRC_NONE)
+
+/* A duplicate row fails -Woverride-init; a missing one fails the count */
+#define CAP_COUNT_ROW(id, name, type, unit, cluster, attr) +1
+_Static_assert(0 CAP_DEFS(CAP_COUNT_ROW) == CAP_MAX,
+               "CAP_DEFS needs exactly one row per CAP_IDS entry");
+
 /* Capability info table */
-static const cap_info_t cap_info_table[] = {
-    {CAP_UNKNOWN,           "unknown",              CAP_VALUE_INT,   ""},
-    {CAP_SWITCH_ON,         "switch.on",            CAP_VALUE_BOOL,  ""},
-    {CAP_LIGHT_ON,          "light.on",             CAP_VALUE_BOOL,  ""},
-    {CAP_LIGHT_LEVEL,       "light.level",          CAP_VALUE_INT,   "%"},
-    {CAP_LIGHT_COLOR_TEMP,  "light.color_temp",     CAP_VALUE_INT,   "mireds"},
-    {CAP_SENSOR_TEMPERATURE,"sensor.temperature",   CAP_VALUE_FLOAT, "°C"},
-    {CAP_SENSOR_HUMIDITY,   "sensor.humidity",      CAP_VALUE_FLOAT, "%"},
-    {CAP_SENSOR_CONTACT,    "sensor.contact",       CAP_VALUE_BOOL,  ""},
-    {CAP_SENSOR_MOTION,     "sensor.motion",        CAP_VALUE_BOOL,  ""},
-    {CAP_SENSOR_ILLUMINANCE,"sensor.illuminance",   CAP_VALUE_INT,   "lux"},
-    {CAP_POWER_WATTS,       "power.watts",          CAP_VALUE_FLOAT, "W"},
-    {CAP_ENERGY_KWH,        "energy.kwh",           CAP_VALUE_FLOAT, "kWh"},
-};
+#define CAP_INFO_ROW(id, name, type, unit, cluster, attr) \
+    [id] = {id, name, type, unit},
+static const cap_info_t cap_info_table[CAP_MAX] = {CAP_DEFS(CAP_INFO_ROW)};
+
+/* Capability to source cluster, for commands */
+#define CAP_CLUSTER_ROW(id, name, type, unit, cluster, attr) [id] = cluster,
+static const uint16_t cap_cluster[CAP_MAX] = {CAP_DEFS(CAP_CLUSTER_ROW)};
+
+/* (cluster, attribute) to capability, in key order */
+#define CAP_KEY(cluster, attr) ((uint32_t)(cluster) << 16 | (uint16_t)(attr))
 
-/* Cluster to capability mapping */
 typedef struct {
-    uint16_t cluster_id;
-    uint16_t attr_id;
+    uint32_t key;
     cap_id_t cap_id;
-} cluster_cap_map_t;
-
-static const cluster_cap_map_t cluster_map[] = {
-    {ZCL_CLUSTER_ONOFF,       ZCL_ATTR_ONOFF,       CAP_LIGHT_ON},
-    {ZCL_CLUSTER_LEVEL,       ZCL_ATTR_LEVEL,       CAP_LIGHT_LEVEL},
-    {ZCL_CLUSTER_COLOR,       ZCL_ATTR_COLOR_TEMP,  CAP_LIGHT_COLOR_TEMP},
-    {ZCL_CLUSTER_TEMPERATURE, ZCL_ATTR_TEMPERATURE, CAP_SENSOR_TEMPERATURE},
-    {ZCL_CLUSTER_HUMIDITY,    ZCL_ATTR_HUMIDITY,    CAP_SENSOR_HUMIDITY},
+} cap_attr_map_t;
+
+#define CAP_ATTR_ROW(id, name, type, unit, cluster, attr) \
+    {CAP_KEY(cluster, attr), id},
+static const cap_attr_map_t attr_map[] = {CAP_DEFS(CAP_ATTR_ROW)};
+
+#define ATTR_MAP_LEN (sizeof(attr_map) / sizeof(attr_map[0]))
+
+/* Report filters: chatty sensors get a deadband and a heartbeat, the rest
+ * are change-only */
+static const cap_filter_t cap_filter_defaults[CAP_MAX] = {
+    [CAP_SENSOR_TEMPERATURE] = {.abs_delta = 0.1f, .max_interval_ms = CAP_FILTER_HEARTBEAT_MS},
+    [CAP_SENSOR_HUMIDITY]    = {.abs_delta = 0.5f, .max_interval_ms = CAP_FILTER_HEARTBEAT_MS},
+    [CAP_SENSOR_ILLUMINANCE] = {.rel_delta = 0.1f, .max_interval_ms = CAP_FILTER_HEARTBEAT_MS},
+    [CAP_POWER_WATTS]        = {.abs_delta = 0.5f, .rel_delta = 0.05f,
+                                .max_interval_ms = CAP_FILTER_HEARTBEAT_MS},
+    [CAP_ENERGY_KWH]         = {.abs_delta = 0.01f, .max_interval_ms = CAP_FILTER_HEARTBEAT_MS},
 };
 
-/* Maximum capabilities per node */
-#define MAX_NODE_CAPS 8
+#define CAP_INDEX_MASK (CAP_INDEX_SIZE - 1)
+
+_Static_assert((CAP_INDEX_SIZE & CAP_INDEX_MASK) == 0,
+               "CAP_INDEX_SIZE must be a power of two");
+_Static_assert(CAP_INDEX_SIZE >= 2 * CAP_MAX_NODES,
+               "CAP_INDEX_SIZE must be at least twice CAP_MAX_NODES");
+_Static_assert(CAP_MAX_STATES <= UINT16_MAX, "state offsets are 16 bit");
 
-/* Node capability cache */
+/* Node capability cache; its states are states[first, first + cap_count) */
 typedef struct {
     os_eui64_t node_addr;
-    cap_state_t caps[MAX_NODE_CAPS];
+    uint16_t first;
     uint8_t cap_count;
     bool valid;
 } node_cap_cache_t;
 
-#define MAX_CAP_CACHE 32
+/* Last known values live in the cache persistence tier, one record per
+ * node: version, count, then per value id, endpoint, type and 4 bytes LE.
+ * Version 1 entries had no endpoint and restore the first instance. */
+#define CAP_PERSIST_KEY_PREFIX "cap/"
+#define CAP_PERSIST_VERSION    2
+#define CAP_RECORD_ENTRY_LEN   7
+#define CAP_RECORD_V1_ENTRY_LEN 6
+#define CAP_RECORD_MAX         (2 + CAP_MAX_NODE_STATES * CAP_RECORD_ENTRY_LEN)
 
 /* Service state */
 static struct {
     bool initialized;
-    node_cap_cache_t cache[MAX_CAP_CACHE];
+    node_cap_cache_t cache[CAP_MAX_NODES];
+    /* Open-addressed by EUI64, linear probing; 0 = empty, else cache slot + 1 */
+    uint16_t index[CAP_INDEX_SIZE];
+    uint16_t nodes_used;
+    /* Per-node runs, packed in cache order of allocation with no gaps */
+    cap_state_t states[CAP_MAX_STATES];
+    uint16_t states_used;
+    cap_filter_t filters[CAP_MAX];
+    cap_filter_stats_t filter_stats[CAP_MAX];
+    /* Distinct transforms, shared by every instance compiled to them; at
+     * most one per quirk table action, so none is ever freed */
+    cap_xform_t xforms[CAP_MAX_XFORMS];
+    uint8_t xform_count;
 } service = {0};
 
 /* Internal functions */
 static node_cap_cache_t *find_cache(os_eui64_t node_addr);
 static node_cap_cache_t *alloc_cache(os_eui64_t node_addr);
+static void free_cache(node_cap_cache_t *cache);
+static cap_state_t *cache_caps(const node_cap_cache_t *cache);
+static bool cache_set_caps(node_cap_cache_t *cache, const cap_state_t *caps, uint8_t count);
 static cap_state_t *find_cap_in_cache(node_cap_cache_t *cache, cap_id_t cap_id);
-static void emit_state_changed(os_eui64_t node_addr, cap_id_t cap_id, const cap_value_t *value);
+static cap_state_t *find_instance(node_cap_cache_t *cache, uint8_t endpoint_id, cap_id_t cap_id);
+static void emit_cap_event(os_event_type_t type, os_eui64_t node_addr, const cap_state_t *cap);
+static void emit_dropped(const node_cap_cache_t *cache, const cap_state_t *caps, uint8_t count);
+static float value_num(const cap_state_t *cap);
+static uint8_t compile_xform(const quirk_entry_t *entry, cap_id_t cap_id);
+static void apply_xform(const cap_xform_t *x, cap_value_type_t type, cap_value_t *value);
+static bool filter_pass(cap_state_t *cap, float num, os_tick_t now);
+static void pass_on(node_cap_cache_t *cache, cap_state_t *cap, float num, os_tick_t now);
+static void value_key(os_eui64_t node_addr, char *key, size_t key_len);
+static void save_values(const node_cap_cache_t *cache);
+static uint32_t load_values(node_cap_cache_t *cache);
+static size_t attr_map_lower(uint32_t key);
+
+static void handle_node_left(const os_event_t *event, void *ctx) {
+    (void)ctx;
+    
+    if (event->payload_len >= sizeof(os_eui64_t)) {
+        os_eui64_t node_addr;
+        memcpy(&node_addr, event->payload, sizeof(node_addr));
+        cap_forget_node(node_addr);
+    }
+}
+
+static void mem_report_nodes(os_mem_region_t *region, void *ctx) {
+    (void)ctx;
+    region->used = service.nodes_used;
+    region->capacity = CAP_MAX_NODES;
+}
+
+static void mem_report_states(os_mem_region_t *region, void *ctx) {
+    (void)ctx;
+    region->used = service.states_used;
+    region->capacity = CAP_MAX_STATES;
+}
 
 os_err_t cap_init(void) {
     if (service.initialized) {
         return OS_ERR_ALREADY_EXISTS;
     }
     
+    if (!cap_attr_map_sorted()) {
+        return OS_ERR_INVALID_ARG;
+    }
+    
     memset(&service, 0, sizeof(service));
+    memcpy(service.filters, cap_filter_defaults, sizeof(service.filters));
     service.initialized = true;
     
-    LOG_I(CAP_MODULE, "Capability service initialized");
+    os_event_filter_t filter_left = {OS_EVENT_ZB_DEVICE_LEFT,
+                                     OS_EVENT_ZB_DEVICE_LEFT};
+    os_event_subscribe(&filter_left, handle_node_left, NULL);
+    
+    os_mem_register("cap.nodes", sizeof(service.cache) + sizeof(service.index),
+                    mem_report_nodes, NULL);
+    os_mem_register("cap.states", sizeof(service.states), mem_report_states,
+                    NULL);
+    
+    LOG_I(CAP_MODULE, "Capability service initialized (%u nodes, %u states)",
+          CAP_MAX_NODES, CAP_MAX_STATES);
     
     return OS_OK;
 }
@@ -108,57 +220,169 @@ uint32_t cap_compute_for_node(reg_node_t *node) {
         return 0;
     }
     
+    cap_state_t caps[CAP_MAX_NODE_STATES];
+    uint8_t count = 0;
+    
+    /* Scan all endpoints/clusters */
+    for (reg_endpoint_t *ep = reg_first_endpoint(node); ep; ep = reg_next_endpoint(ep)) {
+        for (reg_cluster_t *cl = reg_first_cluster(ep); cl; cl = reg_next_cluster(cl)) {
+            
+            if (cl->cluster_id == CAP_SRC_NONE) {
+                continue;
+            }
+            
+            /* Every capability sourced from this cluster */
+            for (size_t m = attr_map_lower(CAP_KEY(cl->cluster_id, 0));
+                 m < ATTR_MAP_LEN && (attr_map[m].key >> 16) == cl->cluster_id; m++) {
+                if (count < CAP_MAX_NODE_STATES) {
+                    cap_state_t *cap = &caps[count];
+                    cap->id = attr_map[m].cap_id;
+                    cap->type = cap_info_table[cap->id].type;
+                    cap->valid = false;  /* No value yet */
+                    cap->timestamp = 0;
+                    cap->endpoint_id = ep->endpoint_id;
+                    cap->sent = false;
+                    cap->sent_value = 0.0f;
+                    cap->sent_at = 0;
+                    
+                    /* Initialize default value */
+                    memset(&cap->value, 0, sizeof(cap->value));
+                    
+                    count++;
+                    
+                    LOG_D(CAP_MODULE, "Node " OS_EUI64_FMT " ep%d: added %s",
+                          OS_EUI64_ARG(node->ieee_addr), ep->endpoint_id,
+                          cap_info_table[cap->id].name);
+                }
+            }
+        }
+    }
+    
+    /* Order by endpoint, so the first instance found is the lowest one */
+    for (uint8_t i = 1; i < count; i++) {
+        cap_state_t cap = caps[i];
+        uint8_t j = i;
+        for (; j > 0 && caps[j - 1].endpoint_id > cap.endpoint_id; j--) {
+            caps[j] = caps[j - 1];
+        }
+        caps[j] = cap;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        caps[i].instances = 0;
+        for (uint8_t j = 0; j < count; j++) {
+            if (caps[j].id == caps[i].id) {
+                caps[i].instances++;
+            }
+        }
+    }
+    
+    /* Match the quirks table once; reports only run the compiled result */
+    const quirk_entry_t *quirk = quirks_find(reg_str(node->manufacturer),
+                                             reg_str(node->model));
+    uint32_t quirked = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        caps[i].xform = quirk ? compile_xform(quirk, caps[i].id) : 0;
+        quirked += caps[i].xform != 0;
+    }
+    
     node_cap_cache_t *cache = find_cache(node->ieee_addr);
+    if (cache) {
+        emit_dropped(cache, caps, count);
+    }
+    if (count == 0) {
+        if (cache) {
+            free_cache(cache);
+        }
+        return 0;
+    }
     if (!cache) {
         cache = alloc_cache(node->ieee_addr);
     }
-    if (!cache) {
-        LOG_E(CAP_MODULE, "Failed to allocate capability cache");
+    if (!cache || !cache_set_caps(cache, caps, count)) {
+        LOG_W(CAP_MODULE, "Capability store full, node " OS_EUI64_FMT " not tracked",
+              OS_EUI64_ARG(node->ieee_addr));
+        if (cache) {
+            free_cache(cache);
+        }
         return 0;
     }
     
-    /* Clear existing caps */
-    cache->cap_count = 0;
+    /* Start from the last known values rather than "unknown" */
+    uint32_t warm = load_values(cache);
     
-    /* Scan all endpoints/clusters */
-    for (uint8_t ep_idx = 0; ep_idx < REG_MAX_ENDPOINTS; ep_idx++) {
-        reg_endpoint_t *ep = &node->endpoints[ep_idx];
-        if (!ep->valid) continue;
-        
-        for (uint8_t cl_idx = 0; cl_idx < REG_MAX_CLUSTERS; cl_idx++) {
-            reg_cluster_t *cl = &ep->clusters[cl_idx];
-            if (!cl->valid) continue;
-            
-            /* Check cluster mapping */
-            for (size_t m = 0; m < sizeof(cluster_map) / sizeof(cluster_map[0]); m++) {
-                if (cluster_map[m].cluster_id == cl->cluster_id) {
-                    /* Found a match - add capability */
-                    if (cache->cap_count < MAX_NODE_CAPS) {
-                        cap_state_t *cap = &cache->caps[cache->cap_count];
-                        cap->id = cluster_map[m].cap_id;
-                        cap->type = cap_info_table[cap->id].type;
-                        cap->valid = false;  /* No value yet */
-                        cap->timestamp = 0;
-                        
-                        /* Initialize default value */
-                        memset(&cap->value, 0, sizeof(cap->value));
-                        
-                        cache->cap_count++;
-                        
-                        LOG_D(CAP_MODULE, "Node " OS_EUI64_FMT " ep%d: added %s",
-                              OS_EUI64_ARG(node->ieee_addr), ep->endpoint_id,
-                              cap_info_table[cap->id].name);
-                    }
-                    break;
-                }
-            }
+    LOG_I(CAP_MODULE, "Node " OS_EUI64_FMT ": computed %d capabilities (%" PRIu32
+          " restored, %" PRIu32 " with quirks)",
+          OS_EUI64_ARG(node->ieee_addr), cache->cap_count, warm, quirked);
+    
+    return cache->cap_count;
+}
+
+uint32_t cap_restore(void) {
+    if (!service.initialized) {
+        return 0;
+    }
+    
+    /* Only nodes exposing a mapped cluster can have capabilities */
+    reg_node_set_t candidates;
+    memset(&candidates, 0, sizeof(candidates));
+    for (size_t m = 0; m < ATTR_MAP_LEN; m++) {
+        uint16_t cluster_id = (uint16_t)(attr_map[m].key >> 16);
+        if (cluster_id == CAP_SRC_NONE) {
+            break;
+        }
+        if (m > 0 && (attr_map[m - 1].key >> 16) == cluster_id) {
+            continue;
+        }
+        reg_node_set_t with_cluster;
+        if (reg_query_cluster(cluster_id, &with_cluster) == OS_OK) {
+            reg_node_set_or(&candidates, &with_cluster);
+        }
+    }
+    
+    uint32_t nodes = 0;
+    reg_iter_t it;
+    reg_iter_begin_set(&it, &candidates);
+    for (reg_node_t *node = reg_iter_next(&it); node; node = reg_iter_next(&it)) {
+        if (cap_compute_for_node(node) > 0) {
+            nodes++;
         }
     }
     
-    LOG_I(CAP_MODULE, "Node " OS_EUI64_FMT ": computed %d capabilities",
-          OS_EUI64_ARG(node->ieee_addr), cache->cap_count);
+    return nodes;
+}
+
+void cap_forget_node(os_eui64_t node_addr) {
+    node_cap_cache_t *cache = find_cache(node_addr);
+    if (!cache) {
+        return;
+    }
     
-    return cache->cap_count;
+    const cap_state_t *caps = cache_caps(cache);
+    for (uint8_t i = 0; i < cache->cap_count; i++) {
+        emit_cap_event(OS_EVENT_CAP_REMOVED, node_addr, &caps[i]);
+    }
+    free_cache(cache);
+    
+    char key[OS_PERSIST_KEY_MAX];
+    value_key(node_addr, key, sizeof(key));
+    os_persist_del(key);
+}
+
+void cap_get_stats(cap_stats_t *stats) {
+    if (!stats) {
+        return;
+    }
+    
+    stats->nodes_used = service.nodes_used;
+    stats->nodes_total = CAP_MAX_NODES;
+    stats->states_used = service.states_used;
+    stats->states_total = CAP_MAX_STATES;
+    stats->reports_passed = 0;
+    stats->reports_suppressed = 0;
+    for (int i = 0; i < CAP_MAX; i++) {
+        stats->reports_passed += service.filter_stats[i].passed;
+        stats->reports_suppressed += service.filter_stats[i].suppressed;
+    }
 }
 
 os_err_t cap_get_state(os_eui64_t node_addr, cap_id_t cap_id, cap_state_t *out_state) {
@@ -180,6 +404,43 @@ os_err_t cap_get_state(os_eui64_t node_addr, cap_id_t cap_id, cap_state_t *out_s
     return OS_OK;
 }
 
+os_err_t cap_get_instance_state(os_eui64_t node_addr, uint8_t endpoint_id,
+                                cap_id_t cap_id, cap_state_t *out_state) {
+    if (!service.initialized || !out_state) {
+        return OS_ERR_INVALID_ARG;
+    }
+    
+    cap_state_t *cap = find_instance(find_cache(node_addr), endpoint_id, cap_id);
+    if (!cap) {
+        return OS_ERR_NOT_FOUND;
+    }
+    
+    *out_state = *cap;
+    return OS_OK;
+}
+
+uint32_t cap_get_instances(os_eui64_t node_addr, cap_state_t *out, uint32_t max) {
+    node_cap_cache_t *cache = service.initialized ? find_cache(node_addr) : NULL;
+    if (!cache || !out) {
+        return 0;
+    }
+    
+    uint32_t count = cache->cap_count < max ? cache->cap_count : max;
+    memcpy(out, cache_caps(cache), count * sizeof(cap_state_t));
+    return count;
+}
+
+const char *cap_instance_name(char *buf, size_t len, cap_id_t cap_id,
+                              uint8_t endpoint_id, uint8_t instances) {
+    const char *name = cap_id < CAP_MAX ? cap_info_table[cap_id].name : "unknown";
+    if (instances > 1) {
+        snprintf(buf, len, "%s_ep%u", name, endpoint_id);
+    } else {
+        snprintf(buf, len, "%s", name);
+    }
+    return buf;
+}
+
 os_err_t cap_handle_attribute_report(os_eui64_t node_addr, uint8_t endpoint_id,
                                       uint16_t cluster_id, uint16_t attr_id,
                                       const reg_attr_value_t *value) {
@@ -187,18 +448,8 @@ os_err_t cap_handle_attribute_report(os_eui64_t node_addr, uint8_t endpoint_id,
         return OS_ERR_INVALID_ARG;
     }
     
-    (void)endpoint_id;  /* For future use */
-    
     /* Find matching capability */
-    cap_id_t cap_id = CAP_UNKNOWN;
-    for (size_t m = 0; m < sizeof(cluster_map) / sizeof(cluster_map[0]); m++) {
-        if (cluster_map[m].cluster_id == cluster_id &&
-            cluster_map[m].attr_id == attr_id) {
-            cap_id = cluster_map[m].cap_id;
-            break;
-        }
-    }
-    
+    cap_id_t cap_id = cap_lookup_attr(cluster_id, attr_id);
     if (cap_id == CAP_UNKNOWN) {
         return OS_OK;  /* Not a mapped attribute */
     }
@@ -209,10 +460,14 @@ os_err_t cap_handle_attribute_report(os_eui64_t node_addr, uint8_t endpoint_id,
         return OS_ERR_NOT_FOUND;
     }
     
-    /* Find capability */
-    cap_state_t *cap = find_cap_in_cache(cache, cap_id);
+    /* Find the instance; a sole instance also takes reports from other
+     * endpoints, as some devices send them from endpoint 1 regardless */
+    cap_state_t *cap = find_instance(cache, endpoint_id, cap_id);
     if (!cap) {
-        return OS_ERR_NOT_FOUND;
+        cap = find_cap_in_cache(cache, cap_id);
+        if (!cap || cap->instances > 1) {
+            return OS_ERR_NOT_FOUND;
+        }
     }
     
     /* Update value based on type */
@@ -244,20 +499,60 @@ os_err_t cap_handle_attribute_report(os_eui64_t node_addr, uint8_t endpoint_id,
             break;
     }
     
+    if (cap->xform) {
+        apply_xform(&service.xforms[cap->xform - 1], cap->type, &new_value);
+    }
+    
     /* Update state */
+    os_tick_t now = os_now_ticks();
     cap->value = new_value;
-    cap->timestamp = os_now_ticks();
+    cap->timestamp = now;
     cap->valid = true;
     
-    /* Emit event */
-    emit_state_changed(node_addr, cap_id, &new_value);
+    /* Readers see every report; consumers only what passes the filter */
+    float num = value_num(cap);
+    if (!filter_pass(cap, num, now)) {
+        service.filter_stats[cap_id].suppressed++;
+        return OS_OK;
+    }
+    pass_on(cache, cap, num, now);
     
-    LOG_D(CAP_MODULE, "Node " OS_EUI64_FMT " %s updated",
-          OS_EUI64_ARG(node_addr), cap_info_table[cap_id].name);
+    LOG_D(CAP_MODULE, "Node " OS_EUI64_FMT " ep%d %s updated",
+          OS_EUI64_ARG(node_addr), cap->endpoint_id, cap_info_table[cap_id].name);
     
     return OS_OK;
 }
 
+uint32_t cap_flush_held(os_tick_t now) {
+    uint32_t flushed = 0;
+    
+    for (uint32_t i = 0; i < CAP_MAX_NODES; i++) {
+        node_cap_cache_t *cache = &service.cache[i];
+        if (!cache->valid) {
+            continue;
+        }
+        cap_state_t *caps = cache_caps(cache);
+        for (uint8_t j = 0; j < cache->cap_count; j++) {
+            cap_state_t *cap = &caps[j];
+            if (!cap->held ||
+                (os_tick_t)(now - cap->sent_at) <
+                    OS_MS_TO_TICKS(service.filters[cap->id].min_interval_ms)) {
+                continue;
+            }
+            /* Re-checked against the latest value; a change that was
+             * undone within the interval is dropped */
+            cap->held = false;
+            float num = value_num(cap);
+            if (filter_pass(cap, num, now)) {
+                pass_on(cache, cap, num, now);
+                flushed++;
+            }
+        }
+    }
+    
+    return flushed;
+}
+
 os_err_t cap_execute_command(const cap_command_t *cmd) {
     if (!service.initialized || !cmd) {
         return OS_ERR_INVALID_ARG;
@@ -267,26 +562,78 @@ os_err_t cap_execute_command(const cap_command_t *cmd) {
           OS_EUI64_ARG(cmd->node_addr), cap_info_table[cmd->cap_id].name, cmd->cmd_type);
     
     /* Find the cluster mapping */
-    uint16_t cluster_id = 0;
-    for (size_t m = 0; m < sizeof(cluster_map) / sizeof(cluster_map[0]); m++) {
-        if (cluster_map[m].cap_id == cmd->cap_id) {
-            cluster_id = cluster_map[m].cluster_id;
-            break;
-        }
-    }
-    
-    if (cluster_id == 0) {
+    if (cmd->cap_id >= CAP_MAX || cap_cluster[cmd->cap_id] == CAP_SRC_NONE) {
         LOG_E(CAP_MODULE, "No cluster mapping for capability %d", cmd->cap_id);
         return OS_ERR_NOT_FOUND;
     }
     
     /* In real implementation, this would send Zigbee command */
-    /* For now, emit a CAP_COMMAND event for the Zigbee adapter to handle */
-    os_event_emit(OS_EVENT_CAP_COMMAND, cmd, sizeof(*cmd));
+    /* For now, emit a CAP_COMMAND event for the Zigbee adapter to handle.
+     * The payload keeps the head of the command (the target); the
+     * correlation ID, further in, travels in the event itself */
+    os_event_t event = {0};
+    event.type = OS_EVENT_CAP_COMMAND;
+    event.timestamp = os_now_ticks();
+    event.corr_id = cmd->corr_id;
+    event.payload_len = sizeof(*cmd) < OS_EVENT_PAYLOAD_SIZE ? sizeof(*cmd) : OS_EVENT_PAYLOAD_SIZE;
+    memcpy(event.payload, cmd, event.payload_len);
+    os_event_publish(&event);
+    
+    return OS_OK;
+}
+
+os_err_t cap_get_filter(cap_id_t cap_id, cap_filter_t *out) {
+    if (cap_id <= CAP_UNKNOWN || cap_id >= CAP_MAX || !out) {
+        return OS_ERR_INVALID_ARG;
+    }
+    
+    *out = service.filters[cap_id];
+    return OS_OK;
+}
+
+os_err_t cap_set_filter(cap_id_t cap_id, const cap_filter_t *filter) {
+    if (cap_id <= CAP_UNKNOWN || cap_id >= CAP_MAX || !filter ||
+        !(filter->abs_delta >= 0.0f) || !(filter->rel_delta >= 0.0f)) {
+        return OS_ERR_INVALID_ARG;
+    }
     
+    service.filters[cap_id] = *filter;
     return OS_OK;
 }
 
+os_err_t cap_get_filter_stats(cap_id_t cap_id, cap_filter_stats_t *out) {
+    if (cap_id <= CAP_UNKNOWN || cap_id >= CAP_MAX || !out) {
+        return OS_ERR_INVALID_ARG;
+    }
+    
+    *out = service.filter_stats[cap_id];
+    return OS_OK;
+}
+
+cap_id_t cap_lookup_attr(uint16_t cluster_id, uint16_t attr_id) {
+    if (cluster_id == CAP_SRC_NONE) {
+        return CAP_UNKNOWN;
+    }
+    
+    uint32_t key = CAP_KEY(cluster_id, attr_id);
+    size_t m = attr_map_lower(key);
+    return m < ATTR_MAP_LEN && attr_map[m].key == key ? attr_map[m].cap_id : CAP_UNKNOWN;
+}
+
+/* Sourced rows strictly ascending, unsourced ones last */
+bool cap_attr_map_sorted(void) {
+    for (size_t m = 1; m < ATTR_MAP_LEN; m++) {
+        uint32_t prev = attr_map[m - 1].key;
+        if (attr_map[m].key < prev ||
+            (attr_map[m].key == prev && (prev >> 16) != CAP_SRC_NONE)) {
+            LOG_E(CAP_MODULE, "CAP_DEFS out of (cluster, attribute) order at %s",
+                  cap_info_table[attr_map[m].cap_id].name);
+            return false;
+        }
+    }
+    return true;
+}
+
 const cap_info_t *cap_get_info(cap_id_t id) {
     if (id < CAP_MAX) {
         return &cap_info_table[id];
@@ -311,53 +658,395 @@ void cap_task(void *arg) {
     LOG_I(CAP_MODULE, "Capability task started");
     
     while (1) {
-        /* Process capability events */
-        /* In real implementation, this would handle reconciliation */
-        os_sleep(1000);
+        cap_flush_held(os_now_ticks());
+        os_sleep(CAP_FLUSH_PERIOD_MS);
     }
 }
 
 /* Internal functions */
 
-static node_cap_cache_t *find_cache(os_eui64_t node_addr) {
-    for (uint32_t i = 0; i < MAX_CAP_CACHE; i++) {
-        if (service.cache[i].valid && service.cache[i].node_addr == node_addr) {
-            return &service.cache[i];
+/* First attr_map entry with a key not below key */
+static size_t attr_map_lower(uint32_t key) {
+    size_t lo = 0;
+    size_t hi = ATTR_MAP_LEN;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (attr_map[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
     }
-    return NULL;
+    return lo;
+}
+
+/* 64-bit finaliser (MurmurHash3 fmix64); EUI64s share long OUI prefixes */
+static uint32_t eui_hash(os_eui64_t addr) {
+    uint64_t h = addr;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return (uint32_t)h;
+}
+
+/* Index position holding node_addr, or -1 */
+static int32_t index_find(os_eui64_t node_addr) {
+    uint32_t pos = eui_hash(node_addr) & CAP_INDEX_MASK;
+    for (uint32_t n = 0; n < CAP_INDEX_SIZE; n++) {
+        uint16_t slot = service.index[pos];
+        if (slot == 0) {
+            return -1;
+        }
+        if (service.cache[slot - 1].node_addr == node_addr) {
+            return (int32_t)pos;
+        }
+        pos = (pos + 1) & CAP_INDEX_MASK;
+    }
+    return -1;
+}
+
+/* Backward-shift deletion, as in the registry's node index */
+static void index_remove(uint32_t pos) {
+    service.index[pos] = 0;
+    uint32_t hole = pos;
+    uint32_t j = pos;
+    while (1) {
+        j = (j + 1) & CAP_INDEX_MASK;
+        uint16_t slot = service.index[j];
+        if (slot == 0) {
+            return;
+        }
+        uint32_t home = eui_hash(service.cache[slot - 1].node_addr) & CAP_INDEX_MASK;
+        bool home_between = (hole <= j) ? (home > hole && home <= j)
+                                        : (home > hole || home <= j);
+        if (!home_between) {
+            service.index[hole] = slot;
+            service.index[j] = 0;
+            hole = j;
+        }
+    }
+}
+
+static node_cap_cache_t *find_cache(os_eui64_t node_addr) {
+    int32_t pos = index_find(node_addr);
+    return pos < 0 ? NULL : &service.cache[service.index[pos] - 1];
 }
 
 static node_cap_cache_t *alloc_cache(os_eui64_t node_addr) {
-    for (uint32_t i = 0; i < MAX_CAP_CACHE; i++) {
-        if (!service.cache[i].valid) {
-            service.cache[i].node_addr = node_addr;
-            service.cache[i].cap_count = 0;
-            service.cache[i].valid = true;
-            return &service.cache[i];
+    for (uint32_t i = 0; i < CAP_MAX_NODES; i++) {
+        node_cap_cache_t *cache = &service.cache[i];
+        if (!cache->valid) {
+            cache->node_addr = node_addr;
+            cache->first = service.states_used;
+            cache->cap_count = 0;
+            cache->valid = true;
+            
+            uint32_t pos = eui_hash(node_addr) & CAP_INDEX_MASK;
+            while (service.index[pos] != 0) {
+                pos = (pos + 1) & CAP_INDEX_MASK;
+            }
+            service.index[pos] = (uint16_t)(i + 1);
+            service.nodes_used++;
+            return cache;
         }
     }
     return NULL;
 }
 
+/* Close the gap a node's run leaves, keeping the state pool packed */
+static void release_states(node_cap_cache_t *cache) {
+    uint16_t first = cache->first;
+    uint16_t count = cache->cap_count;
+    if (count == 0) {
+        return;
+    }
+    
+    memmove(&service.states[first], &service.states[first + count],
+            (size_t)(service.states_used - first - count) * sizeof(cap_state_t));
+    service.states_used -= count;
+    for (uint32_t i = 0; i < CAP_MAX_NODES; i++) {
+        if (service.cache[i].valid && service.cache[i].first > first) {
+            service.cache[i].first -= count;
+        }
+    }
+    cache->cap_count = 0;
+    cache->first = service.states_used;
+}
+
+static void free_cache(node_cap_cache_t *cache) {
+    release_states(cache);
+    int32_t pos = index_find(cache->node_addr);
+    if (pos >= 0) {
+        index_remove((uint32_t)pos);
+    }
+    cache->valid = false;
+    service.nodes_used--;
+}
+
+static cap_state_t *cache_caps(const node_cap_cache_t *cache) {
+    return &service.states[cache->first];
+}
+
+/* Replace a node's states with a run of exactly count entries */
+static bool cache_set_caps(node_cap_cache_t *cache, const cap_state_t *caps, uint8_t count) {
+    release_states(cache);
+    if (service.states_used + count > CAP_MAX_STATES) {
+        return false;
+    }
+    
+    cache->first = service.states_used;
+    cache->cap_count = count;
+    memcpy(&service.states[cache->first], caps, count * sizeof(cap_state_t));
+    service.states_used += count;
+    return true;
+}
+
 static cap_state_t *find_cap_in_cache(node_cap_cache_t *cache, cap_id_t cap_id) {
     if (!cache) return NULL;
     
+    cap_state_t *caps = cache_caps(cache);
     for (uint8_t i = 0; i < cache->cap_count; i++) {
-        if (cache->caps[i].id == cap_id) {
-            return &cache->caps[i];
+        if (caps[i].id == cap_id) {
+            return &caps[i];
         }
     }
     return NULL;
 }
 
-static void emit_state_changed(os_eui64_t node_addr, cap_id_t cap_id, const cap_value_t *value) {
-    /* Payload for CAP_STATE_CHANGED event */
-    struct {
-        os_eui64_t node_addr;
-        cap_id_t cap_id;
-        cap_value_t value;
-    } payload = {node_addr, cap_id, *value};
+/* Node runs hold at most CAP_MAX_NODE_STATES entries, so this is bounded */
+static cap_state_t *find_instance(node_cap_cache_t *cache, uint8_t endpoint_id, cap_id_t cap_id) {
+    if (!cache) return NULL;
+    
+    cap_state_t *caps = cache_caps(cache);
+    for (uint8_t i = 0; i < cache->cap_count; i++) {
+        if (caps[i].id == cap_id && caps[i].endpoint_id == endpoint_id) {
+            return &caps[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Announce the instances of a recomputed node that do not carry over to
+ * the new set: gone, or renamed because the instance count crossed one.
+ * The old state is sent, so listeners clear the name it was known by.
+ */
+static void emit_dropped(const node_cap_cache_t *cache, const cap_state_t *caps, uint8_t count) {
+    const cap_state_t *old = cache_caps(cache);
+    for (uint8_t i = 0; i < cache->cap_count; i++) {
+        bool kept = false;
+        for (uint8_t j = 0; j < count && !kept; j++) {
+            kept = caps[j].id == old[i].id &&
+                   caps[j].endpoint_id == old[i].endpoint_id &&
+                   (caps[j].instances > 1) == (old[i].instances > 1);
+        }
+        if (!kept) {
+            emit_cap_event(OS_EVENT_CAP_REMOVED, cache->node_addr, &old[i]);
+        }
+    }
+}
+
+static void emit_cap_event(os_event_type_t type, os_eui64_t node_addr, const cap_state_t *cap) {
+    cap_event_t payload = {
+        .node_addr = node_addr,
+        .cap_id = cap->id,
+        .endpoint_id = cap->endpoint_id,
+        .instances = cap->instances,
+        .value = cap->value,
+    };
+    
+    os_event_emit(type, &payload, sizeof(payload));
+}
+
+static float value_num(const cap_state_t *cap) {
+    switch (cap->type) {
+        case CAP_VALUE_BOOL:
+            return cap->value.b ? 1.0f : 0.0f;
+        case CAP_VALUE_INT:
+            return (float)cap->value.i;
+        case CAP_VALUE_FLOAT:
+            return cap->value.f;
+        default:
+            return 0.0f;
+    }
+}
+
+/* Intern the transform of entry for cap_id; 0 when it has none */
+static uint8_t compile_xform(const quirk_entry_t *entry, cap_id_t cap_id) {
+    cap_xform_t x;
+    if (quirks_compile(entry, cap_id, &x) == 0) {
+        return 0;
+    }
+    
+    for (uint8_t i = 0; i < service.xform_count; i++) {
+        if (memcmp(&service.xforms[i], &x, sizeof(x)) == 0) {
+            return (uint8_t)(i + 1);
+        }
+    }
+    if (service.xform_count >= CAP_MAX_XFORMS) {
+        LOG_W(CAP_MODULE, "Quirk transform table full, %s not corrected",
+              cap_info_table[cap_id].name);
+        return 0;
+    }
+    
+    service.xforms[service.xform_count++] = x;
+    return service.xform_count;
+}
+
+static void apply_xform(const cap_xform_t *x, cap_value_type_t type, cap_value_t *value) {
+    float f;
+    switch (type) {
+        case CAP_VALUE_BOOL:
+            value->b ^= x->invert;
+            return;
+        case CAP_VALUE_INT:
+            f = (float)value->i;
+            break;
+        case CAP_VALUE_FLOAT:
+            f = value->f;
+            break;
+        default:
+            return;
+    }
+    
+    f = f * x->mul + x->add;
+    f = f < x->lo ? x->lo : f > x->hi ? x->hi : f;
+    if (type == CAP_VALUE_INT) {
+        value->i = (int32_t)(f + (f < 0.0f ? -0.5f : 0.5f));
+    } else {
+        value->f = f;
+    }
+}
+
+/* Whether a report carrying num should be passed on; one held back only
+ * by min_interval is marked for cap_flush_held() */
+static bool filter_pass(cap_state_t *cap, float num, os_tick_t now) {
+    if (!cap->sent || cap->type == CAP_VALUE_STRING) {
+        return true;
+    }
+    
+    const cap_filter_t *f = &service.filters[cap->id];
+    os_tick_t since = now - cap->sent_at;
+    if (f->max_interval_ms && since >= OS_MS_TO_TICKS(f->max_interval_ms)) {
+        return true;  /* Heartbeat */
+    }
+    
+    float last = cap->sent_value;
+    float delta = num > last ? num - last : last - num;
+    float band = f->rel_delta * (last < 0.0f ? -last : last);
+    if (f->abs_delta > band) {
+        band = f->abs_delta;
+    }
+    bool moved = band > 0.0f ? delta >= band : delta != 0.0f;
+    
+    if (moved && f->min_interval_ms && since < OS_MS_TO_TICKS(f->min_interval_ms)) {
+        cap->held = true;
+        return false;
+    }
+    return moved;
+}
+
+/* Send a value the filter passed to consumers */
+static void pass_on(node_cap_cache_t *cache, cap_state_t *cap, float num, os_tick_t now) {
+    service.filter_stats[cap->id].passed++;
+    cap->sent = true;
+    cap->held = false;
+    cap->sent_value = num;
+    cap->sent_at = now;
+    
+    emit_cap_event(OS_EVENT_CAP_STATE_CHANGED, cache->node_addr, cap);
+    
+    /* Trend store keeps x100 fixed point, one series per (node, capability)
+     * following its first instance; untracked pairs are ignored */
+    if ((cap->type == CAP_VALUE_FLOAT || cap->type == CAP_VALUE_INT) &&
+        cap == find_cap_in_cache(cache, cap->id)) {
+        int32_t x100 = cap->type == CAP_VALUE_FLOAT
+                           ? (int32_t)(cap->value.f * 100.0f + (cap->value.f < 0 ? -0.5f : 0.5f))
+                           : cap->value.i * 100;
+        history_record(cache->node_addr, cap->id, x100, os_uptime_s());
+    }
+    
+    /* Remember it across reboots; repeated reports coalesce in RAM */
+    save_values(cache);
+}
+
+static void value_key(os_eui64_t node_addr, char *key, size_t key_len) {
+    snprintf(key, key_len, CAP_PERSIST_KEY_PREFIX OS_EUI64_FMT, OS_EUI64_ARG(node_addr));
+}
+
+static void save_values(const node_cap_cache_t *cache) {
+    uint8_t buf[CAP_RECORD_MAX];
+    size_t len = 2;
+    uint8_t count = 0;
+    
+    const cap_state_t *caps = cache_caps(cache);
+    for (uint8_t i = 0; i < cache->cap_count; i++) {
+        const cap_state_t *cap = &caps[i];
+        if (!cap->valid || cap->type == CAP_VALUE_STRING) {
+            continue;
+        }
+        
+        uint32_t bits;
+        memcpy(&bits, &cap->value, sizeof(bits));
+        buf[len++] = (uint8_t)cap->id;
+        buf[len++] = cap->endpoint_id;
+        buf[len++] = (uint8_t)cap->type;
+        for (int b = 0; b < 4; b++) {
+            buf[len++] = (uint8_t)(bits >> (8 * b));
+        }
+        count++;
+    }
+    
+    buf[0] = CAP_PERSIST_VERSION;
+    buf[1] = count;
+    
+    char key[OS_PERSIST_KEY_MAX];
+    value_key(cache->node_addr, key, sizeof(key));
+    os_persist_put_tier(key, buf, len, OS_PERSIST_TIER_CACHE);
+}
+
+static uint32_t load_values(node_cap_cache_t *cache) {
+    uint8_t buf[CAP_RECORD_MAX];
+    size_t len = 0;
+    char key[OS_PERSIST_KEY_MAX];
+    value_key(cache->node_addr, key, sizeof(key));
+    
+    if (os_persist_get(key, buf, sizeof(buf), &len) != OS_OK || len < 2 ||
+        len > sizeof(buf)) {
+        return 0;
+    }
+    
+    /* Version 1 entries lack the endpoint byte */
+    bool v1 = buf[0] == 1;
+    size_t entry_len = v1 ? CAP_RECORD_V1_ENTRY_LEN : CAP_RECORD_ENTRY_LEN;
+    if ((!v1 && buf[0] != CAP_PERSIST_VERSION) || len < 2 + (size_t)buf[1] * entry_len) {
+        return 0;
+    }
+    
+    uint32_t warm = 0;
+    for (uint8_t n = 0; n < buf[1]; n++) {
+        const uint8_t *p = &buf[2 + n * entry_len];
+        cap_state_t *cap = v1 ? find_cap_in_cache(cache, (cap_id_t)p[0])
+                              : find_instance(cache, p[1], (cap_id_t)p[0]);
+        p += entry_len - 5;
+        
+        /* Skip values whose capability or type no longer matches */
+        if (!cap || cap->type != (cap_value_type_t)p[0]) {
+            continue;
+        }
+        
+        uint32_t bits = (uint32_t)p[1] | ((uint32_t)p[2] << 8) |
+                        ((uint32_t)p[3] << 16) | ((uint32_t)p[4] << 24);
+        memset(&cap->value, 0, sizeof(cap->value));
+        memcpy(&cap->value, &bits, sizeof(bits));
+        cap->timestamp = 0;  /* Known, but from before this boot */
+        cap->valid = true;
+        warm++;
+        
+        emit_cap_event(OS_EVENT_CAP_STATE_CHANGED, cache->node_addr, cap);
+    }
     
-    os_event_emit(OS_EVENT_CAP_STATE_CHANGED, &payload, sizeof(payload));
+    return warm;
 }
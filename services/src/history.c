@@ -0,0 +1,382 @@
+/**
+ * @file history.c
+ * @brief Capability time-series history implementation
+ *
+ * ESP32-C6 Zigbee Bridge OS - Fixed-memory trend store
+ *
+ * The raw ring holds the oldest sample in absolute form (first_s,
+ * first_value) and every later one as a pair of varints: seconds since the
+ * previous sample and the zigzagged value change. Slowly moving sensors
+ * cost 2 bytes per sample. Rollup buckets sit at slot (start / period) %
+ * slots, so no head pointer is needed and stale slots are recognised by
+ * their start time.
+ */
+
+#include "history.h"
+#include "os.h"
+#include <string.h>
+
+#define HISTORY_MODULE "HIST"
+
+#define MINUTE_S 60u
+#define HOUR_S 3600u
+
+/* Longest encoded sample: two 5-byte varints */
+#define SAMPLE_MAX_BYTES 10
+
+_Static_assert(HISTORY_RAW_BYTES >= SAMPLE_MAX_BYTES,
+               "raw ring must hold at least one encoded sample");
+
+typedef struct {
+  uint32_t start_s;
+  int32_t min;
+  int32_t max;
+  uint32_t count;
+  int64_t sum;
+} history_bucket_t;
+
+typedef struct {
+  os_eui64_t node_addr;
+  cap_id_t cap_id;
+  bool valid;
+  uint16_t head;    /* Byte offset of the oldest delta */
+  uint16_t used;    /* Encoded bytes in the ring */
+  uint32_t samples; /* Including the absolute first sample */
+  uint32_t first_s;
+  int32_t first_value;
+  uint32_t last_s;
+  int32_t last_value;
+  uint8_t raw[HISTORY_RAW_BYTES];
+  history_bucket_t minutes[HISTORY_MINUTE_SLOTS];
+  history_bucket_t hours[HISTORY_HOUR_SLOTS];
+} history_series_t;
+
+/* Service state */
+static struct {
+  bool initialized;
+  history_series_t series[HISTORY_MAX_SERIES];
+} service = {0};
+
+static uint32_t zigzag(int32_t v) {
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t v) {
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static uint8_t put_varint(uint8_t *buf, uint32_t v) {
+  uint8_t n = 0;
+  while (v >= 0x80) {
+    buf[n++] = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  buf[n++] = (uint8_t)v;
+  return n;
+}
+
+/* Decode a varint at byte pos of the ring; returns bytes consumed */
+static uint16_t ring_varint(const history_series_t *s, uint16_t pos,
+                            uint32_t *out) {
+  uint32_t v = 0;
+  uint16_t n = 0;
+  uint8_t byte;
+  do {
+    byte = s->raw[(s->head + pos + n) % HISTORY_RAW_BYTES];
+    v |= (uint32_t)(byte & 0x7F) << (7 * n);
+    n++;
+  } while ((byte & 0x80) && n < 5);
+  *out = v;
+  return n;
+}
+
+/* Decode the delta at pos into (t, v); returns bytes consumed */
+static uint16_t ring_sample(const history_series_t *s, uint16_t pos,
+                            uint32_t *t, int32_t *v) {
+  uint32_t dt, dv;
+  uint16_t n = ring_varint(s, pos, &dt);
+  n += ring_varint(s, pos + n, &dv);
+  *t += dt;
+  *v = (int32_t)((uint32_t)*v + (uint32_t)unzigzag(dv));
+  return n;
+}
+
+/* Fold the oldest delta into the absolute first sample */
+static void raw_drop_oldest(history_series_t *s) {
+  uint16_t n = ring_sample(s, 0, &s->first_s, &s->first_value);
+  s->head = (uint16_t)((s->head + n) % HISTORY_RAW_BYTES);
+  s->used -= n;
+  s->samples--;
+}
+
+static void raw_append(history_series_t *s, uint32_t time_s, int32_t value) {
+  if (s->samples == 0) {
+    s->first_s = s->last_s = time_s;
+    s->first_value = s->last_value = value;
+    s->samples = 1;
+    return;
+  }
+
+  uint8_t rec[SAMPLE_MAX_BYTES];
+  uint8_t n = put_varint(rec, time_s - s->last_s);
+  n += put_varint(rec + n,
+                  zigzag((int32_t)((uint32_t)value - (uint32_t)s->last_value)));
+
+  while (s->used + n > HISTORY_RAW_BYTES) {
+    raw_drop_oldest(s);
+  }
+  for (uint8_t i = 0; i < n; i++) {
+    s->raw[(s->head + s->used + i) % HISTORY_RAW_BYTES] = rec[i];
+  }
+  s->used += n;
+  s->samples++;
+  s->last_s = time_s;
+  s->last_value = value;
+}
+
+static void bucket_add(history_bucket_t *ring, uint32_t slots,
+                       uint32_t period, uint32_t time_s, int32_t value) {
+  uint32_t start = time_s - time_s % period;
+  history_bucket_t *b = &ring[(time_s / period) % slots];
+
+  if (b->count == 0 || b->start_s != start) {
+    b->start_s = start;
+    b->min = b->max = value;
+    b->sum = 0;
+    b->count = 0;
+  }
+  if (value < b->min) {
+    b->min = value;
+  }
+  if (value > b->max) {
+    b->max = value;
+  }
+  b->sum += value;
+  b->count++;
+}
+
+static history_series_t *find_series(os_eui64_t node_addr, cap_id_t cap_id) {
+  for (uint32_t i = 0; i < HISTORY_MAX_SERIES; i++) {
+    history_series_t *s = &service.series[i];
+    if (s->valid && s->node_addr == node_addr && s->cap_id == cap_id) {
+      return s;
+    }
+  }
+  return NULL;
+}
+
+static void handle_node_left(const os_event_t *event, void *ctx) {
+  (void)ctx;
+
+  if (event->payload_len >= sizeof(os_eui64_t)) {
+    os_eui64_t node_addr;
+    memcpy(&node_addr, event->payload, sizeof(node_addr));
+    history_forget_node(node_addr);
+  }
+}
+
+static void mem_report_series(os_mem_region_t *region, void *ctx) {
+  (void)ctx;
+  history_stats_t stats;
+  history_get_stats(&stats);
+  region->used = stats.series_used;
+  region->capacity = stats.series_total;
+}
+
+os_err_t history_init(void) {
+  if (service.initialized) {
+    return OS_ERR_ALREADY_EXISTS;
+  }
+
+  memset(&service, 0, sizeof(service));
+  service.initialized = true;
+
+  os_event_filter_t filter_left = {OS_EVENT_ZB_DEVICE_LEFT,
+                                   OS_EVENT_ZB_DEVICE_LEFT};
+  os_event_subscribe(&filter_left, handle_node_left, NULL);
+
+  os_mem_register("history.series", sizeof(service.series), mem_report_series,
+                  NULL);
+
+  LOG_I(HISTORY_MODULE, "History store initialized (%u series, %u bytes)",
+        HISTORY_MAX_SERIES, (unsigned)sizeof(service.series));
+
+  return OS_OK;
+}
+
+os_err_t history_track(os_eui64_t node_addr, cap_id_t cap_id) {
+  if (!service.initialized) {
+    return OS_ERR_NOT_INITIALIZED;
+  }
+
+  const cap_info_t *info = cap_get_info(cap_id);
+  if (!info || (info->type != CAP_VALUE_INT && info->type != CAP_VALUE_FLOAT)) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  if (find_series(node_addr, cap_id)) {
+    return OS_OK;
+  }
+
+  for (uint32_t i = 0; i < HISTORY_MAX_SERIES; i++) {
+    history_series_t *s = &service.series[i];
+    if (!s->valid) {
+      memset(s, 0, sizeof(*s));
+      s->node_addr = node_addr;
+      s->cap_id = cap_id;
+      s->valid = true;
+      LOG_D(HISTORY_MODULE, "Tracking " OS_EUI64_FMT " %s",
+            OS_EUI64_ARG(node_addr), info->name);
+      return OS_OK;
+    }
+  }
+
+  LOG_W(HISTORY_MODULE, "No free series for " OS_EUI64_FMT " %s",
+        OS_EUI64_ARG(node_addr), info->name);
+  return OS_ERR_NO_MEM;
+}
+
+os_err_t history_untrack(os_eui64_t node_addr, cap_id_t cap_id) {
+  history_series_t *s = find_series(node_addr, cap_id);
+  if (!s) {
+    return OS_ERR_NOT_FOUND;
+  }
+  s->valid = false;
+  return OS_OK;
+}
+
+void history_forget_node(os_eui64_t node_addr) {
+  for (uint32_t i = 0; i < HISTORY_MAX_SERIES; i++) {
+    if (service.series[i].node_addr == node_addr) {
+      service.series[i].valid = false;
+    }
+  }
+}
+
+bool history_is_tracked(os_eui64_t node_addr, cap_id_t cap_id) {
+  return find_series(node_addr, cap_id) != NULL;
+}
+
+os_err_t history_record(os_eui64_t node_addr, cap_id_t cap_id,
+                        int32_t value_x100, uint32_t time_s) {
+  history_series_t *s = find_series(node_addr, cap_id);
+  if (!s) {
+    return OS_ERR_NOT_FOUND;
+  }
+
+  /* Deltas are unsigned; late samples land at the newest time */
+  if (s->samples > 0 && time_s < s->last_s) {
+    time_s = s->last_s;
+  }
+
+  raw_append(s, time_s, value_x100);
+  bucket_add(s->minutes, HISTORY_MINUTE_SLOTS, MINUTE_S, time_s, value_x100);
+  bucket_add(s->hours, HISTORY_HOUR_SLOTS, HOUR_S, time_s, value_x100);
+
+  return OS_OK;
+}
+
+static uint32_t query_raw(const history_series_t *s, uint32_t since_s,
+                          history_point_t *out, uint32_t max) {
+  /* First pass counts eligible samples so only the newest max are kept */
+  uint32_t eligible = 0;
+  uint32_t t = s->first_s;
+  int32_t v = s->first_value;
+  uint16_t pos = 0;
+  for (uint32_t i = 0; i < s->samples; i++) {
+    if (i > 0) {
+      pos += ring_sample(s, pos, &t, &v);
+    }
+    if (t >= since_s) {
+      eligible++;
+    }
+  }
+
+  uint32_t skip = eligible > max ? eligible - max : 0;
+  uint32_t written = 0;
+  t = s->first_s;
+  v = s->first_value;
+  pos = 0;
+  for (uint32_t i = 0; i < s->samples && written < max; i++) {
+    if (i > 0) {
+      pos += ring_sample(s, pos, &t, &v);
+    }
+    if (t < since_s) {
+      continue;
+    }
+    if (skip > 0) {
+      skip--;
+      continue;
+    }
+    out[written++] = (history_point_t){t, v, v, v, 1};
+  }
+  return written;
+}
+
+static uint32_t query_buckets(const history_bucket_t *ring, uint32_t slots,
+                              uint32_t period, uint32_t newest_s,
+                              uint32_t since_s, history_point_t *out,
+                              uint32_t max) {
+  uint32_t newest = newest_s / period;
+  uint32_t oldest = newest >= slots ? newest - slots + 1 : 0;
+
+  uint32_t eligible = 0;
+  for (uint32_t p = oldest; p <= newest; p++) {
+    const history_bucket_t *b = &ring[p % slots];
+    if (b->count && b->start_s == p * period && b->start_s >= since_s) {
+      eligible++;
+    }
+  }
+
+  uint32_t skip = eligible > max ? eligible - max : 0;
+  uint32_t written = 0;
+  for (uint32_t p = oldest; p <= newest && written < max; p++) {
+    const history_bucket_t *b = &ring[p % slots];
+    if (!b->count || b->start_s != p * period || b->start_s < since_s) {
+      continue;
+    }
+    if (skip > 0) {
+      skip--;
+      continue;
+    }
+    out[written++] = (history_point_t){b->start_s, b->min, b->max,
+                                       (int32_t)(b->sum / b->count), b->count};
+  }
+  return written;
+}
+
+uint32_t history_query(os_eui64_t node_addr, cap_id_t cap_id,
+                       history_res_t res, uint32_t since_s,
+                       history_point_t *out, uint32_t max) {
+  const history_series_t *s = find_series(node_addr, cap_id);
+  if (!s || !out || max == 0 || s->samples == 0) {
+    return 0;
+  }
+
+  switch (res) {
+  case HISTORY_RES_RAW:
+    return query_raw(s, since_s, out, max);
+  case HISTORY_RES_MINUTE:
+    return query_buckets(s->minutes, HISTORY_MINUTE_SLOTS, MINUTE_S,
+                         s->last_s, since_s, out, max);
+  case HISTORY_RES_HOUR:
+    return query_buckets(s->hours, HISTORY_HOUR_SLOTS, HOUR_S, s->last_s,
+                         since_s, out, max);
+  }
+  return 0;
+}
+
+void history_get_stats(history_stats_t *stats) {
+  if (!stats) {
+    return;
+  }
+
+  memset(stats, 0, sizeof(*stats));
+  for (uint32_t i = 0; i < HISTORY_MAX_SERIES; i++) {
+    if (service.series[i].valid) {
+      stats->series_used++;
+    }
+  }
+  stats->series_total = HISTORY_MAX_SERIES;
+  stats->bytes_total = sizeof(service.series);
+}
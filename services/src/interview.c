@@ -6,6 +6,7 @@
  */
 
 #include "interview.h"
+#include "capability.h"
 #include "registry.h"
 #include "os.h"
 #include <string.h>
@@ -62,6 +63,12 @@ static interview_ctx_t *alloc_interview(os_eui64_t ieee_addr);
 static void free_interview(interview_ctx_t *ctx);
 static void advance_interview(interview_ctx_t *ctx);
 
+static void mem_report_interviews(os_mem_region_t *region, void *ctx) {
+    (void)ctx;
+    region->used = service.active_count;
+    region->capacity = MAX_INTERVIEWS;
+}
+
 os_err_t interview_init(void) {
     if (service.initialized) {
         return OS_ERR_ALREADY_EXISTS;
@@ -70,6 +77,9 @@ os_err_t interview_init(void) {
     memset(&service, 0, sizeof(service));
     service.initialized = true;
     
+    os_mem_register("interview.slots", sizeof(service.interviews),
+                    mem_report_interviews, NULL);
+    
     LOG_I(INTERVIEW_MODULE, "Interview service initialized");
     
     return OS_OK;
@@ -264,10 +274,12 @@ static void simulate_basic_attributes(interview_ctx_t *ctx) {
     if (!node) return;
     
     /* Set node metadata */
-    strncpy(node->manufacturer, "Test Manufacturer", REG_MANUFACTURER_LEN - 1);
-    strncpy(node->model, "Test Model", REG_MODEL_LEN - 1);
+    reg_set_manufacturer(node, "Test Manufacturer");
+    reg_set_model(node, "Test Model");
+    reg_will_write(node);
     node->sw_build = 1;
     node->power_source = REG_POWER_MAINS;
+    reg_mark_dirty(node);
     
     LOG_D(INTERVIEW_MODULE, "Simulated basic attributes");
 }
@@ -323,6 +335,12 @@ static void advance_interview(interview_ctx_t *ctx) {
             /* Update node state */
             reg_set_state(node, REG_STATE_READY);
             
+            /* Capabilities and their quirk transforms, resolved once here */
+            cap_compute_for_node(node);
+            
+            /* Store the interviewed node so it survives a reboot */
+            reg_persist();
+            
             /* Emit event */
             os_event_emit(OS_EVENT_CAP_STATE_CHANGED, &ctx->ieee_addr, sizeof(ctx->ieee_addr));
             
@@ -0,0 +1,328 @@
+/**
+ * @file liveness.c
+ * @brief Node liveness tracking implementation
+ *
+ * ESP32-C6 Zigbee Bridge OS - Node availability service
+ *
+ * The head of each registry liveness list is the class's next deadline, so
+ * a sweep stops at the first node still within its timeout and the task
+ * sleeps until the earliest head expires. Sleeps are capped at the mains
+ * timeout: a node that becomes READY meanwhile cannot expire sooner.
+ *
+ * Probing a mains node touches it, moving it to the tail of its list, and
+ * queues the probe. Probes share one timeout, so the queue is ordered by
+ * deadline and a sweep only looks at its head. A mains node that cannot be
+ * probed is touched too, and asked again at its next deadline: silence
+ * alone never takes it OFFLINE.
+ */
+
+#include "liveness.h"
+#include "mqtt_adapter.h"
+#include "os.h"
+#include "registry.h"
+#include "zb_adapter.h"
+#include <inttypes.h>
+#include <string.h>
+
+#define LIVENESS_MODULE "LIVE"
+
+#define ZCL_CLUSTER_BASIC 0x0000
+#define ZCL_ATTR_ZCL_VERSION 0x0000
+
+static const uint32_t class_timeout_s[REG_LIVENESS_CLASSES] = {
+    [REG_LIVENESS_MAINS] = LIVENESS_MAINS_TIMEOUT_S,
+    [REG_LIVENESS_SLEEPY] = LIVENESS_SLEEPY_TIMEOUT_S,
+};
+
+/* Probe awaiting an answer */
+typedef struct {
+  os_eui64_t node_addr;
+  os_corr_id_t corr_id;
+  os_tick_t deadline;
+} probe_t;
+
+typedef enum {
+  PROBE_SENT = 0,
+  PROBE_UNABLE, /* No endpoint known or the request failed; retried later */
+  PROBE_BUSY,   /* Already probing the node, or the queue is full */
+} probe_result_t;
+
+/* Command sent to a node, so its confirm counts as traffic from it */
+typedef struct {
+  os_eui64_t node_addr;
+  os_corr_id_t corr_id;
+} sent_cmd_t;
+
+/* Service state */
+static struct {
+  bool initialized;
+  probe_t probes[LIVENESS_PROBE_MAX]; /* Oldest first */
+  uint32_t probe_count;
+  sent_cmd_t cmds[LIVENESS_CMD_TRACK]; /* Ring of recent commands */
+  uint32_t cmd_next;
+  liveness_stats_t stats;
+} service = {0};
+
+static os_tick_t class_timeout(reg_liveness_class_t cls) {
+  return OS_MS_TO_TICKS(class_timeout_s[cls] * 1000u);
+}
+
+static int probe_find_node(os_eui64_t node_addr) {
+  for (uint32_t i = 0; i < service.probe_count; i++) {
+    if (service.probes[i].node_addr == node_addr) {
+      return (int)i;
+    }
+  }
+  return -1;
+}
+
+static void probe_drop(int index) {
+  service.probe_count--;
+  memmove(&service.probes[index], &service.probes[index + 1],
+          (service.probe_count - (uint32_t)index) * sizeof(probe_t));
+}
+
+static probe_result_t probe_start(reg_node_t *node, os_tick_t now) {
+  if (probe_find_node(node->ieee_addr) >= 0 ||
+      service.probe_count >= LIVENESS_PROBE_MAX) {
+    return PROBE_BUSY;
+  }
+
+  static const uint16_t attr = ZCL_ATTR_ZCL_VERSION;
+  reg_endpoint_t *ep = reg_first_endpoint(node);
+  os_corr_id_t corr_id = os_event_new_corr_id();
+  if (!ep ||
+      zba_read_attrs(node->ieee_addr, ep->endpoint_id, ZCL_CLUSTER_BASIC,
+                     &attr, 1, corr_id) != OS_OK) {
+    LOG_D(LIVENESS_MODULE, "Cannot probe " OS_EUI64_FMT ", kept READY",
+          OS_EUI64_ARG(node->ieee_addr));
+    service.stats.unprobed++;
+    reg_touch_node(node);
+    return PROBE_UNABLE;
+  }
+
+  service.probes[service.probe_count++] = (probe_t){
+      .node_addr = node->ieee_addr,
+      .corr_id = corr_id,
+      .deadline = now + OS_MS_TO_TICKS(LIVENESS_PROBE_TIMEOUT_S * 1000u),
+  };
+  service.stats.probed++;
+  reg_touch_node(node);
+  return PROBE_SENT;
+}
+
+static void expire(reg_node_t *node) {
+  /* Leaving READY unlinks the node, exposing the next deadline */
+  reg_set_state(node, REG_STATE_OFFLINE);
+  mqtt_publish_availability(node->ieee_addr, false);
+}
+
+static void handle_node_traffic(const os_event_t *event, void *ctx) {
+  (void)ctx;
+
+  /* Reports and announces both start with the sender's IEEE address */
+  if (event->payload_len >= sizeof(os_eui64_t)) {
+    os_eui64_t node_addr;
+    memcpy(&node_addr, event->payload, sizeof(node_addr));
+    liveness_touch(node_addr);
+  }
+}
+
+static void handle_cmd_confirm(const os_event_t *event, void *ctx) {
+  (void)ctx;
+
+  /* Adapters carry the correlation ID in the event or ahead of the payload */
+  os_corr_id_t corr_id = event->corr_id;
+  if (corr_id == 0 && event->payload_len >= sizeof(corr_id)) {
+    memcpy(&corr_id, event->payload, sizeof(corr_id));
+  }
+  if (corr_id == 0) {
+    return;
+  }
+
+  for (uint32_t i = 0; i < service.probe_count; i++) {
+    if (service.probes[i].corr_id == corr_id) {
+      liveness_touch(service.probes[i].node_addr);
+      return;
+    }
+  }
+
+  for (uint32_t i = 0; i < LIVENESS_CMD_TRACK; i++) {
+    sent_cmd_t *cmd = &service.cmds[i];
+    if (cmd->corr_id == corr_id) {
+      cmd->corr_id = 0;
+      liveness_touch(cmd->node_addr);
+      return;
+    }
+  }
+}
+
+/* Commands carry the target first and their correlation ID in the event */
+static void handle_cap_command(const os_event_t *event, void *ctx) {
+  (void)ctx;
+
+  if (event->corr_id == 0 || event->payload_len < sizeof(os_eui64_t)) {
+    return;
+  }
+  sent_cmd_t *cmd = &service.cmds[service.cmd_next++ % LIVENESS_CMD_TRACK];
+  memcpy(&cmd->node_addr, event->payload, sizeof(cmd->node_addr));
+  cmd->corr_id = event->corr_id;
+}
+
+/* Retained state is not available on every broker; resend on reconnect */
+static void handle_net_up(const os_event_t *event, void *ctx) {
+  (void)event;
+  (void)ctx;
+
+  reg_filter_t filter = {.states = REG_STATE_BIT(REG_STATE_OFFLINE)};
+  reg_iter_t it;
+  reg_iter_begin(&it, &filter);
+  for (reg_node_t *node = reg_iter_next(&it); node;
+       node = reg_iter_next(&it)) {
+    mqtt_publish_availability(node->ieee_addr, false);
+  }
+}
+
+os_err_t liveness_init(void) {
+  if (service.initialized) {
+    return OS_ERR_ALREADY_EXISTS;
+  }
+
+  memset(&service, 0, sizeof(service));
+  service.initialized = true;
+
+  os_event_filter_t filter_report = {OS_EVENT_ZB_ATTR_REPORT,
+                                     OS_EVENT_ZB_ATTR_REPORT};
+  os_event_subscribe(&filter_report, handle_node_traffic, NULL);
+
+  os_event_filter_t filter_announce = {OS_EVENT_ZB_ANNOUNCE,
+                                       OS_EVENT_ZB_ANNOUNCE};
+  os_event_subscribe(&filter_announce, handle_node_traffic, NULL);
+
+  os_event_filter_t filter_confirm = {OS_EVENT_ZB_CMD_CONFIRM,
+                                      OS_EVENT_ZB_CMD_CONFIRM};
+  os_event_subscribe(&filter_confirm, handle_cmd_confirm, NULL);
+
+  os_event_filter_t filter_command = {OS_EVENT_CAP_COMMAND,
+                                      OS_EVENT_CAP_COMMAND};
+  os_event_subscribe(&filter_command, handle_cap_command, NULL);
+
+  os_event_filter_t filter_net = {OS_EVENT_NET_UP, OS_EVENT_NET_UP};
+  os_event_subscribe(&filter_net, handle_net_up, NULL);
+
+  LOG_I(LIVENESS_MODULE,
+        "Liveness initialized (mains %us, sleepy %us)",
+        LIVENESS_MAINS_TIMEOUT_S, LIVENESS_SLEEPY_TIMEOUT_S);
+
+  return OS_OK;
+}
+
+void liveness_touch(os_eui64_t node_addr) {
+  reg_node_t *node = reg_find_node(node_addr);
+  if (!node) {
+    return;
+  }
+
+  int probe = probe_find_node(node_addr);
+  if (probe >= 0) {
+    probe_drop(probe);
+    service.stats.answered++;
+  }
+
+  reg_touch_node(node);
+  if (node->state == REG_STATE_OFFLINE) {
+    reg_set_state(node, REG_STATE_READY);
+    service.stats.revived++;
+    mqtt_publish_availability(node_addr, true);
+  }
+}
+
+uint32_t liveness_sweep(os_tick_t now) {
+  uint32_t expired = 0;
+
+  /* Unanswered probes; the node may have left or changed state since */
+  while (service.probe_count > 0 &&
+         (int32_t)(now - service.probes[0].deadline) >= 0) {
+    reg_node_t *node = reg_find_node(service.probes[0].node_addr);
+    probe_drop(0);
+    if (node && node->state == REG_STATE_READY) {
+      LOG_I(LIVENESS_MODULE, "Node " OS_EUI64_FMT " did not answer probe",
+            OS_EUI64_ARG(node->ieee_addr));
+      expire(node);
+      expired++;
+    }
+  }
+
+  for (int cls = 0; cls < REG_LIVENESS_CLASSES; cls++) {
+    os_tick_t timeout = class_timeout((reg_liveness_class_t)cls);
+    reg_node_t *node;
+    reg_node_t *first_deferred = NULL;
+    while ((node = reg_liveness_oldest((reg_liveness_class_t)cls)) &&
+           node != first_deferred &&
+           (os_tick_t)(now - node->last_seen) >= timeout) {
+      if (cls == REG_LIVENESS_MAINS) {
+        /* Deferred nodes are touched to the tail; meeting the first again
+         * means only deferred ones are left */
+        if (probe_start(node, now) == PROBE_BUSY) {
+          break; /* Retried once a probe resolves */
+        }
+        if (!first_deferred) {
+          first_deferred = node;
+        }
+        continue;
+      }
+      LOG_I(LIVENESS_MODULE, "Node " OS_EUI64_FMT " silent for %" PRIu32 "s",
+            OS_EUI64_ARG(node->ieee_addr),
+            (uint32_t)(OS_TICKS_TO_MS(now - node->last_seen) / 1000));
+      expire(node);
+      expired++;
+    }
+  }
+
+  service.stats.expired += expired;
+  return expired;
+}
+
+uint32_t liveness_next_deadline_ms(os_tick_t now) {
+  os_tick_t next = class_timeout(REG_LIVENESS_MAINS);
+
+  if (service.probe_count > 0) {
+    os_tick_t deadline = service.probes[0].deadline;
+    next = (int32_t)(deadline - now) <= 0 ? 0 : deadline - now;
+  }
+
+  for (int cls = 0; cls < REG_LIVENESS_CLASSES; cls++) {
+    reg_node_t *node = reg_liveness_oldest((reg_liveness_class_t)cls);
+    if (!node) {
+      continue;
+    }
+    os_tick_t elapsed = now - node->last_seen;
+    os_tick_t timeout = class_timeout((reg_liveness_class_t)cls);
+    os_tick_t left = elapsed >= timeout ? 0 : timeout - elapsed;
+    if (left < next) {
+      next = left;
+    }
+  }
+
+  return OS_TICKS_TO_MS(next);
+}
+
+void liveness_get_stats(liveness_stats_t *stats) {
+  if (stats) {
+    *stats = service.stats;
+  }
+}
+
+void liveness_task(void *arg) {
+  (void)arg;
+
+  LOG_I(LIVENESS_MODULE, "Liveness task started");
+
+  while (1) {
+    liveness_sweep(os_now_ticks());
+
+    uint32_t sleep_ms = liveness_next_deadline_ms(os_now_ticks());
+    os_sleep(sleep_ms < LIVENESS_MIN_SLEEP_MS ? LIVENESS_MIN_SLEEP_MS
+                                              : sleep_ms);
+  }
+}
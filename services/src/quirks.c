@@ -138,6 +138,71 @@ const quirk_entry_t *quirks_find(const char *manufacturer, const char *model) {
     return NULL;
 }
 
+uint8_t quirks_compile(const quirk_entry_t *entry, cap_id_t cap_id,
+                       cap_xform_t *out) {
+    if (!out) {
+        return 0;
+    }
+    
+    /* Zeroed first so equal transforms compare equal with memcmp */
+    memset(out, 0, sizeof(*out));
+    out->mul = 1.0f;
+    out->lo = -INFINITY;
+    out->hi = INFINITY;
+    
+    if (!entry || entry->action_count > QUIRK_MAX_ACTIONS) {
+        return 0;
+    }
+    
+    uint8_t folded = 0;
+    for (uint8_t i = 0; i < entry->action_count; i++) {
+        const quirk_action_t *action = &entry->actions[i];
+        if (action->target_cap != cap_id) {
+            continue;
+        }
+        
+        switch (action->type) {
+            case QUIRK_ACTION_CLAMP_RANGE: {
+                /* clamp(clamp(x, lo, hi), a, b) = clamp(x, clamp(lo, a, b), clamp(hi, a, b)) */
+                float a = (float)action->params.clamp.min;
+                float b = (float)action->params.clamp.max;
+                out->lo = out->lo < a ? a : out->lo > b ? b : out->lo;
+                out->hi = out->hi < a ? a : out->hi > b ? b : out->hi;
+                break;
+            }
+                
+            case QUIRK_ACTION_INVERT_BOOLEAN:
+                out->invert ^= action->params.invert.enabled;
+                break;
+                
+            case QUIRK_ACTION_SCALE_NUMERIC: {
+                /* Scaling after a clamp scales its bounds; a negative
+                 * multiplier swaps them, zero makes the value constant */
+                float m = action->params.scale.multiplier;
+                float o = action->params.scale.offset;
+                out->mul *= m;
+                out->add = out->add * m + o;
+                if (m == 0.0f) {
+                    out->lo = -INFINITY;
+                    out->hi = INFINITY;
+                } else {
+                    float lo = out->lo * m + o;
+                    float hi = out->hi * m + o;
+                    out->lo = m > 0.0f ? lo : hi;
+                    out->hi = m > 0.0f ? hi : lo;
+                }
+                break;
+            }
+                
+            default:
+                continue;
+        }
+        folded++;
+    }
+    
+    return folded;
+}
+
 os_err_t quirks_apply_value(const char *manufacturer, const char *model,
                              cap_id_t cap_id, cap_value_t *value,
                              quirk_result_t *result) {
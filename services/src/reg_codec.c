@@ -0,0 +1,422 @@
+/**
+ * @file reg_codec.c
+ * @brief Compact binary encoding of registry nodes
+ *
+ * ESP32-C6 Zigbee Bridge OS - Registry persistence format
+ *
+ * A node record is a version byte followed by TLV items
+ * (tag u8, len u8, value). Multi-byte integers are little-endian.
+ * ENDPOINT items open an endpoint; CLUSTER items attach to the most recent
+ * endpoint and ATTR items to the most recent cluster. Only valid endpoints,
+ * clusters and essential (Basic cluster) attributes are stored. Unknown tags
+ * are skipped so newer records stay readable by older firmware.
+ *
+ * Version history:
+ *   v1 - initial layout
+ *   v2 - records end with an END item carrying the item count, so a record
+ *        cut short on an item boundary is rejected instead of restoring a
+ *        node with endpoints missing
+ * Metadata strings were written inline (MANUFACTURER/MODEL/NAME); they are
+ * now written as one STRINGS item of string table IDs, which needs the str/
+ * records persisted alongside. Both forms are read.
+ * Older records are upgraded by os_persist on first read (see
+ * reg_codec_register_migrations).
+ */
+
+#include "os.h"
+#include "registry.h"
+#include <string.h>
+
+/* Record format version (first byte of every node record) */
+#define REG_CODEC_VERSION 2
+
+/* TLV tags */
+#define TAG_IDENT 0x01        /* ieee u64, nwk u16 */
+#define TAG_STATE 0x02        /* state u8, power u8, lqi u8, stage u8 */
+#define TAG_SW_BUILD 0x03     /* u32 */
+#define TAG_MANUFACTURER 0x04 /* string, no terminator */
+#define TAG_MODEL 0x05        /* string */
+#define TAG_NAME 0x06         /* string */
+#define TAG_STRINGS 0x07      /* manufacturer, model, name IDs, u16 each */
+#define TAG_ENDPOINT 0x10     /* ep u8, profile u16, device u16 */
+#define TAG_CLUSTER 0x11      /* cluster u16, direction u8 */
+#define TAG_ATTR 0x12         /* attr u16, type u8, value bytes */
+#define TAG_END 0xFF          /* item count u16 (v2+) */
+
+/* Attributes that identify a device and must survive reboot */
+#define ZCL_CLUSTER_BASIC 0x0000
+
+typedef struct {
+  uint8_t *buf;
+  size_t len;
+  size_t pos;
+  uint16_t items;
+  bool overflow;
+} tlv_writer_t;
+
+static void put_bytes(tlv_writer_t *w, const void *data, size_t len) {
+  if (w->overflow || w->pos + len > w->len) {
+    w->overflow = true;
+    return;
+  }
+  memcpy(&w->buf[w->pos], data, len);
+  w->pos += len;
+}
+
+static void put_u8(tlv_writer_t *w, uint8_t v) { put_bytes(w, &v, 1); }
+
+static void put_u16(tlv_writer_t *w, uint16_t v) {
+  uint8_t b[2] = {(uint8_t)v, (uint8_t)(v >> 8)};
+  put_bytes(w, b, sizeof(b));
+}
+
+static void put_u32(tlv_writer_t *w, uint32_t v) {
+  uint8_t b[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16),
+                  (uint8_t)(v >> 24)};
+  put_bytes(w, b, sizeof(b));
+}
+
+static void put_u64(tlv_writer_t *w, uint64_t v) {
+  put_u32(w, (uint32_t)v);
+  put_u32(w, (uint32_t)(v >> 32));
+}
+
+static void put_tag(tlv_writer_t *w, uint8_t tag, uint8_t len) {
+  put_u8(w, tag);
+  put_u8(w, len);
+  w->items++;
+}
+
+static void put_end(tlv_writer_t *w) {
+  uint16_t items = w->items;
+  put_tag(w, TAG_END, 2);
+  put_u16(w, items);
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+  return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+static void get_string(char *dst, size_t dst_len, const uint8_t *src,
+                       size_t len) {
+  if (len >= dst_len) {
+    len = dst_len - 1;
+  }
+  memcpy(dst, src, len);
+  dst[len] = '\0';
+}
+
+/* Point a metadata field at an interned string, releasing the old one */
+static void set_field(reg_str_t *field, reg_str_t id) {
+  reg_str_release(*field);
+  *field = id;
+}
+
+static void get_interned(reg_str_t *field, const uint8_t *src, size_t len) {
+  char s[REG_STR_MAX_LEN];
+  get_string(s, sizeof(s), src, len);
+  set_field(field, reg_str_intern(s));
+}
+
+/* Encoded size of an attribute value, or 0 if the type is not stored */
+static size_t attr_value_size(const reg_attribute_t *attr) {
+  switch (attr->type) {
+  case REG_ATTR_TYPE_BOOL:
+  case REG_ATTR_TYPE_U8:
+  case REG_ATTR_TYPE_S8:
+    return 1;
+  case REG_ATTR_TYPE_U16:
+  case REG_ATTR_TYPE_S16:
+    return 2;
+  case REG_ATTR_TYPE_U32:
+  case REG_ATTR_TYPE_S32:
+    return 4;
+  case REG_ATTR_TYPE_STRING:
+    return strnlen(attr->value.str, sizeof(attr->value.str));
+  default:
+    return 0;
+  }
+}
+
+static void put_attr(tlv_writer_t *w, const reg_attribute_t *attr) {
+  size_t n = attr_value_size(attr);
+  if (n == 0 && attr->type != REG_ATTR_TYPE_STRING) {
+    return;
+  }
+
+  put_tag(w, TAG_ATTR, (uint8_t)(3 + n));
+  put_u16(w, attr->attr_id);
+  put_u8(w, (uint8_t)attr->type);
+  if (attr->type == REG_ATTR_TYPE_STRING) {
+    put_bytes(w, attr->value.str, n);
+  } else if (n == 1) {
+    put_u8(w, attr->value.u8);
+  } else if (n == 2) {
+    put_u16(w, attr->value.u16);
+  } else {
+    put_u32(w, attr->value.u32);
+  }
+}
+
+os_err_t reg_node_encode(const reg_node_t *node, uint8_t *buf, size_t buf_len,
+                         size_t *out_len) {
+  if (!node || !node->valid || !buf) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  tlv_writer_t w = {buf, buf_len, 0, 0, false};
+
+  put_u8(&w, REG_CODEC_VERSION);
+
+  put_tag(&w, TAG_IDENT, 10);
+  put_u64(&w, node->ieee_addr);
+  put_u16(&w, node->nwk_addr);
+
+  put_tag(&w, TAG_STATE, 4);
+  put_u8(&w, (uint8_t)node->state);
+  put_u8(&w, (uint8_t)node->power_source);
+  put_u8(&w, node->lqi);
+  put_u8(&w, node->interview_stage);
+
+  if (node->sw_build) {
+    put_tag(&w, TAG_SW_BUILD, 4);
+    put_u32(&w, node->sw_build);
+  }
+
+  if (node->manufacturer || node->model || node->friendly_name) {
+    put_tag(&w, TAG_STRINGS, 6);
+    put_u16(&w, node->manufacturer);
+    put_u16(&w, node->model);
+    put_u16(&w, node->friendly_name);
+  }
+
+  for (const reg_endpoint_t *ep = reg_first_endpoint(node); ep;
+       ep = reg_next_endpoint(ep)) {
+    put_tag(&w, TAG_ENDPOINT, 5);
+    put_u8(&w, ep->endpoint_id);
+    put_u16(&w, ep->profile_id);
+    put_u16(&w, ep->device_id);
+
+    for (const reg_cluster_t *cl = reg_first_cluster(ep); cl;
+         cl = reg_next_cluster(cl)) {
+      put_tag(&w, TAG_CLUSTER, 3);
+      put_u16(&w, cl->cluster_id);
+      put_u8(&w, (uint8_t)cl->direction);
+
+      if (cl->cluster_id != ZCL_CLUSTER_BASIC) {
+        continue;
+      }
+      for (const reg_attribute_t *attr = reg_first_attribute(cl); attr;
+           attr = reg_next_attribute(attr)) {
+        put_attr(&w, attr);
+      }
+    }
+  }
+
+  put_end(&w);
+
+  if (w.overflow) {
+    return OS_ERR_NO_MEM;
+  }
+
+  if (out_len) {
+    *out_len = w.pos;
+  }
+  return OS_OK;
+}
+
+static void decode_attr(reg_cluster_t *cl, const uint8_t *v, uint8_t len) {
+  if (!cl || len < 3) {
+    return;
+  }
+
+  reg_attr_type_t type = (reg_attr_type_t)v[2];
+  reg_attr_value_t value;
+  memset(&value, 0, sizeof(value));
+  const uint8_t *data = v + 3;
+  size_t n = (size_t)len - 3;
+  if (type == REG_ATTR_TYPE_STRING) {
+    get_string(value.str, sizeof(value.str), data, n);
+  } else if (n == 1) {
+    value.u8 = data[0];
+  } else if (n == 2) {
+    value.u16 = get_u16(data);
+  } else if (n >= 4) {
+    value.u32 = get_u32(data);
+  }
+  reg_update_attribute(cl, get_u16(v), type, &value);
+}
+
+os_err_t reg_node_decode(const uint8_t *buf, size_t len, reg_node_t *node) {
+  if (!buf || !node || len < 1) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  if (buf[0] != REG_CODEC_VERSION) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  memset(node, 0, sizeof(*node));
+  /* Children are added through the registry, which wants a live node */
+  node->valid = true;
+
+  os_err_t err = OS_OK;
+  reg_endpoint_t *ep = NULL;
+  reg_cluster_t *cl = NULL;
+  bool have_ident = false;
+  bool have_end = false;
+  uint16_t items = 0;
+  size_t pos = 1;
+
+  while (!have_end && pos + 2 <= len) {
+    uint8_t tag = buf[pos];
+    uint8_t tlen = buf[pos + 1];
+    const uint8_t *v = &buf[pos + 2];
+    pos += 2;
+    if (pos + tlen > len) {
+      err = OS_ERR_INVALID_ARG;
+      break;
+    }
+    pos += tlen;
+
+    switch (tag) {
+    case TAG_IDENT:
+      if (tlen >= 10) {
+        node->ieee_addr = get_u64(v);
+        node->nwk_addr = get_u16(v + 8);
+        have_ident = true;
+      }
+      break;
+
+    case TAG_STATE:
+      if (tlen >= 4) {
+        /* Both index registry tables: out of range means a damaged record */
+        if (v[0] > REG_STATE_LEFT || v[1] > REG_POWER_DC) {
+          err = OS_ERR_INVALID_ARG;
+          break;
+        }
+        node->state = (reg_state_t)v[0];
+        node->power_source = (reg_power_source_t)v[1];
+        node->lqi = v[2];
+        node->interview_stage = v[3];
+      }
+      break;
+
+    case TAG_SW_BUILD:
+      if (tlen >= 4) {
+        node->sw_build = get_u32(v);
+      }
+      break;
+
+    case TAG_MANUFACTURER:
+      get_interned(&node->manufacturer, v, tlen);
+      break;
+
+    case TAG_MODEL:
+      get_interned(&node->model, v, tlen);
+      break;
+
+    case TAG_NAME:
+      get_interned(&node->friendly_name, v, tlen);
+      break;
+
+    case TAG_STRINGS:
+      if (tlen >= 6) {
+        set_field(&node->manufacturer, reg_str_acquire(get_u16(v)));
+        set_field(&node->model, reg_str_acquire(get_u16(v + 2)));
+        set_field(&node->friendly_name, reg_str_acquire(get_u16(v + 4)));
+      }
+      break;
+
+    case TAG_ENDPOINT:
+      ep = NULL;
+      cl = NULL;
+      if (tlen >= 5) {
+        ep = reg_add_endpoint(node, v[0], get_u16(v + 1), get_u16(v + 3));
+      }
+      break;
+
+    case TAG_CLUSTER:
+      cl = NULL;
+      if (ep && tlen >= 3) {
+        cl = reg_add_cluster(ep, get_u16(v), (reg_cluster_dir_t)v[2]);
+      }
+      break;
+
+    case TAG_ATTR:
+      decode_attr(cl, v, tlen);
+      break;
+
+    case TAG_END:
+      if (tlen < 2 || get_u16(v) != items) {
+        err = OS_ERR_INVALID_ARG;
+        break;
+      }
+      have_end = true;
+      continue;
+
+    default:
+      /* Unknown item from a newer writer: skip */
+      break;
+    }
+    if (err != OS_OK) {
+      break;
+    }
+    items++;
+  }
+
+  if (err == OS_OK && (!have_ident || !have_end)) {
+    err = OS_ERR_INVALID_ARG;
+  }
+  if (err != OS_OK) {
+    reg_node_clear(node);
+    node->valid = false;
+    return err;
+  }
+
+  node->dirty = false;
+  return OS_OK;
+}
+
+/* v1 -> v2: append the END item */
+static os_err_t migrate_v1(const uint8_t *in, size_t in_len, uint8_t *out,
+                           size_t out_len, size_t *new_len) {
+  if (in_len < 1 || in[0] != 1) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  tlv_writer_t w = {out, out_len, 0, 0, false};
+  put_u8(&w, 2);
+
+  size_t pos = 1;
+  while (pos + 2 <= in_len) {
+    uint8_t tlen = in[pos + 1];
+    if (pos + 2 + tlen > in_len) {
+      return OS_ERR_INVALID_ARG;
+    }
+    put_tag(&w, in[pos], tlen);
+    put_bytes(&w, &in[pos + 2], tlen);
+    pos += 2 + (size_t)tlen;
+  }
+
+  put_end(&w);
+
+  if (w.overflow) {
+    return OS_ERR_NO_MEM;
+  }
+  *new_len = w.pos;
+  return OS_OK;
+}
+
+os_err_t reg_codec_register_migrations(const char *prefix) {
+  return os_persist_register_migration(prefix, 1, migrate_v1);
+}
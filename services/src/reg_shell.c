@@ -2,49 +2,90 @@
  * @file reg_shell.c
  * @brief Registry shell commands
  *
- * ESP32-C6 Zigbee Bridge OS - Shell commands for device registry
+ * ESP32-C6 Zigbee Bridge OS - Shell commands for device registry, the
+ * capability history store and capability report filters
  */
 
+#include "history.h"
 #include "os.h"
 #include "registry.h"
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
-/* Command: devices - List all devices */
+/* Command: devices [state] - List all devices, optionally in one state */
 static int cmd_devices(int argc, char *argv[]) {
-  (void)argc;
-  (void)argv;
-
-  uint32_t count = reg_node_count();
+  reg_filter_t filter = {0};
+  if (argc >= 2) {
+    for (uint32_t s = REG_STATE_NEW; s <= REG_STATE_LEFT; s++) {
+      if (strcasecmp(argv[1], reg_state_name((reg_state_t)s)) == 0) {
+        filter.states = REG_STATE_BIT(s);
+      }
+    }
+    if (!filter.states) {
+      printf("Unknown state: %s\n", argv[1]);
+      return -1;
+    }
+  }
 
-  if (count == 0) {
+  if (reg_node_count() == 0) {
     printf("No devices registered.\n");
     return 0;
   }
 
-  printf("%-18s %-6s %-12s %-20s %-20s\n", "IEEE ADDRESS", "NWK", "STATE",
-         "MANUFACTURER", "MODEL");
+  printf("%-18s %-6s %-12s %-20s %-20s %6s\n", "IEEE ADDRESS", "NWK",
+         "STATE", "MANUFACTURER", "MODEL", "MEM");
   printf("------------------ ------ ------------ -------------------- "
-         "--------------------\n");
+         "-------------------- ------\n");
+
+  uint32_t count = 0;
+  uint32_t mem_total = 0;
+  reg_iter_t it;
+  reg_iter_begin(&it, &filter);
 
-  for (uint32_t i = 0; i < count; i++) {
+  for (reg_node_t *node = reg_iter_next(&it); node;
+       node = reg_iter_next(&it)) {
     reg_node_info_t info;
-    if (reg_get_node_info(i, &info) == OS_OK) {
-      printf(OS_EUI64_FMT " 0x%04X %-12s %-20.20s %-20.20s\n",
+    if (reg_node_get_info(node, &info) == OS_OK) {
+      printf(OS_EUI64_FMT " 0x%04X %-12s %-20.20s %-20.20s %6" PRIu32 "\n",
              OS_EUI64_ARG(info.ieee_addr), info.nwk_addr,
              reg_state_name(info.state),
              info.manufacturer[0] ? info.manufacturer : "-",
-             info.model[0] ? info.model : "-");
+             info.model[0] ? info.model : "-", info.mem_bytes);
+      mem_total += info.mem_bytes;
+      count++;
     }
   }
 
-  printf("\nTotal: %" PRIu32 " device(s)\n", count);
+  reg_pool_stats_t pools;
+  reg_get_pool_stats(&pools);
+  reg_str_stats_t strs;
+  reg_str_get_stats(&strs);
+  printf("\nTotal: %" PRIu32 " device(s), %" PRIu32 " bytes (avg %" PRIu32
+         " per device)\n",
+         count, mem_total, count ? mem_total / count : 0);
+  printf("Pools: endpoints %u/%u, clusters %u/%u, attributes %u/%u "
+         "(registry %" PRIu32 " bytes)\n",
+         pools.endpoints_used, pools.endpoints_total, pools.clusters_used,
+         pools.clusters_total, pools.attributes_used, pools.attributes_total,
+         pools.bytes_total);
+  printf("Strings: %u/%u (%u/%u bytes, %" PRIu32 " references)\n",
+         strs.strings_used, strs.strings_total, strs.arena_used,
+         strs.arena_total, strs.refs);
 
   return 0;
 }
 
+/* Resolve a hex IEEE (16 digits) or NWK address argument */
+static reg_node_t *find_node_arg(const char *arg) {
+  if (strlen(arg) >= 16) {
+    return reg_find_node(strtoull(arg, NULL, 16));
+  }
+  return reg_find_node_by_nwk((uint16_t)strtoul(arg, NULL, 16));
+}
+
 /* Command: device <id> - Show device details */
 static int cmd_device(int argc, char *argv[]) {
   if (argc < 2) {
@@ -52,67 +93,199 @@ static int cmd_device(int argc, char *argv[]) {
     return -1;
   }
 
-  reg_node_t *node = NULL;
-
-  /* Try to parse as hex IEEE address */
-  if (strlen(argv[1]) >= 16) {
-    os_eui64_t addr = strtoull(argv[1], NULL, 16);
-    node = reg_find_node(addr);
-  } else {
-    /* Try as network address */
-    uint16_t nwk = (uint16_t)strtoul(argv[1], NULL, 16);
-    node = reg_find_node_by_nwk(nwk);
-  }
-
+  reg_node_t *node = find_node_arg(argv[1]);
   if (!node) {
     printf("Device not found: %s\n", argv[1]);
     return -1;
   }
 
-  printf("Device: " OS_EUI64_FMT "\n", OS_EUI64_ARG(node->ieee_addr));
-  printf("  Network addr:   0x%04X\n", node->nwk_addr);
-  printf("  State:          %s\n", reg_state_name(node->state));
+  /* One snapshot view for the header and the endpoint walk alike */
+  reg_snapshot_t snap = {0};
+  const reg_node_view_t *view =
+      reg_snapshot_begin(&snap) == OS_OK
+          ? reg_snapshot_node(&snap, node->ieee_addr)
+          : NULL;
+  if (!view) {
+    reg_snapshot_end(&snap);
+    printf("Registry busy, try again\n");
+    return -1;
+  }
+
+  printf("Device: " OS_EUI64_FMT "\n", OS_EUI64_ARG(view->ieee_addr));
+  printf("  Network addr:   0x%04X\n", view->nwk_addr);
+  printf("  State:          %s\n", reg_state_name(view->state));
   printf("  Manufacturer:   %s\n",
-         node->manufacturer[0] ? node->manufacturer : "-");
-  printf("  Model:          %s\n", node->model[0] ? node->model : "-");
+         view->manufacturer ? reg_str(view->manufacturer) : "-");
+  printf("  Model:          %s\n", view->model ? reg_str(view->model) : "-");
   printf("  Friendly name:  %s\n",
-         node->friendly_name[0] ? node->friendly_name : "-");
-  printf("  LQI:            %" PRIu8 "\n", node->lqi);
-  printf("  RSSI:           %d dBm\n", node->rssi);
+         view->friendly_name ? reg_str(view->friendly_name) : "-");
+  printf("  LQI:            %" PRIu8 "\n", view->lqi);
+  printf("  RSSI:           %d dBm\n", view->rssi);
   printf("  Power source:   %s\n",
-         node->power_source == REG_POWER_MAINS     ? "Mains"
-         : node->power_source == REG_POWER_BATTERY ? "Battery"
-         : node->power_source == REG_POWER_DC      ? "DC"
+         view->power_source == REG_POWER_MAINS     ? "Mains"
+         : view->power_source == REG_POWER_BATTERY ? "Battery"
+         : view->power_source == REG_POWER_DC      ? "DC"
                                                    : "Unknown");
-  printf("  Endpoints:      %" PRIu8 "\n", node->endpoint_count);
+  printf("  Endpoints:      %" PRIu8 "\n", view->endpoint_count);
+  printf("  Memory:         %" PRIu32 " bytes\n", reg_node_mem(node));
 
   /* List endpoints */
-  for (uint8_t i = 0; i < REG_MAX_ENDPOINTS; i++) {
-    if (node->endpoints[i].valid) {
-      reg_endpoint_t *ep = &node->endpoints[i];
-      printf("\n  Endpoint %d (profile=0x%04X device=0x%04X):\n",
-             ep->endpoint_id, ep->profile_id, ep->device_id);
-
-      /* List clusters */
-      for (uint8_t j = 0; j < REG_MAX_CLUSTERS; j++) {
-        if (ep->clusters[j].valid) {
-          reg_cluster_t *cl = &ep->clusters[j];
-          printf("    Cluster 0x%04X (%s) - %" PRIu8 " attrs\n", cl->cluster_id,
-                 cl->direction == REG_CLUSTER_SERVER ? "server" : "client",
-                 cl->attr_count);
-        }
-      }
+  for (const reg_endpoint_t *ep = reg_view_first_endpoint(view); ep;
+       ep = reg_view_next_endpoint(ep)) {
+    printf("\n  Endpoint %d (profile=0x%04X device=0x%04X):\n",
+           ep->endpoint_id, ep->profile_id, ep->device_id);
+
+    /* List clusters */
+    for (const reg_cluster_t *cl = reg_view_first_cluster(ep); cl;
+         cl = reg_view_next_cluster(cl)) {
+      printf("    Cluster 0x%04X (%s) - %" PRIu8 " attrs\n", cl->cluster_id,
+             cl->direction == REG_CLUSTER_SERVER ? "server" : "client",
+             cl->attr_count);
     }
   }
+  reg_snapshot_end(&snap);
+
+  return 0;
+}
+
+/* Points shown per history query */
+#define HISTORY_SHELL_POINTS 32
+
+/* Format a x100 fixed-point value as a decimal */
+static const char *fmt_x100(char *buf, size_t len, int32_t v) {
+  uint32_t mag = v < 0 ? 0u - (uint32_t)v : (uint32_t)v;
+  snprintf(buf, len, "%s%" PRIu32 ".%02" PRIu32, v < 0 ? "-" : "", mag / 100,
+           mag % 100);
+  return buf;
+}
+
+static void print_rollups(const char *title, const history_point_t *pts,
+                          uint32_t n) {
+  printf("\n  %s:\n", title);
+  if (n == 0) {
+    printf("    (none)\n");
+    return;
+  }
+  printf("    %8s %10s %10s %10s %6s\n", "START s", "MIN", "MAX", "AVG",
+         "N");
+  for (uint32_t i = 0; i < n; i++) {
+    char lo[16], hi[16], avg[16];
+    printf("    %8" PRIu32 " %10s %10s %10s %6" PRIu32 "\n", pts[i].time_s,
+           fmt_x100(lo, sizeof(lo), pts[i].min),
+           fmt_x100(hi, sizeof(hi), pts[i].max),
+           fmt_x100(avg, sizeof(avg), pts[i].avg), pts[i].count);
+  }
+}
 
+/* Command: history <id> <cap> - Show trend of a capability */
+static int cmd_history(int argc, char *argv[]) {
+  if (argc < 3) {
+    printf("Usage: history <ieee_addr|nwk_addr> <capability>\n");
+    return -1;
+  }
+
+  reg_node_t *node = find_node_arg(argv[1]);
+  if (!node) {
+    printf("Device not found: %s\n", argv[1]);
+    return -1;
+  }
+
+  cap_id_t cap_id = cap_parse_name(argv[2]);
+  if (cap_id == CAP_UNKNOWN) {
+    printf("Unknown capability: %s\n", argv[2]);
+    return -1;
+  }
+  const cap_info_t *info = cap_get_info(cap_id);
+
+  /* First use selects the series; later reports fill it */
+  if (!history_is_tracked(node->ieee_addr, cap_id)) {
+    os_err_t err = history_track(node->ieee_addr, cap_id);
+    if (err == OS_OK) {
+      printf("Now recording %s of " OS_EUI64_FMT "\n", info->name,
+             OS_EUI64_ARG(node->ieee_addr));
+    } else if (err == OS_ERR_INVALID_ARG) {
+      printf("%s is not numeric\n", info->name);
+    } else {
+      printf("No free history series\n");
+    }
+    return err == OS_OK ? 0 : -1;
+  }
+
+  static history_point_t pts[HISTORY_SHELL_POINTS];
+  uint32_t n = history_query(node->ieee_addr, cap_id, HISTORY_RES_RAW, 0, pts,
+                             HISTORY_SHELL_POINTS);
+  printf(OS_EUI64_FMT " %s (%s)\n", OS_EUI64_ARG(node->ieee_addr), info->name,
+         info->unit[0] ? info->unit : "-");
+  if (n == 0) {
+    printf("  No samples yet\n");
+    return 0;
+  }
+  char last[16];
+  printf("  Last: %s at %" PRIu32 " s (%" PRIu32 " samples since %" PRIu32
+         " s)\n",
+         fmt_x100(last, sizeof(last), pts[n - 1].avg), pts[n - 1].time_s, n,
+         pts[0].time_s);
+
+  /* Ten most recent minutes, then every hour kept */
+  n = history_query(node->ieee_addr, cap_id, HISTORY_RES_MINUTE, 0, pts, 10);
+  print_rollups("1 min", pts, n);
+  n = history_query(node->ieee_addr, cap_id, HISTORY_RES_HOUR, 0, pts,
+                    HISTORY_SHELL_POINTS);
+  print_rollups("1 h", pts, n);
+
+  return 0;
+}
+
+/* Command: filter [cap abs rel% min_s max_s] - Show or set report filters */
+static int cmd_filter(int argc, char *argv[]) {
+  if (argc >= 2) {
+    cap_id_t cap_id = cap_parse_name(argv[1]);
+    if (cap_id == CAP_UNKNOWN) {
+      printf("Unknown capability: %s\n", argv[1]);
+      return -1;
+    }
+    if (argc < 6) {
+      printf("Usage: filter <capability> <abs> <rel%%> <min_s> <max_s>\n");
+      return -1;
+    }
+    cap_filter_t filter = {
+        .abs_delta = strtof(argv[2], NULL),
+        .rel_delta = strtof(argv[3], NULL) / 100.0f,
+        .min_interval_ms = (uint32_t)strtoul(argv[4], NULL, 10) * 1000u,
+        .max_interval_ms = (uint32_t)strtoul(argv[5], NULL, 10) * 1000u,
+    };
+    if (cap_set_filter(cap_id, &filter) != OS_OK) {
+      printf("Invalid filter\n");
+      return -1;
+    }
+  }
+
+  printf("%-20s %8s %6s %6s %6s %10s %10s\n", "CAPABILITY", "ABS", "REL%",
+         "MIN_S", "MAX_S", "PASSED", "SUPPRESSED");
+  for (int id = CAP_UNKNOWN + 1; id < CAP_MAX; id++) {
+    cap_filter_t f;
+    cap_filter_stats_t st;
+    if (cap_get_filter((cap_id_t)id, &f) != OS_OK ||
+        cap_get_filter_stats((cap_id_t)id, &st) != OS_OK) {
+      continue;
+    }
+    printf("%-20s %8.2f %6.1f %6" PRIu32 " %6" PRIu32 " %10" PRIu32
+           " %10" PRIu32 "\n",
+           cap_get_info((cap_id_t)id)->name, (double)f.abs_delta,
+           (double)(f.rel_delta * 100.0f), f.min_interval_ms / 1000,
+           f.max_interval_ms / 1000, st.passed, st.suppressed);
+  }
   return 0;
 }
 
 /* Register registry shell commands */
 os_err_t reg_shell_init(void) {
   static const os_shell_cmd_t cmds[] = {
-      {"devices", "List all registered devices", cmd_devices},
+      {"devices", "List registered devices [state]", cmd_devices},
       {"device", "Show device details <addr>", cmd_device},
+      {"history", "Show capability trend <addr> <cap>", cmd_history},
+      {"filter", "Show or set report filters [cap abs rel% min_s max_s]",
+       cmd_filter},
   };
 
   for (size_t i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i++) {
@@ -0,0 +1,337 @@
+/**
+ * @file reg_str.c
+ * @brief Interned strings for registry metadata
+ *
+ * ESP32-C6 Zigbee Bridge OS - Device registry string table
+ *
+ * Manufacturer, model and friendly names are stored once and referenced by
+ * 16-bit IDs (entry index + 1, REG_STR_NONE = empty), so a fleet of identical
+ * devices shares one copy and equal strings compare as equal IDs. Text lives
+ * in an arena as [id u16][len u8][chars][NUL]; released text is marked dead
+ * by zeroing its id and reclaimed by sliding live records down when the
+ * arena fills.
+ *
+ * Each string is persisted as its own record, str/<id>, so node records can
+ * carry IDs. reg_persist() puts new strings ahead of the node records that
+ * use them and deletes unreferenced ones only once every node record has
+ * been committed; an ID is not reused before its record is gone.
+ */
+
+#include "os.h"
+#include "registry.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REG_MODULE "REG"
+
+#define STR_PERSIST_KEY_PREFIX "str/"
+
+/* Arena record header: id u16, len u8 */
+#define STR_HDR 3
+
+/* Entry flags; an entry with none set is free */
+#define STR_LIVE 0x01   /* Text in the arena */
+#define STR_SAVED 0x02  /* str/<id> record in storage */
+#define STR_STAGED 0x04 /* Put in the open persist transaction */
+
+typedef struct {
+  uint16_t offset; /* Arena offset of the record */
+  uint16_t refs;
+  uint16_t hash;
+  uint8_t len;
+  uint8_t flags;
+} str_entry_t;
+
+static struct {
+  str_entry_t entries[REG_STR_MAX];
+  uint8_t arena[REG_STR_ARENA];
+  uint16_t arena_used; /* End of the last record */
+  uint16_t arena_dead; /* Bytes of released records below arena_used */
+  uint16_t live;
+} table = {0};
+
+/* FNV-1a folded to 16 bits */
+static uint16_t str_hash(const char *s, size_t len) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ (uint8_t)s[i]) * 16777619u;
+  }
+  return (uint16_t)(h ^ (h >> 16));
+}
+
+static str_entry_t *entry_at(reg_str_t id) {
+  return id && id <= REG_STR_MAX ? &table.entries[id - 1] : NULL;
+}
+
+static const char *entry_text(const str_entry_t *e) {
+  return (const char *)&table.arena[e->offset + STR_HDR];
+}
+
+/* Slide live records over dead ones, keeping their order */
+static void arena_compact(void) {
+  uint16_t rd = 0;
+  uint16_t wr = 0;
+  while (rd < table.arena_used) {
+    uint16_t id = (uint16_t)(table.arena[rd] | (table.arena[rd + 1] << 8));
+    uint16_t size = (uint16_t)(STR_HDR + table.arena[rd + 2] + 1);
+    if (id) {
+      memmove(&table.arena[wr], &table.arena[rd], size);
+      table.entries[id - 1].offset = wr;
+      wr += size;
+    }
+    rd += size;
+  }
+  table.arena_used = wr;
+  table.arena_dead = 0;
+}
+
+/* Store text for entry id; false if the arena cannot hold it */
+static bool arena_put(reg_str_t id, const char *s, uint8_t len) {
+  uint16_t size = (uint16_t)(STR_HDR + len + 1);
+  if (table.arena_used + size > REG_STR_ARENA) {
+    if (table.arena_used - table.arena_dead + size > REG_STR_ARENA) {
+      return false;
+    }
+    arena_compact();
+  }
+
+  uint8_t *rec = &table.arena[table.arena_used];
+  rec[0] = (uint8_t)id;
+  rec[1] = (uint8_t)(id >> 8);
+  rec[2] = len;
+  memcpy(&rec[STR_HDR], s, len);
+  rec[STR_HDR + len] = '\0';
+
+  str_entry_t *e = entry_at(id);
+  e->offset = table.arena_used;
+  e->len = len;
+  e->hash = str_hash(s, len);
+  e->flags |= STR_LIVE;
+  table.arena_used += size;
+  table.live++;
+  return true;
+}
+
+/* Release the text of an unreferenced entry; a saved one stays reserved
+ * until its record is deleted */
+static void entry_drop(str_entry_t *e) {
+  table.arena[e->offset] = 0;
+  table.arena[e->offset + 1] = 0;
+  table.arena_dead += (uint16_t)(STR_HDR + e->len + 1);
+  e->flags &= (uint8_t)~(STR_LIVE | STR_STAGED);
+  e->refs = 0;
+  table.live--;
+}
+
+static size_t clamp_len(const char *s) {
+  return strnlen(s, REG_STR_MAX_LEN - 1);
+}
+
+reg_str_t reg_str_find(const char *s) {
+  if (!s || !s[0]) {
+    return REG_STR_NONE;
+  }
+
+  size_t len = clamp_len(s);
+  uint16_t hash = str_hash(s, len);
+  for (uint32_t i = 0; i < REG_STR_MAX; i++) {
+    const str_entry_t *e = &table.entries[i];
+    if ((e->flags & STR_LIVE) && e->hash == hash && e->len == len &&
+        memcmp(entry_text(e), s, len) == 0) {
+      return (reg_str_t)(i + 1);
+    }
+  }
+  return REG_STR_NONE;
+}
+
+reg_str_t reg_str_intern(const char *s) {
+  reg_str_t id = reg_str_find(s);
+  if (id) {
+    table.entries[id - 1].refs++;
+    return id;
+  }
+  if (!s || !s[0]) {
+    return REG_STR_NONE;
+  }
+
+  for (uint32_t i = 0; i < REG_STR_MAX; i++) {
+    if (table.entries[i].flags == 0) {
+      id = (reg_str_t)(i + 1);
+      if (!arena_put(id, s, (uint8_t)clamp_len(s))) {
+        break;
+      }
+      table.entries[i].refs = 1;
+      return id;
+    }
+  }
+
+  LOG_W(REG_MODULE, "String table full, dropping \"%s\"", s);
+  return REG_STR_NONE;
+}
+
+reg_str_t reg_str_acquire(reg_str_t id) {
+  str_entry_t *e = entry_at(id);
+  if (!e || !(e->flags & STR_LIVE)) {
+    return REG_STR_NONE;
+  }
+  e->refs++;
+  return id;
+}
+
+void reg_str_release(reg_str_t id) {
+  str_entry_t *e = entry_at(id);
+  if (!e || !(e->flags & STR_LIVE) || e->refs == 0) {
+    return;
+  }
+  if (--e->refs == 0) {
+    entry_drop(e);
+  }
+}
+
+const char *reg_str(reg_str_t id) {
+  const str_entry_t *e = entry_at(id);
+  return e && (e->flags & STR_LIVE) ? entry_text(e) : "";
+}
+
+void reg_str_get_stats(reg_str_stats_t *stats) {
+  if (!stats) {
+    return;
+  }
+
+  memset(stats, 0, sizeof(*stats));
+  for (uint32_t i = 0; i < REG_STR_MAX; i++) {
+    stats->refs += table.entries[i].refs;
+  }
+  stats->strings_used = table.live;
+  stats->strings_total = REG_STR_MAX;
+  stats->arena_used = (uint16_t)(table.arena_used - table.arena_dead);
+  stats->arena_total = REG_STR_ARENA;
+}
+
+static void str_key(reg_str_t id, char *key, size_t key_len) {
+  snprintf(key, key_len, STR_PERSIST_KEY_PREFIX "%04X", id);
+}
+
+os_err_t reg_str_persist_stage(void) {
+  uint32_t staged = 0;
+  for (uint32_t i = 0; i < REG_STR_MAX; i++) {
+    str_entry_t *e = &table.entries[i];
+    if ((e->flags & (STR_LIVE | STR_SAVED | STR_STAGED)) != STR_LIVE ||
+        e->refs == 0) {
+      continue;
+    }
+
+    char key[OS_PERSIST_KEY_MAX];
+    str_key((reg_str_t)(i + 1), key, sizeof(key));
+    os_err_t err = os_persist_put(key, entry_text(e), e->len);
+    if (err == OS_ERR_FULL && staged == 0) {
+      return OS_ERR_NO_MEM;
+    }
+    if (err != OS_OK) {
+      return err;
+    }
+    e->flags |= STR_STAGED;
+    staged++;
+  }
+  return OS_OK;
+}
+
+void reg_str_persist_done(bool committed) {
+  for (uint32_t i = 0; i < REG_STR_MAX; i++) {
+    str_entry_t *e = &table.entries[i];
+    if (e->flags & STR_STAGED) {
+      e->flags &= (uint8_t)~STR_STAGED;
+      if (committed) {
+        e->flags |= STR_SAVED;
+      }
+    }
+  }
+}
+
+uint32_t reg_str_persist_purge(void) {
+  uint32_t purged = 0;
+  for (uint32_t i = 0; i < REG_STR_MAX; i++) {
+    str_entry_t *e = &table.entries[i];
+    if (e->flags != STR_SAVED) {
+      continue;
+    }
+
+    char key[OS_PERSIST_KEY_MAX];
+    str_key((reg_str_t)(i + 1), key, sizeof(key));
+    os_err_t err = os_persist_del(key);
+    if (err == OS_OK || err == OS_ERR_NOT_FOUND) {
+      e->flags = 0;
+      purged++;
+    }
+  }
+  return purged;
+}
+
+uint32_t reg_str_restore(void) {
+  os_persist_iter_t it;
+  if (os_persist_iter_begin(&it, STR_PERSIST_KEY_PREFIX) != OS_OK) {
+    return 0;
+  }
+
+  uint32_t loaded = 0;
+  char key[OS_PERSIST_KEY_MAX];
+  char text[REG_STR_MAX_LEN];
+  while (os_persist_iter_next(&it, key, sizeof(key)) == OS_OK) {
+    unsigned long id = strtoul(key + strlen(STR_PERSIST_KEY_PREFIX), NULL, 16);
+    str_entry_t *e = entry_at((reg_str_t)id);
+    size_t len = 0;
+    if (!e || id > REG_STR_MAX ||
+        os_persist_get(key, text, sizeof(text) - 1, &len) != OS_OK ||
+        len == 0) {
+      LOG_W(REG_MODULE, "Bad string record %s", key);
+      continue;
+    }
+    text[len] = '\0';
+
+    if (e->flags & STR_LIVE) {
+      /* Restored twice, or the ID was taken before restore */
+      if (e->len == len && memcmp(entry_text(e), text, len) == 0) {
+        e->flags |= STR_SAVED;
+      } else {
+        LOG_W(REG_MODULE, "String %s already in use", key);
+      }
+      continue;
+    }
+    if (e->flags == 0 && arena_put((reg_str_t)id, text, (uint8_t)len)) {
+      e->flags |= STR_SAVED;
+      loaded++;
+    }
+  }
+  os_persist_iter_end(&it);
+  return loaded;
+}
+
+void reg_str_restore_done(void) {
+  for (uint32_t i = 0; i < REG_STR_MAX; i++) {
+    str_entry_t *e = &table.entries[i];
+    if ((e->flags & STR_LIVE) && e->refs == 0) {
+      entry_drop(e);
+    }
+  }
+}
+
+static void mem_report_entries(os_mem_region_t *region, void *ctx) {
+  (void)ctx;
+  region->used = table.live;
+  region->capacity = REG_STR_MAX;
+}
+
+static void mem_report_arena(os_mem_region_t *region, void *ctx) {
+  (void)ctx;
+  region->used = (uint32_t)(table.arena_used - table.arena_dead);
+  region->capacity = REG_STR_ARENA;
+}
+
+void reg_str_reset(void) {
+  memset(&table, 0, sizeof(table));
+  os_mem_register("reg.strings", sizeof(table.entries), mem_report_entries,
+                  NULL);
+  os_mem_register("reg.str_arena", sizeof(table) - sizeof(table.entries),
+                  mem_report_arena, NULL);
+}
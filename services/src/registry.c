@@ -13,28 +13,838 @@
 
 #define REG_MODULE "REG"
 
+/* Persistence key format */
+#define REG_PERSIST_KEY_PREFIX "node/"
+#define REG_PERSIST_COUNT_KEY "reg/count"
+/* Key buffer size: prefix (5) + IEEE addr hex (16) + null (1) = 22, use 32 for
+ * safety */
+#define REG_PERSIST_KEY_SIZE 32
+
+/* Essential attributes are persisted; other attribute updates never dirty a
+ * node */
+#define ZCL_CLUSTER_BASIC 0x0000
+
+#define REG_INDEX_MASK (REG_INDEX_SIZE - 1)
+
+_Static_assert((REG_INDEX_SIZE & REG_INDEX_MASK) == 0,
+               "REG_INDEX_SIZE must be a power of two");
+_Static_assert(REG_INDEX_SIZE >= 2 * REG_MAX_NODES,
+               "REG_INDEX_SIZE must be at least twice REG_MAX_NODES");
+
+#define REG_STATE_COUNT (REG_STATE_LEFT + 1)
+
+/* Lookup tables over registry.nodes[] */
+typedef enum {
+  INDEX_EUI = 0,
+  INDEX_NWK,
+} reg_index_t;
+
 /* Registry storage */
 static struct {
   bool initialized;
   reg_node_t nodes[REG_MAX_NODES];
+  /* Open-addressed, linear probing; 0 = empty, else node slot + 1 */
+  uint16_t index[2][REG_INDEX_SIZE];
+  /* Shared child pools; free entries are chained through next */
+  reg_endpoint_t endpoints[REG_POOL_ENDPOINTS];
+  reg_cluster_t clusters[REG_POOL_CLUSTERS];
+  reg_attribute_t attributes[REG_POOL_ATTRIBUTES];
+  uint16_t free_endpoint;
+  uint16_t free_cluster;
+  uint16_t free_attribute;
+  uint16_t endpoints_used;
+  uint16_t clusters_used;
+  uint16_t attributes_used;
+  /* Secondary indices; by_cluster is sorted by cluster ID */
+  reg_node_set_t by_state[REG_STATE_COUNT];
+  struct {
+    uint16_t cluster_id;
+    reg_node_set_t nodes;
+  } by_cluster[REG_CLUSTER_INDEX_SIZE];
+  uint16_t cluster_ids;
+  bool cluster_overflow; /* Some IDs not indexed: queries fall back to scans */
+  /* Liveness lists of READY nodes by last_seen, oldest first; links are
+   * slot + 1, 0 = none */
+  struct {
+    uint16_t prev;
+    uint16_t next;
+    uint8_t cls;
+    bool linked;
+  } live[REG_MAX_NODES];
+  uint16_t live_head[REG_LIVENESS_CLASSES];
+  uint16_t live_tail[REG_LIVENESS_CLASSES];
+  /* Snapshot views. A view is the node as snapshots with epochs in
+   * (from, until] see it; until 0 marks the current view of a live node,
+   * which node_view[] holds as index + 1 */
+  struct {
+    reg_node_view_t view;
+    uint32_t from;
+    uint32_t until;
+    uint32_t epoch; /* Newest snapshot that fetched a current view */
+    uint16_t owner; /* Slot + 1 while current */
+    bool used;
+  } views[REG_SNAP_VIEWS];
+  uint8_t node_view[REG_MAX_NODES];
+  /* Snapshots up to this epoch must not see the live node of a slot */
+  uint32_t node_epoch[REG_MAX_NODES];
+  /* Children of views, chained like the live pools */
+  reg_endpoint_t snap_endpoints[REG_SNAP_ENDPOINTS];
+  reg_cluster_t snap_clusters[REG_SNAP_CLUSTERS];
+  reg_attribute_t snap_attributes[REG_SNAP_ATTRIBUTES];
+  uint16_t snap_free_endpoint;
+  uint16_t snap_free_cluster;
+  uint16_t snap_free_attribute;
+  uint32_t snap_pins[REG_SNAP_READERS]; /* Epoch per open snapshot, 0 = free */
+  uint8_t snap_lost; /* Readers missing a version, one bit each */
+  uint32_t snap_epoch;
+  uint32_t snap_copies;
+  uint32_t snap_lost_count;
+  /* Change journal: the entry for generation g lives at g % size */
+  reg_change_t journal[REG_JOURNAL_SIZE];
+  uint32_t generation;
   uint32_t node_count;
+  uint32_t persisted_count;
+  bool count_dirty;
 } registry = {0};
 
+/* Encode scratch buffer (fibres are cooperative, so one is enough) */
+static uint8_t persist_buf[OS_PERSIST_VALUE_MAX];
+
 /* State names (per 00_context_and_guardrails.yaml FSM) */
 static const char *state_names[] = {"NEW",   "ANNOUNCED", "INTERVIEWING",
                                     "READY", "OFFLINE",   "FAILED",
                                     "STALE", "LEFT"};
 
+static void node_key(os_eui64_t ieee_addr, char *key, size_t key_len) {
+  snprintf(key, key_len, REG_PERSIST_KEY_PREFIX OS_EUI64_FMT,
+           OS_EUI64_ARG(ieee_addr));
+}
+
+/* Pool links are index + 1 so that zero-initialised nodes have no children */
+#define EP_AT(ref) (&registry.endpoints[(ref) - 1])
+#define CL_AT(ref) (&registry.clusters[(ref) - 1])
+#define ATTR_AT(ref) (&registry.attributes[(ref) - 1])
+#define SNAP_EP_AT(ref) (&registry.snap_endpoints[(ref) - 1])
+#define SNAP_CL_AT(ref) (&registry.snap_clusters[(ref) - 1])
+#define SNAP_ATTR_AT(ref) (&registry.snap_attributes[(ref) - 1])
+
+static uint16_t ep_ref(const reg_endpoint_t *ep) {
+  return (uint16_t)(ep - registry.endpoints + 1);
+}
+
+static uint16_t cl_ref(const reg_cluster_t *cl) {
+  return (uint16_t)(cl - registry.clusters + 1);
+}
+
+static uint16_t attr_ref(const reg_attribute_t *attr) {
+  return (uint16_t)(attr - registry.attributes + 1);
+}
+
+/* Registry slot + 1 of a node, or 0 for a node decoded elsewhere */
+static uint16_t node_ref(const reg_node_t *node) {
+  if (node < registry.nodes || node >= registry.nodes + REG_MAX_NODES) {
+    return 0;
+  }
+  return (uint16_t)(node - registry.nodes + 1);
+}
+
+/* Owning registry node of an endpoint */
+static reg_node_t *owner_node(const reg_endpoint_t *ep) {
+  return ep->node ? &registry.nodes[ep->node - 1] : NULL;
+}
+
+_Static_assert(REG_SNAP_VIEWS < 256, "node_view[] holds view index + 1");
+_Static_assert(REG_SNAP_READERS <= 8, "snap_lost holds a bit per reader");
+
+/* A view may be in use while a snapshot in its epoch range is open; a
+ * current view only by those that fetched it so far */
+static bool view_held(uint32_t v) {
+  uint32_t from = registry.views[v].from;
+  uint32_t until = registry.views[v].until ? registry.views[v].until
+                                           : registry.views[v].epoch;
+  for (uint32_t r = 0; r < REG_SNAP_READERS; r++) {
+    uint32_t pin = registry.snap_pins[r];
+    if (pin > from && pin <= until) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Return a view's copied children to the view pools */
+static void view_free_children(reg_node_view_t *view) {
+  uint16_t ep_ref = view->endpoints;
+  while (ep_ref) {
+    reg_endpoint_t *ep = SNAP_EP_AT(ep_ref);
+    uint16_t cl_ref = ep->clusters;
+    while (cl_ref) {
+      reg_cluster_t *cl = SNAP_CL_AT(cl_ref);
+      uint16_t attr_ref = cl->attributes;
+      while (attr_ref) {
+        reg_attribute_t *attr = SNAP_ATTR_AT(attr_ref);
+        uint16_t next = attr->next;
+        attr->next = registry.snap_free_attribute;
+        registry.snap_free_attribute = attr_ref;
+        attr_ref = next;
+      }
+      uint16_t next = cl->next;
+      cl->next = registry.snap_free_cluster;
+      registry.snap_free_cluster = cl_ref;
+      cl_ref = next;
+    }
+    uint16_t next = ep->next;
+    ep->next = registry.snap_free_endpoint;
+    registry.snap_free_endpoint = ep_ref;
+    ep_ref = next;
+  }
+  view->endpoints = 0;
+}
+
+static void view_free(uint32_t v) {
+  reg_node_view_t *view = &registry.views[v].view;
+  reg_str_release(view->manufacturer);
+  reg_str_release(view->model);
+  reg_str_release(view->friendly_name);
+  view_free_children(view);
+  if (registry.views[v].owner) {
+    registry.node_view[registry.views[v].owner - 1] = 0;
+  }
+  memset(&registry.views[v], 0, sizeof(registry.views[v]));
+}
+
+/* Free every view no open snapshot can hold, except keep */
+static void views_reclaim(int32_t keep) {
+  for (uint32_t v = 0; v < REG_SNAP_VIEWS; v++) {
+    if (registry.views[v].used && (int32_t)v != keep && !view_held(v)) {
+      view_free(v);
+    }
+  }
+}
+
+/* Take a free view, reclaiming one no open snapshot can hold */
+static int32_t view_alloc(void) {
+  for (uint32_t v = 0; v < REG_SNAP_VIEWS; v++) {
+    if (!registry.views[v].used) {
+      registry.views[v].used = true;
+      return (int32_t)v;
+    }
+  }
+  for (uint32_t v = 0; v < REG_SNAP_VIEWS; v++) {
+    if (!view_held(v)) {
+      view_free(v);
+      registry.views[v].used = true;
+      return (int32_t)v;
+    }
+  }
+  return -1;
+}
+
+/* Copy a node's endpoints, clusters and attributes into the view pools,
+ * linking each copy as it is made; false when a pool runs out */
+static bool view_copy_children(reg_node_view_t *view, const reg_node_t *node) {
+  uint16_t *ep_link = &view->endpoints;
+  for (const reg_endpoint_t *ep = reg_first_endpoint(node); ep;
+       ep = reg_next_endpoint(ep)) {
+    uint16_t ep_ref = registry.snap_free_endpoint;
+    if (!ep_ref) {
+      return false;
+    }
+    reg_endpoint_t *ep_copy = SNAP_EP_AT(ep_ref);
+    registry.snap_free_endpoint = ep_copy->next;
+    *ep_copy = *ep;
+    ep_copy->clusters = 0;
+    ep_copy->next = 0;
+    ep_copy->node = 0;
+    *ep_link = ep_ref;
+    ep_link = &ep_copy->next;
+
+    uint16_t *cl_link = &ep_copy->clusters;
+    for (const reg_cluster_t *cl = reg_first_cluster(ep); cl;
+         cl = reg_next_cluster(cl)) {
+      uint16_t cl_ref = registry.snap_free_cluster;
+      if (!cl_ref) {
+        return false;
+      }
+      reg_cluster_t *cl_copy = SNAP_CL_AT(cl_ref);
+      registry.snap_free_cluster = cl_copy->next;
+      *cl_copy = *cl;
+      cl_copy->attributes = 0;
+      cl_copy->next = 0;
+      cl_copy->endpoint = ep_ref;
+      *cl_link = cl_ref;
+      cl_link = &cl_copy->next;
+
+      uint16_t *attr_link = &cl_copy->attributes;
+      for (const reg_attribute_t *attr = reg_first_attribute(cl); attr;
+           attr = reg_next_attribute(attr)) {
+        uint16_t attr_ref = registry.snap_free_attribute;
+        if (!attr_ref) {
+          return false;
+        }
+        reg_attribute_t *attr_copy = SNAP_ATTR_AT(attr_ref);
+        registry.snap_free_attribute = attr_copy->next;
+        *attr_copy = *attr;
+        attr_copy->next = 0;
+        *attr_link = attr_ref;
+        attr_link = &attr_copy->next;
+      }
+    }
+  }
+  return true;
+}
+
+/* Fill a fresh view with a copy of node; a copy that does not fit is
+ * retried once after reclaiming unheld views */
+static bool view_fill(uint32_t v, const reg_node_t *node) {
+  reg_node_view_t *view = &registry.views[v].view;
+  view->ieee_addr = node->ieee_addr;
+  view->nwk_addr = node->nwk_addr;
+  view->state = node->state;
+  view->manufacturer = reg_str_acquire(node->manufacturer);
+  view->model = reg_str_acquire(node->model);
+  view->friendly_name = reg_str_acquire(node->friendly_name);
+  view->sw_build = node->sw_build;
+  view->lqi = node->lqi;
+  view->rssi = node->rssi;
+  view->power_source = node->power_source;
+  view->endpoint_count = node->endpoint_count;
+  view->generation = node->changed_gen;
+
+  if (view_copy_children(view, node)) {
+    return true;
+  }
+  view_free_children(view);
+  views_reclaim((int32_t)v);
+  if (view_copy_children(view, node)) {
+    return true;
+  }
+  view_free_children(view);
+  return false;
+}
+
+/* Call before changing a registry node: snapshots opened since its last
+ * version would see the change, so its current state is kept for them
+ * first. With no such snapshot the current view is just dropped. */
+static void view_preserve(const reg_node_t *node) {
+  uint16_t ref = node ? node_ref(node) : 0;
+  if (!ref || !node->valid) {
+    return;
+  }
+  uint32_t slot = ref - 1;
+  uint32_t from = registry.node_epoch[slot];
+  uint8_t readers = 0;
+  for (uint32_t r = 0; r < REG_SNAP_READERS; r++) {
+    if (registry.snap_pins[r] > from) {
+      readers |= (uint8_t)(1u << r);
+    }
+  }
+
+  uint32_t cur = registry.node_view[slot];
+  if (!readers) {
+    if (cur) {
+      view_free(cur - 1);
+    }
+    return;
+  }
+
+  /* The current view already holds this state: retag it */
+  registry.node_epoch[slot] = registry.snap_epoch;
+  if (cur) {
+    registry.snap_copies++;
+    registry.views[cur - 1].until = registry.snap_epoch;
+    registry.views[cur - 1].owner = 0;
+    registry.node_view[slot] = 0;
+    return;
+  }
+
+  int32_t v = view_alloc();
+  if (v >= 0 && view_fill((uint32_t)v, node)) {
+    registry.views[v].from = from;
+    registry.views[v].until = registry.snap_epoch;
+    registry.snap_copies++;
+    return;
+  }
+  if (v >= 0) {
+    view_free((uint32_t)v);
+  }
+  registry.snap_lost |= readers;
+  registry.snap_lost_count++;
+  LOG_W(REG_MODULE, "No room to keep " OS_EUI64_FMT " for open snapshots",
+        OS_EUI64_ARG(node->ieee_addr));
+}
+
+/* Journal a change to a node and return its generation */
+static uint32_t journal(reg_node_t *node, reg_change_kind_t kind,
+                        uint8_t endpoint_id, uint16_t cluster_id,
+                        uint16_t attr_id) {
+  uint32_t gen = ++registry.generation;
+  reg_change_t *c = &registry.journal[gen % REG_JOURNAL_SIZE];
+  c->generation = gen;
+  c->ieee_addr = node->ieee_addr;
+  c->kind = kind;
+  c->endpoint_id = endpoint_id;
+  c->cluster_id = cluster_id;
+  c->attr_id = attr_id;
+  node->changed_gen = gen;
+  if (kind == REG_CHANGE_ADDED) {
+    /* Snapshots already open do not see the node */
+    registry.node_epoch[node_ref(node) - 1] = registry.snap_epoch;
+  }
+  return gen;
+}
+
+/* Only registry nodes past reg_add_node()/reg_restore() are journaled and
+ * indexed; records being decoded and nodes outside the registry are not */
+static bool tracked(const reg_node_t *node) {
+  return node && node->valid && node->added_gen != 0 && node_ref(node) != 0;
+}
+
+static void set_add(reg_node_set_t *set, uint32_t slot) {
+  set->bits[slot / 32] |= 1u << (slot % 32);
+}
+
+static void set_del(reg_node_set_t *set, uint32_t slot) {
+  set->bits[slot / 32] &= ~(1u << (slot % 32));
+}
+
+static bool set_empty(const reg_node_set_t *set) {
+  for (uint32_t w = 0; w < REG_NODE_SET_WORDS; w++) {
+    if (set->bits[w]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Position of cluster_id in by_cluster, or where it would be inserted */
+static uint32_t cluster_lower_bound(uint16_t cluster_id) {
+  uint32_t lo = 0;
+  uint32_t hi = registry.cluster_ids;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if (registry.by_cluster[mid].cluster_id < cluster_id) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static int32_t cluster_find(uint16_t cluster_id) {
+  uint32_t i = cluster_lower_bound(cluster_id);
+  if (i < registry.cluster_ids &&
+      registry.by_cluster[i].cluster_id == cluster_id) {
+    return (int32_t)i;
+  }
+  return -1;
+}
+
+static bool node_has_cluster(reg_node_t *node, uint16_t cluster_id);
+
+static void cluster_index_add(uint16_t cluster_id, uint32_t slot) {
+  uint32_t i = cluster_lower_bound(cluster_id);
+  if (i >= registry.cluster_ids ||
+      registry.by_cluster[i].cluster_id != cluster_id) {
+    if (registry.cluster_ids >= REG_CLUSTER_INDEX_SIZE) {
+      if (!registry.cluster_overflow) {
+        LOG_W(REG_MODULE, "Cluster index full (%d IDs), 0x%04X not indexed",
+              REG_CLUSTER_INDEX_SIZE, cluster_id);
+      }
+      registry.cluster_overflow = true;
+      return;
+    }
+    memmove(&registry.by_cluster[i + 1], &registry.by_cluster[i],
+            (registry.cluster_ids - i) * sizeof(registry.by_cluster[0]));
+    memset(&registry.by_cluster[i], 0, sizeof(registry.by_cluster[0]));
+    registry.by_cluster[i].cluster_id = cluster_id;
+    registry.cluster_ids++;
+    /* The ID may have been skipped while the index was full: start its set
+     * from every node exposing it, not just this one */
+    if (registry.cluster_overflow) {
+      for (uint32_t n = 0; n < REG_MAX_NODES; n++) {
+        reg_node_t *node = &registry.nodes[n];
+        if (tracked(node) && node_has_cluster(node, cluster_id)) {
+          set_add(&registry.by_cluster[i].nodes, n);
+        }
+      }
+    }
+  }
+  set_add(&registry.by_cluster[i].nodes, slot);
+}
+
+static void cluster_index_del(uint16_t cluster_id, uint32_t slot) {
+  int32_t i = cluster_find(cluster_id);
+  if (i < 0) {
+    return;
+  }
+  set_del(&registry.by_cluster[i].nodes, slot);
+  /* Drop IDs no node exposes any more, freeing room for new ones */
+  if (set_empty(&registry.by_cluster[i].nodes)) {
+    registry.cluster_ids--;
+    memmove(&registry.by_cluster[i], &registry.by_cluster[i + 1],
+            (registry.cluster_ids - (uint32_t)i) *
+                sizeof(registry.by_cluster[0]));
+  }
+}
+
+reg_liveness_class_t reg_liveness_class(const reg_node_t *node) {
+  return node && (node->power_source == REG_POWER_MAINS ||
+                  node->power_source == REG_POWER_DC)
+             ? REG_LIVENESS_MAINS
+             : REG_LIVENESS_SLEEPY;
+}
+
+static void live_unlink(uint32_t slot) {
+  if (!registry.live[slot].linked) {
+    return;
+  }
+  uint8_t cls = registry.live[slot].cls;
+  uint16_t prev = registry.live[slot].prev;
+  uint16_t next = registry.live[slot].next;
+  if (prev) {
+    registry.live[prev - 1].next = next;
+  } else {
+    registry.live_head[cls] = next;
+  }
+  if (next) {
+    registry.live[next - 1].prev = prev;
+  } else {
+    registry.live_tail[cls] = prev;
+  }
+  registry.live[slot].linked = false;
+}
+
+/* Append as the most recently seen node of its class */
+static void live_append(reg_node_t *node, uint32_t slot) {
+  uint8_t cls = (uint8_t)reg_liveness_class(node);
+  uint16_t ref = (uint16_t)(slot + 1);
+  registry.live[slot].cls = cls;
+  registry.live[slot].prev = registry.live_tail[cls];
+  registry.live[slot].next = 0;
+  registry.live[slot].linked = true;
+  if (registry.live_tail[cls]) {
+    registry.live[registry.live_tail[cls] - 1].next = ref;
+  } else {
+    registry.live_head[cls] = ref;
+  }
+  registry.live_tail[cls] = ref;
+  node->last_seen = os_now_ticks();
+}
+
+/* Add a node, with its state and clusters, to the secondary indices */
+static void index_node(reg_node_t *node) {
+  uint32_t slot = node_ref(node) - 1;
+  set_add(&registry.by_state[node->state], slot);
+  if (node->state == REG_STATE_READY) {
+    live_append(node, slot);
+  }
+  for (reg_endpoint_t *ep = reg_first_endpoint(node); ep;
+       ep = reg_next_endpoint(ep)) {
+    for (reg_cluster_t *cl = reg_first_cluster(ep); cl;
+         cl = reg_next_cluster(cl)) {
+      cluster_index_add(cl->cluster_id, slot);
+    }
+  }
+}
+
+static void unindex_node(const reg_node_t *node) {
+  uint32_t slot = node_ref(node) - 1;
+  set_del(&registry.by_state[node->state], slot);
+  live_unlink(slot);
+  for (reg_endpoint_t *ep = reg_first_endpoint(node); ep;
+       ep = reg_next_endpoint(ep)) {
+    for (reg_cluster_t *cl = reg_first_cluster(ep); cl;
+         cl = reg_next_cluster(cl)) {
+      cluster_index_del(cl->cluster_id, slot);
+    }
+  }
+}
+
+static void pools_init(void) {
+  for (uint16_t i = 0; i < REG_POOL_ENDPOINTS; i++) {
+    registry.endpoints[i].next = i + 1 < REG_POOL_ENDPOINTS ? i + 2 : 0;
+  }
+  for (uint16_t i = 0; i < REG_POOL_CLUSTERS; i++) {
+    registry.clusters[i].next = i + 1 < REG_POOL_CLUSTERS ? i + 2 : 0;
+  }
+  for (uint16_t i = 0; i < REG_POOL_ATTRIBUTES; i++) {
+    registry.attributes[i].next = i + 1 < REG_POOL_ATTRIBUTES ? i + 2 : 0;
+  }
+  registry.free_endpoint = 1;
+  registry.free_cluster = 1;
+  registry.free_attribute = 1;
+
+  for (uint16_t i = 0; i < REG_SNAP_ENDPOINTS; i++) {
+    registry.snap_endpoints[i].next = i + 1 < REG_SNAP_ENDPOINTS ? i + 2 : 0;
+  }
+  for (uint16_t i = 0; i < REG_SNAP_CLUSTERS; i++) {
+    registry.snap_clusters[i].next = i + 1 < REG_SNAP_CLUSTERS ? i + 2 : 0;
+  }
+  for (uint16_t i = 0; i < REG_SNAP_ATTRIBUTES; i++) {
+    registry.snap_attributes[i].next = i + 1 < REG_SNAP_ATTRIBUTES ? i + 2 : 0;
+  }
+  registry.snap_free_endpoint = 1;
+  registry.snap_free_cluster = 1;
+  registry.snap_free_attribute = 1;
+}
+
+/* Take a zeroed entry off a free list; NULL when the pool is exhausted */
+static reg_endpoint_t *ep_alloc(void) {
+  if (registry.free_endpoint == 0) {
+    return NULL;
+  }
+  reg_endpoint_t *ep = EP_AT(registry.free_endpoint);
+  registry.free_endpoint = ep->next;
+  memset(ep, 0, sizeof(*ep));
+  registry.endpoints_used++;
+  return ep;
+}
+
+static reg_cluster_t *cl_alloc(void) {
+  if (registry.free_cluster == 0) {
+    return NULL;
+  }
+  reg_cluster_t *cl = CL_AT(registry.free_cluster);
+  registry.free_cluster = cl->next;
+  memset(cl, 0, sizeof(*cl));
+  registry.clusters_used++;
+  return cl;
+}
+
+static reg_attribute_t *attr_alloc(void) {
+  if (registry.free_attribute == 0) {
+    return NULL;
+  }
+  reg_attribute_t *attr = ATTR_AT(registry.free_attribute);
+  registry.free_attribute = attr->next;
+  memset(attr, 0, sizeof(*attr));
+  registry.attributes_used++;
+  return attr;
+}
+
+/* Release a cluster and its attributes */
+static void cl_free(reg_cluster_t *cl) {
+  uint16_t ref = cl->attributes;
+  while (ref) {
+    reg_attribute_t *attr = ATTR_AT(ref);
+    ref = attr->next;
+    attr->valid = false;
+    attr->next = registry.free_attribute;
+    registry.free_attribute = attr_ref(attr);
+    registry.attributes_used--;
+  }
+  cl->valid = false;
+  cl->next = registry.free_cluster;
+  registry.free_cluster = cl_ref(cl);
+  registry.clusters_used--;
+}
+
+/* Release an endpoint and everything under it */
+static void ep_free(reg_endpoint_t *ep) {
+  uint16_t ref = ep->clusters;
+  while (ref) {
+    reg_cluster_t *cl = CL_AT(ref);
+    ref = cl->next;
+    cl_free(cl);
+  }
+  ep->valid = false;
+  ep->next = registry.free_endpoint;
+  registry.free_endpoint = ep_ref(ep);
+  registry.endpoints_used--;
+}
+
+/* 64-bit finaliser (MurmurHash3 fmix64); EUI64s share long OUI prefixes */
+static uint32_t eui_hash(os_eui64_t addr) {
+  uint64_t h = addr;
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ULL;
+  h ^= h >> 33;
+  return (uint32_t)h;
+}
+
+/* Fibonacci hashing; coordinator-assigned NWK addresses are random anyway */
+static uint32_t nwk_hash(uint16_t addr) {
+  return ((uint32_t)addr * 2654435769u) >> 16;
+}
+
+static uint32_t index_home(reg_index_t which, const reg_node_t *node) {
+  return (which == INDEX_EUI ? eui_hash(node->ieee_addr)
+                             : nwk_hash(node->nwk_addr)) &
+         REG_INDEX_MASK;
+}
+
+/* Find index position holding ieee_addr, or -1 */
+static int32_t eui_find_pos(os_eui64_t ieee_addr) {
+  const uint16_t *index = registry.index[INDEX_EUI];
+  uint32_t pos = eui_hash(ieee_addr) & REG_INDEX_MASK;
+  for (uint32_t n = 0; n < REG_INDEX_SIZE; n++) {
+    uint16_t slot = index[pos];
+    if (slot == 0) {
+      return -1;
+    }
+    if (registry.nodes[slot - 1].ieee_addr == ieee_addr) {
+      return (int32_t)pos;
+    }
+    pos = (pos + 1) & REG_INDEX_MASK;
+  }
+  return -1;
+}
+
+/* Find index position holding nwk_addr, or -1 */
+static int32_t nwk_find_pos(uint16_t nwk_addr) {
+  const uint16_t *index = registry.index[INDEX_NWK];
+  uint32_t pos = nwk_hash(nwk_addr) & REG_INDEX_MASK;
+  for (uint32_t n = 0; n < REG_INDEX_SIZE; n++) {
+    uint16_t slot = index[pos];
+    if (slot == 0) {
+      return -1;
+    }
+    if (registry.nodes[slot - 1].nwk_addr == nwk_addr) {
+      return (int32_t)pos;
+    }
+    pos = (pos + 1) & REG_INDEX_MASK;
+  }
+  return -1;
+}
+
+static void index_insert(reg_index_t which, const reg_node_t *node) {
+  uint16_t *index = registry.index[which];
+  uint32_t pos = index_home(which, node);
+  while (index[pos] != 0) {
+    pos = (pos + 1) & REG_INDEX_MASK;
+  }
+  index[pos] = (uint16_t)(node - registry.nodes + 1);
+}
+
+/* Backward-shift deletion keeps linear probe chains intact without
+ * tombstones */
+static void index_remove(reg_index_t which, uint32_t pos) {
+  uint16_t *index = registry.index[which];
+  index[pos] = 0;
+  uint32_t hole = pos;
+  uint32_t j = pos;
+  while (1) {
+    j = (j + 1) & REG_INDEX_MASK;
+    uint16_t slot = index[j];
+    if (slot == 0) {
+      return;
+    }
+    uint32_t home = index_home(which, &registry.nodes[slot - 1]);
+    /* Entry at j may move into the hole unless its home lies in (hole, j] */
+    bool home_between = (hole <= j) ? (home > hole && home <= j)
+                                    : (home > hole || home <= j);
+    if (!home_between) {
+      index[hole] = slot;
+      index[j] = 0;
+      hole = j;
+    }
+  }
+}
+
+/* Point nwk_addr at node, taking it over from any stale holder */
+static void nwk_index_claim(const reg_node_t *node) {
+  int32_t pos = nwk_find_pos(node->nwk_addr);
+  if (pos >= 0) {
+    registry.index[INDEX_NWK][pos] = (uint16_t)(node - registry.nodes + 1);
+  } else {
+    index_insert(INDEX_NWK, node);
+  }
+}
+
+/* Drop node's NWK entry if it still owns it */
+static void nwk_index_release(const reg_node_t *node) {
+  int32_t pos = nwk_find_pos(node->nwk_addr);
+  if (pos >= 0 &&
+      registry.index[INDEX_NWK][pos] == (uint16_t)(node - registry.nodes + 1)) {
+    index_remove(INDEX_NWK, (uint32_t)pos);
+  }
+}
+
+static void mem_report_nodes(os_mem_region_t *region, void *ctx) {
+  (void)ctx;
+  region->used = registry.node_count;
+  region->capacity = REG_MAX_NODES;
+}
+
+static void mem_report_endpoints(os_mem_region_t *region, void *ctx) {
+  (void)ctx;
+  region->used = registry.endpoints_used;
+  region->capacity = REG_POOL_ENDPOINTS;
+}
+
+static void mem_report_clusters(os_mem_region_t *region, void *ctx) {
+  (void)ctx;
+  region->used = registry.clusters_used;
+  region->capacity = REG_POOL_CLUSTERS;
+}
+
+static void mem_report_attributes(os_mem_region_t *region, void *ctx) {
+  (void)ctx;
+  region->used = registry.attributes_used;
+  region->capacity = REG_POOL_ATTRIBUTES;
+}
+
+static void mem_report_views(os_mem_region_t *region, void *ctx) {
+  (void)ctx;
+  reg_snap_stats_t stats;
+  reg_snapshot_get_stats(&stats);
+  region->used = stats.views_used;
+  region->capacity = stats.views_total;
+}
+
+/* Lookup tables, secondary indices, liveness lists and the journal; the
+ * cluster index is the part that can fill up */
+static void mem_report_indices(os_mem_region_t *region, void *ctx) {
+  (void)ctx;
+  region->used = registry.cluster_ids;
+  region->capacity = REG_CLUSTER_INDEX_SIZE;
+}
+
+static void mem_register(void) {
+  uint32_t views = sizeof(registry.views) + sizeof(registry.node_view) +
+                   sizeof(registry.node_epoch) +
+                   sizeof(registry.snap_endpoints) +
+                   sizeof(registry.snap_clusters) +
+                   sizeof(registry.snap_attributes);
+  uint32_t accounted = sizeof(registry.nodes) + sizeof(registry.endpoints) +
+                       sizeof(registry.clusters) + sizeof(registry.attributes) +
+                       views;
+  os_mem_register("reg.nodes", sizeof(registry.nodes), mem_report_nodes, NULL);
+  os_mem_register("reg.endpoints", sizeof(registry.endpoints),
+                  mem_report_endpoints, NULL);
+  os_mem_register("reg.clusters", sizeof(registry.clusters),
+                  mem_report_clusters, NULL);
+  os_mem_register("reg.attributes", sizeof(registry.attributes),
+                  mem_report_attributes, NULL);
+  os_mem_register("reg.views", views, mem_report_views, NULL);
+  os_mem_register("reg.indices", sizeof(registry) - accounted,
+                  mem_report_indices, NULL);
+  os_mem_register("reg.scratch", sizeof(persist_buf), NULL, NULL);
+}
+
 os_err_t reg_init(void) {
   if (registry.initialized) {
     return OS_ERR_ALREADY_EXISTS;
   }
 
   memset(&registry, 0, sizeof(registry));
+  pools_init();
+  reg_str_reset();
   registry.initialized = true;
+  mem_register();
 
-  LOG_I(REG_MODULE, "Device registry initialized (max %d nodes)",
-        REG_MAX_NODES);
+  /* Older node records are upgraded on first read */
+  os_err_t err = reg_codec_register_migrations(REG_PERSIST_KEY_PREFIX);
+  if (err != OS_OK) {
+    LOG_W(REG_MODULE, "Node record migrations not registered: %d", err);
+  }
+
+  LOG_I(REG_MODULE,
+        "Device registry initialized (max %d nodes, %" PRIu32 " bytes)",
+        REG_MAX_NODES, (uint32_t)sizeof(registry));
 
   return OS_OK;
 }
@@ -49,7 +859,7 @@ reg_node_t *reg_add_node(os_eui64_t ieee_addr, uint16_t nwk_addr) {
   if (existing) {
     LOG_D(REG_MODULE, "Node " OS_EUI64_FMT " already exists, updating nwk_addr",
           OS_EUI64_ARG(ieee_addr));
-    existing->nwk_addr = nwk_addr;
+    reg_set_nwk_addr(existing, nwk_addr);
     reg_touch_node(existing);
     return existing;
   }
@@ -76,8 +886,14 @@ reg_node_t *reg_add_node(os_eui64_t ieee_addr, uint16_t nwk_addr) {
   node->join_time = os_now_ticks();
   node->last_seen = node->join_time;
   node->valid = true;
+  node->added_gen = journal(node, REG_CHANGE_ADDED, 0, 0, 0);
+  index_node(node);
+  node->dirty = true;
+  index_insert(INDEX_EUI, node);
+  nwk_index_claim(node);
 
   registry.node_count++;
+  registry.count_dirty = true;
 
   LOG_I(REG_MODULE, "Added node " OS_EUI64_FMT " (nwk=0x%04X)",
         OS_EUI64_ARG(ieee_addr), nwk_addr);
@@ -97,13 +913,9 @@ reg_node_t *reg_find_node(os_eui64_t ieee_addr) {
     return NULL;
   }
 
-  for (uint32_t i = 0; i < REG_MAX_NODES; i++) {
-    if (registry.nodes[i].valid && registry.nodes[i].ieee_addr == ieee_addr) {
-      return &registry.nodes[i];
-    }
-  }
-
-  return NULL;
+  int32_t pos = eui_find_pos(ieee_addr);
+  return pos < 0 ? NULL
+                 : &registry.nodes[registry.index[INDEX_EUI][pos] - 1];
 }
 
 reg_node_t *reg_find_node_by_nwk(uint16_t nwk_addr) {
@@ -111,13 +923,30 @@ reg_node_t *reg_find_node_by_nwk(uint16_t nwk_addr) {
     return NULL;
   }
 
-  for (uint32_t i = 0; i < REG_MAX_NODES; i++) {
-    if (registry.nodes[i].valid && registry.nodes[i].nwk_addr == nwk_addr) {
-      return &registry.nodes[i];
-    }
+  int32_t pos = nwk_find_pos(nwk_addr);
+  return pos < 0 ? NULL
+                 : &registry.nodes[registry.index[INDEX_NWK][pos] - 1];
+}
+
+os_err_t reg_set_nwk_addr(reg_node_t *node, uint16_t nwk_addr) {
+  if (!node || !node->valid) {
+    return OS_ERR_INVALID_ARG;
   }
 
-  return NULL;
+  if (node->nwk_addr == nwk_addr) {
+    return OS_OK;
+  }
+
+  view_preserve(node);
+  nwk_index_release(node);
+  node->nwk_addr = nwk_addr;
+  nwk_index_claim(node);
+  node->dirty = true;
+  if (tracked(node)) {
+    journal(node, REG_CHANGE_NWK, 0, 0, 0);
+  }
+
+  return OS_OK;
 }
 
 os_err_t reg_remove_node(os_eui64_t ieee_addr) {
@@ -130,15 +959,31 @@ os_err_t reg_remove_node(os_eui64_t ieee_addr) {
 
   /* Emit event before removal */
   os_event_emit(OS_EVENT_ZB_DEVICE_LEFT, &ieee_addr, sizeof(ieee_addr));
+  view_preserve(node);
+  journal(node, REG_CHANGE_REMOVED, 0, 0, 0);
+  unindex_node(node);
 
+  int32_t pos = eui_find_pos(ieee_addr);
+  if (pos >= 0) {
+    index_remove(INDEX_EUI, (uint32_t)pos);
+  }
+  nwk_index_release(node);
+  reg_node_clear(node);
   node->valid = false;
+  node->dirty = false;
   registry.node_count--;
+  registry.count_dirty = true;
+
+  /* Drop the persisted record so it is not restored */
+  char key[REG_PERSIST_KEY_SIZE];
+  node_key(ieee_addr, key, sizeof(key));
+  os_persist_del(key);
 
   return OS_OK;
 }
 
 os_err_t reg_set_state(reg_node_t *node, reg_state_t state) {
-  if (!node || !node->valid) {
+  if (!node || !node->valid || state > REG_STATE_LEFT) {
     return OS_ERR_INVALID_ARG;
   }
 
@@ -147,7 +992,20 @@ os_err_t reg_set_state(reg_node_t *node, reg_state_t state) {
     return OS_OK;
   }
 
+  view_preserve(node);
   node->state = state;
+  node->dirty = true;
+  if (tracked(node)) {
+    uint32_t slot = node_ref(node) - 1;
+    set_del(&registry.by_state[old_state], slot);
+    set_add(&registry.by_state[state], slot);
+    if (state == REG_STATE_READY) {
+      live_append(node, slot);
+    } else {
+      live_unlink(slot);
+    }
+    journal(node, REG_CHANGE_STATE, 0, 0, 0);
+  }
 
   LOG_I(REG_MODULE, "Node " OS_EUI64_FMT " state: %s -> %s",
         OS_EUI64_ARG(node->ieee_addr), state_names[old_state],
@@ -157,9 +1015,73 @@ os_err_t reg_set_state(reg_node_t *node, reg_state_t state) {
 }
 
 void reg_touch_node(reg_node_t *node) {
+  if (!node || !node->valid) {
+    return;
+  }
+
+  node->last_seen = os_now_ticks();
+  uint16_t ref = node_ref(node);
+  if (ref && registry.live[ref - 1].linked) {
+    /* Relinking also picks up a power source learned since */
+    live_unlink(ref - 1);
+    live_append(node, ref - 1);
+  }
+}
+
+reg_node_t *reg_liveness_oldest(reg_liveness_class_t cls) {
+  if (cls >= REG_LIVENESS_CLASSES || !registry.live_head[cls]) {
+    return NULL;
+  }
+  return &registry.nodes[registry.live_head[cls] - 1];
+}
+
+void reg_will_write(reg_node_t *node) {
+  if (node && node->valid) {
+    view_preserve(node);
+  }
+}
+
+void reg_mark_dirty(reg_node_t *node) {
   if (node && node->valid) {
-    node->last_seen = os_now_ticks();
+    node->dirty = true;
+    if (tracked(node)) {
+      journal(node, REG_CHANGE_META, 0, 0, 0);
+    }
+  }
+}
+
+static os_err_t set_str(reg_node_t *node, reg_str_t *field, const char *s) {
+  if (!node || !node->valid) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  /* Intern first: setting the same text must not free it in between */
+  reg_str_t id = reg_str_intern(s);
+  if (id == REG_STR_NONE && s && s[0]) {
+    return OS_ERR_NO_MEM;
+  }
+  if (id == *field) {
+    reg_str_release(id);
+    return OS_OK;
   }
+
+  view_preserve(node);
+  reg_str_release(*field);
+  *field = id;
+  reg_mark_dirty(node);
+  return OS_OK;
+}
+
+os_err_t reg_set_manufacturer(reg_node_t *node, const char *s) {
+  return set_str(node, &node->manufacturer, s);
+}
+
+os_err_t reg_set_model(reg_node_t *node, const char *s) {
+  return set_str(node, &node->model, s);
+}
+
+os_err_t reg_set_friendly_name(reg_node_t *node, const char *s) {
+  return set_str(node, &node->friendly_name, s);
 }
 
 uint32_t reg_node_count(void) { return registry.node_count; }
@@ -173,16 +1095,7 @@ os_err_t reg_get_node_info(uint32_t index, reg_node_info_t *info) {
   for (uint32_t i = 0; i < REG_MAX_NODES; i++) {
     if (registry.nodes[i].valid) {
       if (count == index) {
-        reg_node_t *node = &registry.nodes[i];
-        info->ieee_addr = node->ieee_addr;
-        info->nwk_addr = node->nwk_addr;
-        info->state = node->state;
-        info->manufacturer = node->manufacturer;
-        info->model = node->model;
-        info->friendly_name = node->friendly_name;
-        info->lqi = node->lqi;
-        info->endpoint_count = node->endpoint_count;
-        return OS_OK;
+        return reg_node_get_info(&registry.nodes[i], info);
       }
       count++;
     }
@@ -191,6 +1104,162 @@ os_err_t reg_get_node_info(uint32_t index, reg_node_info_t *info) {
   return OS_ERR_NOT_FOUND;
 }
 
+os_err_t reg_node_get_info(const reg_node_t *node, reg_node_info_t *info) {
+  if (!node || !node->valid || !info) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  info->ieee_addr = node->ieee_addr;
+  info->nwk_addr = node->nwk_addr;
+  info->state = node->state;
+  info->manufacturer = reg_str(node->manufacturer);
+  info->model = reg_str(node->model);
+  info->friendly_name = reg_str(node->friendly_name);
+  info->lqi = node->lqi;
+  info->endpoint_count = node->endpoint_count;
+  info->mem_bytes = reg_node_mem(node);
+  return OS_OK;
+}
+
+/* Checked again on every step: a node's state may change mid-iteration */
+static bool node_matches(reg_node_t *node, const reg_filter_t *filter) {
+  if (filter->states && !(filter->states & REG_STATE_BIT(node->state))) {
+    return false;
+  }
+  if (filter->has_power_source &&
+      node->power_source != filter->power_source) {
+    return false;
+  }
+  return true;
+}
+
+void reg_iter_begin(reg_iter_t *it, const reg_filter_t *filter) {
+  if (!it) {
+    return;
+  }
+
+  memset(it, 0, sizeof(*it));
+  if (filter) {
+    it->filter = *filter;
+  }
+  it->generation = registry.generation;
+
+  /* Candidates from the indices; power source is checked per node */
+  if (it->filter.states) {
+    for (uint32_t st = 0; st < REG_STATE_COUNT; st++) {
+      if (it->filter.states & REG_STATE_BIT(st)) {
+        reg_node_set_or(&it->candidates, &registry.by_state[st]);
+      }
+    }
+  } else {
+    for (uint32_t slot = 0; slot < REG_MAX_NODES; slot++) {
+      set_add(&it->candidates, slot);
+    }
+  }
+  if (it->filter.has_cluster) {
+    reg_node_set_t with_cluster;
+    reg_query_cluster(it->filter.cluster_id, &with_cluster);
+    reg_node_set_and(&it->candidates, &with_cluster);
+  }
+}
+
+void reg_iter_begin_set(reg_iter_t *it, const reg_node_set_t *set) {
+  if (!it || !set) {
+    return;
+  }
+
+  memset(it, 0, sizeof(*it));
+  it->candidates = *set;
+  it->generation = registry.generation;
+}
+
+reg_node_t *reg_iter_next(reg_iter_t *it) {
+  if (!it || !registry.initialized) {
+    return NULL;
+  }
+
+  /* Slots never move, so removals cannot shift the cursor; the generation
+   * check keeps a node re-added into a later slot from showing up twice */
+  while (it->pos < REG_MAX_NODES) {
+    uint32_t word = it->candidates.bits[it->pos / 32] >> (it->pos % 32);
+    if (word == 0) {
+      it->pos = (uint16_t)((it->pos / 32 + 1) * 32);
+      continue;
+    }
+    it->pos += (uint16_t)__builtin_ctz(word);
+    if (it->pos >= REG_MAX_NODES) {
+      break;
+    }
+
+    reg_node_t *node = &registry.nodes[it->pos++];
+    if (node->valid && node->added_gen <= it->generation &&
+        node_matches(node, &it->filter)) {
+      return node;
+    }
+  }
+
+  return NULL;
+}
+
+os_err_t reg_query_state(reg_state_t state, reg_node_set_t *out) {
+  if (!out || (uint32_t)state >= REG_STATE_COUNT) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  *out = registry.by_state[state];
+  return OS_OK;
+}
+
+static bool node_has_cluster(reg_node_t *node, uint16_t cluster_id) {
+  for (reg_endpoint_t *ep = reg_first_endpoint(node); ep;
+       ep = reg_next_endpoint(ep)) {
+    if (reg_find_cluster(ep, cluster_id)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+os_err_t reg_query_cluster(uint16_t cluster_id, reg_node_set_t *out) {
+  if (!out) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  memset(out, 0, sizeof(*out));
+  int32_t i = cluster_find(cluster_id);
+  if (i >= 0) {
+    *out = registry.by_cluster[i].nodes;
+  } else if (registry.cluster_overflow) {
+    for (uint32_t slot = 0; slot < REG_MAX_NODES; slot++) {
+      reg_node_t *node = &registry.nodes[slot];
+      if (node->valid && node_has_cluster(node, cluster_id)) {
+        set_add(out, slot);
+      }
+    }
+  }
+  return OS_OK;
+}
+
+void reg_node_set_and(reg_node_set_t *set, const reg_node_set_t *other) {
+  for (uint32_t w = 0; w < REG_NODE_SET_WORDS; w++) {
+    set->bits[w] &= other->bits[w];
+  }
+}
+
+void reg_node_set_or(reg_node_set_t *set, const reg_node_set_t *other) {
+  for (uint32_t w = 0; w < REG_NODE_SET_WORDS; w++) {
+    set->bits[w] |= other->bits[w];
+  }
+}
+
+uint32_t reg_node_set_count(const reg_node_set_t *set) {
+  uint32_t count = 0;
+  for (uint32_t w = 0; w < REG_NODE_SET_WORDS; w++) {
+    count += (uint32_t)__builtin_popcount(set->bits[w]);
+  }
+  return count;
+}
+
 reg_endpoint_t *reg_add_endpoint(reg_node_t *node, uint8_t endpoint_id,
                                  uint16_t profile_id, uint16_t device_id) {
   if (!node || !node->valid) {
@@ -203,25 +1272,35 @@ reg_endpoint_t *reg_add_endpoint(reg_node_t *node, uint8_t endpoint_id,
     return ep;
   }
 
-  /* Find free slot */
-  for (uint8_t i = 0; i < REG_MAX_ENDPOINTS; i++) {
-    if (!node->endpoints[i].valid) {
-      ep = &node->endpoints[i];
-      break;
-    }
+  if (node->endpoint_count >= REG_MAX_ENDPOINTS) {
+    LOG_E(REG_MODULE, "Max endpoints reached for node");
+    return NULL;
   }
 
+  ep = ep_alloc();
   if (!ep) {
-    LOG_E(REG_MODULE, "Max endpoints reached for node");
+    LOG_E(REG_MODULE, "Endpoint pool exhausted (%d)", REG_POOL_ENDPOINTS);
     return NULL;
   }
 
-  memset(ep, 0, sizeof(*ep));
   ep->endpoint_id = endpoint_id;
   ep->profile_id = profile_id;
   ep->device_id = device_id;
+  ep->node = node_ref(node);
   ep->valid = true;
+
+  /* Append, so endpoints keep discovery order */
+  view_preserve(node);
+  uint16_t *link = &node->endpoints;
+  while (*link) {
+    link = &EP_AT(*link)->next;
+  }
+  *link = ep_ref(ep);
   node->endpoint_count++;
+  node->dirty = true;
+  if (tracked(node)) {
+    journal(node, REG_CHANGE_ENDPOINT, endpoint_id, 0, 0);
+  }
 
   LOG_D(REG_MODULE,
         "Node " OS_EUI64_FMT
@@ -236,16 +1315,24 @@ reg_endpoint_t *reg_find_endpoint(reg_node_t *node, uint8_t endpoint_id) {
     return NULL;
   }
 
-  for (uint8_t i = 0; i < REG_MAX_ENDPOINTS; i++) {
-    if (node->endpoints[i].valid &&
-        node->endpoints[i].endpoint_id == endpoint_id) {
-      return &node->endpoints[i];
+  for (reg_endpoint_t *ep = reg_first_endpoint(node); ep;
+       ep = reg_next_endpoint(ep)) {
+    if (ep->endpoint_id == endpoint_id) {
+      return ep;
     }
   }
 
   return NULL;
 }
 
+reg_endpoint_t *reg_first_endpoint(const reg_node_t *node) {
+  return node && node->endpoints ? EP_AT(node->endpoints) : NULL;
+}
+
+reg_endpoint_t *reg_next_endpoint(const reg_endpoint_t *endpoint) {
+  return endpoint && endpoint->next ? EP_AT(endpoint->next) : NULL;
+}
+
 reg_cluster_t *reg_add_cluster(reg_endpoint_t *endpoint, uint16_t cluster_id,
                                reg_cluster_dir_t direction) {
   if (!endpoint || !endpoint->valid) {
@@ -258,24 +1345,37 @@ reg_cluster_t *reg_add_cluster(reg_endpoint_t *endpoint, uint16_t cluster_id,
     return cluster;
   }
 
-  /* Find free slot */
-  for (uint8_t i = 0; i < REG_MAX_CLUSTERS; i++) {
-    if (!endpoint->clusters[i].valid) {
-      cluster = &endpoint->clusters[i];
-      break;
-    }
+  if (endpoint->cluster_count >= REG_MAX_CLUSTERS) {
+    LOG_E(REG_MODULE, "Max clusters reached for endpoint");
+    return NULL;
   }
 
+  cluster = cl_alloc();
   if (!cluster) {
-    LOG_E(REG_MODULE, "Max clusters reached for endpoint");
+    LOG_E(REG_MODULE, "Cluster pool exhausted (%d)", REG_POOL_CLUSTERS);
     return NULL;
   }
 
-  memset(cluster, 0, sizeof(*cluster));
   cluster->cluster_id = cluster_id;
   cluster->direction = direction;
+  cluster->endpoint = ep_ref(endpoint);
   cluster->valid = true;
+
+  view_preserve(owner_node(endpoint));
+  uint16_t *link = &endpoint->clusters;
+  while (*link) {
+    link = &CL_AT(*link)->next;
+  }
+  *link = cl_ref(cluster);
   endpoint->cluster_count++;
+  reg_node_t *node = owner_node(endpoint);
+  if (node) {
+    node->dirty = true;
+    if (tracked(node)) {
+      cluster_index_add(cluster_id, node_ref(node) - 1);
+      journal(node, REG_CHANGE_CLUSTER, endpoint->endpoint_id, cluster_id, 0);
+    }
+  }
 
   LOG_T(REG_MODULE, "Endpoint %d added cluster 0x%04X (%s)",
         endpoint->endpoint_id, cluster_id,
@@ -289,16 +1389,24 @@ reg_cluster_t *reg_find_cluster(reg_endpoint_t *endpoint, uint16_t cluster_id) {
     return NULL;
   }
 
-  for (uint8_t i = 0; i < REG_MAX_CLUSTERS; i++) {
-    if (endpoint->clusters[i].valid &&
-        endpoint->clusters[i].cluster_id == cluster_id) {
-      return &endpoint->clusters[i];
+  for (reg_cluster_t *cl = reg_first_cluster(endpoint); cl;
+       cl = reg_next_cluster(cl)) {
+    if (cl->cluster_id == cluster_id) {
+      return cl;
     }
   }
 
   return NULL;
 }
 
+reg_cluster_t *reg_first_cluster(const reg_endpoint_t *endpoint) {
+  return endpoint && endpoint->clusters ? CL_AT(endpoint->clusters) : NULL;
+}
+
+reg_cluster_t *reg_next_cluster(const reg_cluster_t *cluster) {
+  return cluster && cluster->next ? CL_AT(cluster->next) : NULL;
+}
+
 os_err_t reg_update_attribute(reg_cluster_t *cluster, uint16_t attr_id,
                               reg_attr_type_t type,
                               const reg_attr_value_t *value) {
@@ -306,24 +1414,31 @@ os_err_t reg_update_attribute(reg_cluster_t *cluster, uint16_t attr_id,
     return OS_ERR_INVALID_ARG;
   }
 
+  reg_endpoint_t *ep = EP_AT(cluster->endpoint);
+  reg_node_t *node = owner_node(ep);
+  view_preserve(node);
+
   /* Find or create attribute */
   reg_attribute_t *attr = reg_find_attribute(cluster, attr_id);
   if (!attr) {
-    /* Find free slot */
-    for (uint8_t i = 0; i < REG_MAX_ATTRIBUTES; i++) {
-      if (!cluster->attributes[i].valid) {
-        attr = &cluster->attributes[i];
-        break;
-      }
+    if (cluster->attr_count >= REG_MAX_ATTRIBUTES) {
+      LOG_E(REG_MODULE, "Max attributes reached for cluster");
+      return OS_ERR_FULL;
     }
-  }
 
-  if (!attr) {
-    LOG_E(REG_MODULE, "Max attributes reached for cluster");
-    return OS_ERR_FULL;
-  }
+    attr = attr_alloc();
+    if (!attr) {
+      LOG_E(REG_MODULE, "Attribute pool exhausted (%d)", REG_POOL_ATTRIBUTES);
+      return OS_ERR_NO_MEM;
+    }
 
-  bool is_new = !attr->valid;
+    uint16_t *link = &cluster->attributes;
+    while (*link) {
+      link = &ATTR_AT(*link)->next;
+    }
+    *link = attr_ref(attr);
+    cluster->attr_count++;
+  }
 
   attr->attr_id = attr_id;
   attr->type = type;
@@ -331,8 +1446,12 @@ os_err_t reg_update_attribute(reg_cluster_t *cluster, uint16_t attr_id,
   attr->last_updated = os_now_ticks();
   attr->valid = true;
 
-  if (is_new) {
-    cluster->attr_count++;
+  if (node && cluster->cluster_id == ZCL_CLUSTER_BASIC) {
+    node->dirty = true;
+  }
+  if (tracked(node)) {
+    attr->generation = journal(node, REG_CHANGE_ATTRIBUTE, ep->endpoint_id,
+                               cluster->cluster_id, attr_id);
   }
 
   return OS_OK;
@@ -343,50 +1462,196 @@ reg_attribute_t *reg_find_attribute(reg_cluster_t *cluster, uint16_t attr_id) {
     return NULL;
   }
 
-  for (uint8_t i = 0; i < REG_MAX_ATTRIBUTES; i++) {
-    if (cluster->attributes[i].valid &&
-        cluster->attributes[i].attr_id == attr_id) {
-      return &cluster->attributes[i];
+  for (reg_attribute_t *attr = reg_first_attribute(cluster); attr;
+       attr = reg_next_attribute(attr)) {
+    if (attr->attr_id == attr_id) {
+      return attr;
     }
   }
 
   return NULL;
 }
 
-/* Persistence key format */
-#define REG_PERSIST_KEY_PREFIX "node/"
-#define REG_PERSIST_COUNT_KEY "reg/count"
-/* Key buffer size: prefix (5) + IEEE addr hex (16) + null (1) = 22, use 32 for
- * safety */
-#define REG_PERSIST_KEY_SIZE 32
+reg_attribute_t *reg_first_attribute(const reg_cluster_t *cluster) {
+  return cluster && cluster->attributes ? ATTR_AT(cluster->attributes) : NULL;
+}
+
+reg_attribute_t *reg_next_attribute(const reg_attribute_t *attr) {
+  return attr && attr->next ? ATTR_AT(attr->next) : NULL;
+}
+
+void reg_node_clear(reg_node_t *node) {
+  if (!node) {
+    return;
+  }
+
+  view_preserve(node);
+  uint16_t ref = node->endpoints;
+  while (ref) {
+    reg_endpoint_t *ep = EP_AT(ref);
+    ref = ep->next;
+    ep_free(ep);
+  }
+  node->endpoints = 0;
+  node->endpoint_count = 0;
+
+  reg_str_release(node->manufacturer);
+  reg_str_release(node->model);
+  reg_str_release(node->friendly_name);
+  node->manufacturer = REG_STR_NONE;
+  node->model = REG_STR_NONE;
+  node->friendly_name = REG_STR_NONE;
+}
+
+uint32_t reg_node_mem(const reg_node_t *node) {
+  if (!node) {
+    return 0;
+  }
+
+  uint32_t bytes = sizeof(reg_node_t);
+  for (reg_endpoint_t *ep = reg_first_endpoint(node); ep;
+       ep = reg_next_endpoint(ep)) {
+    bytes += sizeof(reg_endpoint_t);
+    for (reg_cluster_t *cl = reg_first_cluster(ep); cl;
+         cl = reg_next_cluster(cl)) {
+      bytes += sizeof(reg_cluster_t) + cl->attr_count * sizeof(reg_attribute_t);
+    }
+  }
+  return bytes;
+}
+
+void reg_get_pool_stats(reg_pool_stats_t *stats) {
+  if (!stats) {
+    return;
+  }
+
+  stats->endpoints_used = registry.endpoints_used;
+  stats->endpoints_total = REG_POOL_ENDPOINTS;
+  stats->clusters_used = registry.clusters_used;
+  stats->clusters_total = REG_POOL_CLUSTERS;
+  stats->attributes_used = registry.attributes_used;
+  stats->attributes_total = REG_POOL_ATTRIBUTES;
+  stats->bytes_total = sizeof(registry);
+}
+
+/* Nodes put in the open persist transaction */
+static bool persist_staged[REG_MAX_NODES];
+
+/* Commit staged node records; they stay dirty if the commit fails */
+static os_err_t persist_commit(uint32_t *persisted) {
+  os_err_t err = os_persist_txn_commit();
+  if (err != OS_OK) {
+    os_persist_txn_abort();
+  }
+
+  reg_str_persist_done(err == OS_OK);
+  for (uint32_t i = 0; i < REG_MAX_NODES; i++) {
+    if (persist_staged[i] && err == OS_OK) {
+      registry.nodes[i].dirty = false;
+      (*persisted)++;
+    }
+    persist_staged[i] = false;
+  }
+  return err;
+}
 
 os_err_t reg_persist(void) {
   if (!registry.initialized) {
     return OS_ERR_NOT_INITIALIZED;
   }
 
+  /* Node records and the count reach storage together or not at all */
+  os_err_t result = os_persist_txn_begin();
+  if (result != OS_OK) {
+    return result;
+  }
+
   uint32_t persisted = 0;
 
+  /* New strings go first, so committed node records can resolve their IDs */
+  os_err_t err;
+  while ((err = reg_str_persist_stage()) == OS_ERR_FULL) {
+    err = persist_commit(&persisted);
+    if (err == OS_OK) {
+      err = os_persist_txn_begin();
+    }
+    if (err != OS_OK) {
+      return err;
+    }
+  }
+  if (err != OS_OK) {
+    os_persist_txn_abort();
+    reg_str_persist_done(false);
+    return err;
+  }
+
+  /* Only nodes whose persisted fields changed are rewritten */
   for (uint32_t i = 0; i < REG_MAX_NODES; i++) {
-    if (registry.nodes[i].valid) {
-      char key[REG_PERSIST_KEY_SIZE];
-      snprintf(key, sizeof(key), REG_PERSIST_KEY_PREFIX OS_EUI64_FMT,
-               OS_EUI64_ARG(registry.nodes[i].ieee_addr));
+    reg_node_t *node = &registry.nodes[i];
+    if (!node->valid || !node->dirty) {
+      continue;
+    }
+
+    size_t len = 0;
+    err = reg_node_encode(node, persist_buf, sizeof(persist_buf), &len);
+    if (err != OS_OK) {
+      LOG_E(REG_MODULE, "Node " OS_EUI64_FMT " too large to persist",
+            OS_EUI64_ARG(node->ieee_addr));
+      result = err;
+      continue;
+    }
 
-      os_err_t err =
-          os_persist_put(key, &registry.nodes[i], sizeof(reg_node_t));
+    char key[REG_PERSIST_KEY_SIZE];
+    node_key(node->ieee_addr, key, sizeof(key));
+    err = os_persist_put(key, persist_buf, len);
+    if (err == OS_ERR_FULL) {
+      /* More changes than the write cache holds: commit in parts */
+      err = persist_commit(&persisted);
       if (err == OS_OK) {
-        persisted++;
+        err = os_persist_txn_begin();
+      }
+      if (err != OS_OK) {
+        return err;
       }
+      err = os_persist_put(key, persist_buf, len);
     }
+    if (err != OS_OK) {
+      result = err;
+      continue;
+    }
+
+    persist_staged[i] = true;
   }
 
   /* Store count */
-  os_persist_put(REG_PERSIST_COUNT_KEY, &persisted, sizeof(persisted));
+  bool count_staged = false;
+  uint32_t count = registry.node_count;
+  if (registry.count_dirty || registry.persisted_count != count) {
+    count_staged =
+        os_persist_put(REG_PERSIST_COUNT_KEY, &count, sizeof(count)) == OS_OK;
+  }
+
+  err = persist_commit(&persisted);
+  if (err != OS_OK) {
+    LOG_E(REG_MODULE, "Registry commit failed: %d", err);
+    return err;
+  }
 
-  LOG_I(REG_MODULE, "Persisted %" PRIu32 " nodes", persisted);
+  /* No stored node record refers to an unreferenced string any more */
+  if (result == OS_OK) {
+    reg_str_persist_purge();
+  }
 
-  return OS_OK;
+  if (count_staged) {
+    registry.persisted_count = count;
+    registry.count_dirty = false;
+  }
+
+  if (persisted > 0) {
+    LOG_I(REG_MODULE, "Persisted %" PRIu32 " changed nodes", persisted);
+  }
+
+  return result;
 }
 
 os_err_t reg_restore(void) {
@@ -394,25 +1659,239 @@ os_err_t reg_restore(void) {
     return OS_ERR_NOT_INITIALIZED;
   }
 
-  /* This is a simplified restore - in a real implementation,
-     we would enumerate stored keys */
-  uint32_t count = 0;
-  size_t len;
+  os_time_ms_t start = os_uptime_ms();
+  uint32_t restored = 0;
+  uint32_t skipped = 0;
+  char key[OS_PERSIST_KEY_MAX];
 
-  if (os_persist_get(REG_PERSIST_COUNT_KEY, &count, sizeof(count), &len) !=
-      OS_OK) {
-    LOG_D(REG_MODULE, "No persisted registry found");
-    return OS_OK;
+  /* Node records refer to strings by ID */
+  uint32_t strings = reg_str_restore();
+
+  os_persist_iter_t it;
+  os_err_t err = os_persist_iter_begin(&it, REG_PERSIST_KEY_PREFIX);
+  if (err != OS_OK) {
+    reg_str_restore_done();
+    return err;
   }
 
-  LOG_I(REG_MODULE, "Restoring %" PRIu32 " nodes from storage", count);
+  /* One pass over node/ records, decoding each straight into a free slot */
+  while (os_persist_iter_next(&it, key, sizeof(key)) == OS_OK) {
+    size_t len = 0;
+    if (os_persist_get(key, persist_buf, sizeof(persist_buf), &len) != OS_OK) {
+      skipped++;
+      continue;
+    }
 
-  /* In a real implementation, we would iterate through stored keys
-     For now, nodes are restored on-demand or via explicit load */
+    reg_node_t *slot = NULL;
+    for (uint32_t i = 0; i < REG_MAX_NODES; i++) {
+      if (!registry.nodes[i].valid) {
+        slot = &registry.nodes[i];
+        break;
+      }
+    }
+    if (!slot) {
+      LOG_W(REG_MODULE, "Registry full, not restoring %s", key);
+      skipped++;
+      continue;
+    }
+
+    if (reg_node_decode(persist_buf, len, slot) != OS_OK) {
+      LOG_W(REG_MODULE, "Corrupt record %s", key);
+      memset(slot, 0, sizeof(*slot));
+      skipped++;
+      continue;
+    }
+
+    /* Already known (e.g. re-announced before restore): memory wins */
+    if (reg_find_node(slot->ieee_addr)) {
+      reg_node_clear(slot);
+      memset(slot, 0, sizeof(*slot));
+      continue;
+    }
+    index_insert(INDEX_EUI, slot);
+    nwk_index_claim(slot);
+    slot->added_gen = journal(slot, REG_CHANGE_ADDED, 0, 0, 0);
+    index_node(slot);
+
+    slot->join_time = os_now_ticks();
+    slot->last_seen = slot->join_time;
+    slot->dirty = false;
+    registry.node_count++;
+    restored++;
+  }
+  os_persist_iter_end(&it);
+  reg_str_restore_done();
+
+  registry.persisted_count = registry.node_count;
+  registry.count_dirty = false;
+
+  LOG_I(REG_MODULE,
+        "Restored %" PRIu32 " nodes, %" PRIu32 " strings (%" PRIu32
+        " skipped) in %" PRIu32 " ms",
+        restored, strings, skipped, (uint32_t)(os_uptime_ms() - start));
 
   return OS_OK;
 }
 
+uint32_t reg_generation(void) { return registry.generation; }
+
+uint32_t reg_changes_read(uint32_t *since, reg_change_t *out, uint32_t max,
+                          bool *resync) {
+  if (resync) {
+    *resync = false;
+  }
+  if (!since || !out || *since > registry.generation) {
+    return 0;
+  }
+
+  /* Entries older than one ring's worth have been overwritten */
+  if (registry.generation - *since > REG_JOURNAL_SIZE) {
+    LOG_D(REG_MODULE, "Journal consumer %" PRIu32 " changes behind, resync",
+          registry.generation - *since);
+    *since = registry.generation;
+    if (resync) {
+      *resync = true;
+    }
+    return 0;
+  }
+
+  uint32_t n = 0;
+  while (n < max && *since < registry.generation) {
+    (*since)++;
+    out[n++] = registry.journal[*since % REG_JOURNAL_SIZE];
+  }
+  return n;
+}
+
+os_err_t reg_snapshot_begin(reg_snapshot_t *snap) {
+  if (!snap) {
+    return OS_ERR_INVALID_ARG;
+  }
+
+  for (uint32_t r = 0; r < REG_SNAP_READERS; r++) {
+    if (registry.snap_pins[r] == 0) {
+      registry.snap_pins[r] = ++registry.snap_epoch;
+      registry.snap_lost &= (uint8_t)~(1u << r);
+      snap->epoch = registry.snap_pins[r];
+      snap->reader = (uint8_t)r;
+      return OS_OK;
+    }
+  }
+  return OS_ERR_BUSY;
+}
+
+void reg_snapshot_end(reg_snapshot_t *snap) {
+  if (snap && snap->reader < REG_SNAP_READERS &&
+      registry.snap_pins[snap->reader] == snap->epoch) {
+    registry.snap_pins[snap->reader] = 0;
+  }
+
+  /* Old versions go as soon as no snapshot holds them, releasing their
+   * strings; current views stay for the next reader */
+  for (uint32_t v = 0; v < REG_SNAP_VIEWS; v++) {
+    if (registry.views[v].used && registry.views[v].until && !view_held(v)) {
+      view_free(v);
+    }
+  }
+}
+
+const reg_node_view_t *reg_snapshot_node(const reg_snapshot_t *snap,
+                                         os_eui64_t ieee_addr) {
+  if (!snap || snap->reader >= REG_SNAP_READERS || snap->epoch == 0 ||
+      registry.snap_pins[snap->reader] != snap->epoch ||
+      (registry.snap_lost & (1u << snap->reader))) {
+    return NULL;
+  }
+
+  /* A version kept for this epoch wins over the live node */
+  for (uint32_t v = 0; v < REG_SNAP_VIEWS; v++) {
+    if (registry.views[v].until &&
+        registry.views[v].view.ieee_addr == ieee_addr &&
+        registry.views[v].from < snap->epoch &&
+        snap->epoch <= registry.views[v].until) {
+      return &registry.views[v].view;
+    }
+  }
+
+  /* Otherwise the live node, unless it is newer than the snapshot */
+  reg_node_t *node = reg_find_node(ieee_addr);
+  if (!node) {
+    return NULL;
+  }
+  uint32_t slot = node_ref(node) - 1;
+  if (registry.node_epoch[slot] >= snap->epoch) {
+    return NULL;
+  }
+
+  if (!registry.node_view[slot]) {
+    int32_t v = view_alloc();
+    if (v < 0 || !view_fill((uint32_t)v, node)) {
+      if (v >= 0) {
+        view_free((uint32_t)v);
+      }
+      LOG_W(REG_MODULE, "No free snapshot view for " OS_EUI64_FMT,
+            OS_EUI64_ARG(ieee_addr));
+      return NULL;
+    }
+    registry.views[v].from = registry.node_epoch[slot];
+    registry.views[v].owner = (uint16_t)(slot + 1);
+    registry.node_view[slot] = (uint8_t)(v + 1);
+  }
+
+  uint32_t v = registry.node_view[slot] - 1;
+  if (registry.views[v].epoch < snap->epoch) {
+    registry.views[v].epoch = snap->epoch;
+  }
+  return &registry.views[v].view;
+}
+
+const reg_endpoint_t *reg_view_first_endpoint(const reg_node_view_t *view) {
+  return view && view->endpoints ? SNAP_EP_AT(view->endpoints) : NULL;
+}
+
+const reg_endpoint_t *reg_view_next_endpoint(const reg_endpoint_t *endpoint) {
+  return endpoint && endpoint->next ? SNAP_EP_AT(endpoint->next) : NULL;
+}
+
+const reg_cluster_t *reg_view_first_cluster(const reg_endpoint_t *endpoint) {
+  return endpoint && endpoint->clusters ? SNAP_CL_AT(endpoint->clusters)
+                                        : NULL;
+}
+
+const reg_cluster_t *reg_view_next_cluster(const reg_cluster_t *cluster) {
+  return cluster && cluster->next ? SNAP_CL_AT(cluster->next) : NULL;
+}
+
+const reg_attribute_t *reg_view_first_attribute(const reg_cluster_t *cluster) {
+  return cluster && cluster->attributes ? SNAP_ATTR_AT(cluster->attributes)
+                                        : NULL;
+}
+
+const reg_attribute_t *reg_view_next_attribute(const reg_attribute_t *attr) {
+  return attr && attr->next ? SNAP_ATTR_AT(attr->next) : NULL;
+}
+
+void reg_snapshot_get_stats(reg_snap_stats_t *stats) {
+  if (!stats) {
+    return;
+  }
+
+  memset(stats, 0, sizeof(*stats));
+  for (uint32_t v = 0; v < REG_SNAP_VIEWS; v++) {
+    if (registry.views[v].used) {
+      stats->views_used++;
+    }
+  }
+  for (uint32_t r = 0; r < REG_SNAP_READERS; r++) {
+    if (registry.snap_pins[r]) {
+      stats->readers++;
+    }
+  }
+  stats->views_total = REG_SNAP_VIEWS;
+  stats->copies = registry.snap_copies;
+  stats->lost = registry.snap_lost_count;
+}
+
 const char *reg_state_name(reg_state_t state) {
   if (state < sizeof(state_names) / sizeof(state_names[0])) {
     return state_names[state];
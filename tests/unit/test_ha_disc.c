@@ -42,7 +42,7 @@ static void test_ha_disc_generate_config(void) {
     os_eui64_t addr = 0xAABBCCDDEEFF0011;
     ha_disc_config_t config;
     
-    os_err_t err = ha_disc_generate_config(addr, CAP_LIGHT_ON, &config);
+    os_err_t err = ha_disc_generate_config(addr, 1, CAP_LIGHT_ON, &config);
     ASSERT_EQ(err, OS_OK);
     ASSERT_EQ(config.component, HA_COMPONENT_LIGHT);
     ASSERT_TRUE(strlen(config.unique_id) > 0);
@@ -8,19 +8,27 @@
 #include <assert.h>
 #include <dirent.h>
 #include <inttypes.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 /* Include OS headers directly for testing */
 #include "capability.h"
+#include "history.h"
 #include "interview.h"
+#include "liveness.h"
 #include "os_config.h"
 #include "os_event.h"
+#include "os_fibre.h"
 #include "os_log.h"
+#include "os_mem.h"
 #include "os_persist.h"
+#include "os_persist_telemetry.h"
 #include "os_types.h"
 #include "quirks.h"
 #include "registry.h"
@@ -309,6 +317,22 @@ static void test_types(void) {
   TEST_PASS();
 }
 
+static void test_uptime_seconds(void) {
+  TEST_START("uptime_seconds");
+
+  /* Seconds are counted with the ticks, not derived from them */
+  uint32_t s = os_uptime_s();
+  os_time_ms_t ms = os_uptime_ms();
+  for (int i = 0; i < 2000; i++) {
+    os_tick_advance();
+  }
+  ASSERT_EQ(os_uptime_s(), s + 2);
+  ASSERT_EQ(os_uptime_ms() - ms, 2000);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
 /* Persistence tests */
 
 static void test_persist_init(void) {
@@ -403,6 +427,470 @@ static void test_persist_schema_version(void) {
   TEST_PASS();
 }
 
+static void test_persist_cache_eviction(void) {
+  TEST_START("persist_cache_eviction");
+
+  ASSERT_EQ(os_persist_flush(), OS_OK);
+  os_persist_stats_t before;
+  os_persist_get_stats_ex(&before);
+
+  /* More keys than one buffer holds, mixed sizes: forces a buffer swap */
+  char key[OS_PERSIST_KEY_MAX];
+  uint8_t value[96];
+  for (uint32_t i = 0; i < OS_PERSIST_CACHE_ENTRIES * 2; i++) {
+    snprintf(key, sizeof(key), "evict/%" PRIu32, i);
+    size_t len = 1 + (i * 7) % sizeof(value);
+    memset(value, (int)i, len);
+    os_err_t err = os_persist_put(key, value, len);
+    ASSERT_EQ(err, OS_OK);
+  }
+
+  os_persist_stats_t after;
+  os_persist_get_stats_ex(&after);
+  ASSERT_EQ(after.buffer_swaps, before.buffer_swaps + 1);
+  ASSERT_EQ(after.stalls, before.stalls);
+  ASSERT_TRUE(after.writes_buffered <= OS_PERSIST_CACHE_ENTRIES * 2);
+
+  /* Every value readable, whether buffered, sealed or written */
+  for (uint32_t i = 0; i < OS_PERSIST_CACHE_ENTRIES * 2; i++) {
+    snprintf(key, sizeof(key), "evict/%" PRIu32, i);
+    size_t len = 0;
+    os_err_t err = os_persist_get(key, value, sizeof(value), &len);
+    ASSERT_EQ(err, OS_OK);
+    ASSERT_EQ(len, 1 + (i * 7) % sizeof(value));
+    ASSERT_EQ(value[len - 1], (uint8_t)i);
+  }
+
+  /* Growing an existing key reallocates in place of the old region */
+  uint8_t big[OS_PERSIST_VALUE_MAX];
+  memset(big, 0xA5, sizeof(big));
+  ASSERT_EQ(os_persist_put("evict/0", big, sizeof(big)), OS_OK);
+  size_t len = 0;
+  ASSERT_EQ(os_persist_get("evict/0", big, sizeof(big), &len), OS_OK);
+  ASSERT_EQ(len, sizeof(big));
+  ASSERT_EQ(big[sizeof(big) - 1], 0xA5);
+
+  ASSERT_EQ(os_persist_flush(), OS_OK);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_persist_flush_stall(void) {
+  TEST_START("persist_flush_stall");
+
+  ASSERT_EQ(os_persist_flush(), OS_OK);
+  os_persist_stats_t before;
+  os_persist_get_stats_ex(&before);
+
+  /* Both buffers fill without waiting for storage */
+  char key[OS_PERSIST_KEY_MAX];
+  uint8_t value[16];
+  for (uint32_t i = 0; i < OS_PERSIST_CACHE_ENTRIES * 2; i++) {
+    snprintf(key, sizeof(key), "stall/%" PRIu32, i);
+    memset(value, (int)i, sizeof(value));
+    ASSERT_EQ(os_persist_put(key, value, sizeof(value)), OS_OK);
+  }
+
+  os_persist_stats_t stats;
+  os_persist_get_stats_ex(&stats);
+  ASSERT_EQ(stats.stalls, before.stalls);
+  ASSERT_EQ(stats.flushes, before.flushes);
+  ASSERT_EQ(stats.writes_buffered, OS_PERSIST_CACHE_ENTRIES * 2);
+
+  /* Sealed buffer never drained: next put must flush it first */
+  ASSERT_EQ(os_persist_put("stall/extra", value, sizeof(value)), OS_OK);
+  os_persist_get_stats_ex(&stats);
+  ASSERT_EQ(stats.stalls, before.stalls + 1);
+  ASSERT_EQ(stats.flushes, before.flushes + 1);
+  ASSERT_EQ(stats.writes_buffered, OS_PERSIST_CACHE_ENTRIES + 1);
+
+  ASSERT_EQ(os_persist_flush(), OS_OK);
+  os_persist_get_stats_ex(&stats);
+  ASSERT_EQ(stats.writes_buffered, 0);
+  ASSERT_TRUE(stats.flush_p50_ms <= stats.flush_p90_ms);
+  ASSERT_TRUE(stats.flush_p90_ms <= stats.flush_p99_ms);
+
+  size_t len = 0;
+  ASSERT_EQ(os_persist_get("stall/0", value, sizeof(value), &len), OS_OK);
+  ASSERT_EQ(len, sizeof(value));
+  ASSERT_EQ(value[0], 0);
+
+  for (uint32_t i = 0; i < OS_PERSIST_CACHE_ENTRIES * 2; i++) {
+    snprintf(key, sizeof(key), "stall/%" PRIu32, i);
+    os_persist_del(key);
+  }
+  os_persist_del("stall/extra");
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_persist_flush_policy(void) {
+  TEST_START("persist_flush_policy");
+
+  ASSERT_EQ(os_persist_flush(), OS_OK);
+  ASSERT_EQ(os_persist_flush_due(), OS_PERSIST_FLUSH_NONE);
+
+  os_persist_stats_t before;
+  os_persist_get_stats_ex(&before);
+
+  /* A fresh burst is debounced */
+  uint32_t v = 0;
+  for (v = 0; v < 10; v++) {
+    ASSERT_EQ(os_persist_put("policy/hot", &v, sizeof(v)), OS_OK);
+  }
+  ASSERT_EQ(os_persist_flush_due(), OS_PERSIST_FLUSH_NONE);
+
+  os_persist_stats_t stats;
+  os_persist_get_stats_ex(&stats);
+  ASSERT_EQ(stats.puts, before.puts + 10);
+  ASSERT_EQ(stats.puts_absorbed, before.puts_absorbed + 9);
+  ASSERT_TRUE(stats.max_absorbed >= 9);
+  ASSERT_EQ(stats.writes_buffered, 1);
+
+  /* Enough dirty bytes fire the volume trigger without waiting */
+  static uint8_t blob[OS_PERSIST_VALUE_MAX];
+  memset(blob, 0x3C, sizeof(blob));
+  char key[OS_PERSIST_KEY_MAX];
+  for (uint32_t i = 0; i * sizeof(blob) < OS_PERSIST_FLUSH_BYTES; i++) {
+    snprintf(key, sizeof(key), "policy/%" PRIu32, i);
+    ASSERT_EQ(os_persist_put(key, blob, sizeof(blob)), OS_OK);
+  }
+  ASSERT_EQ(os_persist_flush_due(), OS_PERSIST_FLUSH_VOLUME);
+
+  ASSERT_EQ(os_persist_flush(), OS_OK);
+  ASSERT_EQ(os_persist_flush_due(), OS_PERSIST_FLUSH_NONE);
+
+  size_t len = 0;
+  ASSERT_EQ(os_persist_get("policy/hot", &v, sizeof(v), &len), OS_OK);
+  ASSERT_EQ(v, 9);
+
+  os_persist_del("policy/hot");
+  for (uint32_t i = 0; i * sizeof(blob) < OS_PERSIST_FLUSH_BYTES; i++) {
+    snprintf(key, sizeof(key), "policy/%" PRIu32, i);
+    os_persist_del(key);
+  }
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_persist_tiers(void) {
+  TEST_START("persist_tiers");
+
+  ASSERT_EQ(os_persist_flush(), OS_OK);
+  os_persist_stats_t before;
+  os_persist_get_stats_ex(&before);
+
+  /* Overflowing the cache tier drops its values instead of stalling */
+  char key[OS_PERSIST_KEY_MAX];
+  uint32_t v;
+  for (v = 0; v <= OS_PERSIST_CACHE_ENTRIES; v++) {
+    snprintf(key, sizeof(key), "tier/%" PRIu32, v);
+    ASSERT_EQ(os_persist_put_tier(key, &v, sizeof(v), OS_PERSIST_TIER_CACHE),
+              OS_OK);
+  }
+
+  os_persist_stats_t stats;
+  os_persist_get_stats_ex(&stats);
+  ASSERT_EQ(stats.tier_dropped, before.tier_dropped + OS_PERSIST_CACHE_ENTRIES);
+  ASSERT_EQ(stats.tier_buffered, 1);
+  ASSERT_EQ(stats.writes_buffered, 0);
+  ASSERT_EQ(stats.stalls, before.stalls);
+
+  /* Newest value readable before and after it reaches storage */
+  size_t len = 0;
+  ASSERT_EQ(os_persist_get(key, &v, sizeof(v), &len), OS_OK);
+  ASSERT_EQ(v, OS_PERSIST_CACHE_ENTRIES);
+  ASSERT_EQ(os_persist_flush(), OS_OK);
+  ASSERT_EQ(os_persist_get(key, &v, sizeof(v), &len), OS_OK);
+  ASSERT_EQ(v, OS_PERSIST_CACHE_ENTRIES);
+  ASSERT_FALSE(os_persist_exists("tier/0"));
+
+  ASSERT_EQ(os_persist_del(key), OS_OK);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_persist_crc_quarantine(void) {
+  TEST_START("persist_crc_quarantine");
+
+  ASSERT_EQ(os_persist_put("crc/a", "hello", 5), OS_OK);
+  ASSERT_EQ(os_persist_put("crc/b", "world", 5), OS_OK);
+  ASSERT_EQ(os_persist_flush(), OS_OK);
+
+  os_persist_stats_t before;
+  os_persist_get_stats_ex(&before);
+
+  /* Bit flip in the payload: reads as absent, then moved aside */
+  FILE *f = fopen("/tmp/bridge_persist/crc%2Fa.bin", "r+b");
+  ASSERT_TRUE(f != NULL);
+  fseek(f, -1, SEEK_END);
+  fputc('X', f);
+  fclose(f);
+
+  char buf[16];
+  size_t len = 0;
+  ASSERT_EQ(os_persist_get("crc/a", buf, sizeof(buf), &len), OS_ERR_NOT_FOUND);
+  ASSERT_EQ(os_persist_flush(), OS_OK);
+  ASSERT_FALSE(os_persist_exists("crc/a"));
+  struct stat st;
+  ASSERT_EQ(stat("/tmp/bridge_persist/crc%2Fa.bad", &st), 0);
+
+  /* Torn write found by the boot scan */
+  ASSERT_EQ(truncate("/tmp/bridge_persist/crc%2Fb.bin", 6), 0);
+  /* Unframed record in a converted store is damage too */
+  f = fopen("/tmp/bridge_persist/crc%2Fc.bin", "wb");
+  ASSERT_TRUE(f != NULL);
+  fwrite("raw", 1, 3, f);
+  fclose(f);
+
+  ASSERT_EQ(os_persist_scan(), OS_OK);
+  os_persist_stats_t stats;
+  os_persist_get_stats_ex(&stats);
+  ASSERT_EQ(stats.corrupt, before.corrupt + 3);
+  ASSERT_EQ(stats.quarantined, before.quarantined + 3);
+  ASSERT_EQ(stats.legacy, 0);
+  ASSERT_TRUE(stats.scan_complete);
+  ASSERT_FALSE(os_persist_exists("crc/b"));
+  ASSERT_FALSE(os_persist_exists("crc/c"));
+
+  /* Store from before framing: converted once by the scan */
+  ASSERT_EQ(unlink("/tmp/bridge_persist/_store_format.bin"), 0);
+  f = fopen("/tmp/bridge_persist/crc%2Fd.bin", "wb");
+  ASSERT_TRUE(f != NULL);
+  fwrite("raw", 1, 3, f);
+  fclose(f);
+
+  ASSERT_EQ(os_persist_scan(), OS_OK);
+  os_persist_get_stats_ex(&stats);
+  ASSERT_EQ(stats.legacy, 1);
+  ASSERT_EQ(stats.corrupt, before.corrupt + 3);
+  ASSERT_EQ(stat("/tmp/bridge_persist/_store_format.bin", &st), 0);
+  ASSERT_EQ(os_persist_get("crc/d", buf, sizeof(buf), &len), OS_OK);
+  ASSERT_EQ(len, 3);
+  ASSERT_TRUE(memcmp(buf, "raw", 3) == 0);
+
+  /* Rescan finds it framed; later unframed writes are not accepted */
+  f = fopen("/tmp/bridge_persist/crc%2Fe.bin", "wb");
+  ASSERT_TRUE(f != NULL);
+  fwrite("raw", 1, 3, f);
+  fclose(f);
+  ASSERT_EQ(os_persist_scan(), OS_OK);
+  os_persist_get_stats_ex(&stats);
+  ASSERT_EQ(stats.legacy, 0);
+  ASSERT_EQ(stats.corrupt, before.corrupt + 4);
+  ASSERT_TRUE(os_persist_exists("crc/d"));
+  ASSERT_FALSE(os_persist_exists("crc/e"));
+
+  os_persist_del("crc/d");
+  unlink("/tmp/bridge_persist/crc%2Fa.bad");
+  unlink("/tmp/bridge_persist/crc%2Fb.bad");
+  unlink("/tmp/bridge_persist/crc%2Fc.bad");
+  unlink("/tmp/bridge_persist/crc%2Fe.bad");
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_persist_telemetry(void) {
+  TEST_START("persist_telemetry");
+
+  os_persist_stats_t before;
+  os_persist_get_stats_ex(&before);
+
+  /* Ten puts of one key, one flush: one record reaches storage */
+  uint8_t value[40];
+  for (uint32_t i = 0; i < 10; i++) {
+    memset(value, (int)i, sizeof(value));
+    ASSERT_EQ(os_persist_put("tm/key", value, sizeof(value)), OS_OK);
+  }
+  ASSERT_EQ(os_persist_flush(), OS_OK);
+
+  os_persist_stats_t stats;
+  os_persist_get_stats_ex(&stats);
+  ASSERT_EQ(stats.put_bytes - before.put_bytes, 10 * sizeof(value));
+  ASSERT_EQ(stats.records_written - before.records_written, 1);
+  /* Framing header included; 48 bytes = header entry + 2 data entries */
+  ASSERT_EQ(stats.bytes_written - before.bytes_written, sizeof(value) + 8);
+  ASSERT_EQ(stats.entries_written - before.entries_written, 3);
+
+  os_persist_telemetry_t t;
+  ASSERT_EQ(os_persist_telemetry_get(&t), OS_OK);
+  ASSERT_TRUE(t.avg_value_size > 0);
+  ASSERT_TRUE(t.puts_per_flush_x100 >= 100);
+  ASSERT_EQ(t.nvs_total_entries, OS_PERSIST_HOST_NVS_ENTRIES);
+  ASSERT_TRUE(t.nvs_used_entries >= 3);
+  ASSERT_EQ(t.nvs_used_entries + t.nvs_free_entries, t.nvs_total_entries);
+
+  os_persist_del("tm/key");
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_persist_iter(void) {
+  TEST_START("persist_iter");
+
+  uint8_t v = 1;
+  ASSERT_EQ(os_persist_put("it/a", &v, 1), OS_OK);
+  ASSERT_EQ(os_persist_put("it/b", &v, 1), OS_OK);
+  ASSERT_EQ(os_persist_put("other/x", &v, 1), OS_OK);
+  ASSERT_EQ(os_persist_flush(), OS_OK);
+
+  /* One key only in the cache, one both cached and stored */
+  ASSERT_EQ(os_persist_put("it/c", &v, 1), OS_OK);
+  ASSERT_EQ(os_persist_put("it/a", &v, 1), OS_OK);
+
+  os_persist_iter_t it;
+  char key[OS_PERSIST_KEY_MAX];
+  uint32_t seen = 0;
+  uint32_t mask = 0;
+  ASSERT_EQ(os_persist_iter_begin(&it, "it/"), OS_OK);
+  while (os_persist_iter_next(&it, key, sizeof(key)) == OS_OK) {
+    ASSERT_TRUE(strncmp(key, "it/", 3) == 0);
+    mask |= 1u << (key[3] - 'a');
+    seen++;
+  }
+  os_persist_iter_end(&it);
+  ASSERT_EQ(seen, 3);
+  ASSERT_EQ(mask, 0x7);
+
+  /* Deleted keys are not visited */
+  ASSERT_EQ(os_persist_del("it/b"), OS_OK);
+  seen = 0;
+  ASSERT_EQ(os_persist_iter_begin(&it, "it/"), OS_OK);
+  while (os_persist_iter_next(&it, key, sizeof(key)) == OS_OK) {
+    seen++;
+  }
+  os_persist_iter_end(&it);
+  ASSERT_EQ(seen, 2);
+
+  os_persist_del("it/a");
+  os_persist_del("it/c");
+  os_persist_del("other/x");
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_persist_txn(void) {
+  TEST_START("persist_txn");
+
+  uint32_t v = 1;
+  ASSERT_EQ(os_persist_put("txn/pre", &v, sizeof(v)), OS_OK);
+
+  /* Abort discards transaction puts but not earlier buffered values */
+  ASSERT_EQ(os_persist_txn_begin(), OS_OK);
+  ASSERT_EQ(os_persist_txn_begin(), OS_ERR_BUSY);
+  v = 2;
+  ASSERT_EQ(os_persist_put("txn/pre", &v, sizeof(v)), OS_OK);
+  ASSERT_EQ(os_persist_put("txn/a", &v, sizeof(v)), OS_OK);
+  ASSERT_TRUE(os_persist_exists("txn/a"));
+  ASSERT_EQ(os_persist_txn_abort(), OS_OK);
+  ASSERT_FALSE(os_persist_exists("txn/a"));
+  ASSERT_EQ(os_persist_get("txn/pre", &v, sizeof(v), NULL), OS_OK);
+  ASSERT_EQ(v, 1);
+
+  /* Flush leaves an open transaction alone; commit writes it through */
+  ASSERT_EQ(os_persist_txn_begin(), OS_OK);
+  v = 3;
+  ASSERT_EQ(os_persist_put("txn/a", &v, sizeof(v)), OS_OK);
+  ASSERT_EQ(os_persist_put("txn/b", &v, sizeof(v)), OS_OK);
+  ASSERT_EQ(os_persist_flush(), OS_OK);
+  uint32_t buffered = 0;
+  os_persist_get_stats(&buffered, NULL, NULL);
+  ASSERT_EQ(buffered, 2);
+  ASSERT_EQ(os_persist_txn_commit(), OS_OK);
+  os_persist_get_stats(&buffered, NULL, NULL);
+  ASSERT_EQ(buffered, 0);
+  ASSERT_EQ(os_persist_get("txn/b", &v, sizeof(v), NULL), OS_OK);
+  ASSERT_EQ(v, 3);
+
+  os_persist_del("txn/pre");
+  os_persist_del("txn/a");
+  os_persist_del("txn/b");
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+/* Kill a writer process at random points while it commits transactions;
+ * after recovery every key must come from the same transaction */
+static void test_persist_txn_crash(void) {
+  TEST_START("persist_txn_crash");
+
+  enum { KEYS = 8, WORDS = 32, ROUNDS = 25 };
+  uint32_t value[WORDS];
+  char key[OS_PERSIST_KEY_MAX];
+
+  memset(value, 0, sizeof(value));
+  ASSERT_EQ(os_persist_txn_begin(), OS_OK);
+  for (uint32_t k = 0; k < KEYS; k++) {
+    snprintf(key, sizeof(key), "crash/%" PRIu32, k);
+    ASSERT_EQ(os_persist_put(key, value, sizeof(value)), OS_OK);
+  }
+  ASSERT_EQ(os_persist_txn_commit(), OS_OK);
+
+  srand(0xC0FFEE);
+  uint32_t replays = 0;
+  for (uint32_t round = 0; round < ROUNDS; round++) {
+    fflush(stdout);
+    pid_t pid = fork();
+    ASSERT_TRUE(pid >= 0);
+    if (pid == 0) {
+      for (uint32_t gen = 1;; gen++) {
+        for (uint32_t w = 0; w < WORDS; w++) {
+          value[w] = gen;
+        }
+        os_persist_txn_begin();
+        for (uint32_t k = 0; k < KEYS; k++) {
+          snprintf(key, sizeof(key), "crash/%" PRIu32, k);
+          os_persist_put(key, value, sizeof(value));
+        }
+        os_persist_txn_commit();
+      }
+    }
+
+    usleep((useconds_t)(rand() % 4000));
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+
+    os_persist_stats_t before, after;
+    os_persist_get_stats_ex(&before);
+    ASSERT_EQ(os_persist_recover(), OS_OK);
+    os_persist_get_stats_ex(&after);
+    if (after.txn_replayed > before.txn_replayed) {
+      replays++;
+    }
+
+    uint32_t gen = 0;
+    for (uint32_t k = 0; k < KEYS; k++) {
+      snprintf(key, sizeof(key), "crash/%" PRIu32, k);
+      size_t len = 0;
+      ASSERT_EQ(os_persist_get(key, value, sizeof(value), &len), OS_OK);
+      ASSERT_EQ(len, sizeof(value));
+      if (k == 0) {
+        gen = value[0];
+      }
+      for (uint32_t w = 0; w < WORDS; w++) {
+        ASSERT_EQ(value[w], gen);
+      }
+    }
+  }
+  printf("(%u kills, %" PRIu32 " replayed) ", (unsigned)ROUNDS, replays);
+
+  for (uint32_t k = 0; k < KEYS; k++) {
+    snprintf(key, sizeof(key), "crash/%" PRIu32, k);
+    os_persist_del(key);
+  }
+
+  tests_passed++;
+  TEST_PASS();
+}
+
 /* Registry tests */
 
 static void test_reg_init(void) {
@@ -526,6 +1014,123 @@ static void test_reg_set_state(void) {
   ASSERT_EQ(err, OS_OK);
   ASSERT_EQ(node->state, REG_STATE_READY);
 
+  /* Unknown states are refused before they reach the state index */
+  err = reg_set_state(node, (reg_state_t)(REG_STATE_LEFT + 1));
+  ASSERT_EQ(err, OS_ERR_INVALID_ARG);
+  ASSERT_EQ(node->state, REG_STATE_READY);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_reg_codec_roundtrip(void) {
+  TEST_START("reg_codec_roundtrip");
+
+  os_eui64_t addr = 0x00112233445566AA;
+  reg_node_t *node = reg_find_node(addr);
+  ASSERT_TRUE(node != NULL);
+  ASSERT_EQ(reg_set_manufacturer(node, "IKEA"), OS_OK);
+  ASSERT_EQ(reg_set_model(node, "TRADFRI bulb"), OS_OK);
+
+  reg_endpoint_t *ep = reg_find_endpoint(node, 1);
+  ASSERT_TRUE(ep != NULL);
+  reg_cluster_t *basic = reg_add_cluster(ep, 0x0000, REG_CLUSTER_SERVER);
+  ASSERT_TRUE(basic != NULL);
+  reg_attr_value_t power = {.u8 = 1};
+  reg_attr_value_t model = {0};
+  strncpy(model.str, "ABC", sizeof(model.str) - 1);
+  ASSERT_EQ(reg_update_attribute(basic, 0x0007, REG_ATTR_TYPE_U8, &power),
+            OS_OK);
+  ASSERT_EQ(reg_update_attribute(basic, 0x0005, REG_ATTR_TYPE_STRING, &model),
+            OS_OK);
+
+  static uint8_t buf[OS_PERSIST_VALUE_MAX];
+  static reg_node_t decoded;
+  size_t len = 0;
+  ASSERT_EQ(reg_node_encode(node, buf, sizeof(buf), &len), OS_OK);
+  ASSERT_TRUE(len > 0 && len < 128);
+  ASSERT_EQ(reg_node_decode(buf, len, &decoded), OS_OK);
+
+  ASSERT_EQ(decoded.ieee_addr, node->ieee_addr);
+  ASSERT_EQ(decoded.nwk_addr, node->nwk_addr);
+  ASSERT_EQ(decoded.state, node->state);
+  ASSERT_TRUE(strcmp(reg_str(decoded.manufacturer), "IKEA") == 0);
+  ASSERT_TRUE(strcmp(reg_str(decoded.model), "TRADFRI bulb") == 0);
+  ASSERT_EQ(decoded.model, node->model);
+  ASSERT_EQ(decoded.endpoint_count, node->endpoint_count);
+
+  reg_endpoint_t *dep = reg_first_endpoint(&decoded);
+  ASSERT_EQ(dep->endpoint_id, 1);
+  ASSERT_EQ(dep->cluster_count, ep->cluster_count);
+  reg_cluster_t *dbasic = reg_find_cluster(dep, 0x0000);
+  ASSERT_TRUE(dbasic != NULL);
+  ASSERT_EQ(reg_find_attribute(dbasic, 0x0007)->value.u8, 1);
+  ASSERT_TRUE(strcmp(reg_find_attribute(dbasic, 0x0005)->value.str, "ABC") ==
+              0);
+
+  /* Non-essential attributes are not stored */
+  reg_cluster_t *donoff = reg_find_cluster(dep, 0x0006);
+  ASSERT_TRUE(donoff != NULL);
+  ASSERT_EQ(donoff->attr_count, 0);
+
+  /* Truncated records are rejected */
+  reg_node_clear(&decoded);
+  reg_pool_stats_t pools;
+  reg_get_pool_stats(&pools);
+  ASSERT_EQ(reg_node_decode(buf, len - 1, &decoded), OS_ERR_INVALID_ARG);
+
+  /* ...without leaking what was decoded before the damage */
+  reg_pool_stats_t after;
+  reg_get_pool_stats(&after);
+  ASSERT_EQ(after.endpoints_used, pools.endpoints_used);
+  ASSERT_EQ(after.clusters_used, pools.clusters_used);
+  ASSERT_EQ(after.attributes_used, pools.attributes_used);
+
+  /* An out-of-range state or power source is damage, not a node */
+  size_t state_pos = 0;
+  for (size_t pos = 1; pos + 2 <= len; pos += 2 + buf[pos + 1]) {
+    if (buf[pos] == 0x02) {
+      state_pos = pos + 2;
+      break;
+    }
+  }
+  ASSERT_TRUE(state_pos != 0);
+  uint8_t saved_state = buf[state_pos];
+  buf[state_pos] = 0xC8;
+  ASSERT_EQ(reg_node_decode(buf, len, &decoded), OS_ERR_INVALID_ARG);
+  buf[state_pos] = saved_state;
+  buf[state_pos + 1] = 0x17;
+  ASSERT_EQ(reg_node_decode(buf, len, &decoded), OS_ERR_INVALID_ARG);
+  reg_get_pool_stats(&after);
+  ASSERT_EQ(after.endpoints_used, pools.endpoints_used);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_reg_persist_dirty(void) {
+  TEST_START("reg_persist_dirty");
+
+  os_eui64_t addr = 0x00112233445566AA;
+  reg_node_t *node = reg_find_node(addr);
+  ASSERT_TRUE(node != NULL);
+  ASSERT_TRUE(node->dirty);
+
+  ASSERT_EQ(reg_persist(), OS_OK);
+  ASSERT_FALSE(node->dirty);
+  ASSERT_TRUE(os_persist_exists("node/00112233445566AA"));
+
+  /* Non-essential attribute reports do not dirty the node */
+  reg_cluster_t *cl = reg_find_cluster(reg_find_endpoint(node, 1), 0x0006);
+  reg_attr_value_t value = {.b = false};
+  reg_update_attribute(cl, 0x0000, REG_ATTR_TYPE_BOOL, &value);
+  ASSERT_FALSE(node->dirty);
+
+  reg_set_state(node, REG_STATE_OFFLINE);
+  ASSERT_TRUE(node->dirty);
+  ASSERT_EQ(reg_persist(), OS_OK);
+  ASSERT_FALSE(node->dirty);
+
   tests_passed++;
   TEST_PASS();
 }
@@ -543,6 +1148,613 @@ static void test_reg_remove_node(void) {
   reg_node_t *node = reg_find_node(addr);
   ASSERT_TRUE(node == NULL);
 
+  /* Persisted record is dropped with the node */
+  ASSERT_FALSE(os_persist_exists("node/00112233445566AA"));
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_reg_restore_boot(void) {
+  TEST_START("reg_restore_boot");
+
+  /* More paired devices on flash than the registry holds */
+  const uint32_t paired = REG_MAX_NODES + 32;
+  static reg_node_t tmpl;
+  static uint8_t buf[OS_PERSIST_VALUE_MAX];
+  memset(&tmpl, 0, sizeof(tmpl));
+  tmpl.valid = true;
+  tmpl.state = REG_STATE_READY;
+  ASSERT_EQ(reg_set_manufacturer(&tmpl, "IKEA of Sweden"), OS_OK);
+  ASSERT_EQ(reg_set_model(&tmpl, "TRADFRI bulb E27"), OS_OK);
+  reg_endpoint_t *tep = reg_add_endpoint(&tmpl, 1, 0x0104, 0x0100);
+  reg_add_cluster(tep, 0x0000, REG_CLUSTER_SERVER);
+  reg_add_cluster(tep, 0x0006, REG_CLUSTER_SERVER);
+
+  char key[OS_PERSIST_KEY_MAX];
+  for (uint32_t i = 0; i < paired; i++) {
+    tmpl.ieee_addr = 0xBEEF000000000000ULL | i;
+    tmpl.nwk_addr = (uint16_t)(0x1000 + i);
+    size_t len = 0;
+    ASSERT_EQ(reg_node_encode(&tmpl, buf, sizeof(buf), &len), OS_OK);
+    snprintf(key, sizeof(key), "node/" OS_EUI64_FMT,
+             OS_EUI64_ARG(tmpl.ieee_addr));
+    ASSERT_EQ(os_persist_put(key, buf, len), OS_OK);
+  }
+  ASSERT_EQ(os_persist_flush(), OS_OK);
+
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  ASSERT_EQ(reg_restore(), OS_OK);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  double ms = (double)(t1.tv_sec - t0.tv_sec) * 1e3 +
+              (double)(t1.tv_nsec - t0.tv_nsec) / 1e6;
+  printf("(%" PRIu32 " records, %" PRIu32 " nodes restored in %.2f ms) ",
+         paired, reg_node_count(), ms);
+
+  ASSERT_EQ(reg_node_count(), REG_MAX_NODES);
+  reg_node_t *node = NULL;
+  for (uint32_t i = 0; i < paired && !node; i++) {
+    node = reg_find_node_by_nwk((uint16_t)(0x1000 + i));
+  }
+  ASSERT_TRUE(node != NULL);
+  ASSERT_EQ(node->state, REG_STATE_READY);
+  ASSERT_TRUE(strcmp(reg_str(node->model), "TRADFRI bulb E27") == 0);
+  ASSERT_EQ(node->model, tmpl.model);
+  ASSERT_TRUE(reg_find_cluster(reg_find_endpoint(node, 1), 0x0006) != NULL);
+  ASSERT_FALSE(node->dirty);
+
+  /* A second restore keeps existing nodes and adds none */
+  ASSERT_EQ(reg_restore(), OS_OK);
+  ASSERT_EQ(reg_node_count(), REG_MAX_NODES);
+
+  /* Leave the registry and storage empty for later tests */
+  reg_node_clear(&tmpl);
+  for (uint32_t i = 0; i < paired; i++) {
+    os_eui64_t addr = 0xBEEF000000000000ULL | i;
+    if (reg_remove_node(addr) != OS_OK) {
+      snprintf(key, sizeof(key), "node/" OS_EUI64_FMT, OS_EUI64_ARG(addr));
+      os_persist_del(key);
+    }
+  }
+  os_event_dispatch(0);
+  ASSERT_EQ(reg_node_count(), 0);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_reg_pools(void) {
+  TEST_START("reg_pools");
+
+  reg_pool_stats_t before;
+  reg_get_pool_stats(&before);
+
+  /* A typical bulb: one endpoint, a handful of clusters */
+  reg_node_t *node = reg_add_node(0x0017880100000001ULL, 0x4001);
+  ASSERT_TRUE(node != NULL);
+  uint32_t bare = reg_node_mem(node);
+  ASSERT_EQ(bare, sizeof(reg_node_t));
+  reg_endpoint_t *ep = reg_add_endpoint(node, 11, 0x0104, 0x0100);
+  ASSERT_TRUE(ep != NULL);
+  static const uint16_t ids[] = {0x0000, 0x0003, 0x0004, 0x0006, 0x0008};
+  for (size_t i = 0; i < sizeof(ids) / sizeof(ids[0]); i++) {
+    ASSERT_TRUE(reg_add_cluster(ep, ids[i], REG_CLUSTER_SERVER) != NULL);
+  }
+  reg_attr_value_t on = {.b = true};
+  ASSERT_EQ(reg_update_attribute(reg_find_cluster(ep, 0x0006), 0x0000,
+                                 REG_ATTR_TYPE_BOOL, &on),
+            OS_OK);
+
+  /* Discovery order is kept */
+  reg_cluster_t *cl = reg_first_cluster(ep);
+  for (size_t i = 0; i < sizeof(ids) / sizeof(ids[0]); i++) {
+    ASSERT_TRUE(cl != NULL);
+    ASSERT_EQ(cl->cluster_id, ids[i]);
+    cl = reg_next_cluster(cl);
+  }
+  ASSERT_TRUE(cl == NULL);
+
+  reg_pool_stats_t stats;
+  reg_get_pool_stats(&stats);
+  ASSERT_EQ(stats.endpoints_used, before.endpoints_used + 1);
+  ASSERT_EQ(stats.clusters_used, before.clusters_used + 5);
+  ASSERT_EQ(stats.attributes_used, before.attributes_used + 1);
+  uint32_t mem = reg_node_mem(node);
+  ASSERT_EQ(mem, sizeof(reg_node_t) + sizeof(reg_endpoint_t) +
+                     5 * sizeof(reg_cluster_t) + sizeof(reg_attribute_t));
+  printf("(bulb: %" PRIu32 " bytes, registry: %" PRIu32 " bytes) ", mem,
+         stats.bytes_total);
+
+  /* Removal hands everything back for the next device */
+  ASSERT_EQ(reg_remove_node(0x0017880100000001ULL), OS_OK);
+  reg_get_pool_stats(&stats);
+  ASSERT_EQ(stats.endpoints_used, before.endpoints_used);
+  ASSERT_EQ(stats.clusters_used, before.clusters_used);
+  ASSERT_EQ(stats.attributes_used, before.attributes_used);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_reg_iter(void) {
+  TEST_START("reg_iter");
+
+  /* Eight nodes: odd ones READY on battery, 0 and 4 expose OnOff */
+  reg_node_t *nodes[8];
+  for (uint32_t i = 0; i < 8; i++) {
+    nodes[i] = reg_add_node(0x00124B0000000000ULL | i, (uint16_t)(0x3000 + i));
+    ASSERT_TRUE(nodes[i] != NULL);
+    if (i & 1) {
+      reg_set_state(nodes[i], REG_STATE_READY);
+      nodes[i]->power_source = REG_POWER_BATTERY;
+    }
+    reg_endpoint_t *ep = reg_add_endpoint(nodes[i], 1, 0x0104, 0x0100);
+    reg_add_cluster(ep, (i % 4 == 0) ? 0x0006 : 0x0402, REG_CLUSTER_SERVER);
+  }
+
+  reg_iter_t it;
+  uint32_t seen = 0;
+  reg_iter_begin(&it, NULL);
+  while (reg_iter_next(&it)) {
+    seen++;
+  }
+  ASSERT_EQ(seen, 8);
+
+  reg_filter_t ready = {.states = REG_STATE_BIT(REG_STATE_READY)};
+  seen = 0;
+  reg_iter_begin(&it, &ready);
+  for (reg_node_t *n = reg_iter_next(&it); n; n = reg_iter_next(&it)) {
+    ASSERT_EQ(n->state, REG_STATE_READY);
+    seen++;
+  }
+  ASSERT_EQ(seen, 4);
+
+  reg_filter_t onoff = {.has_cluster = true, .cluster_id = 0x0006};
+  seen = 0;
+  reg_iter_begin(&it, &onoff);
+  for (reg_node_t *n = reg_iter_next(&it); n; n = reg_iter_next(&it)) {
+    ASSERT_TRUE(n == nodes[0] || n == nodes[4]);
+    seen++;
+  }
+  ASSERT_EQ(seen, 2);
+
+  reg_filter_t mains = {.has_power_source = true,
+                        .power_source = REG_POWER_MAINS};
+  reg_iter_begin(&it, &mains);
+  ASSERT_TRUE(reg_iter_next(&it) == NULL);
+
+  /* Removing the current and a later node neither skips nor repeats the
+   * others; a node that leaves and rejoins mid-scan is not seen twice */
+  bool visited[10] = {false};
+  seen = 0;
+  reg_iter_begin(&it, NULL);
+  for (reg_node_t *n = reg_iter_next(&it); n; n = reg_iter_next(&it)) {
+    uint32_t i = (uint32_t)(n->ieee_addr & 0xFF);
+    ASSERT_FALSE(visited[i]);
+    visited[i] = true;
+    seen++;
+    if (i == 2) {
+      ASSERT_EQ(reg_remove_node(0x00124B0000000002ULL), OS_OK);
+      ASSERT_EQ(reg_remove_node(0x00124B0000000005ULL), OS_OK);
+      ASSERT_EQ(reg_remove_node(0x00124B0000000001ULL), OS_OK);
+      /* Newcomers take the freed slots 1 and 2, pushing the rejoin past
+       * the cursor */
+      ASSERT_TRUE(reg_add_node(0x00124B0000000008ULL, 0x3008) != NULL);
+      ASSERT_TRUE(reg_add_node(0x00124B0000000009ULL, 0x3009) != NULL);
+      ASSERT_TRUE(reg_add_node(0x00124B0000000001ULL, 0x3001) != NULL);
+    }
+  }
+  ASSERT_EQ(seen, 7);
+  ASSERT_FALSE(visited[5]);
+
+  os_event_dispatch(0);
+  for (uint32_t i = 0; i < 10; i++) {
+    reg_remove_node(0x00124B0000000000ULL | i);
+  }
+  os_event_dispatch(0);
+  ASSERT_EQ(reg_node_count(), 0);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_reg_journal(void) {
+  TEST_START("reg_journal");
+
+  uint32_t since = reg_generation();
+  os_eui64_t addr = 0x00158D0000000001ULL;
+  reg_node_t *node = reg_add_node(addr, 0x5001);
+  ASSERT_TRUE(node != NULL);
+  reg_set_state(node, REG_STATE_INTERVIEWING);
+  reg_endpoint_t *ep = reg_add_endpoint(node, 1, 0x0104, 0x0302);
+  reg_cluster_t *cl = reg_add_cluster(ep, 0x0402, REG_CLUSTER_SERVER);
+  reg_attr_value_t v = {.s16 = 2150};
+  ASSERT_EQ(reg_update_attribute(cl, 0x0000, REG_ATTR_TYPE_S16, &v), OS_OK);
+  ASSERT_EQ(reg_find_attribute(cl, 0x0000)->generation, reg_generation());
+  reg_set_nwk_addr(node, 0x5002);
+  reg_mark_dirty(node);
+  ASSERT_EQ(node->changed_gen, reg_generation());
+
+  /* Read in small batches, oldest first */
+  static const reg_change_kind_t expect[] = {
+      REG_CHANGE_ADDED,     REG_CHANGE_STATE, REG_CHANGE_ENDPOINT,
+      REG_CHANGE_CLUSTER,   REG_CHANGE_ATTRIBUTE, REG_CHANGE_NWK,
+      REG_CHANGE_META};
+  reg_change_t changes[4];
+  bool resync = true;
+  uint32_t total = 0;
+  uint32_t n;
+  while ((n = reg_changes_read(&since, changes, 4, &resync)) > 0) {
+    ASSERT_FALSE(resync);
+    for (uint32_t i = 0; i < n; i++, total++) {
+      ASSERT_EQ(changes[i].ieee_addr, addr);
+      ASSERT_EQ(changes[i].kind, expect[total]);
+    }
+  }
+  ASSERT_EQ(total, 7);
+  ASSERT_EQ(since, reg_generation());
+  ASSERT_EQ(changes[0].kind, REG_CHANGE_ATTRIBUTE);
+  ASSERT_EQ(changes[0].endpoint_id, 1);
+  ASSERT_EQ(changes[0].cluster_id, 0x0402);
+
+  /* A consumer a full ring behind still catches up... */
+  for (uint32_t i = 0; i < REG_JOURNAL_SIZE; i++) {
+    reg_mark_dirty(node);
+  }
+  static reg_change_t ring[REG_JOURNAL_SIZE];
+  ASSERT_EQ(reg_changes_read(&since, ring, REG_JOURNAL_SIZE, &resync),
+            REG_JOURNAL_SIZE);
+  ASSERT_FALSE(resync);
+
+  /* ...one more and it must rescan */
+  for (uint32_t i = 0; i <= REG_JOURNAL_SIZE; i++) {
+    reg_mark_dirty(node);
+  }
+  ASSERT_EQ(reg_changes_read(&since, ring, REG_JOURNAL_SIZE, &resync), 0);
+  ASSERT_TRUE(resync);
+  ASSERT_EQ(since, reg_generation());
+
+  ASSERT_EQ(reg_remove_node(addr), OS_OK);
+  ASSERT_EQ(reg_changes_read(&since, changes, 4, &resync), 1);
+  ASSERT_EQ(changes[0].kind, REG_CHANGE_REMOVED);
+  os_event_dispatch(0);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_reg_query(void) {
+  TEST_START("reg_query");
+
+  /* Four meters (0x0702), two of them READY; one READY light (0x0006) */
+  reg_node_t *nodes[5];
+  for (uint32_t i = 0; i < 5; i++) {
+    nodes[i] = reg_add_node(0x0050C20000000000ULL | i, (uint16_t)(0x6000 + i));
+    reg_endpoint_t *ep = reg_add_endpoint(nodes[i], 1, 0x0104, 0x0051);
+    reg_add_cluster(ep, 0x0000, REG_CLUSTER_SERVER);
+    reg_add_cluster(ep, i < 4 ? 0x0702 : 0x0006, REG_CLUSTER_SERVER);
+  }
+  reg_set_state(nodes[1], REG_STATE_READY);
+  reg_set_state(nodes[3], REG_STATE_READY);
+  reg_set_state(nodes[4], REG_STATE_READY);
+  reg_set_state(nodes[2], REG_STATE_INTERVIEWING);
+
+  reg_node_set_t ready, meters, set;
+  ASSERT_EQ(reg_query_state(REG_STATE_READY, &ready), OS_OK);
+  ASSERT_EQ(reg_node_set_count(&ready), 3);
+  ASSERT_EQ(reg_query_state(REG_STATE_INTERVIEWING, &set), OS_OK);
+  ASSERT_EQ(reg_node_set_count(&set), 1);
+  ASSERT_EQ(reg_query_cluster(0x0702, &meters), OS_OK);
+  ASSERT_EQ(reg_node_set_count(&meters), 4);
+  ASSERT_EQ(reg_query_cluster(0x0B04, &set), OS_OK);
+  ASSERT_EQ(reg_node_set_count(&set), 0);
+
+  /* "READY nodes with cluster 0x0702" */
+  reg_node_set_and(&meters, &ready);
+  ASSERT_EQ(reg_node_set_count(&meters), 2);
+  reg_iter_t it;
+  reg_iter_begin_set(&it, &meters);
+  ASSERT_TRUE(reg_iter_next(&it) == nodes[1]);
+  ASSERT_TRUE(reg_iter_next(&it) == nodes[3]);
+  ASSERT_TRUE(reg_iter_next(&it) == NULL);
+
+  /* The filtered cursor answers the same question from the indices */
+  reg_filter_t filter = {.states = REG_STATE_BIT(REG_STATE_READY),
+                         .has_cluster = true,
+                         .cluster_id = 0x0702};
+  uint32_t seen = 0;
+  reg_iter_begin(&it, &filter);
+  while (reg_iter_next(&it)) {
+    seen++;
+  }
+  ASSERT_EQ(seen, 2);
+
+  /* Removal leaves no trace; an ID nobody exposes is dropped */
+  os_event_dispatch(0);
+  ASSERT_EQ(reg_remove_node(0x0050C20000000004ULL), OS_OK);
+  ASSERT_EQ(reg_query_cluster(0x0006, &set), OS_OK);
+  ASSERT_EQ(reg_node_set_count(&set), 0);
+  ASSERT_EQ(reg_query_state(REG_STATE_READY, &set), OS_OK);
+  ASSERT_EQ(reg_node_set_count(&set), 2);
+
+  /* More distinct IDs than the index holds: queries still answer */
+  reg_node_t *spare = reg_add_node(0x0050C20000000010ULL, 0x6010);
+  reg_add_cluster(reg_add_endpoint(spare, 1, 0x0104, 0x0000), 0xFB00,
+                  REG_CLUSTER_SERVER);
+  reg_node_t *big = nodes[0];
+  uint32_t added = 0;
+  for (uint8_t e = 2; e < 2 + REG_MAX_ENDPOINTS - 1; e++) {
+    reg_endpoint_t *ep = reg_add_endpoint(big, e, 0x0104, 0x0000);
+    for (uint16_t c = 0; c < REG_MAX_CLUSTERS; c++) {
+      reg_add_cluster(ep, (uint16_t)(0xFC00 + added++), REG_CLUSTER_SERVER);
+    }
+  }
+  ASSERT_TRUE(added > REG_CLUSTER_INDEX_SIZE);
+  uint16_t skipped = (uint16_t)(0xFC00 + added - 1);
+  ASSERT_EQ(reg_query_cluster(skipped, &set), OS_OK);
+  ASSERT_EQ(reg_node_set_count(&set), 1);
+
+  /* Once an ID is freed, a skipped one indexed later covers every node */
+  ASSERT_EQ(reg_remove_node(0x0050C20000000010ULL), OS_OK);
+  reg_node_t *late = reg_add_node(0x0050C20000000011ULL, 0x6011);
+  reg_add_cluster(reg_add_endpoint(late, 1, 0x0104, 0x0000), skipped,
+                  REG_CLUSTER_SERVER);
+  ASSERT_EQ(reg_query_cluster(skipped, &set), OS_OK);
+  ASSERT_EQ(reg_node_set_count(&set), 2);
+  filter = (reg_filter_t){.has_cluster = true, .cluster_id = skipped};
+  seen = 0;
+  reg_iter_begin(&it, &filter);
+  while (reg_iter_next(&it)) {
+    seen++;
+  }
+  ASSERT_EQ(seen, 2);
+  ASSERT_EQ(reg_remove_node(0x0050C20000000011ULL), OS_OK);
+
+  for (uint32_t i = 0; i < 4; i++) {
+    reg_remove_node(0x0050C20000000000ULL | i);
+  }
+  os_event_dispatch(0);
+  ASSERT_EQ(reg_query_cluster(0x0702, &set), OS_OK);
+  ASSERT_EQ(reg_node_set_count(&set), 0);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+/* Old reg_find_node(): first valid node with a matching address */
+static reg_node_t *linear_find(reg_node_t **nodes, uint32_t count,
+                               os_eui64_t addr) {
+  for (uint32_t i = 0; i < count; i++) {
+    if (nodes[i]->valid && nodes[i]->ieee_addr == addr) {
+      return nodes[i];
+    }
+  }
+  return NULL;
+}
+
+static double elapsed_ms(const struct timespec *t0, const struct timespec *t1) {
+  return (double)(t1->tv_sec - t0->tv_sec) * 1e3 +
+         (double)(t1->tv_nsec - t0->tv_nsec) / 1e6;
+}
+
+static void test_reg_strings(void) {
+  TEST_START("reg_strings");
+
+  reg_str_stats_t before, st;
+  reg_str_get_stats(&before);
+
+  /* Forty identical bulbs share one copy of each string */
+  reg_node_t *nodes[40];
+  for (uint32_t i = 0; i < 40; i++) {
+    nodes[i] = reg_add_node(0x5715000000000000ULL | i, (uint16_t)(0x7000 + i));
+    ASSERT_TRUE(nodes[i] != NULL);
+    ASSERT_EQ(reg_set_manufacturer(nodes[i], "IKEA of Sweden"), OS_OK);
+    ASSERT_EQ(reg_set_model(nodes[i], "TRADFRI bulb E27"), OS_OK);
+  }
+  os_event_dispatch(0);
+  ASSERT_EQ(nodes[0]->model, nodes[39]->model);
+  ASSERT_TRUE(nodes[0]->model != nodes[0]->manufacturer);
+  ASSERT_EQ(reg_str_find("TRADFRI bulb E27"), nodes[0]->model);
+  ASSERT_EQ(reg_str_find("TRADFRI bulb"), REG_STR_NONE);
+  reg_str_get_stats(&st);
+  ASSERT_EQ(st.strings_used, before.strings_used + 2);
+  ASSERT_EQ(st.refs, before.refs + 80);
+
+  /* Setting the same text is not a change; renaming releases the old */
+  nodes[0]->dirty = false;
+  ASSERT_EQ(reg_set_model(nodes[0], "TRADFRI bulb E27"), OS_OK);
+  ASSERT_FALSE(nodes[0]->dirty);
+  ASSERT_EQ(reg_set_friendly_name(nodes[0], "Kitchen"), OS_OK);
+  ASSERT_TRUE(nodes[0]->dirty);
+  ASSERT_EQ(reg_set_friendly_name(nodes[0], "Hall"), OS_OK);
+  ASSERT_EQ(reg_str_find("Kitchen"), REG_STR_NONE);
+  ASSERT_TRUE(strcmp(reg_str(nodes[0]->friendly_name), "Hall") == 0);
+  ASSERT_TRUE(strcmp(reg_str(REG_STR_NONE), "") == 0);
+
+  /* Strings persist as records next to the nodes that refer to them */
+  ASSERT_EQ(reg_persist(), OS_OK);
+  char key[OS_PERSIST_KEY_MAX];
+  reg_str_t hall = nodes[0]->friendly_name;
+  snprintf(key, sizeof(key), "str/%04X", hall);
+  ASSERT_TRUE(os_persist_exists(key));
+
+  /* Records carry IDs; decoding takes references */
+  static uint8_t buf[OS_PERSIST_VALUE_MAX];
+  static reg_node_t decoded;
+  size_t len = 0;
+  ASSERT_EQ(reg_node_encode(nodes[0], buf, sizeof(buf), &len), OS_OK);
+  ASSERT_EQ(reg_node_decode(buf, len, &decoded), OS_OK);
+  ASSERT_EQ(decoded.friendly_name, hall);
+  reg_node_clear(&decoded);
+
+  /* The last reference frees a string; its record goes with the next
+   * persist, and until then the ID is not handed out again */
+  ASSERT_EQ(reg_set_friendly_name(nodes[0], NULL), OS_OK);
+  ASSERT_EQ(reg_str_find("Hall"), REG_STR_NONE);
+  ASSERT_TRUE(os_persist_exists(key));
+  reg_str_t other = reg_str_intern("Other");
+  ASSERT_TRUE(other != hall);
+  reg_str_release(other);
+  ASSERT_EQ(reg_persist(), OS_OK);
+  ASSERT_FALSE(os_persist_exists(key));
+
+  for (uint32_t i = 0; i < 40; i++) {
+    ASSERT_EQ(reg_remove_node(0x5715000000000000ULL | i), OS_OK);
+  }
+  os_event_dispatch(0);
+  ASSERT_EQ(reg_persist(), OS_OK);
+  reg_str_get_stats(&st);
+  ASSERT_EQ(st.strings_used, before.strings_used);
+  ASSERT_EQ(st.refs, before.refs);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_reg_lookup_index(void) {
+  TEST_START("reg_lookup_index");
+
+  /* Same OUI, sequential NWK addresses: worst case for weak hashes */
+  reg_node_t *nodes[REG_MAX_NODES];
+  for (uint32_t i = 0; i < REG_MAX_NODES; i++) {
+    nodes[i] = reg_add_node(0x000D6F0000000000ULL | i, (uint16_t)(0x2000 + i));
+    ASSERT_TRUE(nodes[i] != NULL);
+  }
+  for (uint32_t i = 0; i < REG_MAX_NODES; i++) {
+    ASSERT_TRUE(reg_find_node(0x000D6F0000000000ULL | i) == nodes[i]);
+    ASSERT_TRUE(reg_find_node_by_nwk((uint16_t)(0x2000 + i)) == nodes[i]);
+  }
+  ASSERT_TRUE(reg_find_node(0x000D6F00000000FFULL) == NULL);
+  ASSERT_TRUE(reg_find_node_by_nwk(0x0001) == NULL);
+
+  /* Rejoin with a new short address moves the NWK entry */
+  ASSERT_TRUE(reg_add_node(0x000D6F0000000003ULL, 0x7777) == nodes[3]);
+  ASSERT_TRUE(reg_find_node_by_nwk(0x7777) == nodes[3]);
+  ASSERT_TRUE(reg_find_node_by_nwk(0x2003) == NULL);
+
+  /* A stale holder loses its address to the new one */
+  ASSERT_EQ(reg_set_nwk_addr(nodes[4], 0x7777), OS_OK);
+  ASSERT_TRUE(reg_find_node_by_nwk(0x7777) == nodes[4]);
+  ASSERT_EQ(reg_set_nwk_addr(nodes[3], 0x2003), OS_OK);
+
+  /* Removal in the middle of probe chains keeps the rest reachable */
+  for (uint32_t i = 0; i < REG_MAX_NODES; i += 2) {
+    ASSERT_EQ(reg_remove_node(0x000D6F0000000000ULL | i), OS_OK);
+  }
+  for (uint32_t i = 1; i < REG_MAX_NODES; i += 2) {
+    ASSERT_TRUE(reg_find_node(0x000D6F0000000000ULL | i) == nodes[i]);
+  }
+  ASSERT_TRUE(reg_find_node(0x000D6F0000000000ULL) == NULL);
+  ASSERT_TRUE(reg_find_node_by_nwk(0x7777) == NULL);
+  os_event_dispatch(0); /* JOINED/LEFT events would fill the queue */
+  for (uint32_t i = 0; i < REG_MAX_NODES; i += 2) {
+    nodes[i] = reg_add_node(0x000D6F0000000000ULL | i, (uint16_t)(0x2000 + i));
+    ASSERT_TRUE(nodes[i] != NULL);
+  }
+
+  /* Lookups/sec: hashed index against the linear scan it replaced. Half
+   * the lookups miss, as they do for traffic from unknown devices. */
+  const uint32_t rounds = 200000;
+  volatile uintptr_t sink = 0;
+  struct timespec t0, t1, t2;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (uint32_t n = 0; n < rounds; n++) {
+    sink += (uintptr_t)reg_find_node(0x000D6F0000000000ULL |
+                                     (n % (2 * REG_MAX_NODES)));
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  for (uint32_t n = 0; n < rounds; n++) {
+    sink += (uintptr_t)linear_find(nodes, REG_MAX_NODES,
+                                   0x000D6F0000000000ULL |
+                                       (n % (2 * REG_MAX_NODES)));
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t2);
+  (void)sink;
+  double hashed_ms = elapsed_ms(&t0, &t1);
+  double linear_ms = elapsed_ms(&t1, &t2);
+  printf("(%u nodes: %.1f M/s hashed, %.1f M/s linear) ", REG_MAX_NODES,
+         hashed_ms > 0 ? rounds / hashed_ms / 1e3 : 0.0,
+         linear_ms > 0 ? rounds / linear_ms / 1e3 : 0.0);
+
+  os_event_dispatch(0);
+  for (uint32_t i = 0; i < REG_MAX_NODES; i++) {
+    ASSERT_EQ(reg_remove_node(0x000D6F0000000000ULL | i), OS_OK);
+  }
+  os_event_dispatch(0);
+  ASSERT_EQ(reg_node_count(), 0);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+/* t_migrate_v1_to_v2_roundtrip (40_persistence_schema_evolution.yaml) */
+static void test_migrate_v1_to_v2_roundtrip(void) {
+  TEST_START("migrate_v1_to_v2_roundtrip");
+
+  /* Node record as written by v1 firmware, plus an item v1 never knew */
+  static const uint8_t v1_fixture[] = {
+      0x01,                                           /* version */
+      0x01, 0x0A, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, /* IDENT */
+      0x11, 0x00, 0x34, 0x12,                         /* ... nwk 0x1234 */
+      0x02, 0x04, 0x03, 0x01, 0xC8, 0x05,             /* STATE READY mains */
+      0x04, 0x04, 'A',  'c',  'm',  'e',              /* MANUFACTURER */
+      0x05, 0x04, 'L',  'a',  'm',  'p',              /* MODEL */
+      0x10, 0x05, 0x01, 0x04, 0x01, 0x00, 0x01,       /* ENDPOINT 1 */
+      0x11, 0x03, 0x00, 0x00, 0x00,                   /* CLUSTER Basic */
+      0x12, 0x04, 0x07, 0x00, 0x02, 0x01,             /* ATTR power u8 */
+      0x11, 0x03, 0x06, 0x00, 0x00,                   /* CLUSTER OnOff */
+      0x7E, 0x03, 0xAA, 0xBB, 0xCC,                   /* unknown item */
+  };
+  const char *key = "node/0011223344556677";
+
+  /* Load v1 fixture */
+  ASSERT_EQ(os_persist_put(key, v1_fixture, sizeof(v1_fixture)), OS_OK);
+  ASSERT_EQ(os_persist_flush(), OS_OK);
+
+  os_persist_stats_t before;
+  os_persist_get_stats_ex(&before);
+
+  /* Migrate to v2 on first read */
+  static uint8_t buf[OS_PERSIST_VALUE_MAX];
+  static reg_node_t node;
+  size_t len = 0;
+  ASSERT_EQ(os_persist_get(key, buf, sizeof(buf), &len), OS_OK);
+  ASSERT_EQ(buf[0], 2);
+
+  os_persist_stats_t after;
+  os_persist_get_stats_ex(&after);
+  ASSERT_EQ(after.migrations, before.migrations + 1);
+
+  /* Save, reload: no second migration, no essential data lost */
+  ASSERT_EQ(os_persist_flush(), OS_OK);
+  memset(buf, 0, sizeof(buf));
+  ASSERT_EQ(os_persist_get(key, buf, sizeof(buf), &len), OS_OK);
+  os_persist_get_stats_ex(&after);
+  ASSERT_EQ(after.migrations, before.migrations + 1);
+
+  ASSERT_EQ(reg_node_decode(buf, len, &node), OS_OK);
+  ASSERT_EQ(node.ieee_addr, 0x0011223344556677ULL);
+  ASSERT_EQ(node.nwk_addr, 0x1234);
+  ASSERT_EQ(node.state, REG_STATE_READY);
+  ASSERT_EQ(node.power_source, REG_POWER_MAINS);
+  ASSERT_EQ(node.lqi, 200);
+  ASSERT_TRUE(strcmp(reg_str(node.manufacturer), "Acme") == 0);
+  ASSERT_TRUE(strcmp(reg_str(node.model), "Lamp") == 0);
+  ASSERT_EQ(node.endpoint_count, 1);
+  ASSERT_EQ(reg_first_endpoint(&node)->profile_id, 0x0104);
+  ASSERT_EQ(reg_first_endpoint(&node)->cluster_count, 2);
+  reg_cluster_t *basic = reg_find_cluster(reg_first_endpoint(&node), 0x0000);
+  ASSERT_TRUE(basic != NULL);
+  ASSERT_EQ(reg_find_attribute(basic, 0x0007)->value.u8, 1);
+  reg_node_clear(&node);
+
+  /* v1 records cannot be decoded without migration */
+  ASSERT_EQ(reg_node_decode(v1_fixture, sizeof(v1_fixture), &node),
+            OS_ERR_INVALID_ARG);
+
+  ASSERT_EQ(os_persist_del(key), OS_OK);
+
   tests_passed++;
   TEST_PASS();
 }
@@ -587,6 +1799,9 @@ static void test_interview_start(void) {
 static void test_cap_init(void) {
   TEST_START("cap_init");
 
+  /* CAP_DEFS rows must stay in (cluster, attribute) order */
+  ASSERT_TRUE(cap_attr_map_sorted());
+
   os_err_t err = cap_init();
   ASSERT_EQ(err, OS_OK);
 
@@ -616,6 +1831,45 @@ static void test_cap_compute(void) {
   TEST_PASS();
 }
 
+static void test_cap_warm_values(void) {
+  TEST_START("cap_warm_values");
+
+  os_eui64_t addr = 0xAABBCCDDEEFF0011;
+  reg_node_t *node = reg_find_node(addr);
+  ASSERT_TRUE(node != NULL);
+
+  reg_attr_value_t value = {0};
+  value.b = true;
+  ASSERT_EQ(cap_handle_attribute_report(addr, 1, 0x0006, 0x0000, &value),
+            OS_OK);
+  value.u8 = 127;
+  ASSERT_EQ(cap_handle_attribute_report(addr, 1, 0x0008, 0x0000, &value),
+            OS_OK);
+
+  /* Values sit in the cache tier, not the essential buffers */
+  os_persist_stats_t stats;
+  os_persist_get_stats_ex(&stats);
+  ASSERT_EQ(stats.tier_buffered, 1);
+  ASSERT_EQ(os_persist_flush(), OS_OK);
+  os_persist_get_stats_ex(&stats);
+  ASSERT_EQ(stats.tier_buffered, 0);
+  ASSERT_TRUE(stats.tier_writes >= 1);
+
+  /* Recomputing (as after a reboot) starts from the stored values */
+  ASSERT_TRUE(cap_compute_for_node(node) >= 2);
+  cap_state_t state;
+  ASSERT_EQ(cap_get_state(addr, CAP_LIGHT_ON, &state), OS_OK);
+  ASSERT_TRUE(state.valid);
+  ASSERT_TRUE(state.value.b);
+  ASSERT_EQ(state.timestamp, 0);
+  ASSERT_EQ(cap_get_state(addr, CAP_LIGHT_LEVEL, &state), OS_OK);
+  ASSERT_TRUE(state.valid);
+  ASSERT_EQ(state.value.i, 50);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
 static void test_cap_get_info(void) {
   TEST_START("cap_get_info");
 
@@ -644,6 +1898,935 @@ static void test_cap_parse_name(void) {
   TEST_PASS();
 }
 
+/* The linear cluster_map scan cap_lookup_attr() replaced */
+static const struct {
+  uint16_t cluster_id;
+  uint16_t attr_id;
+  cap_id_t cap_id;
+} lookup_ref[] = {
+    {0x0006, 0x0000, CAP_LIGHT_ON},
+    {0x0008, 0x0000, CAP_LIGHT_LEVEL},
+    {0x0300, 0x0007, CAP_LIGHT_COLOR_TEMP},
+    {0x0402, 0x0000, CAP_SENSOR_TEMPERATURE},
+    {0x0405, 0x0000, CAP_SENSOR_HUMIDITY},
+};
+
+#define LOOKUP_REF_LEN (sizeof(lookup_ref) / sizeof(lookup_ref[0]))
+
+static cap_id_t linear_lookup(uint16_t cluster_id, uint16_t attr_id) {
+  for (size_t m = 0; m < LOOKUP_REF_LEN; m++) {
+    if (lookup_ref[m].cluster_id == cluster_id &&
+        lookup_ref[m].attr_id == attr_id) {
+      return lookup_ref[m].cap_id;
+    }
+  }
+  return CAP_UNKNOWN;
+}
+
+static void test_cap_lookup(void) {
+  TEST_START("cap_lookup");
+
+  for (size_t m = 0; m < LOOKUP_REF_LEN; m++) {
+    ASSERT_EQ(cap_lookup_attr(lookup_ref[m].cluster_id, lookup_ref[m].attr_id),
+              lookup_ref[m].cap_id);
+  }
+  ASSERT_EQ(cap_lookup_attr(0x0000, 0x0004), CAP_UNKNOWN);  /* Basic */
+  ASSERT_EQ(cap_lookup_attr(0x0300, 0x0000), CAP_UNKNOWN);  /* Hue */
+  ASSERT_EQ(cap_lookup_attr(0x0006, 0x4003), CAP_UNKNOWN);
+  ASSERT_EQ(cap_lookup_attr(0xFFFF, 0xFFFF), CAP_UNKNOWN);
+  ASSERT_EQ(cap_lookup_attr(0xFFFF, 0x0000), CAP_UNKNOWN);
+
+  /* Lookups/sec against the linear scan; half the reports are for
+   * attributes no capability maps (Basic, power config, OTA) */
+  static const uint16_t misses[][2] = {
+      {0x0000, 0x0005}, {0x0001, 0x0021}, {0x0019, 0x0002},
+      {0x0300, 0x0003}, {0x0B05, 0x011D},
+  };
+  const uint32_t rounds = 500000;
+  volatile uint32_t sink = 0;
+  struct timespec t0, t1, t2;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (uint32_t n = 0; n < rounds; n++) {
+    uint32_t i = (n >> 1) % LOOKUP_REF_LEN;
+    sink += (n & 1) ? cap_lookup_attr(misses[i][0], misses[i][1])
+                    : cap_lookup_attr(lookup_ref[i].cluster_id,
+                                      lookup_ref[i].attr_id);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  for (uint32_t n = 0; n < rounds; n++) {
+    uint32_t i = (n >> 1) % LOOKUP_REF_LEN;
+    sink += (n & 1) ? linear_lookup(misses[i][0], misses[i][1])
+                    : linear_lookup(lookup_ref[i].cluster_id,
+                                    lookup_ref[i].attr_id);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t2);
+  (void)sink;
+  double table_ms = elapsed_ms(&t0, &t1);
+  double linear_ms = elapsed_ms(&t1, &t2);
+  printf("(%zu mappings: %.1f M/s table, %.1f M/s linear) ", LOOKUP_REF_LEN,
+         table_ms > 0 ? rounds / table_ms / 1e3 : 0.0,
+         linear_ms > 0 ? rounds / linear_ms / 1e3 : 0.0);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_cap_store(void) {
+  TEST_START("cap_store");
+
+  cap_stats_t before, st;
+  cap_get_stats(&before);
+  ASSERT_EQ(before.nodes_total, CAP_MAX_NODES);
+
+  /* More nodes than the old fixed cache held, with one or two states each */
+  const uint32_t count = 64;
+  for (uint32_t i = 0; i < count; i++) {
+    reg_node_t *node =
+        reg_add_node(0xCA90000000000000ULL | i, (uint16_t)(0x6400 + i));
+    ASSERT_TRUE(node != NULL);
+    reg_endpoint_t *ep = reg_add_endpoint(node, 1, 0x0104, 0x0100);
+    ASSERT_TRUE(ep != NULL);
+    reg_add_cluster(ep, 0x0006, REG_CLUSTER_SERVER);
+    if (i & 1) {
+      reg_add_cluster(ep, 0x0008, REG_CLUSTER_SERVER);
+    }
+    ASSERT_EQ(cap_compute_for_node(node), (i & 1) ? 2 : 1);
+  }
+  os_event_dispatch(0);
+  cap_get_stats(&st);
+  ASSERT_EQ(st.nodes_used, before.nodes_used + count);
+  ASSERT_EQ(st.states_used, before.states_used + count + count / 2);
+
+  reg_attr_value_t value = {0};
+  value.b = true;
+  cap_state_t state;
+  for (uint32_t i = 0; i < count; i++) {
+    os_eui64_t addr = 0xCA90000000000000ULL | i;
+    ASSERT_EQ(cap_handle_attribute_report(addr, 1, 0x0006, 0x0000, &value),
+              OS_OK);
+    ASSERT_EQ(cap_get_state(addr, CAP_LIGHT_ON, &state), OS_OK);
+    ASSERT_TRUE(state.valid && state.value.b);
+    ASSERT_EQ(cap_get_state(addr, CAP_LIGHT_LEVEL, &state),
+              (i & 1) ? OS_OK : OS_ERR_NOT_FOUND);
+  }
+  os_persist_flush();
+
+  /* Departed nodes free their states; the rest keep theirs */
+  for (uint32_t i = 0; i < count; i += 4) {
+    ASSERT_EQ(reg_remove_node(0xCA90000000000000ULL | i), OS_OK);
+    ASSERT_EQ(reg_remove_node(0xCA90000000000001ULL | i), OS_OK);
+  }
+  os_event_dispatch(0);
+  cap_get_stats(&st);
+  ASSERT_EQ(st.nodes_used, before.nodes_used + count / 2);
+  ASSERT_EQ(st.states_used, before.states_used + (count + count / 2) / 2);
+  for (uint32_t i = 0; i < count; i++) {
+    os_eui64_t addr = 0xCA90000000000000ULL | i;
+    bool gone = (i & 3) < 2;
+    ASSERT_EQ(cap_get_state(addr, CAP_LIGHT_ON, &state),
+              gone ? OS_ERR_NOT_FOUND : OS_OK);
+    ASSERT_TRUE(gone || (state.valid && state.value.b));
+    if (gone) {
+      char key[OS_PERSIST_KEY_MAX];
+      snprintf(key, sizeof(key), "cap/" OS_EUI64_FMT, OS_EUI64_ARG(addr));
+      ASSERT_TRUE(!os_persist_exists(key));
+    }
+  }
+
+  /* Recomputing with another cluster moves the node to a longer run */
+  reg_node_t *node = reg_find_node(0xCA90000000000002ULL);
+  ASSERT_TRUE(node != NULL);
+  reg_endpoint_t *ep = reg_find_endpoint(node, 1);
+  ASSERT_TRUE(ep != NULL);
+  reg_add_cluster(ep, 0x0008, REG_CLUSTER_SERVER);
+  ASSERT_EQ(cap_compute_for_node(node), 2);
+  ASSERT_EQ(cap_get_state(0xCA90000000000002ULL, CAP_LIGHT_LEVEL, &state),
+            OS_OK);
+  ASSERT_EQ(cap_get_state(0xCA90000000000003ULL, CAP_LIGHT_LEVEL, &state),
+            OS_OK);
+
+  for (uint32_t i = 2; i < count; i += 4) {
+    ASSERT_EQ(reg_remove_node(0xCA90000000000000ULL | i), OS_OK);
+    ASSERT_EQ(reg_remove_node(0xCA90000000000001ULL | i), OS_OK);
+  }
+  os_event_dispatch(0);
+  cap_get_stats(&st);
+  ASSERT_EQ(st.nodes_used, before.nodes_used);
+  ASSERT_EQ(st.states_used, before.states_used);
+  ASSERT_EQ(cap_get_state(0xAABBCCDDEEFF0011ULL, CAP_LIGHT_ON, &state), OS_OK);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static uint32_t cap_removed_count;
+static uint8_t cap_removed_endpoints;
+static uint8_t cap_removed_instances;
+
+static void cap_removed_handler(const os_event_t *event, void *ctx) {
+  (void)ctx;
+  cap_event_t cap;
+  memset(&cap, 0, sizeof(cap));
+  memcpy(&cap, event->payload, event->payload_len);
+  cap_removed_count++;
+  cap_removed_endpoints |= (uint8_t)(1u << cap.endpoint_id);
+  cap_removed_instances = cap.instances;
+}
+
+static void test_cap_instances(void) {
+  TEST_START("cap_instances");
+
+  /* Two-gang switch with a temperature sensor on each endpoint */
+  os_eui64_t addr = 0xCA95000000000001ULL;
+  reg_node_t *node = reg_add_node(addr, 0x6501);
+  ASSERT_TRUE(node != NULL);
+  for (uint8_t ep_id = 1; ep_id <= 2; ep_id++) {
+    reg_endpoint_t *ep = reg_add_endpoint(node, ep_id, 0x0104, 0x0100);
+    ASSERT_TRUE(ep != NULL);
+    reg_add_cluster(ep, 0x0006, REG_CLUSTER_SERVER);
+    reg_add_cluster(ep, 0x0402, REG_CLUSTER_SERVER);
+  }
+  ASSERT_EQ(cap_compute_for_node(node), 4);
+  os_event_dispatch(0);
+
+  cap_state_t caps[CAP_MAX_NODE_STATES];
+  ASSERT_EQ(cap_get_instances(addr, caps, CAP_MAX_NODE_STATES), 4);
+  for (uint32_t i = 0; i < 4; i++) {
+    ASSERT_EQ(caps[i].instances, 2);
+  }
+
+  /* Each endpoint reports into its own instance */
+  reg_attr_value_t value = {0};
+  value.b = true;
+  ASSERT_EQ(cap_handle_attribute_report(addr, 2, 0x0006, 0x0000, &value),
+            OS_OK);
+  value.s16 = 2150;
+  ASSERT_EQ(cap_handle_attribute_report(addr, 1, 0x0402, 0x0000, &value),
+            OS_OK);
+  value.s16 = 1875;
+  ASSERT_EQ(cap_handle_attribute_report(addr, 2, 0x0402, 0x0000, &value),
+            OS_OK);
+  os_event_dispatch(0);
+
+  cap_state_t state;
+  ASSERT_EQ(cap_get_instance_state(addr, 2, CAP_LIGHT_ON, &state), OS_OK);
+  ASSERT_TRUE(state.valid && state.value.b);
+  ASSERT_EQ(cap_get_instance_state(addr, 1, CAP_LIGHT_ON, &state), OS_OK);
+  ASSERT_TRUE(!state.valid);
+  ASSERT_EQ(cap_get_instance_state(addr, 1, CAP_SENSOR_TEMPERATURE, &state),
+            OS_OK);
+  ASSERT_TRUE(state.value.f > 21.4f && state.value.f < 21.6f);
+  ASSERT_EQ(cap_get_instance_state(addr, 2, CAP_SENSOR_TEMPERATURE, &state),
+            OS_OK);
+  ASSERT_TRUE(state.value.f > 18.7f && state.value.f < 18.8f);
+
+  /* An endpoint without the cluster cannot pick an instance */
+  ASSERT_EQ(cap_handle_attribute_report(addr, 3, 0x0006, 0x0000, &value),
+            OS_ERR_NOT_FOUND);
+
+  char name[CAP_INSTANCE_NAME_LEN];
+  ASSERT_TRUE(strcmp(cap_instance_name(name, sizeof(name), CAP_LIGHT_ON, 2,
+                                       2),
+                     "light.on_ep2") == 0);
+  ASSERT_TRUE(strcmp(cap_instance_name(name, sizeof(name), CAP_LIGHT_ON, 1,
+                                       1),
+                     "light.on") == 0);
+
+  /* A third gang keeps every name, so nothing is removed */
+  os_event_filter_t filter = {OS_EVENT_CAP_REMOVED, OS_EVENT_CAP_REMOVED};
+  ASSERT_EQ(os_event_subscribe(&filter, cap_removed_handler, NULL), OS_OK);
+  cap_removed_count = 0;
+  reg_endpoint_t *ep3 = reg_add_endpoint(node, 3, 0x0104, 0x0100);
+  ASSERT_TRUE(ep3 != NULL);
+  reg_add_cluster(ep3, 0x0006, REG_CLUSTER_SERVER);
+  ASSERT_EQ(cap_compute_for_node(node), 5);
+  os_event_dispatch(0);
+  ASSERT_EQ(cap_removed_count, 0);
+
+  /* A second gang renames the single light.on to light.on_ep1: the old
+   * name is removed, the sensor it does not touch is kept */
+  os_eui64_t single = 0xCA95000000000002ULL;
+  reg_node_t *lone = reg_add_node(single, 0x6502);
+  ASSERT_TRUE(lone != NULL);
+  reg_endpoint_t *ep = reg_add_endpoint(lone, 1, 0x0104, 0x0100);
+  ASSERT_TRUE(ep != NULL);
+  reg_add_cluster(ep, 0x0006, REG_CLUSTER_SERVER);
+  reg_add_cluster(ep, 0x0402, REG_CLUSTER_SERVER);
+  ASSERT_EQ(cap_compute_for_node(lone), 2);
+  ep = reg_add_endpoint(lone, 2, 0x0104, 0x0100);
+  ASSERT_TRUE(ep != NULL);
+  reg_add_cluster(ep, 0x0006, REG_CLUSTER_SERVER);
+  cap_removed_count = 0;
+  cap_removed_endpoints = 0;
+  ASSERT_EQ(cap_compute_for_node(lone), 3);
+  os_event_dispatch(0);
+  ASSERT_EQ(cap_removed_count, 1);
+  ASSERT_EQ(cap_removed_endpoints, 0x02);
+  ASSERT_EQ(cap_removed_instances, 1);
+  ASSERT_EQ(reg_remove_node(single), OS_OK);
+  os_event_dispatch(0);
+  os_event_dispatch(0);
+
+  /* Leaving drops every instance, each announced with its endpoint */
+  cap_removed_count = 0;
+  cap_removed_endpoints = 0;
+  ASSERT_EQ(reg_remove_node(addr), OS_OK);
+  os_event_dispatch(0);
+  os_event_dispatch(0);
+  ASSERT_EQ(cap_removed_count, 5);
+  ASSERT_EQ(cap_removed_endpoints, 0x0E);
+  ASSERT_EQ(cap_get_instances(addr, caps, CAP_MAX_NODE_STATES), 0);
+  os_event_unsubscribe(cap_removed_handler);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static uint32_t cap_changed_count;
+
+static void cap_changed_handler(const os_event_t *event, void *ctx) {
+  (void)event;
+  (void)ctx;
+  cap_changed_count++;
+}
+
+static void test_cap_filter(void) {
+  TEST_START("cap_filter");
+
+  os_eui64_t addr = 0xCA96000000000001ULL;
+  reg_node_t *node = reg_add_node(addr, 0x6601);
+  ASSERT_TRUE(node != NULL);
+  reg_endpoint_t *ep = reg_add_endpoint(node, 1, 0x0104, 0x0302);
+  ASSERT_TRUE(ep != NULL);
+  reg_add_cluster(ep, 0x0006, REG_CLUSTER_SERVER);
+  reg_add_cluster(ep, 0x0402, REG_CLUSTER_SERVER);
+  ASSERT_EQ(cap_compute_for_node(node), 2);
+  os_event_dispatch(0);
+
+  os_event_filter_t filter = {OS_EVENT_CAP_STATE_CHANGED,
+                              OS_EVENT_CAP_STATE_CHANGED};
+  ASSERT_EQ(os_event_subscribe(&filter, cap_changed_handler, NULL), OS_OK);
+  cap_changed_count = 0;
+  cap_filter_stats_t before, st;
+  ASSERT_EQ(cap_get_filter_stats(CAP_SENSOR_TEMPERATURE, &before), OS_OK);
+
+  /* Default deadband: 0.1 degC from the last value passed on */
+  static const int16_t temps[] = {2100, 2105, 2108, 2112, 2103, 2104, 2090};
+  static const bool passes[] = {true, false, false, true, false, false, true};
+  reg_attr_value_t value = {0};
+  cap_state_t state;
+  for (size_t i = 0; i < sizeof(temps) / sizeof(temps[0]); i++) {
+    value.s16 = temps[i];
+    ASSERT_EQ(cap_handle_attribute_report(addr, 1, 0x0402, 0x0000, &value),
+              OS_OK);
+    os_event_dispatch(0);
+    /* The state follows every report */
+    ASSERT_EQ(cap_get_state(addr, CAP_SENSOR_TEMPERATURE, &state), OS_OK);
+    ASSERT_TRUE(state.value.f > temps[i] / 100.0f - 0.001f &&
+                state.value.f < temps[i] / 100.0f + 0.001f);
+  }
+  uint32_t expected = 0;
+  for (size_t i = 0; i < sizeof(passes) / sizeof(passes[0]); i++) {
+    expected += passes[i];
+  }
+  ASSERT_EQ(cap_changed_count, expected);
+  ASSERT_EQ(cap_get_filter_stats(CAP_SENSOR_TEMPERATURE, &st), OS_OK);
+  ASSERT_EQ(st.passed - before.passed, expected);
+  ASSERT_EQ(st.suppressed - before.suppressed,
+            sizeof(temps) / sizeof(temps[0]) - expected);
+
+  /* Change-only booleans */
+  cap_changed_count = 0;
+  value.b = true;
+  for (int i = 0; i < 3; i++) {
+    cap_handle_attribute_report(addr, 1, 0x0006, 0x0000, &value);
+  }
+  value.b = false;
+  cap_handle_attribute_report(addr, 1, 0x0006, 0x0000, &value);
+  os_event_dispatch(0);
+  ASSERT_EQ(cap_changed_count, 2);
+
+  /* Rate limit and heartbeat, in ticks of 1 ms */
+  cap_filter_t saved, f = {.abs_delta = 0.5f,
+                           .min_interval_ms = 10,
+                           .max_interval_ms = 50};
+  ASSERT_EQ(cap_get_filter(CAP_SENSOR_TEMPERATURE, &saved), OS_OK);
+  ASSERT_EQ(cap_set_filter(CAP_SENSOR_TEMPERATURE, &f), OS_OK);
+  f.rel_delta = -1.0f;
+  ASSERT_EQ(cap_set_filter(CAP_SENSOR_TEMPERATURE, &f), OS_ERR_INVALID_ARG);
+
+  cap_changed_count = 0;
+  value.s16 = 2300; /* Moved, but too soon after the last one */
+  cap_handle_attribute_report(addr, 1, 0x0402, 0x0000, &value);
+  for (int i = 0; i < 10; i++) {
+    os_tick_advance();
+  }
+  cap_handle_attribute_report(addr, 1, 0x0402, 0x0000, &value);
+  os_event_dispatch(0);
+  ASSERT_EQ(cap_changed_count, 1);
+
+  for (int i = 0; i < 49; i++) {
+    os_tick_advance();
+  }
+  cap_handle_attribute_report(addr, 1, 0x0402, 0x0000, &value);
+  os_event_dispatch(0);
+  ASSERT_EQ(cap_changed_count, 1);
+  os_tick_advance();
+  cap_handle_attribute_report(addr, 1, 0x0402, 0x0000, &value);
+  os_event_dispatch(0);
+  ASSERT_EQ(cap_changed_count, 2);
+
+  /* A change inside min_interval is sent when the interval ends */
+  value.s16 = 2400;
+  cap_handle_attribute_report(addr, 1, 0x0402, 0x0000, &value);
+  ASSERT_EQ(cap_flush_held(os_now_ticks()), 0);
+  for (int i = 0; i < 10; i++) {
+    os_tick_advance();
+  }
+  ASSERT_EQ(cap_flush_held(os_now_ticks()), 1);
+  os_event_dispatch(0);
+  ASSERT_EQ(cap_changed_count, 3);
+  ASSERT_EQ(cap_flush_held(os_now_ticks()), 0);
+
+  /* One undone within the interval is dropped */
+  value.s16 = 2500;
+  cap_handle_attribute_report(addr, 1, 0x0402, 0x0000, &value);
+  value.s16 = 2400;
+  cap_handle_attribute_report(addr, 1, 0x0402, 0x0000, &value);
+  for (int i = 0; i < 10; i++) {
+    os_tick_advance();
+  }
+  ASSERT_EQ(cap_flush_held(os_now_ticks()), 0);
+  os_event_dispatch(0);
+  ASSERT_EQ(cap_changed_count, 3);
+
+  cap_stats_t stats;
+  cap_get_stats(&stats);
+  ASSERT_TRUE(stats.reports_suppressed >= st.suppressed);
+
+  ASSERT_EQ(cap_set_filter(CAP_SENSOR_TEMPERATURE, &saved), OS_OK);
+  os_event_unsubscribe(cap_changed_handler);
+  ASSERT_EQ(reg_remove_node(addr), OS_OK);
+  os_event_dispatch(0);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_history(void) {
+  TEST_START("history");
+
+  static history_point_t pts[1024];
+  os_eui64_t addr = 0xAABBCCDDEEFF0011;
+  ASSERT_EQ(history_init(), OS_OK);
+
+  /* Only numeric capabilities, and nothing until selected */
+  ASSERT_EQ(history_track(addr, CAP_LIGHT_ON), OS_ERR_INVALID_ARG);
+  ASSERT_EQ(history_record(addr, CAP_SENSOR_TEMPERATURE, 2000, 0),
+            OS_ERR_NOT_FOUND);
+  ASSERT_EQ(history_track(addr, CAP_SENSOR_TEMPERATURE), OS_OK);
+  ASSERT_EQ(history_track(addr, CAP_SENSOR_TEMPERATURE), OS_OK);
+  ASSERT_TRUE(history_is_tracked(addr, CAP_SENSOR_TEMPERATURE));
+
+  /* Two hours at 10 s; 20.00 to 20.50 within each minute */
+  for (uint32_t t = 0; t < 7200; t += 10) {
+    ASSERT_EQ(history_record(addr, CAP_SENSOR_TEMPERATURE,
+                             (int32_t)(2000 + t % 60), t),
+              OS_OK);
+  }
+
+  /* Small steps encode in 2 bytes; the ring keeps the newest that fit */
+  uint32_t n = history_query(addr, CAP_SENSOR_TEMPERATURE, HISTORY_RES_RAW, 0,
+                             pts, 1024);
+  ASSERT_EQ(n, HISTORY_RAW_BYTES / 2 + 1);
+  ASSERT_EQ(pts[0].time_s, 7190 - (n - 1) * 10);
+  ASSERT_EQ(pts[n - 1].time_s, 7190);
+  ASSERT_EQ(pts[n - 1].avg, 2050);
+  n = history_query(addr, CAP_SENSOR_TEMPERATURE, HISTORY_RES_RAW, 0, pts, 4);
+  ASSERT_EQ(n, 4);
+  ASSERT_EQ(pts[0].time_s, 7160);
+  ASSERT_EQ(pts[0].avg, 2020);
+  ASSERT_EQ(pts[3].avg, 2050);
+
+  /* Minute rollups cover the newest HISTORY_MINUTE_SLOTS minutes */
+  n = history_query(addr, CAP_SENSOR_TEMPERATURE, HISTORY_RES_MINUTE, 0, pts,
+                    1024);
+  ASSERT_EQ(n, HISTORY_MINUTE_SLOTS);
+  ASSERT_EQ(pts[n - 1].time_s, 7140);
+  ASSERT_EQ(pts[0].time_s, 7200 - HISTORY_MINUTE_SLOTS * 60);
+  ASSERT_EQ(pts[0].min, 2000);
+  ASSERT_EQ(pts[0].max, 2050);
+  ASSERT_EQ(pts[0].avg, 2025);
+  ASSERT_EQ(pts[0].count, 6);
+  n = history_query(addr, CAP_SENSOR_TEMPERATURE, HISTORY_RES_MINUTE, 7000,
+                    pts, 1024);
+  ASSERT_EQ(n, 3);
+  ASSERT_EQ(pts[0].time_s, 7020);
+
+  n = history_query(addr, CAP_SENSOR_TEMPERATURE, HISTORY_RES_HOUR, 0, pts,
+                    1024);
+  ASSERT_EQ(n, 2);
+  ASSERT_EQ(pts[0].time_s, 0);
+  ASSERT_EQ(pts[1].time_s, 3600);
+  ASSERT_EQ(pts[1].count, 360);
+  ASSERT_EQ(pts[1].avg, 2025);
+
+  /* Negative values and late samples */
+  ASSERT_EQ(history_track(addr, CAP_POWER_WATTS), OS_OK);
+  ASSERT_EQ(history_record(addr, CAP_POWER_WATTS, -150, 100), OS_OK);
+  ASSERT_EQ(history_record(addr, CAP_POWER_WATTS, 300000, 50), OS_OK);
+  n = history_query(addr, CAP_POWER_WATTS, HISTORY_RES_RAW, 0, pts, 1024);
+  ASSERT_EQ(n, 2);
+  ASSERT_EQ(pts[0].avg, -150);
+  ASSERT_EQ(pts[1].avg, 300000);
+  ASSERT_EQ(pts[1].time_s, 100);
+
+  /* Reports of tracked capabilities feed the store */
+  ASSERT_EQ(history_track(addr, CAP_LIGHT_LEVEL), OS_OK);
+  reg_attr_value_t value = {0};
+  value.u8 = 254;
+  ASSERT_EQ(cap_handle_attribute_report(addr, 1, 0x0008, 0x0000, &value),
+            OS_OK);
+  n = history_query(addr, CAP_LIGHT_LEVEL, HISTORY_RES_RAW, 0, pts, 1024);
+  ASSERT_EQ(n, 1);
+  ASSERT_EQ(pts[0].avg, 10000);
+
+  history_stats_t stats;
+  history_get_stats(&stats);
+  ASSERT_EQ(stats.series_used, 3);
+  ASSERT_EQ(stats.series_total, HISTORY_MAX_SERIES);
+
+  /* A departed node releases its series */
+  os_event_emit(OS_EVENT_ZB_DEVICE_LEFT, &addr, sizeof(addr));
+  os_event_dispatch(0);
+  ASSERT_TRUE(!history_is_tracked(addr, CAP_SENSOR_TEMPERATURE));
+  history_get_stats(&stats);
+  ASSERT_EQ(stats.series_used, 0);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_reg_snapshot(void) {
+  TEST_START("reg_snapshot");
+
+  os_eui64_t addr = 0x5A50000000000001ULL;
+  reg_node_t *node = reg_add_node(addr, 0x7B01);
+  ASSERT_TRUE(node != NULL);
+  ASSERT_EQ(reg_set_model(node, "Snap bulb"), OS_OK);
+
+  reg_snap_stats_t before, st;
+  reg_snapshot_get_stats(&before);
+  ASSERT_EQ(before.readers, 0);
+
+  reg_snapshot_t snap;
+  ASSERT_EQ(reg_snapshot_begin(&snap), OS_OK);
+  const reg_node_view_t *view = reg_snapshot_node(&snap, addr);
+  ASSERT_TRUE(view != NULL);
+  ASSERT_EQ(view->ieee_addr, addr);
+  ASSERT_TRUE(strcmp(reg_str(view->model), "Snap bulb") == 0);
+  ASSERT_TRUE(reg_snapshot_node(&snap, addr) == view);
+  ASSERT_TRUE(reg_snapshot_node(&snap, 0x5A500000000000FFULL) == NULL);
+
+  /* Writers keep the node for the snapshot instead of changing its view */
+  ASSERT_EQ(reg_set_model(node, "Snap bulb v2"), OS_OK);
+  ASSERT_EQ(reg_set_state(node, REG_STATE_INTERVIEWING), OS_OK);
+  ASSERT_TRUE(strcmp(reg_str(view->model), "Snap bulb") == 0);
+  ASSERT_EQ(view->state, REG_STATE_NEW);
+  reg_snapshot_get_stats(&st);
+  ASSERT_EQ(st.copies, before.copies + 1);
+  ASSERT_EQ(st.readers, 1);
+
+  /* A later snapshot sees the change; the first keeps its view */
+  reg_snapshot_t later;
+  ASSERT_EQ(reg_snapshot_begin(&later), OS_OK);
+  const reg_node_view_t *view2 = reg_snapshot_node(&later, addr);
+  ASSERT_TRUE(view2 != NULL && view2 != view);
+  ASSERT_TRUE(strcmp(reg_str(view2->model), "Snap bulb v2") == 0);
+  ASSERT_EQ(view2->state, REG_STATE_INTERVIEWING);
+  ASSERT_TRUE(view2->generation > view->generation);
+
+  /* Removal leaves the node visible to snapshots opened before it */
+  ASSERT_EQ(reg_remove_node(addr), OS_OK);
+  os_event_dispatch(0);
+  ASSERT_TRUE(reg_snapshot_node(&later, addr) == view2);
+  ASSERT_TRUE(reg_snapshot_node(&snap, addr) == view);
+  ASSERT_TRUE(strcmp(reg_str(view2->model), "Snap bulb v2") == 0);
+  reg_snapshot_t after;
+  ASSERT_EQ(reg_snapshot_begin(&after), OS_OK);
+  ASSERT_TRUE(reg_snapshot_node(&after, addr) == NULL);
+  reg_snapshot_end(&after);
+  reg_snapshot_end(&later);
+  reg_snapshot_end(&snap);
+  ASSERT_EQ(reg_str_find("Snap bulb v2"), REG_STR_NONE);
+
+  /* Bounded readers; a closed snapshot returns nothing */
+  reg_snapshot_t open[REG_SNAP_READERS];
+  for (uint32_t r = 0; r < REG_SNAP_READERS; r++) {
+    ASSERT_EQ(reg_snapshot_begin(&open[r]), OS_OK);
+  }
+  ASSERT_EQ(reg_snapshot_begin(&snap), OS_ERR_BUSY);
+  for (uint32_t r = 0; r < REG_SNAP_READERS; r++) {
+    reg_snapshot_end(&open[r]);
+  }
+  ASSERT_TRUE(reg_snapshot_node(&later, addr) == NULL);
+
+  /* Views held by an open snapshot are not reclaimed */
+  static reg_node_t *nodes[REG_SNAP_VIEWS + 1];
+  for (uint32_t i = 0; i <= REG_SNAP_VIEWS; i++) {
+    nodes[i] = reg_add_node(0x5A51000000000000ULL | i, (uint16_t)(0x7C00 + i));
+    ASSERT_TRUE(nodes[i] != NULL);
+  }
+  os_event_dispatch(0);
+  ASSERT_EQ(reg_snapshot_begin(&snap), OS_OK);
+  for (uint32_t i = 0; i < REG_SNAP_VIEWS; i++) {
+    ASSERT_TRUE(reg_snapshot_node(&snap, nodes[i]->ieee_addr) != NULL);
+  }
+  ASSERT_TRUE(reg_snapshot_node(&snap, nodes[REG_SNAP_VIEWS]->ieee_addr) ==
+              NULL);
+  reg_snapshot_end(&snap);
+
+  /* With no reader, changes keep no version */
+  reg_snapshot_get_stats(&before);
+  ASSERT_EQ(reg_set_state(nodes[0], REG_STATE_ANNOUNCED), OS_OK);
+  reg_snapshot_get_stats(&st);
+  ASSERT_EQ(st.copies, before.copies);
+  ASSERT_EQ(reg_snapshot_begin(&snap), OS_OK);
+  view = reg_snapshot_node(&snap, nodes[0]->ieee_addr);
+  ASSERT_TRUE(view != NULL);
+  ASSERT_EQ(view->state, REG_STATE_ANNOUNCED);
+  ASSERT_TRUE(reg_snapshot_node(&snap, nodes[REG_SNAP_VIEWS]->ieee_addr) !=
+              NULL);
+  reg_snapshot_end(&snap);
+
+  for (uint32_t i = 0; i <= REG_SNAP_VIEWS; i++) {
+    ASSERT_EQ(reg_remove_node(0x5A51000000000000ULL | i), OS_OK);
+  }
+  os_event_dispatch(0);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_reg_snapshot_epoch(void) {
+  TEST_START("reg_snapshot_epoch");
+
+  /* A sensor with one reading, and a node to be removed */
+  os_eui64_t addr = 0x5A52000000000001ULL;
+  os_eui64_t gone = 0x5A52000000000002ULL;
+  os_eui64_t added = 0x5A52000000000003ULL;
+  reg_node_t *node = reg_add_node(addr, 0x7D01);
+  ASSERT_TRUE(node != NULL);
+  ASSERT_TRUE(reg_add_node(gone, 0x7D02) != NULL);
+  reg_endpoint_t *ep = reg_add_endpoint(node, 1, 0x0104, 0x0302);
+  ASSERT_TRUE(ep != NULL);
+  reg_cluster_t *temp = reg_add_cluster(ep, 0x0402, REG_CLUSTER_SERVER);
+  ASSERT_TRUE(temp != NULL);
+  reg_attr_value_t value = {0};
+  value.s16 = 2100;
+  ASSERT_EQ(reg_update_attribute(temp, 0x0000, REG_ATTR_TYPE_S16, &value),
+            OS_OK);
+
+  reg_snap_stats_t before, st;
+  reg_snapshot_get_stats(&before);
+  reg_snapshot_t snap;
+  ASSERT_EQ(reg_snapshot_begin(&snap), OS_OK);
+
+  /* Everything below happens before the snapshot reads anything */
+  ASSERT_EQ(reg_set_state(node, REG_STATE_READY), OS_OK);
+  value.s16 = 2250;
+  ASSERT_EQ(reg_update_attribute(temp, 0x0000, REG_ATTR_TYPE_S16, &value),
+            OS_OK);
+  ASSERT_TRUE(reg_add_cluster(ep, 0x0006, REG_CLUSTER_SERVER) != NULL);
+  ASSERT_TRUE(reg_add_endpoint(node, 2, 0x0104, 0x0100) != NULL);
+  ASSERT_EQ(reg_remove_node(gone), OS_OK);
+  ASSERT_TRUE(reg_add_node(added, 0x7D03) != NULL);
+  os_event_dispatch(0);
+  reg_snapshot_get_stats(&st);
+  ASSERT_EQ(st.copies, before.copies + 2);
+
+  /* The snapshot still sees the node, children included, as at begin */
+  const reg_node_view_t *view = reg_snapshot_node(&snap, addr);
+  ASSERT_TRUE(view != NULL);
+  ASSERT_EQ(view->state, REG_STATE_NEW);
+  ASSERT_EQ(view->endpoint_count, 1);
+  const reg_endpoint_t *vep = reg_view_first_endpoint(view);
+  ASSERT_TRUE(vep != NULL && vep->endpoint_id == 1);
+  ASSERT_TRUE(reg_view_next_endpoint(vep) == NULL);
+  const reg_cluster_t *vcl = reg_view_first_cluster(vep);
+  ASSERT_TRUE(vcl != NULL && vcl->cluster_id == 0x0402);
+  ASSERT_TRUE(reg_view_next_cluster(vcl) == NULL);
+  const reg_attribute_t *vattr = reg_view_first_attribute(vcl);
+  ASSERT_TRUE(vattr != NULL && vattr->value.s16 == 2100);
+  ASSERT_TRUE(reg_view_next_attribute(vattr) == NULL);
+
+  /* Removed after begin is still there, added after begin is not */
+  const reg_node_view_t *old = reg_snapshot_node(&snap, gone);
+  ASSERT_TRUE(old != NULL && old->ieee_addr == gone);
+  ASSERT_TRUE(reg_snapshot_node(&snap, added) == NULL);
+
+  /* A later snapshot sees the changes */
+  reg_snapshot_t later;
+  ASSERT_EQ(reg_snapshot_begin(&later), OS_OK);
+  const reg_node_view_t *now = reg_snapshot_node(&later, addr);
+  ASSERT_TRUE(now != NULL && now != view);
+  ASSERT_EQ(now->state, REG_STATE_READY);
+  ASSERT_EQ(now->endpoint_count, 2);
+  vep = reg_view_first_endpoint(now);
+  ASSERT_TRUE(vep != NULL && reg_view_next_endpoint(vep) != NULL);
+  vcl = reg_view_first_cluster(vep);
+  ASSERT_TRUE(vcl != NULL && reg_view_next_cluster(vcl) != NULL);
+  ASSERT_EQ(reg_view_first_attribute(vcl)->value.s16, 2250);
+  ASSERT_TRUE(reg_snapshot_node(&later, gone) == NULL);
+  ASSERT_TRUE(reg_snapshot_node(&later, added) != NULL);
+
+  /* The first snapshot's view did not move */
+  ASSERT_TRUE(reg_snapshot_node(&snap, addr) == view);
+  ASSERT_EQ(reg_view_first_attribute(
+                reg_view_first_cluster(reg_view_first_endpoint(view)))
+                ->value.s16,
+            2100);
+  reg_snapshot_end(&later);
+  reg_snapshot_end(&snap);
+
+  /* A version that does not fit costs its snapshot every further read */
+  static reg_node_t *nodes[REG_SNAP_VIEWS + 1];
+  for (uint32_t i = 0; i <= REG_SNAP_VIEWS; i++) {
+    nodes[i] = reg_add_node(0x5A53000000000000ULL | i, (uint16_t)(0x7E00 + i));
+    ASSERT_TRUE(nodes[i] != NULL);
+  }
+  os_event_dispatch(0);
+  reg_snapshot_get_stats(&before);
+  ASSERT_EQ(reg_snapshot_begin(&snap), OS_OK);
+  for (uint32_t i = 0; i <= REG_SNAP_VIEWS; i++) {
+    ASSERT_EQ(reg_set_state(nodes[i], REG_STATE_ANNOUNCED), OS_OK);
+  }
+  reg_snapshot_get_stats(&st);
+  ASSERT_EQ(st.lost, before.lost + 1);
+  ASSERT_EQ(st.views_used, REG_SNAP_VIEWS);
+  ASSERT_TRUE(reg_snapshot_node(&snap, nodes[0]->ieee_addr) == NULL);
+  reg_snapshot_end(&snap);
+
+  /* Closing it frees the versions; new snapshots read again */
+  reg_snapshot_get_stats(&st);
+  ASSERT_EQ(st.views_used, 0);
+  ASSERT_EQ(reg_snapshot_begin(&snap), OS_OK);
+  view = reg_snapshot_node(&snap, nodes[0]->ieee_addr);
+  ASSERT_TRUE(view != NULL && view->state == REG_STATE_ANNOUNCED);
+  reg_snapshot_end(&snap);
+
+  for (uint32_t i = 0; i <= REG_SNAP_VIEWS; i++) {
+    ASSERT_EQ(reg_remove_node(0x5A53000000000000ULL | i), OS_OK);
+  }
+  ASSERT_EQ(reg_remove_node(addr), OS_OK);
+  ASSERT_EQ(reg_remove_node(added), OS_OK);
+  os_event_dispatch(0);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void mem_test_report(os_mem_region_t *region, void *ctx) {
+  uint32_t *used = ctx;
+  region->dynamic_bytes = 64;
+  region->used = *used;
+  region->capacity = 8;
+}
+
+static const os_mem_region_t *mem_find(const os_mem_metrics_t *m,
+                                       const char *name) {
+  for (uint32_t i = 0; i < m->region_count; i++) {
+    if (strcmp(m->regions[i].name, name) == 0) {
+      return &m->regions[i];
+    }
+  }
+  return NULL;
+}
+
+static void test_os_mem(void) {
+  TEST_START("os_mem");
+
+  static os_mem_metrics_t m;
+  ASSERT_EQ(os_mem_get_metrics(&m), OS_OK);
+  uint32_t base_count = m.region_count;
+  uint32_t base_static = m.static_total;
+
+  /* Subsystems registered at init */
+  const os_mem_region_t *r = mem_find(&m, "reg.nodes");
+  ASSERT_TRUE(r != NULL);
+  ASSERT_EQ(r->used, reg_node_count());
+  ASSERT_EQ(r->capacity, REG_MAX_NODES);
+  ASSERT_TRUE(r->static_bytes > 0);
+  ASSERT_TRUE(mem_find(&m, "event.queue") != NULL);
+  ASSERT_TRUE(mem_find(&m, "log.ring") != NULL);
+  ASSERT_TRUE(mem_find(&m, "persist.buffers") != NULL);
+
+  /* Reporters run on each read */
+  uint32_t used = 3;
+  ASSERT_EQ(os_mem_register("test.region", 100, mem_test_report, &used),
+            OS_OK);
+  ASSERT_EQ(os_mem_get_metrics(&m), OS_OK);
+  ASSERT_EQ(m.region_count, base_count + 1);
+  ASSERT_EQ(m.static_total, base_static + 100);
+  r = mem_find(&m, "test.region");
+  ASSERT_TRUE(r != NULL);
+  ASSERT_EQ(r->dynamic_bytes, 64);
+  ASSERT_EQ(r->used, 3);
+  ASSERT_EQ(r->capacity, 8);
+
+  used = 5;
+  ASSERT_EQ(os_mem_get_metrics(&m), OS_OK);
+  ASSERT_EQ(mem_find(&m, "test.region")->used, 5);
+
+  /* Registering again replaces the entry */
+  ASSERT_EQ(os_mem_register("test.region", 40, NULL, NULL), OS_OK);
+  ASSERT_EQ(os_mem_get_metrics(&m), OS_OK);
+  ASSERT_EQ(m.region_count, base_count + 1);
+  ASSERT_EQ(m.static_total, base_static + 40);
+  r = mem_find(&m, "test.region");
+  ASSERT_EQ(r->dynamic_bytes, 0);
+  ASSERT_EQ(r->capacity, 0);
+  ASSERT_EQ(os_mem_register(NULL, 0, NULL, NULL), OS_ERR_INVALID_ARG);
+
+  uint32_t total = 0;
+  for (uint32_t i = 0; i < m.region_count; i++) {
+    total += m.regions[i].dynamic_bytes;
+  }
+  ASSERT_EQ(m.dynamic_total, total);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
+static void test_liveness(void) {
+  TEST_START("liveness");
+
+  ASSERT_EQ(liveness_init(), OS_OK);
+  ASSERT_EQ(liveness_init(), OS_ERR_ALREADY_EXISTS);
+
+  /* Nodes made READY by earlier tests are put back afterwards */
+  reg_node_set_t ready_before;
+  ASSERT_EQ(reg_query_state(REG_STATE_READY, &ready_before), OS_OK);
+  ASSERT_TRUE(reg_liveness_oldest(REG_LIVENESS_MAINS) == NULL);
+
+  os_eui64_t mains_a = 0x11FE000000000001ULL;
+  os_eui64_t mains_b = 0x11FE000000000002ULL;
+  os_eui64_t sleepy = 0x11FE000000000003ULL;
+  reg_node_t *a = reg_add_node(mains_a, 0x7A01);
+  reg_node_t *b = reg_add_node(mains_b, 0x7A02);
+  reg_node_t *c = reg_add_node(sleepy, 0x7A03);
+  ASSERT_TRUE(a && b && c);
+  a->power_source = REG_POWER_MAINS;
+  b->power_source = REG_POWER_DC;
+  c->power_source = REG_POWER_BATTERY;
+  ASSERT_EQ(reg_liveness_class(a), REG_LIVENESS_MAINS);
+  ASSERT_EQ(reg_liveness_class(c), REG_LIVENESS_SLEEPY);
+
+  /* a can be probed; b has no endpoint to ask */
+  ASSERT_TRUE(reg_add_endpoint(a, 1, 0x0104, 0x0100) != NULL);
+
+  /* Only READY nodes are tracked, newest at the tail */
+  ASSERT_EQ(reg_set_state(a, REG_STATE_READY), OS_OK);
+  ASSERT_EQ(reg_set_state(b, REG_STATE_READY), OS_OK);
+  ASSERT_EQ(reg_set_state(c, REG_STATE_READY), OS_OK);
+  os_event_dispatch(0);
+
+  /* Traffic from a moves it behind b */
+  ASSERT_TRUE(reg_liveness_oldest(REG_LIVENESS_MAINS) == a);
+  uint8_t report[12] = {0};
+  memcpy(report, &mains_a, sizeof(mains_a));
+  os_event_emit(OS_EVENT_ZB_ATTR_REPORT, report, sizeof(report));
+  os_event_dispatch(0);
+  ASSERT_TRUE(reg_liveness_oldest(REG_LIVENESS_MAINS) == b);
+  ASSERT_TRUE(reg_liveness_oldest(REG_LIVENESS_SLEEPY) != NULL);
+
+  os_tick_t now = os_now_ticks();
+  uint32_t mains_ms = LIVENESS_MAINS_TIMEOUT_S * 1000u;
+  uint32_t probe_ms = LIVENESS_PROBE_TIMEOUT_S * 1000u;
+  ASSERT_TRUE(liveness_next_deadline_ms(now) <= mains_ms);
+  ASSERT_EQ(liveness_next_deadline_ms(now + OS_MS_TO_TICKS(mains_ms)), 0);
+
+  /* At the mains deadline a is asked and b kept; c is within its timeout */
+  liveness_stats_t st;
+  liveness_get_stats(&st);
+  os_tick_t due = now + OS_MS_TO_TICKS(mains_ms);
+  ASSERT_EQ(liveness_sweep(due), 0);
+  ASSERT_EQ(a->state, REG_STATE_READY);
+  ASSERT_EQ(b->state, REG_STATE_READY);
+  ASSERT_EQ(c->state, REG_STATE_READY);
+  ASSERT_TRUE(liveness_next_deadline_ms(due) <= probe_ms);
+
+  /* Unanswered, a goes OFFLINE once the probe times out; b stays */
+  ASSERT_EQ(liveness_sweep(due + OS_MS_TO_TICKS(probe_ms)), 1);
+  ASSERT_EQ(a->state, REG_STATE_OFFLINE);
+  ASSERT_EQ(b->state, REG_STATE_READY);
+
+  /* A late answer does not bring it back; an announce does */
+  os_event_dispatch(0);
+  ASSERT_EQ(a->state, REG_STATE_OFFLINE);
+  os_event_emit(OS_EVENT_ZB_ANNOUNCE, report, sizeof(report));
+  os_event_dispatch(0);
+  ASSERT_EQ(a->state, REG_STATE_READY);
+
+  /* A probe answered in time keeps it READY */
+  due = os_now_ticks() + OS_MS_TO_TICKS(mains_ms);
+  ASSERT_EQ(liveness_sweep(due), 0);
+  os_event_dispatch(0); /* The fake adapter confirms the read */
+  ASSERT_EQ(liveness_sweep(due + OS_MS_TO_TICKS(probe_ms)), 0);
+  ASSERT_EQ(a->state, REG_STATE_READY);
+  os_event_dispatch(0); /* Answers the probe that sweep sent */
+
+  /* A confirmed command to an OFFLINE node is traffic from it */
+  due = os_now_ticks() + OS_MS_TO_TICKS(mains_ms);
+  ASSERT_EQ(liveness_sweep(due), 0);
+  ASSERT_EQ(liveness_sweep(due + OS_MS_TO_TICKS(probe_ms)), 1);
+  ASSERT_EQ(a->state, REG_STATE_OFFLINE);
+  os_event_dispatch(0);
+  /* As cap_execute_command() publishes it */
+  os_event_t cmd = {.type = OS_EVENT_CAP_COMMAND, .corr_id = 0x4C1E0001};
+  cmd.payload_len = sizeof(mains_a);
+  memcpy(cmd.payload, &mains_a, sizeof(mains_a));
+  ASSERT_EQ(os_event_publish(&cmd), OS_OK);
+  os_event_dispatch(0);
+  ASSERT_EQ(a->state, REG_STATE_OFFLINE);
+  os_event_emit(OS_EVENT_ZB_CMD_CONFIRM, &cmd.corr_id, sizeof(cmd.corr_id));
+  os_event_dispatch(0);
+  ASSERT_EQ(a->state, REG_STATE_READY);
+
+  /* Unknown senders are ignored */
+  liveness_touch(0x11FE0000000000FFULL);
+
+  /* Sleepy nodes are not probed */
+  uint32_t sleepy_ms = LIVENESS_SLEEPY_TIMEOUT_S * 1000u;
+  ASSERT_EQ(liveness_sweep(now + OS_MS_TO_TICKS(sleepy_ms)), 1);
+  ASSERT_EQ(c->state, REG_STATE_OFFLINE);
+  ASSERT_EQ(b->state, REG_STATE_READY);
+  ASSERT_TRUE(reg_liveness_oldest(REG_LIVENESS_SLEEPY) == NULL);
+  os_event_dispatch(0);
+
+  liveness_stats_t after;
+  liveness_get_stats(&after);
+  ASSERT_EQ(after.revived, st.revived + 2);
+  ASSERT_EQ(after.expired, st.expired + 3);
+  ASSERT_EQ(after.probed, st.probed + 5);
+  ASSERT_EQ(after.answered, st.answered + 3);
+  ASSERT_TRUE(after.unprobed >= st.unprobed + 4);
+
+  ASSERT_EQ(reg_remove_node(mains_a), OS_OK);
+  ASSERT_EQ(reg_remove_node(mains_b), OS_OK);
+  ASSERT_EQ(reg_remove_node(sleepy), OS_OK);
+  reg_iter_t it;
+  reg_iter_begin_set(&it, &ready_before);
+  for (reg_node_t *node = reg_iter_next(&it); node;
+       node = reg_iter_next(&it)) {
+    reg_set_state(node, REG_STATE_READY);
+  }
+  os_event_dispatch(0);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
 /* Quirks tests */
 
 static void test_quirks_init(void) {
@@ -703,6 +2886,78 @@ static void test_quirks_apply_value(void) {
   TEST_PASS();
 }
 
+static void test_quirks_compile(void) {
+  TEST_START("quirks_compile");
+
+  /* Actions fold in table order into one clamp(x * mul + add, lo, hi) */
+  static const quirk_entry_t entry = {
+      .manufacturer = "TEST",
+      .model = "FOLD",
+      .actions = {
+          {.type = QUIRK_ACTION_SCALE_NUMERIC,
+           .target_cap = CAP_SENSOR_TEMPERATURE,
+           .params.scale = {.multiplier = 2.0f, .offset = 1.0f}},
+          {.type = QUIRK_ACTION_CLAMP_RANGE,
+           .target_cap = CAP_SENSOR_TEMPERATURE,
+           .params.clamp = {.min = 0, .max = 10}},
+          {.type = QUIRK_ACTION_SCALE_NUMERIC,
+           .target_cap = CAP_SENSOR_TEMPERATURE,
+           .params.scale = {.multiplier = -1.0f, .offset = 0.0f}},
+          {.type = QUIRK_ACTION_INVERT_BOOLEAN,
+           .target_cap = CAP_SENSOR_CONTACT,
+           .params.invert = {.enabled = true}},
+      },
+      .action_count = 4,
+  };
+
+  cap_xform_t x;
+  ASSERT_EQ(quirks_compile(&entry, CAP_SENSOR_TEMPERATURE, &x), 3);
+  ASSERT_TRUE(x.mul == -2.0f && x.add == -1.0f);
+  ASSERT_TRUE(x.lo == -10.0f && x.hi == 0.0f);
+  ASSERT_TRUE(!x.invert);
+  ASSERT_EQ(quirks_compile(&entry, CAP_SENSOR_CONTACT, &x), 1);
+  ASSERT_TRUE(x.invert && x.mul == 1.0f && x.add == 0.0f);
+  ASSERT_EQ(quirks_compile(&entry, CAP_LIGHT_LEVEL, &x), 0);
+  ASSERT_EQ(quirks_compile(NULL, CAP_LIGHT_LEVEL, &x), 0);
+
+  /* A quirked node gets its transform when capabilities are computed */
+  os_eui64_t addr = 0xCA97000000000001ULL;
+  reg_node_t *node = reg_add_node(addr, 0x6701);
+  ASSERT_TRUE(node != NULL);
+  ASSERT_EQ(reg_set_manufacturer(node, "DUMMY"), OS_OK);
+  ASSERT_EQ(reg_set_model(node, "DUMMY-LIGHT-1"), OS_OK);
+  reg_endpoint_t *ep = reg_add_endpoint(node, 1, 0x0104, 0x0101);
+  ASSERT_TRUE(ep != NULL);
+  reg_add_cluster(ep, 0x0006, REG_CLUSTER_SERVER);
+  reg_add_cluster(ep, 0x0008, REG_CLUSTER_SERVER);
+  ASSERT_EQ(cap_compute_for_node(node), 2);
+
+  cap_state_t state;
+  ASSERT_EQ(cap_get_state(addr, CAP_LIGHT_LEVEL, &state), OS_OK);
+  ASSERT_TRUE(state.xform != 0);
+  ASSERT_EQ(cap_get_state(addr, CAP_LIGHT_ON, &state), OS_OK);
+  ASSERT_EQ(state.xform, 0);
+
+  /* Level 0 is clamped to the quirk's minimum of 1 */
+  reg_attr_value_t value = {0};
+  value.u8 = 0;
+  ASSERT_EQ(cap_handle_attribute_report(addr, 1, 0x0008, 0x0000, &value),
+            OS_OK);
+  ASSERT_EQ(cap_get_state(addr, CAP_LIGHT_LEVEL, &state), OS_OK);
+  ASSERT_EQ(state.value.i, 1);
+  value.u8 = 254;
+  ASSERT_EQ(cap_handle_attribute_report(addr, 1, 0x0008, 0x0000, &value),
+            OS_OK);
+  ASSERT_EQ(cap_get_state(addr, CAP_LIGHT_LEVEL, &state), OS_OK);
+  ASSERT_EQ(state.value.i, 100);
+
+  ASSERT_EQ(reg_remove_node(addr), OS_OK);
+  os_event_dispatch(0);
+
+  tests_passed++;
+  TEST_PASS();
+}
+
 static void test_quirks_count(void) {
   TEST_START("quirks_count");
 
@@ -735,6 +2990,7 @@ int main(int argc, char *argv[]) {
 
   printf("Type tests:\n");
   test_types();
+  test_uptime_seconds();
 
   printf("\nEvent bus tests:\n");
   test_event_init();
@@ -757,6 +3013,15 @@ int main(int argc, char *argv[]) {
   test_persist_exists();
   test_persist_del();
   test_persist_schema_version();
+  test_persist_cache_eviction();
+  test_persist_flush_stall();
+  test_persist_flush_policy();
+  test_persist_tiers();
+  test_persist_crc_quarantine();
+  test_persist_telemetry();
+  test_persist_iter();
+  test_persist_txn();
+  test_persist_txn_crash();
 
   printf("\nRegistry tests:\n");
   test_reg_init();
@@ -766,7 +3031,21 @@ int main(int argc, char *argv[]) {
   test_reg_add_cluster();
   test_reg_update_attribute();
   test_reg_set_state();
+  test_reg_codec_roundtrip();
+  test_reg_persist_dirty();
   test_reg_remove_node();
+  test_reg_restore_boot();
+  test_reg_lookup_index();
+  test_reg_pools();
+  test_reg_iter();
+  test_reg_journal();
+  test_reg_query();
+  test_reg_strings();
+  test_reg_snapshot();
+  test_reg_snapshot_epoch();
+  test_os_mem();
+  test_liveness();
+  test_migrate_v1_to_v2_roundtrip();
 
   printf("\nInterview tests:\n");
   test_interview_init();
@@ -775,8 +3054,14 @@ int main(int argc, char *argv[]) {
   printf("\nCapability tests:\n");
   test_cap_init();
   test_cap_compute();
+  test_cap_warm_values();
   test_cap_get_info();
   test_cap_parse_name();
+  test_cap_lookup();
+  test_cap_store();
+  test_cap_instances();
+  test_cap_filter();
+  test_history();
 
   printf("\nHA Discovery tests:\n");
   run_ha_disc_tests();
@@ -791,6 +3076,7 @@ int main(int argc, char *argv[]) {
   test_quirks_init();
   test_quirks_find();
   test_quirks_apply_value();
+  test_quirks_compile();
   test_quirks_count();
   test_quirks_action_name();
 